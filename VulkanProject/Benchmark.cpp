@@ -0,0 +1,855 @@
+#include "Benchmark.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+Benchmark::Benchmark(BenchmarkConfig newConfig)
+{
+	this->config = newConfig;
+	this->random.seed(this->config.seed);
+}
+
+int Benchmark::run()
+{
+	if (this->renderer.initHeadless(this->config.width, this->config.height, this->config.rendererConfig) == EXIT_FAILURE) {
+		return EXIT_FAILURE;
+	}
+
+	// Once the renderer is up it's cleaned up however the measurement ends
+	bool measured = false;
+	try {
+		this->measure();
+		measured = true;
+	}
+	catch (const std::exception& e) {
+		printf("ERROR: %s\n", e.what());
+	}
+	catch (...) {
+		printf("ERROR: Unknown error during benchmark\n");
+	}
+	this->renderer.cleanup();
+
+	if (!measured) {
+		return EXIT_FAILURE;
+	}
+
+	// An output file that can't be written or a baseline that can't be read fails the run rather than aborting it
+	try {
+		this->writeResults();
+
+		if (!this->config.baselineFile.empty() && !this->compareBaseline()) {
+			return EXIT_FAILURE;
+		}
+	}
+	catch (const std::exception& e) {
+		printf("ERROR: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void Benchmark::measure()
+{
+	this->results.deviceName = this->renderer.getDeviceName();
+	ShaderCompilerStats shaderStats = this->renderer.getShaderCompilerStats();
+	this->results.shadersCompiled = shaderStats.compiled;
+	this->results.shaderCacheHits = shaderStats.cacheHits;
+	this->results.shaderCompileMs = shaderStats.compileTime;
+
+	// Load time covers generating the scene and uploading it to the device
+	auto loadStart = std::chrono::high_resolution_clock::now();
+	this->createScene();
+	auto loadEnd = std::chrono::high_resolution_clock::now();
+	this->results.loadTimeMs = std::chrono::duration<double, std::milli>(loadEnd - loadStart).count();
+
+	std::vector<double> cpuRecordTimes;
+	std::vector<double> transformTimes;
+	std::vector<double> cpuFrameTimes;
+	std::vector<double> frameWaitTimes;
+	std::vector<double> gpuTimes;
+	std::vector<double> latencies;
+	std::vector<double> shadowTimes;
+	auto measureStart = std::chrono::high_resolution_clock::now();
+
+	for (int frame = 0; frame < this->config.warmupFrames + this->config.frameCount; frame++) {
+		if (frame == this->config.warmupFrames) {
+			measureStart = std::chrono::high_resolution_clock::now();
+		}
+
+		auto updateStart = std::chrono::high_resolution_clock::now();
+		this->updateScene(frame);
+		auto updateEnd = std::chrono::high_resolution_clock::now();
+		this->renderer.draw();
+
+		if (frame < this->config.warmupFrames) {
+			continue;
+		}
+
+		// GPU time and latency lag behind by the frames in flight, but over a fixed scene that doesn't matter
+		FrameStats frameStats = this->renderer.getFrameStats();
+		cpuRecordTimes.push_back(frameStats.cpuRecordTime);
+		transformTimes.push_back(std::chrono::duration<double, std::milli>(updateEnd - updateStart).count() + frameStats.transformTime);
+		cpuFrameTimes.push_back(frameStats.cpuFrameTime);
+		frameWaitTimes.push_back(frameStats.frameWaitTime);
+		if (frameStats.gpuTime >= 0.0) {
+			gpuTimes.push_back(frameStats.gpuTime);
+		}
+		if (frameStats.latency >= 0.0) {
+			latencies.push_back(frameStats.latency);
+		}
+		this->results.resourcesReloaded += frameStats.resourcesReloaded;
+
+		// Cascades that weren't drawn are negative
+		double shadowTime = 0.0;
+		for (uint32_t i = 0; i < MAX_SHADOW_CASCADES; i++) {
+			shadowTime += std::max(frameStats.shadowCascadeTimes[i], 0.0);
+		}
+		if (frameStats.shadowCascadeTimes[0] >= 0.0) {
+			shadowTimes.push_back(shadowTime);
+		}
+		this->results.shadowCascadesRefreshed += frameStats.shadowCascadesRefreshed;
+	}
+	auto measureEnd = std::chrono::high_resolution_clock::now();
+
+	this->results.cpuRecordMsMean = mean(cpuRecordTimes);
+	this->results.cpuRecordMsP95 = percentile(cpuRecordTimes, 0.95);
+	this->results.transformMsMean = mean(transformTimes);
+	if (!gpuTimes.empty()) {
+		this->results.gpuMsMean = mean(gpuTimes);
+		this->results.gpuMsP95 = percentile(gpuTimes, 0.95);
+	}
+	this->results.cpuFrameMsMean = mean(cpuFrameTimes);
+	this->results.frameWaitMsMean = mean(frameWaitTimes);
+	if (!latencies.empty()) {
+		this->results.latencyMsMean = mean(latencies);
+		this->results.latencyMsP95 = percentile(latencies, 0.95);
+	}
+	if (!shadowTimes.empty()) {
+		this->results.shadowMsMean = mean(shadowTimes);
+	}
+	this->results.frameIntervalMsMean = std::chrono::duration<double, std::milli>(measureEnd - measureStart).count() / this->config.frameCount;
+
+	// Scene is the same every frame, so the last frame's counts stand for all of them
+	FrameStats lastFrameStats = this->renderer.getFrameStats();
+	this->results.drawCount = lastFrameStats.drawCount;
+	this->results.bindCount = lastFrameStats.bindCount;
+	this->results.bindsSkipped = lastFrameStats.bindsSkipped;
+	this->results.trianglesDrawn = static_cast<double>(lastFrameStats.trianglesDrawn);
+	this->results.overdraw = lastFrameStats.overdraw;
+	this->results.gpuMsWithPrePass = lastFrameStats.gpuTimeWithPrePass;
+	this->results.gpuMsWithoutPrePass = lastFrameStats.gpuTimeWithoutPrePass;
+	this->results.pipelineVariants = this->renderer.getPipelineVariantStats().variants;
+	this->results.descriptorPools = this->renderer.getDescriptorAllocatorStats().pools;
+	this->results.pipelineFallbackFrames = static_cast<double>(lastFrameStats.pipelineFallbackFrames);
+	this->results.peakVramBytes = static_cast<double>(getDeviceMemoryStats().peakBytes);
+	this->results.peakRssBytes = getPeakRss();
+}
+
+int Benchmark::checkClusters()
+{
+	if (this->renderer.initHeadless(this->config.width, this->config.height, this->config.rendererConfig) == EXIT_FAILURE) {
+		return EXIT_FAILURE;
+	}
+
+	int failedFrames = -1;
+	try {
+		failedFrames = this->compareClusters();
+	}
+	catch (const std::exception& e) {
+		printf("ERROR: %s\n", e.what());
+	}
+	catch (...) {
+		printf("ERROR: Unknown error during cluster check\n");
+	}
+	this->renderer.cleanup();
+
+	if (failedFrames < 0) {
+		return EXIT_FAILURE;
+	}
+	std::cout << failedFrames << " of " << this->config.frameCount << " frames had clusters not matching the CPU reference" << std::endl;
+	return failedFrames == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int Benchmark::compareClusters()
+{
+	this->createScene();
+
+	int failedFrames = 0;
+	LightBufferHeader header;
+	std::vector<Light> frameLights;
+	std::vector<uint32_t> gpuClusters;
+	std::vector<uint32_t> cpuClusters;
+	std::vector<uint32_t> differing;
+
+	for (int frame = 0; frame < this->config.frameCount; frame++) {
+		this->updateScene(frame);
+		this->renderer.draw();
+		this->renderer.readClusterBuffer(&header, &frameLights, &gpuClusters);
+		assignLightsToClusters(header, frameLights, &cpuClusters);
+
+		// Both lists are in light index order, so they're compared as sorted sets
+		uint32_t clustersDiffering = 0;
+		uint32_t clustersOnBorder = 0;
+		for (uint32_t cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+			const uint32_t* gpuLights = &gpuClusters[CLUSTER_COUNT + cluster * MAX_LIGHTS_PER_CLUSTER];
+			const uint32_t* cpuLights = &cpuClusters[CLUSTER_COUNT + cluster * MAX_LIGHTS_PER_CLUSTER];
+			uint32_t gpuCount = std::min(gpuClusters[cluster], MAX_LIGHTS_PER_CLUSTER);
+			uint32_t cpuCount = cpuClusters[cluster];
+
+			differing.clear();
+			std::set_symmetric_difference(gpuLights, gpuLights + gpuCount, cpuLights, cpuLights + cpuCount, std::back_inserter(differing));
+			if (differing.empty()) {
+				continue;
+			}
+
+			AABB bounds = computeClusterBounds(header, cluster);
+			bool onBorder = true;
+			for (uint32_t light : differing) {
+				onBorder = onBorder && light < frameLights.size() && onClusterBorder(header.view, frameLights[light], bounds);
+			}
+			if (onBorder) {
+				clustersOnBorder++;
+			}
+			else {
+				clustersDiffering++;
+			}
+		}
+
+		// Each light reaches its own position, so the fragment there (looked up as the lighting shader does) must be lit by
+		// it, unless its cluster was full
+		uint32_t lightsMissing = 0;
+		glm::mat4 projection = glm::inverse(header.inverseProjection);
+		for (uint32_t i = 0; i < frameLights.size(); i++) {
+			glm::vec4 viewPosition = header.view * glm::vec4(frameLights[i].position, 1.0f);
+			float viewDepth = -viewPosition.z;
+			glm::vec4 clipPosition = projection * viewPosition;
+			if (viewDepth < header.screen.z || viewDepth > header.screen.w) {
+				continue;
+			}
+			glm::vec2 ndc = glm::vec2(clipPosition) / clipPosition.w;
+			if (std::abs(ndc.x) > 1.0f || std::abs(ndc.y) > 1.0f) {
+				continue;
+			}
+
+			uint32_t cluster = findCluster(header, (ndc * 0.5f + 0.5f) * glm::vec2(header.screen), viewDepth);
+			uint32_t count = gpuClusters[cluster];
+			const uint32_t* gpuLights = &gpuClusters[CLUSTER_COUNT + cluster * MAX_LIGHTS_PER_CLUSTER];
+			if (count < MAX_LIGHTS_PER_CLUSTER && std::find(gpuLights, gpuLights + count, i) == gpuLights + count) {
+				lightsMissing++;
+			}
+		}
+
+		if (clustersDiffering > 0 || lightsMissing > 0) {
+			std::cout << "Frame " << frame << ": " << clustersDiffering << " clusters differ, " << lightsMissing
+				<< " lights missing from their own cluster" << std::endl;
+			failedFrames++;
+		}
+		else if (clustersOnBorder > 0) {
+			std::cout << "Frame " << frame << ": " << clustersOnBorder << " clusters differ only by lights on their border" << std::endl;
+		}
+	}
+
+	return failedFrames;
+}
+
+bool Benchmark::onClusterBorder(const glm::mat4& view, const Light& light, const AABB& bounds)
+{
+	// Within a small fraction of the scale involved of touching the bounds exactly, either way
+	glm::vec3 centre = glm::vec3(view * glm::vec4(light.position, 1.0f));
+	float distance = glm::length(centre - glm::clamp(centre, bounds.min, bounds.max));
+	float slack = 1e-3f * (glm::length(centre) + light.range);
+	return std::abs(distance - light.range) <= slack;
+}
+
+bool Benchmark::parseArgs(int argc, char* argv[], BenchmarkConfig* config)
+{
+	// Options all take a value, so walk them in pairs
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--benchmark" || arg == "--benchmark-bvh" || arg == "--check-clusters") {
+			continue;
+		}
+		if (i + 1 >= argc) {
+			std::cout << "Missing value for option: " << arg << std::endl;
+			return false;
+		}
+
+		std::string value = argv[++i];
+		if (parseRendererConfigArg(arg, value, &config->rendererConfig)) {
+			continue;
+		}
+
+		if (arg == "--meshes") config->meshCount = std::max(1, std::atoi(value.c_str()));
+		else if (arg == "--textures") config->textureCount = std::max(1, std::atoi(value.c_str()));
+		else if (arg == "--instances") config->instanceCount = std::max(1, std::atoi(value.c_str()));
+		else if (arg == "--triangles") config->trianglesPerMesh = std::max(8, std::atoi(value.c_str()));
+		else if (arg == "--texture-size") config->textureSize = std::max(2, std::atoi(value.c_str()));
+		else if (arg == "--lights") config->lightCount = std::min(std::max(0, std::atoi(value.c_str())), static_cast<int>(MAX_LIGHTS));
+		else if (arg == "--sun") config->sun = std::atoi(value.c_str()) != 0;
+		else if (arg == "--frames") config->frameCount = std::max(1, std::atoi(value.c_str()));
+		else if (arg == "--warmup") config->warmupFrames = std::max(0, std::atoi(value.c_str()));
+		else if (arg == "--width") config->width = static_cast<uint32_t>(std::atoi(value.c_str()));
+		else if (arg == "--height") config->height = static_cast<uint32_t>(std::atoi(value.c_str()));
+		else if (arg == "--seed") config->seed = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+		else if (arg == "--output") config->outputFile = value;
+		else if (arg == "--baseline") config->baselineFile = value;
+		else if (arg == "--tolerance") config->tolerance = std::atof(value.c_str());
+		else {
+			std::cout << "Unknown benchmark option: " << arg << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int Benchmark::runSpatial(BenchmarkConfig config)
+{
+	std::mt19937 random(config.seed);
+
+	// Boxes spread over a wide, flat area like an open scene, in a range of sizes
+	float extent = std::sqrt(static_cast<float>(config.instanceCount)) * 2.0f;
+	std::uniform_real_distribution<float> positionDist(-extent, extent);
+	std::uniform_real_distribution<float> sizeDist(0.25f, 2.0f);
+	std::uniform_real_distribution<float> moveDist(-0.5f, 0.5f);
+
+	std::vector<AABB> boxes(config.instanceCount);
+	for (AABB& box : boxes) {
+		glm::vec3 centre = glm::vec3(positionDist(random), positionDist(random) * 0.1f, positionDist(random));
+		glm::vec3 halfSize = glm::vec3(sizeDist(random), sizeDist(random), sizeDist(random));
+		box.min = centre - halfSize;
+		box.max = centre + halfSize;
+	}
+
+	auto elapsedMs = [](std::chrono::high_resolution_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	Bvh bvh;
+	auto start = std::chrono::high_resolution_clock::now();
+	bvh.build(boxes);
+	double buildMs = elapsedMs(start);
+
+	// Small moves, as objects would make between frames
+	for (AABB& box : boxes) {
+		glm::vec3 offset = glm::vec3(moveDist(random), 0.0f, moveDist(random));
+		box.min += offset;
+		box.max += offset;
+	}
+	start = std::chrono::high_resolution_clock::now();
+	bvh.refit(boxes);
+	double refitMs = elapsedMs(start);
+
+	// -- Each query type against brute force over the same boxes, with the same random query shapes
+	double frustumMs = 0.0, boxMs = 0.0, sphereMs = 0.0, nearestMs = 0.0, bruteMs = 0.0;
+	uint64_t frustumResults = 0;
+	bool correct = true;
+	std::vector<uint32_t> results;
+	std::vector<uint32_t> expected;
+
+	for (int query = 0; query < config.frameCount; query++) {
+		glm::vec3 eye = glm::vec3(positionDist(random), 10.0f, positionDist(random));
+		glm::vec3 target = glm::vec3(positionDist(random), 0.0f, positionDist(random));
+		glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, extent)
+			* glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+		Frustum frustum = Frustum::fromMatrix(viewProjection);
+
+		results.clear();
+		start = std::chrono::high_resolution_clock::now();
+		bvh.queryFrustum(frustum, &results);
+		frustumMs += elapsedMs(start);
+		frustumResults += results.size();
+
+		expected.clear();
+		start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < boxes.size(); i++) {
+			if (frustum.classify(boxes[i]) != 0) {
+				expected.push_back(i);
+			}
+		}
+		bruteMs += elapsedMs(start);
+
+		std::sort(results.begin(), results.end());
+		correct = correct && results == expected;
+
+		AABB queryBox;
+		queryBox.min = target - glm::vec3(extent * 0.05f);
+		queryBox.max = target + glm::vec3(extent * 0.05f);
+		results.clear();
+		start = std::chrono::high_resolution_clock::now();
+		bvh.queryBox(queryBox, &results);
+		boxMs += elapsedMs(start);
+
+		results.clear();
+		start = std::chrono::high_resolution_clock::now();
+		bvh.querySphere(target, extent * 0.05f, &results);
+		sphereMs += elapsedMs(start);
+
+		uint32_t nearest;
+		float nearestDistance;
+		start = std::chrono::high_resolution_clock::now();
+		bvh.queryNearest(eye, std::numeric_limits<float>::max(), &nearest, &nearestDistance);
+		nearestMs += elapsedMs(start);
+	}
+
+	// -- Ray casts against one mesh of trianglesPerMesh triangles: a bumpy grid, so rays hit at many different depths
+	int gridSize = std::max(1, static_cast<int>(std::sqrt(config.trianglesPerMesh / 2.0f)));
+	std::uniform_real_distribution<float> heightDist(-0.5f, 0.5f);
+	std::vector<Vertex> gridVertices;
+	std::vector<uint32_t> gridIndices;
+	for (int z = 0; z <= gridSize; z++) {
+		for (int x = 0; x <= gridSize; x++) {
+			Vertex vertex = {};
+			vertex.pos = glm::vec3(x, heightDist(random), z);
+			gridVertices.push_back(vertex);
+		}
+	}
+	for (int z = 0; z < gridSize; z++) {
+		for (int x = 0; x < gridSize; x++) {
+			uint32_t corner = z * (gridSize + 1) + x;
+			gridIndices.insert(gridIndices.end(), { corner, corner + gridSize + 1, corner + 1, corner + 1, corner + gridSize + 1, corner + gridSize + 2 });
+		}
+	}
+
+	TriangleBvh triangleBvh;
+	start = std::chrono::high_resolution_clock::now();
+	triangleBvh.build(gridVertices, gridIndices, 0, static_cast<uint32_t>(gridIndices.size()));
+	double triangleBuildMs = elapsedMs(start);
+
+	std::uniform_real_distribution<float> gridDist(0.0f, static_cast<float>(gridSize));
+	double raycastMs = 0.0;
+	int raycastHits = 0;
+	for (int query = 0; query < config.frameCount; query++) {
+		glm::vec3 origin = glm::vec3(gridDist(random), 10.0f, gridDist(random));
+		glm::vec3 target = glm::vec3(gridDist(random), 0.0f, gridDist(random));
+		Ray ray(origin, glm::normalize(target - origin));
+
+		uint32_t triangle;
+		float distance;
+		start = std::chrono::high_resolution_clock::now();
+		bool hit = triangleBvh.raycast(ray, std::numeric_limits<float>::max(), &triangle, &distance);
+		raycastMs += elapsedMs(start);
+
+		// Every ray aims at the grid from 10 above it, so must hit before dropping below its lowest point (0.5 under)
+		if (hit) {
+			raycastHits++;
+		}
+		correct = correct && hit && distance <= glm::length(target - origin) * 1.05f;
+	}
+
+	int queries = std::max(1, config.frameCount);
+	std::ostringstream json;
+	json << "{\n";
+	json << "  \"objects\": " << config.instanceCount << ",\n";
+	json << "  \"queries\": " << config.frameCount << ",\n";
+	json << "  \"seed\": " << config.seed << ",\n";
+	json << "  \"nodes\": " << bvh.getNodeCount() << ",\n";
+	json << "  \"raycastTriangles\": " << triangleBvh.getTriangleCount() << ",\n";
+	json << "  \"metrics\": {\n";
+	json << "    \"buildMs\": " << buildMs << ",\n";
+	json << "    \"refitMs\": " << refitMs << ",\n";
+	json << "    \"frustumQueryMs\": " << frustumMs / queries << ",\n";
+	json << "    \"frustumBruteForceMs\": " << bruteMs / queries << ",\n";
+	json << "    \"frustumResultsMean\": " << static_cast<double>(frustumResults) / queries << ",\n";
+	json << "    \"boxQueryMs\": " << boxMs / queries << ",\n";
+	json << "    \"sphereQueryMs\": " << sphereMs / queries << ",\n";
+	json << "    \"nearestQueryMs\": " << nearestMs / queries << ",\n";
+	json << "    \"raycastBuildMs\": " << triangleBuildMs << ",\n";
+	json << "    \"raycastMs\": " << raycastMs / queries << ",\n";
+	json << "    \"raycastHits\": " << raycastHits << "\n";
+	json << "  },\n";
+	json << "  \"matchesBruteForce\": " << (correct ? "true" : "false") << "\n";
+	json << "}\n";
+
+	std::cout << json.str();
+
+	std::ofstream file(config.outputFile);
+	if (!file.is_open()) {
+		std::cout << "Failed to write benchmark results (" << config.outputFile << ")" << std::endl;
+		return EXIT_FAILURE;
+	}
+	file << json.str();
+
+	return correct ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+Benchmark::~Benchmark()
+{
+}
+
+void Benchmark::createScene()
+{
+	// Textures first so meshes can refer to their descriptor ids
+	std::vector<int> textureIds;
+	for (int i = 0; i < this->config.textureCount; i++) {
+		std::vector<stbi_uc> pixels = this->createCheckerboard(this->config.textureSize);
+		textureIds.push_back(this->renderer.createTextureFromPixels(pixels.data(), this->config.textureSize, this->config.textureSize));
+	}
+
+	// Each mesh is generated once, and uploaded once for each texture it's used with (instances with the same mesh and
+	// texture share one geometry asset)
+	std::vector<std::vector<Vertex>> meshVertices(this->config.meshCount);
+	std::vector<std::vector<uint32_t>> meshIndices(this->config.meshCount);
+	for (int i = 0; i < this->config.meshCount; i++) {
+		this->createSphere(this->config.trianglesPerMesh, &meshVertices[i], &meshIndices[i]);
+	}
+
+	// Lay instances out on a square grid so they're all in view
+	int gridSize = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(this->config.instanceCount))));
+	float spacing = gridSize > 1 ? 20.0f / (gridSize - 1) : 0.0f;
+
+	this->modelTransforms.resize(this->config.instanceCount);
+	for (int i = 0; i < this->config.instanceCount; i++) {
+		int meshIndex = i % this->config.meshCount;
+		int textureIndex = i % this->config.textureCount;
+
+		this->modelIds.push_back(this->renderer.createMeshModel(&meshVertices[meshIndex], &meshIndices[meshIndex], textureIds[textureIndex]));
+		glm::vec3 position = glm::vec3(
+			-10.0f + spacing * (i % gridSize),
+			0.0f,
+			-10.0f + spacing * (i / gridSize));
+		this->modelTransforms.set(i, position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+	}
+
+	// Coloured point lights scattered just above the grid, with a dim ambient so they stand out
+	std::uniform_real_distribution<float> positionDist(-10.0f, 10.0f);
+	std::uniform_real_distribution<float> colourDist(0.2f, 1.0f);
+	for (int i = 0; i < this->config.lightCount; i++) {
+		glm::vec3 position = glm::vec3(positionDist(this->random), 1.5f, positionDist(this->random));
+		glm::vec3 colour = glm::vec3(colourDist(this->random), colourDist(this->random), colourDist(this->random));
+		this->lights.push_back(makePointLight(position, colour, 10.0f, 4.0f));
+	}
+	if (!this->lights.empty()) {
+		this->renderer.setAmbientLight(glm::vec3(0.1f));
+	}
+
+	// Sun at an angle over a ground plane under the grid. The plane never moves, so its shadows stay cached, while the
+	// instances (rotated every frame) are drawn into the shadow maps each frame
+	if (this->config.sun) {
+		std::vector<Vertex> groundVertices(4);
+		std::vector<uint32_t> groundIndices = { 0, 1, 2, 2, 3, 0 };
+		glm::vec2 corners[4] = { glm::vec2(-1.0f, -1.0f), glm::vec2(-1.0f, 1.0f), glm::vec2(1.0f, 1.0f), glm::vec2(1.0f, -1.0f) };
+		for (int i = 0; i < 4; i++) {
+			groundVertices[i].pos = glm::vec3(corners[i].x * 15.0f, -1.5f, corners[i].y * 15.0f);
+			groundVertices[i].col = glm::vec3(0.5f);
+			groundVertices[i].tex = corners[i] * 0.5f + 0.5f;
+			groundVertices[i].normal = glm::vec3(0.0f, 1.0f, 0.0f);
+		}
+		this->renderer.createMeshModel(&groundVertices, &groundIndices, textureIds[0]);
+
+		for (int modelId : this->modelIds) {
+			this->renderer.setModelStatic(modelId, false);
+		}
+		this->renderer.setDirectionalLight(glm::vec3(-0.4f, -1.0f, -0.3f), glm::vec3(1.0f, 0.95f, 0.85f), 2.0f);
+		this->renderer.setAmbientLight(glm::vec3(0.1f));
+	}
+
+	this->renderer.updateView(glm::lookAt(glm::vec3(0.0f, 15.0f, 20.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+}
+
+void Benchmark::createSphere(int triangles, std::vector<Vertex>* vertices, std::vector<uint32_t>* indices)
+{
+	// UV sphere has segments * rings * 2 triangles, with rings = segments / 2
+	int segments = std::max(4, static_cast<int>(std::sqrt(static_cast<float>(triangles))));
+	int rings = std::max(2, segments / 2);
+
+	std::uniform_real_distribution<float> radiusDist(0.5f, 1.0f);
+	std::uniform_real_distribution<float> colourDist(0.0f, 1.0f);
+	float radius = radiusDist(this->random);
+	glm::vec3 colour = glm::vec3(colourDist(this->random), colourDist(this->random), colourDist(this->random));
+
+	const float pi = 3.14159265358979f;
+	for (int ring = 0; ring <= rings; ring++) {
+		float v = static_cast<float>(ring) / rings;
+		float phi = v * pi;
+
+		for (int segment = 0; segment <= segments; segment++) {
+			float u = static_cast<float>(segment) / segments;
+			float theta = u * 2.0f * pi;
+
+			Vertex vertex = {};
+			vertex.pos = radius * glm::vec3(std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta));
+			vertex.col = colour;
+			vertex.tex = glm::vec2(u, v);
+			vertex.normal = glm::vec3(std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta));
+			vertices->push_back(vertex);
+		}
+	}
+
+	for (int ring = 0; ring < rings; ring++) {
+		for (int segment = 0; segment < segments; segment++) {
+			uint32_t current = ring * (segments + 1) + segment;
+			uint32_t below = current + segments + 1;
+
+			indices->push_back(current);
+			indices->push_back(below);
+			indices->push_back(current + 1);
+
+			indices->push_back(current + 1);
+			indices->push_back(below);
+			indices->push_back(below + 1);
+		}
+	}
+}
+
+std::vector<stbi_uc> Benchmark::createCheckerboard(int size)
+{
+	std::uniform_int_distribution<int> colourDist(0, 255);
+	stbi_uc colourA[3] = { (stbi_uc)colourDist(this->random), (stbi_uc)colourDist(this->random), (stbi_uc)colourDist(this->random) };
+	stbi_uc colourB[3] = { (stbi_uc)colourDist(this->random), (stbi_uc)colourDist(this->random), (stbi_uc)colourDist(this->random) };
+
+	// RGBA, 8 checks across
+	std::vector<stbi_uc> pixels(static_cast<size_t>(size) * size * 4);
+	int checkSize = std::max(1, size / 8);
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			stbi_uc* colour = ((x / checkSize + y / checkSize) % 2 == 0) ? colourA : colourB;
+			size_t pixel = (static_cast<size_t>(y) * size + x) * 4;
+			pixels[pixel] = colour[0];
+			pixels[pixel + 1] = colour[1];
+			pixels[pixel + 2] = colour[2];
+			pixels[pixel + 3] = 255;
+		}
+	}
+
+	return pixels;
+}
+
+void Benchmark::updateScene(int frame)
+{
+	// Driven by frame number rather than time so every run does the same work
+	float angle = static_cast<float>(frame % 360);
+	glm::quat rotation = glm::angleAxis(glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	// Only the rotation changes, so only those components are rewritten before the whole batch is sent
+	for (size_t i = 0; i < this->modelIds.size(); i++) {
+		this->modelTransforms.rotationX[i] = rotation.x;
+		this->modelTransforms.rotationY[i] = rotation.y;
+		this->modelTransforms.rotationZ[i] = rotation.z;
+		this->modelTransforms.rotationW[i] = rotation.w;
+	}
+	this->renderer.updateModels(this->modelIds.data(), this->modelTransforms);
+
+	// Lights circle their start positions, so the clusters they fall in change every frame
+	if (!this->lights.empty()) {
+		std::vector<Light> movedLights = this->lights;
+		for (size_t i = 0; i < movedLights.size(); i++) {
+			float lightAngle = glm::radians(angle * 2.0f) + static_cast<float>(i);
+			movedLights[i].position += glm::vec3(std::cos(lightAngle), 0.0f, std::sin(lightAngle)) * 2.0f;
+		}
+		this->renderer.setLights(movedLights);
+	}
+}
+
+void Benchmark::writeResults()
+{
+	std::ostringstream json;
+	json << "{\n";
+	json << "  \"device\": " << jsonString(this->results.deviceName) << ",\n";
+	json << "  \"config\": {\n";
+	json << "    \"meshes\": " << this->config.meshCount << ",\n";
+	json << "    \"textures\": " << this->config.textureCount << ",\n";
+	json << "    \"instances\": " << this->config.instanceCount << ",\n";
+	json << "    \"trianglesPerMesh\": " << this->config.trianglesPerMesh << ",\n";
+	json << "    \"textureSize\": " << this->config.textureSize << ",\n";
+	json << "    \"lights\": " << this->config.lightCount << ",\n";
+	json << "    \"sun\": " << (this->config.sun ? 1 : 0) << ",\n";
+	json << "    \"frames\": " << this->config.frameCount << ",\n";
+	json << "    \"warmupFrames\": " << this->config.warmupFrames << ",\n";
+	json << "    \"width\": " << this->config.width << ",\n";
+	json << "    \"height\": " << this->config.height << ",\n";
+	json << "    \"seed\": " << this->config.seed << ",\n";
+	json << "    \"framesInFlight\": " << this->config.rendererConfig.framesInFlight << ",\n";
+	json << "    \"depthPrePass\": \"" << (this->config.rendererConfig.depthPrePass == DepthPrePassMode::On ? "on"
+		: this->config.rendererConfig.depthPrePass == DepthPrePassMode::Off ? "off" : "auto") << "\",\n";
+	json << "    \"lighting\": \"" << (this->config.rendererConfig.lightingMode == LightingMode::Unlit ? "unlit"
+		: this->config.rendererConfig.lightingMode == LightingMode::Normals ? "normals" : "lit") << "\",\n";
+	json << "    \"pipelineThreads\": " << this->config.rendererConfig.pipelineThreads << ",\n";
+	json << "    \"targetFps\": " << this->config.rendererConfig.targetFps << "\n";
+	json << "  },\n";
+	json << "  \"metrics\": {\n";
+	json << "    \"loadTimeMs\": " << this->results.loadTimeMs << ",\n";
+	json << "    \"cpuRecordMsMean\": " << this->results.cpuRecordMsMean << ",\n";
+	json << "    \"cpuRecordMsP95\": " << this->results.cpuRecordMsP95 << ",\n";
+	json << "    \"transformMsMean\": " << this->results.transformMsMean << ",\n";
+	json << "    \"gpuMsMean\": " << this->results.gpuMsMean << ",\n";
+	json << "    \"gpuMsP95\": " << this->results.gpuMsP95 << ",\n";
+	json << "    \"cpuFrameMsMean\": " << this->results.cpuFrameMsMean << ",\n";
+	json << "    \"frameWaitMsMean\": " << this->results.frameWaitMsMean << ",\n";
+	json << "    \"latencyMsMean\": " << this->results.latencyMsMean << ",\n";
+	json << "    \"latencyMsP95\": " << this->results.latencyMsP95 << ",\n";
+	json << "    \"frameIntervalMsMean\": " << this->results.frameIntervalMsMean << ",\n";
+	json << "    \"drawCount\": " << this->results.drawCount << ",\n";
+	json << "    \"bindCount\": " << this->results.bindCount << ",\n";
+	json << "    \"bindsSkipped\": " << this->results.bindsSkipped << ",\n";
+	json << "    \"trianglesDrawn\": " << static_cast<uint64_t>(this->results.trianglesDrawn) << ",\n";
+	json << "    \"shadowMsMean\": " << this->results.shadowMsMean << ",\n";
+	json << "    \"shadowCascadesRefreshed\": " << static_cast<uint64_t>(this->results.shadowCascadesRefreshed) << ",\n";
+	json << "    \"overdraw\": " << this->results.overdraw << ",\n";
+	json << "    \"gpuMsWithPrePass\": " << this->results.gpuMsWithPrePass << ",\n";
+	json << "    \"gpuMsWithoutPrePass\": " << this->results.gpuMsWithoutPrePass << ",\n";
+	json << "    \"resourcesReloaded\": " << static_cast<uint64_t>(this->results.resourcesReloaded) << ",\n";
+	json << "    \"shadersCompiled\": " << static_cast<uint64_t>(this->results.shadersCompiled) << ",\n";
+	json << "    \"shaderCacheHits\": " << static_cast<uint64_t>(this->results.shaderCacheHits) << ",\n";
+	json << "    \"shaderCompileMs\": " << this->results.shaderCompileMs << ",\n";
+	json << "    \"pipelineVariants\": " << static_cast<uint64_t>(this->results.pipelineVariants) << ",\n";
+	json << "    \"descriptorPools\": " << static_cast<uint64_t>(this->results.descriptorPools) << ",\n";
+	json << "    \"pipelineFallbackFrames\": " << static_cast<uint64_t>(this->results.pipelineFallbackFrames) << ",\n";
+	json << "    \"peakVramBytes\": " << static_cast<uint64_t>(this->results.peakVramBytes) << ",\n";
+	json << "    \"peakRssBytes\": " << static_cast<uint64_t>(this->results.peakRssBytes) << "\n";
+	json << "  }\n";
+	json << "}\n";
+
+	std::cout << json.str();
+
+	std::ofstream file(this->config.outputFile);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open benchmark output file (" + this->config.outputFile + ")");
+	}
+	file << json.str();
+}
+
+bool Benchmark::compareBaseline()
+{
+	std::ifstream file(this->config.baselineFile);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open benchmark baseline file (" + this->config.baselineFile + ")");
+	}
+	std::stringstream contents;
+	contents << file.rdbuf();
+	std::string baseline = contents.str();
+
+	// Baselines are files written by writeResults, so only the metrics section needs to be found
+	size_t metricsStart = baseline.find("\"metrics\"");
+	if (metricsStart == std::string::npos) {
+		throw std::runtime_error("Benchmark baseline has no metrics (" + this->config.baselineFile + ")");
+	}
+
+	std::vector<std::pair<std::string, double>> metrics = {
+		{ "loadTimeMs", this->results.loadTimeMs },
+		{ "cpuRecordMsMean", this->results.cpuRecordMsMean },
+		{ "cpuRecordMsP95", this->results.cpuRecordMsP95 },
+		{ "transformMsMean", this->results.transformMsMean },
+		{ "gpuMsMean", this->results.gpuMsMean },
+		{ "gpuMsP95", this->results.gpuMsP95 },
+		{ "cpuFrameMsMean", this->results.cpuFrameMsMean },
+		{ "latencyMsMean", this->results.latencyMsMean },
+		{ "latencyMsP95", this->results.latencyMsP95 },
+		{ "frameIntervalMsMean", this->results.frameIntervalMsMean },
+		{ "bindCount", this->results.bindCount },
+		{ "trianglesDrawn", this->results.trianglesDrawn },
+		{ "shadowMsMean", this->results.shadowMsMean },
+		{ "peakVramBytes", this->results.peakVramBytes },
+		{ "peakRssBytes", this->results.peakRssBytes }
+	};
+
+	bool passed = true;
+	for (const auto& metric : metrics) {
+		size_t keyStart = baseline.find("\"" + metric.first + "\"", metricsStart);
+		if (keyStart == std::string::npos) {
+			continue;
+		}
+		size_t valueStart = baseline.find(':', keyStart) + 1;
+		double baselineValue = std::strtod(baseline.c_str() + valueStart, nullptr);
+
+		// Skip metrics that weren't measured in either run (eg no timestamp support)
+		if (baselineValue < 0.0 || metric.second < 0.0) {
+			continue;
+		}
+
+		double limit = baselineValue * (1.0 + this->config.tolerance);
+		bool regressed = metric.second > limit;
+		std::cout << (regressed ? "REGRESSION " : "ok         ") << metric.first
+			<< ": " << metric.second << " (baseline " << baselineValue << ")" << std::endl;
+
+		passed = passed && !regressed;
+	}
+
+	return passed;
+}
+
+std::string Benchmark::jsonString(const std::string& value)
+{
+	// Quoted, with quotes, backslashes and control characters escaped so any device name gives valid JSON
+	std::ostringstream quoted;
+	quoted << '"';
+	for (char c : value) {
+		switch (c) {
+		case '"': quoted << "\\\""; break;
+		case '\\': quoted << "\\\\"; break;
+		case '\b': quoted << "\\b"; break;
+		case '\f': quoted << "\\f"; break;
+		case '\n': quoted << "\\n"; break;
+		case '\r': quoted << "\\r"; break;
+		case '\t': quoted << "\\t"; break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+				quoted << escaped;
+			}
+			else {
+				quoted << c;
+			}
+			break;
+		}
+	}
+	quoted << '"';
+	return quoted.str();
+}
+
+double Benchmark::mean(const std::vector<double>& values)
+{
+	if (values.empty()) {
+		return 0.0;
+	}
+
+	double total = 0.0;
+	for (double value : values) {
+		total += value;
+	}
+	return total / values.size();
+}
+
+double Benchmark::percentile(std::vector<double> values, double fraction)
+{
+	if (values.empty()) {
+		return 0.0;
+	}
+
+	size_t index = static_cast<size_t>(fraction * (values.size() - 1));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+double Benchmark::getPeakRss()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = {};
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return static_cast<double>(counters.PeakWorkingSetSize);
+	}
+	return 0.0;
+#else
+	// VmHWM is the peak resident set size in kB
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.compare(0, 6, "VmHWM:") == 0) {
+			return std::atof(line.c_str() + 6) * 1024.0;
+		}
+	}
+	return 0.0;
+#endif
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <random>
+
+#include "VulkanRenderer.h"
+
+// Everything needed to regenerate exactly the same scene and run
+struct BenchmarkConfig {
+	BenchmarkConfig() {
+		// Lavapipe (reports itself as llvmpipe) gives results that don't depend on the machine's GPU
+		rendererConfig.preferredDevice = "llvmpipe";
+	}
+
+	int meshCount = 8; // N unique procedural meshes
+	int textureCount = 4; // M procedural textures
+	int instanceCount = 16; // K models drawn each frame, each using mesh (i % N) and texture (i % M)
+	int trianglesPerMesh = 5000;
+	int textureSize = 256;
+	int lightCount = 0; // Point lights moving over the grid, binned into clusters each frame
+	bool sun = false; // Shadowed sun over a static ground plane, the instances move so they're dynamic shadow casters
+	int frameCount = 500; // Frames measured
+	int warmupFrames = 50; // Frames drawn before measuring starts
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	uint32_t seed = 1234;
+	RendererConfig rendererConfig; // Frames in flight, frame rate limit and preferred device (present mode doesn't apply headless)
+	std::string outputFile = "benchmark.json";
+	std::string baselineFile; // Results to compare against, no comparison when empty
+	double tolerance = 0.10; // Fraction a metric may get worse than the baseline before it counts as a regression
+};
+
+// All metrics are "lower is better" so they can be compared against a baseline the same way
+struct BenchmarkResults {
+	std::string deviceName;
+	double loadTimeMs = 0.0;
+	double cpuRecordMsMean = 0.0;
+	double cpuRecordMsP95 = 0.0;
+	double transformMsMean = 0.0; // Composing the animated transforms, world transforms and writing the object buffer
+	double gpuMsMean = -1.0; // Negative if the device has no timestamp support
+	double gpuMsP95 = -1.0;
+	double cpuFrameMsMean = 0.0;
+	double frameWaitMsMean = 0.0;
+	double latencyMsMean = -1.0; // CPU start of a frame to its completion being seen, grows with frames in flight
+	double latencyMsP95 = -1.0;
+	double frameIntervalMsMean = 0.0; // Wall time between frames, 1000 / fps
+	double drawCount = 0.0; // Per frame, from the last measured frame
+	double bindCount = 0.0;
+	double bindsSkipped = 0.0; // Higher is better, so reported but not compared against the baseline
+	double trianglesDrawn = 0.0; // After LOD selection
+	double shadowMsMean = -1.0; // GPU time of every shadow cascade together, negative without --sun or timestamp support
+	double shadowCascadesRefreshed = 0.0; // Over all measured frames, cascades whose static shadows were redrawn (reported, not compared)
+	// Depth pre-pass, from the last measured frame's averages (reported, not compared as they depend on --depth-prepass)
+	double overdraw = -1.0; // Negative without pipeline statistics support
+	double gpuMsWithPrePass = -1.0; // Negative if no measured frame drew the pre-pass
+	double gpuMsWithoutPrePass = -1.0;
+	double resourcesReloaded = 0.0; // Over all measured frames, only non zero with a --vram-budget too small for the scene (reported, not compared)
+	// Shaders compiled while the renderer was created, 0 on a warm start that found them all in the cache (reported, not compared)
+	double shadersCompiled = 0.0;
+	double shaderCacheHits = 0.0;
+	double shaderCompileMs = 0.0;
+	double pipelineVariants = 0.0; // Pipeline permutations built by the end of the run, including ones built lazily (reported, not compared)
+	double descriptorPools = 0.0; // Descriptor pools created by the end of the run, chained as they filled (reported, not compared)
+	double pipelineFallbackFrames = 0.0; // Frames, warm up included, drawn with a stand-in while a pipeline was built (reported, not compared)
+	double peakVramBytes = 0.0;
+	double peakRssBytes = 0.0;
+};
+
+class Benchmark
+{
+public:
+	Benchmark(BenchmarkConfig newConfig);
+
+	// Returns EXIT_FAILURE if the run failed or regressed against the baseline
+	int run();
+
+	// CPU only benchmark of the scene BVH: instanceCount random boxes, frameCount of each query, checked against brute force.
+	// Then frameCount ray casts against a mesh of trianglesPerMesh triangles.
+	// Returns EXIT_FAILURE if any query disagrees with brute force or a ray misses
+	static int runSpatial(BenchmarkConfig config);
+
+	// Draws frameCount frames of the scene (after no warmup) and reads back each one's cluster buffer, to compare it with
+	// assignLightsToClusters for the same light buffer. Lights may only differ in clusters whose border they're on, as the
+	// GPU's float maths can round either way there. Each light in view must also be in the cluster findCluster gives for
+	// its own position. Returns EXIT_FAILURE if any frame doesn't match
+	int checkClusters();
+
+	// Parses "--benchmark" style command line options into config (including renderer options), returns false on unknown options
+	static bool parseArgs(int argc, char* argv[], BenchmarkConfig* config);
+
+	~Benchmark();
+
+private:
+	BenchmarkConfig config;
+	BenchmarkResults results;
+
+	VulkanRenderer renderer;
+	std::mt19937 random;
+
+	std::vector<int> modelIds;
+	TransformSoA modelTransforms; // Updated in place each frame then handed to the renderer as one batch
+	std::vector<Light> lights; // Where each light starts, they circle around it
+
+	// - Scene generation
+	void createScene();
+	void createSphere(int triangles, std::vector<Vertex>* vertices, std::vector<uint32_t>* indices);
+	std::vector<stbi_uc> createCheckerboard(int size);
+	void updateScene(int frame);
+
+	// - Measurement
+	// Draws the warmup and measured frames into results, throws if the renderer does
+	void measure();
+	// Draws and compares the checkClusters frames, returning how many of them didn't match
+	int compareClusters();
+	static bool onClusterBorder(const glm::mat4& view, const Light& light, const AABB& bounds);
+
+	// - Reporting
+	void writeResults();
+	bool compareBaseline();
+	static std::string jsonString(const std::string& value);
+
+	static double mean(const std::vector<double>& values);
+	static double percentile(std::vector<double> values, double fraction);
+	static double getPeakRss();
+};
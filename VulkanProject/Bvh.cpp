@@ -0,0 +1,583 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+// Binned SAH settings: bins per axis when looking for a split, and the most items a leaf may hold
+const int BVH_BIN_COUNT = 12;
+const uint32_t BVH_MAX_LEAF_ITEMS = 4;
+const float BVH_TRAVERSAL_COST = 1.0f; // Relative to testing one item
+
+// Rebuild once the tree's total surface area has grown by this much through refitting
+const float BVH_REBUILD_RATIO = 1.5f;
+
+void AABB::grow(const glm::vec3& point)
+{
+	this->min = glm::min(this->min, point);
+	this->max = glm::max(this->max, point);
+}
+
+void AABB::grow(const AABB& other)
+{
+	this->min = glm::min(this->min, other.min);
+	this->max = glm::max(this->max, other.max);
+}
+
+bool AABB::isValid() const
+{
+	return this->min.x <= this->max.x && this->min.y <= this->max.y && this->min.z <= this->max.z;
+}
+
+glm::vec3 AABB::centre() const
+{
+	return (this->min + this->max) * 0.5f;
+}
+
+float AABB::surfaceArea() const
+{
+	if (!this->isValid()) {
+		return 0.0f;
+	}
+
+	glm::vec3 extent = this->max - this->min;
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+AABB AABB::transformed(const glm::mat4& transform) const
+{
+	// Arvo's method: the new box is the translation plus, per axis, the smallest and largest contribution of each column
+	AABB result;
+	result.min = glm::vec3(transform[3]);
+	result.max = glm::vec3(transform[3]);
+
+	for (int column = 0; column < 3; column++) {
+		glm::vec3 a = glm::vec3(transform[column]) * this->min[column];
+		glm::vec3 b = glm::vec3(transform[column]) * this->max[column];
+		result.min += glm::min(a, b);
+		result.max += glm::max(a, b);
+	}
+
+	return result;
+}
+
+Frustum Frustum::fromMatrix(const glm::mat4& viewProjection)
+{
+	// Rows of the matrix (glm is column major)
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++) {
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0]; // Left
+	frustum.planes[1] = rows[3] - rows[0]; // Right
+	frustum.planes[2] = rows[3] + rows[1]; // Bottom
+	frustum.planes[3] = rows[3] - rows[1]; // Top
+	frustum.planes[4] = rows[3] + rows[2]; // Near
+	frustum.planes[5] = rows[3] - rows[2]; // Far
+
+	for (glm::vec4& plane : frustum.planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	return frustum;
+}
+
+int Frustum::classify(const AABB& box) const
+{
+	bool inside = true;
+	for (const glm::vec4& plane : this->planes) {
+		glm::vec3 normal = glm::vec3(plane);
+
+		// Corner furthest along the plane's normal, if even that is behind the plane the box is outside
+		glm::vec3 positive = glm::vec3(normal.x >= 0.0f ? box.max.x : box.min.x,
+			normal.y >= 0.0f ? box.max.y : box.min.y,
+			normal.z >= 0.0f ? box.max.z : box.min.z);
+		if (glm::dot(normal, positive) + plane.w < 0.0f) {
+			return 0;
+		}
+
+		// And if the nearest corner is behind it, the box crosses the plane
+		glm::vec3 negative = glm::vec3(normal.x >= 0.0f ? box.min.x : box.max.x,
+			normal.y >= 0.0f ? box.min.y : box.max.y,
+			normal.z >= 0.0f ? box.min.z : box.max.z);
+		if (glm::dot(normal, negative) + plane.w < 0.0f) {
+			inside = false;
+		}
+	}
+
+	return inside ? 2 : 1;
+}
+
+Ray::Ray(const glm::vec3& newOrigin, const glm::vec3& newDirection)
+{
+	this->origin = newOrigin;
+	this->direction = newDirection;
+
+	for (int axis = 0; axis < 3; axis++) {
+		float component = newDirection[axis];
+		if (std::abs(component) < 1e-20f) {
+			component = component < 0.0f ? -1e-20f : 1e-20f;
+		}
+		this->inverseDirection[axis] = 1.0f / component;
+	}
+}
+
+bool intersectRayBox(const Ray& ray, const AABB& box, float maxDistance, float* entry)
+{
+#ifdef BVH_SSE2
+	// All three slabs at once, the fourth lane repeats z so it never changes the result
+	__m128 origin = _mm_setr_ps(ray.origin.x, ray.origin.y, ray.origin.z, ray.origin.z);
+	__m128 inverse = _mm_setr_ps(ray.inverseDirection.x, ray.inverseDirection.y, ray.inverseDirection.z, ray.inverseDirection.z);
+	__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(box.min.x, box.min.y, box.min.z, box.min.z), origin), inverse);
+	__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(box.max.x, box.max.y, box.max.z, box.max.z), origin), inverse);
+	__m128 entries = _mm_min_ps(t1, t2);
+	__m128 exits = _mm_max_ps(t1, t2);
+
+	// Horizontal max of the entry distances and min of the exit ones
+	entries = _mm_max_ps(entries, _mm_shuffle_ps(entries, entries, _MM_SHUFFLE(2, 3, 0, 1)));
+	entries = _mm_max_ps(entries, _mm_shuffle_ps(entries, entries, _MM_SHUFFLE(1, 0, 3, 2)));
+	exits = _mm_min_ps(exits, _mm_shuffle_ps(exits, exits, _MM_SHUFFLE(2, 3, 0, 1)));
+	exits = _mm_min_ps(exits, _mm_shuffle_ps(exits, exits, _MM_SHUFFLE(1, 0, 3, 2)));
+
+	float tNear = std::max(_mm_cvtss_f32(entries), 0.0f);
+	float tFar = std::min(_mm_cvtss_f32(exits), maxDistance);
+#else
+	glm::vec3 t1 = (box.min - ray.origin) * ray.inverseDirection;
+	glm::vec3 t2 = (box.max - ray.origin) * ray.inverseDirection;
+	glm::vec3 entries = glm::min(t1, t2);
+	glm::vec3 exits = glm::max(t1, t2);
+
+	float tNear = std::max(std::max(entries.x, entries.y), std::max(entries.z, 0.0f));
+	float tFar = std::min(std::min(exits.x, exits.y), std::min(exits.z, maxDistance));
+#endif
+
+	*entry = tNear;
+	return tNear <= tFar;
+}
+
+static bool boxesOverlap(const AABB& a, const AABB& b)
+{
+	return a.min.x <= b.max.x && a.max.x >= b.min.x
+		&& a.min.y <= b.max.y && a.max.y >= b.min.y
+		&& a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+static bool boxContains(const AABB& outer, const AABB& inner)
+{
+	return outer.min.x <= inner.min.x && outer.max.x >= inner.max.x
+		&& outer.min.y <= inner.min.y && outer.max.y >= inner.max.y
+		&& outer.min.z <= inner.min.z && outer.max.z >= inner.max.z;
+}
+
+static float distanceSquaredToBox(const glm::vec3& point, const AABB& box)
+{
+	glm::vec3 closest = glm::clamp(point, box.min, box.max);
+	glm::vec3 offset = point - closest;
+	return glm::dot(offset, offset);
+}
+
+// Squared distance from point to the box's furthest corner, if that's within the sphere then so is the whole box
+static float furthestDistanceSquared(const glm::vec3& point, const AABB& box)
+{
+	glm::vec3 furthest = glm::max(glm::abs(point - box.min), glm::abs(point - box.max));
+	return glm::dot(furthest, furthest);
+}
+
+Bvh::Bvh()
+{
+	this->builtSurfaceArea = 0.0f;
+	this->currentSurfaceArea = 0.0f;
+}
+
+void Bvh::build(const std::vector<AABB>& itemBounds)
+{
+	this->bounds = itemBounds;
+	this->items.resize(itemBounds.size());
+	for (size_t i = 0; i < itemBounds.size(); i++) {
+		this->items[i] = static_cast<uint32_t>(i);
+	}
+
+	this->nodes.clear();
+	if (itemBounds.empty()) {
+		this->builtSurfaceArea = this->currentSurfaceArea = 0.0f;
+		return;
+	}
+
+	// A binary tree with leaves of at least one item never has more than 2n - 1 nodes
+	this->nodes.reserve(itemBounds.size() * 2);
+
+	Node root = {};
+	root.firstItem = 0;
+	root.itemCount = static_cast<uint32_t>(itemBounds.size());
+	this->nodes.push_back(root);
+
+	// Depth first with an explicit stack (of node and depth), children are always added after their parent which is what
+	// refit relies on
+	std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, 0 } };
+	while (!stack.empty()) {
+		uint32_t nodeIndex = stack.back().first;
+		uint32_t depth = stack.back().second;
+		stack.pop_back();
+
+		this->subdivide(nodeIndex, depth < BVH_MAX_DEPTH);
+
+		if (this->nodes[nodeIndex].left != 0) {
+			stack.push_back({ this->nodes[nodeIndex].left, depth + 1 });
+			stack.push_back({ this->nodes[nodeIndex].left + 1, depth + 1 });
+		}
+	}
+
+	float surfaceArea = 0.0f;
+	for (const Node& node : this->nodes) {
+		surfaceArea += node.bounds.surfaceArea();
+	}
+	this->builtSurfaceArea = this->currentSurfaceArea = surfaceArea;
+}
+
+void Bvh::subdivide(uint32_t nodeIndex, bool allowSplit)
+{
+	Node& node = this->nodes[nodeIndex];
+	node.left = 0;
+
+	// -- Bounds of the node, and of its items' centres which is what the split is chosen along
+	AABB centroidBounds;
+	node.bounds = AABB();
+	for (uint32_t i = 0; i < node.itemCount; i++) {
+		const AABB& itemBounds = this->bounds[this->items[node.firstItem + i]];
+		node.bounds.grow(itemBounds);
+		centroidBounds.grow(itemBounds.centre());
+	}
+
+	if (node.itemCount <= 1 || !allowSplit) {
+		return;
+	}
+
+	// -- Find the cheapest split over all axes using binned surface area heuristic
+	// Cost of a split is (items left * area left + items right * area right) plus visiting the extra node, leaving it as a
+	// leaf costs items * area
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1;
+	int bestSplit = 0;
+
+	for (int axis = 0; axis < 3; axis++) {
+		float axisMin = centroidBounds.min[axis];
+		float axisExtent = centroidBounds.max[axis] - axisMin;
+		if (axisExtent <= 0.0f) {
+			continue;
+		}
+
+		AABB binBounds[BVH_BIN_COUNT];
+		uint32_t binCounts[BVH_BIN_COUNT] = {};
+		float binScale = BVH_BIN_COUNT / axisExtent;
+
+		for (uint32_t i = 0; i < node.itemCount; i++) {
+			const AABB& itemBounds = this->bounds[this->items[node.firstItem + i]];
+			int bin = std::min(BVH_BIN_COUNT - 1, static_cast<int>((itemBounds.centre()[axis] - axisMin) * binScale));
+			binBounds[bin].grow(itemBounds);
+			binCounts[bin]++;
+		}
+
+		// Sweep from each end so each split plane's cost is found in one pass
+		float leftAreas[BVH_BIN_COUNT - 1];
+		uint32_t leftCounts[BVH_BIN_COUNT - 1];
+		AABB leftBox;
+		uint32_t leftCount = 0;
+		for (int i = 0; i < BVH_BIN_COUNT - 1; i++) {
+			leftBox.grow(binBounds[i]);
+			leftCount += binCounts[i];
+			leftAreas[i] = leftBox.surfaceArea();
+			leftCounts[i] = leftCount;
+		}
+
+		AABB rightBox;
+		uint32_t rightCount = 0;
+		for (int i = BVH_BIN_COUNT - 1; i > 0; i--) {
+			rightBox.grow(binBounds[i]);
+			rightCount += binCounts[i];
+
+			if (leftCounts[i - 1] == 0 || rightCount == 0) {
+				continue;
+			}
+
+			float cost = leftCounts[i - 1] * leftAreas[i - 1] + rightCount * rightBox.surfaceArea();
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+
+	float nodeArea = node.bounds.surfaceArea();
+	float leafCost = node.itemCount * nodeArea;
+	bestCost += BVH_TRAVERSAL_COST * nodeArea;
+
+	uint32_t* first = &this->items[node.firstItem];
+	uint32_t* last = first + node.itemCount;
+	uint32_t* middle;
+
+	if (bestAxis >= 0 && (bestCost < leafCost || node.itemCount > BVH_MAX_LEAF_ITEMS)) {
+		// Partition items by which side of the chosen bin boundary their centre is on
+		float axisMin = centroidBounds.min[bestAxis];
+		float binScale = BVH_BIN_COUNT / (centroidBounds.max[bestAxis] - axisMin);
+		middle = std::partition(first, last, [&](uint32_t item) {
+			int bin = std::min(BVH_BIN_COUNT - 1, static_cast<int>((this->bounds[item].centre()[bestAxis] - axisMin) * binScale));
+			return bin < bestSplit;
+		});
+	}
+	else if (node.itemCount > BVH_MAX_LEAF_ITEMS) {
+		// All centres in the same place (so no axis can split them) but too many for a leaf, split down the middle
+		middle = first + node.itemCount / 2;
+	}
+	else {
+		return;
+	}
+
+	uint32_t leftCount = static_cast<uint32_t>(middle - first);
+	uint32_t firstItem = node.firstItem;
+	uint32_t itemCount = node.itemCount;
+
+	// Adding children may reallocate nodes, so node can't be used after this
+	uint32_t leftIndex = static_cast<uint32_t>(this->nodes.size());
+	Node leftChild = {};
+	leftChild.firstItem = firstItem;
+	leftChild.itemCount = leftCount;
+	Node rightChild = {};
+	rightChild.firstItem = firstItem + leftCount;
+	rightChild.itemCount = itemCount - leftCount;
+	this->nodes.push_back(leftChild);
+	this->nodes.push_back(rightChild);
+
+	this->nodes[nodeIndex].left = leftIndex;
+}
+
+void Bvh::refit(const std::vector<AABB>& itemBounds)
+{
+	if (itemBounds.size() != this->bounds.size()) {
+		this->build(itemBounds);
+		return;
+	}
+
+	this->bounds = itemBounds;
+
+	// Children always come after their parent, so walking backwards updates every child before its parent
+	float surfaceArea = 0.0f;
+	for (size_t i = this->nodes.size(); i-- > 0;) {
+		Node& node = this->nodes[i];
+		node.bounds = AABB();
+
+		if (node.left == 0) {
+			for (uint32_t j = 0; j < node.itemCount; j++) {
+				node.bounds.grow(this->bounds[this->items[node.firstItem + j]]);
+			}
+		}
+		else {
+			node.bounds.grow(this->nodes[node.left].bounds);
+			node.bounds.grow(this->nodes[node.left + 1].bounds);
+		}
+
+		surfaceArea += node.bounds.surfaceArea();
+	}
+
+	this->currentSurfaceArea = surfaceArea;
+}
+
+bool Bvh::needsRebuild() const
+{
+	return this->currentSurfaceArea > this->builtSurfaceArea * BVH_REBUILD_RATIO;
+}
+
+size_t Bvh::getItemCount() const
+{
+	return this->items.size();
+}
+
+size_t Bvh::getNodeCount() const
+{
+	return this->nodes.size();
+}
+
+const std::vector<uint32_t>& Bvh::getItemOrder() const
+{
+	return this->items;
+}
+
+void Bvh::appendItems(const Node& node, std::vector<uint32_t>* results) const
+{
+	results->insert(results->end(), this->items.begin() + node.firstItem, this->items.begin() + node.firstItem + node.itemCount);
+}
+
+void Bvh::queryFrustum(const Frustum& frustum, std::vector<uint32_t>* results) const
+{
+	if (this->nodes.empty()) {
+		return;
+	}
+
+	uint32_t stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		const Node& node = this->nodes[stack[--stackSize]];
+
+		int classification = frustum.classify(node.bounds);
+		if (classification == 0) {
+			continue;
+		}
+
+		// Entirely inside, so is everything beneath it
+		if (classification == 2) {
+			this->appendItems(node, results);
+			continue;
+		}
+
+		if (node.left == 0) {
+			for (uint32_t i = 0; i < node.itemCount; i++) {
+				uint32_t item = this->items[node.firstItem + i];
+				if (frustum.classify(this->bounds[item]) != 0) {
+					results->push_back(item);
+				}
+			}
+		}
+		else {
+			stack[stackSize++] = node.left;
+			stack[stackSize++] = node.left + 1;
+		}
+	}
+}
+
+void Bvh::queryBox(const AABB& box, std::vector<uint32_t>* results) const
+{
+	if (this->nodes.empty()) {
+		return;
+	}
+
+	uint32_t stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		const Node& node = this->nodes[stack[--stackSize]];
+
+		if (!boxesOverlap(node.bounds, box)) {
+			continue;
+		}
+
+		if (boxContains(box, node.bounds)) {
+			this->appendItems(node, results);
+			continue;
+		}
+
+		if (node.left == 0) {
+			for (uint32_t i = 0; i < node.itemCount; i++) {
+				uint32_t item = this->items[node.firstItem + i];
+				if (boxesOverlap(this->bounds[item], box)) {
+					results->push_back(item);
+				}
+			}
+		}
+		else {
+			stack[stackSize++] = node.left;
+			stack[stackSize++] = node.left + 1;
+		}
+	}
+}
+
+void Bvh::querySphere(const glm::vec3& centre, float radius, std::vector<uint32_t>* results) const
+{
+	if (this->nodes.empty()) {
+		return;
+	}
+
+	float radiusSquared = radius * radius;
+
+	uint32_t stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		const Node& node = this->nodes[stack[--stackSize]];
+
+		if (distanceSquaredToBox(centre, node.bounds) > radiusSquared) {
+			continue;
+		}
+
+		if (furthestDistanceSquared(centre, node.bounds) <= radiusSquared) {
+			this->appendItems(node, results);
+			continue;
+		}
+
+		if (node.left == 0) {
+			for (uint32_t i = 0; i < node.itemCount; i++) {
+				uint32_t item = this->items[node.firstItem + i];
+				if (distanceSquaredToBox(centre, this->bounds[item]) <= radiusSquared) {
+					results->push_back(item);
+				}
+			}
+		}
+		else {
+			stack[stackSize++] = node.left;
+			stack[stackSize++] = node.left + 1;
+		}
+	}
+}
+
+bool Bvh::queryNearest(const glm::vec3& point, float maxDistance, uint32_t* item, float* distance) const
+{
+	if (this->nodes.empty()) {
+		return false;
+	}
+
+	float bestDistanceSquared = maxDistance * maxDistance;
+	bool found = false;
+
+	uint32_t stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		const Node& node = this->nodes[stack[--stackSize]];
+
+		// Nothing in here can beat what's already been found
+		if (distanceSquaredToBox(point, node.bounds) > bestDistanceSquared) {
+			continue;
+		}
+
+		if (node.left == 0) {
+			for (uint32_t i = 0; i < node.itemCount; i++) {
+				uint32_t candidate = this->items[node.firstItem + i];
+				float candidateDistance = distanceSquaredToBox(point, this->bounds[candidate]);
+				if (candidateDistance <= bestDistanceSquared) {
+					bestDistanceSquared = candidateDistance;
+					*item = candidate;
+					found = true;
+				}
+			}
+		}
+		else {
+			// Visit the nearer child first (pushed last), so the best distance shrinks sooner and prunes more
+			float leftDistance = distanceSquaredToBox(point, this->nodes[node.left].bounds);
+			float rightDistance = distanceSquaredToBox(point, this->nodes[node.left + 1].bounds);
+			if (leftDistance < rightDistance) {
+				stack[stackSize++] = node.left + 1;
+				stack[stackSize++] = node.left;
+			}
+			else {
+				stack[stackSize++] = node.left;
+				stack[stackSize++] = node.left + 1;
+			}
+		}
+	}
+
+	if (found) {
+		*distance = std::sqrt(bestDistanceSquared);
+	}
+
+	return found;
+}
+
+Bvh::~Bvh()
+{
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE2
+#include <emmintrin.h>
+#endif
+
+// Deepest a node can be, which keeps the fixed size traversal stacks (one entry per level, plus one) from overflowing
+const uint32_t BVH_MAX_DEPTH = 60;
+const int BVH_STACK_SIZE = 64;
+
+struct AABB {
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+	void grow(const glm::vec3& point);
+	void grow(const AABB& other);
+	bool isValid() const;
+	glm::vec3 centre() const;
+	float surfaceArea() const;
+
+	// Box around this box after transforming it, which is usually bigger than the transformed box itself
+	AABB transformed(const glm::mat4& transform) const;
+};
+
+// Planes of a view frustum, pointing inwards
+struct Frustum {
+	glm::vec4 planes[6];
+
+	// Gribb/Hartmann extraction from a projection * view matrix. The near plane is taken at clip z = -w, which is the
+	// true near plane for OpenGL depth and slightly behind it for Vulkan's [0, 1] depth, so it is safe for either
+	static Frustum fromMatrix(const glm::mat4& viewProjection);
+
+	// 0 if outside, 1 if intersecting, 2 if fully inside
+	int classify(const AABB& box) const;
+};
+
+struct Ray {
+	Ray(const glm::vec3& newOrigin, const glm::vec3& newDirection);
+
+	glm::vec3 origin;
+	glm::vec3 direction;
+	glm::vec3 inverseDirection; // Zero components are nudged to tiny values so slab tests never see 0 * infinity
+};
+
+// Slab test, true if the ray enters the box before maxDistance (entry is 0 if it starts inside)
+bool intersectRayBox(const Ray& ray, const AABB& box, float maxDistance, float* entry);
+
+// Bounding volume hierarchy over a set of boxes (items), built with the surface area heuristic. Items keep the index they
+// were given, so results can be mapped straight back to whatever the boxes came from
+class Bvh
+{
+public:
+	Bvh();
+
+	// Builds from scratch, item i has bounds itemBounds[i]
+	void build(const std::vector<AABB>& itemBounds);
+
+	// Updates the boxes of the existing tree for moved items (same item count), much cheaper than a rebuild but the
+	// tree gets looser the further items move from where they were when it was built
+	void refit(const std::vector<AABB>& itemBounds);
+
+	// True once refitting has loosened the tree enough that rebuilding would be worth it
+	bool needsRebuild() const;
+
+	size_t getItemCount() const;
+	size_t getNodeCount() const;
+
+	// Items visible in (or intersecting) the frustum/box/sphere, appended to results
+	void queryFrustum(const Frustum& frustum, std::vector<uint32_t>* results) const;
+	void queryBox(const AABB& box, std::vector<uint32_t>* results) const;
+	void querySphere(const glm::vec3& centre, float radius, std::vector<uint32_t>* results) const;
+
+	// Item whose box is closest to point (0 if the point is inside it), within maxDistance. False if there is none
+	bool queryNearest(const glm::vec3& point, float maxDistance, uint32_t* item, float* distance) const;
+
+	// Walks the leaves the ray passes through, nearest first, calling leafTest(firstItem, itemCount, &maxDistance) for
+	// each. The items of a leaf are getItemOrder()[firstItem] onwards, and leafTest shortens maxDistance when it finds a
+	// hit so later leaves behind it are skipped
+	template <typename LeafTest>
+	void traverseRay(const Ray& ray, float maxDistance, LeafTest leafTest) const;
+
+	// Item indices in the order leaves reference them, so per item data can be stored in that order too
+	const std::vector<uint32_t>& getItemOrder() const;
+
+	~Bvh();
+
+private:
+	// Interior nodes have their children at left and left + 1, leaves have left = 0 (the root is never a child).
+	// Every node knows its range of items, so a subtree fully inside a query can be taken without visiting it
+	struct Node {
+		AABB bounds;
+		uint32_t left;
+		uint32_t firstItem;
+		uint32_t itemCount;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> items; // Item indices in leaf order
+	std::vector<AABB> bounds; // Copy of the bounds of each item, by item index
+
+	float builtSurfaceArea; // Sum of node surface areas when last built, compared against after refits
+	float currentSurfaceArea;
+
+	void subdivide(uint32_t nodeIndex, bool allowSplit);
+	void appendItems(const Node& node, std::vector<uint32_t>* results) const;
+};
+
+template <typename LeafTest>
+void Bvh::traverseRay(const Ray& ray, float maxDistance, LeafTest leafTest) const
+{
+	float entry;
+	if (this->nodes.empty() || !intersectRayBox(ray, this->nodes[0].bounds, maxDistance, &entry)) {
+		return;
+	}
+
+	// Entry distance is kept with each node, so nodes further than a hit found since they were pushed are skipped
+	uint32_t stack[BVH_STACK_SIZE];
+	float stackEntries[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize] = 0;
+	stackEntries[stackSize++] = entry;
+
+	while (stackSize > 0) {
+		stackSize--;
+		if (stackEntries[stackSize] > maxDistance) {
+			continue;
+		}
+		const Node& node = this->nodes[stack[stackSize]];
+
+		if (node.left == 0) {
+			leafTest(node.firstItem, node.itemCount, &maxDistance);
+			continue;
+		}
+
+		float leftEntry, rightEntry;
+		bool hitLeft = intersectRayBox(ray, this->nodes[node.left].bounds, maxDistance, &leftEntry);
+		bool hitRight = intersectRayBox(ray, this->nodes[node.left + 1].bounds, maxDistance, &rightEntry);
+
+		// Nearer child pushed last so it's visited first
+		if (hitLeft && hitRight && leftEntry < rightEntry) {
+			stack[stackSize] = node.left + 1;
+			stackEntries[stackSize++] = rightEntry;
+			hitRight = false;
+		}
+		if (hitLeft) {
+			stack[stackSize] = node.left;
+			stackEntries[stackSize++] = leftEntry;
+		}
+		if (hitRight) {
+			stack[stackSize] = node.left + 1;
+			stackEntries[stackSize++] = rightEntry;
+		}
+	}
+}
@@ -0,0 +1,222 @@
+#include "DescriptorAllocator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "Utilities.h"
+
+// Handles are pointers on 64-bit and integers on 32-bit builds, either way they fit in 64 bits
+template <typename Handle>
+static uint64_t handleValue(Handle handle)
+{
+	uint64_t value = 0;
+	memcpy(&value, &handle, sizeof(handle));
+	return value;
+}
+
+// What a set written with these writes refers to, field by field as the structs have padding
+static std::vector<uint64_t> writeContents(VkDescriptorSetLayout layout, const std::vector<VkWriteDescriptorSet>& writes)
+{
+	std::vector<uint64_t> contents = { handleValue(layout) };
+	for (const VkWriteDescriptorSet& write : writes) {
+		contents.push_back(write.dstBinding);
+		contents.push_back(write.dstArrayElement);
+		contents.push_back(static_cast<uint64_t>(write.descriptorType));
+		contents.push_back(write.descriptorCount);
+
+		for (uint32_t i = 0; i < write.descriptorCount; i++) {
+			switch (write.descriptorType) {
+			case VK_DESCRIPTOR_TYPE_SAMPLER:
+			case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+			case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+			case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+			case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+				contents.push_back(handleValue(write.pImageInfo[i].sampler));
+				contents.push_back(handleValue(write.pImageInfo[i].imageView));
+				contents.push_back(static_cast<uint64_t>(write.pImageInfo[i].imageLayout));
+				break;
+			case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+			case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+				contents.push_back(handleValue(write.pTexelBufferView[i]));
+				break;
+			default:
+				contents.push_back(handleValue(write.pBufferInfo[i].buffer));
+				contents.push_back(write.pBufferInfo[i].offset);
+				contents.push_back(write.pBufferInfo[i].range);
+				break;
+			}
+		}
+	}
+	return contents;
+}
+
+DescriptorAllocator::DescriptorAllocator()
+{
+}
+
+void DescriptorAllocator::create(VkDevice newDevice, uint32_t newSetsPerPool)
+{
+	this->device = newDevice;
+	this->setsPerPool = std::max(newSetsPerPool, 1u);
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+	DescriptorCounts needed = {};
+	for (const VkDescriptorSetLayoutBinding& binding : bindings) {
+		if (binding.descriptorType >= DESCRIPTOR_TYPE_COUNT) {
+			throw std::runtime_error("Descriptor type can't be allocated from a descriptor pool");
+		}
+		needed[binding.descriptorType] += binding.descriptorCount;
+	}
+	for (uint32_t i = 0; i < DESCRIPTOR_TYPE_COUNT; i++) {
+		this->largestSet[i] = std::max(this->largestSet[i], needed[i]);
+	}
+
+	// Move along the chain to the first pool with room, adding a pool at the end once they're all full. The counts are
+	// checked here so the allocation below isn't a call that fails
+	while (this->currentPool < this->pools.size() && !this->hasRoom(this->pools[this->currentPool], needed)) {
+		this->currentPool++;
+	}
+	if (this->currentPool == this->pools.size()) {
+		this->createPool();
+	}
+
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = this->pools[this->currentPool].pool;
+	setAllocInfo.descriptorSetCount = 1;
+	setAllocInfo.pSetLayouts = &layout;
+
+	VkDescriptorSet descriptorSet;
+	VkResult result = vkAllocateDescriptorSets(this->device, &setAllocInfo, &descriptorSet);
+	if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+		// A pool shared by sets of different layouts can be fragmented with room left by the counts. A new pool can't be
+		this->createPool();
+		setAllocInfo.descriptorPool = this->pools[this->currentPool].pool;
+		result = vkAllocateDescriptorSets(this->device, &setAllocInfo, &descriptorSet);
+	}
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate descriptor set");
+	}
+
+	Pool& pool = this->pools[this->currentPool];
+	pool.setsLeft--;
+	for (uint32_t i = 0; i < DESCRIPTOR_TYPE_COUNT; i++) {
+		pool.descriptorsLeft[i] -= needed[i];
+	}
+	this->stats.setsAllocated++;
+
+	return descriptorSet;
+}
+
+VkDescriptorSet DescriptorAllocator::getSet(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings, std::vector<VkWriteDescriptorSet> writes)
+{
+	std::vector<uint64_t> contents = writeContents(layout, writes);
+	uint64_t key = hashContent(contents.data(), sizeof(uint64_t) * contents.size());
+
+	auto range = this->cachedSets.equal_range(key);
+	for (auto found = range.first; found != range.second; ++found) {
+		if (found->second.contents == contents) {
+			this->stats.setsCached++;
+			return found->second.descriptorSet;
+		}
+	}
+
+	VkDescriptorSet descriptorSet = this->allocate(layout, bindings);
+	for (VkWriteDescriptorSet& write : writes) {
+		write.dstSet = descriptorSet;
+	}
+	vkUpdateDescriptorSets(this->device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+	CachedSet cachedSet = { contents, descriptorSet };
+	this->cachedSets.insert(std::make_pair(key, cachedSet));
+	return descriptorSet;
+}
+
+void DescriptorAllocator::reset()
+{
+	for (Pool& pool : this->pools) {
+		if (pool.setsLeft == pool.maxSets) {
+			continue;
+		}
+		vkResetDescriptorPool(this->device, pool.pool, 0);
+		pool.setsLeft = pool.maxSets;
+		pool.descriptorsLeft = pool.capacity;
+	}
+
+	// The cached sets went with the pools
+	this->cachedSets.clear();
+	this->currentPool = 0;
+	this->stats.resets++;
+}
+
+DescriptorAllocatorStats DescriptorAllocator::getStats()
+{
+	return this->stats;
+}
+
+void DescriptorAllocator::destroy()
+{
+	for (Pool& pool : this->pools) {
+		vkDestroyDescriptorPool(this->device, pool.pool, nullptr);
+	}
+	this->pools.clear();
+	this->cachedSets.clear();
+	this->currentPool = 0;
+}
+
+DescriptorAllocator::~DescriptorAllocator()
+{
+}
+
+bool DescriptorAllocator::hasRoom(const Pool& pool, const DescriptorCounts& needed)
+{
+	if (pool.setsLeft == 0) {
+		return false;
+	}
+	for (uint32_t i = 0; i < DESCRIPTOR_TYPE_COUNT; i++) {
+		if (pool.descriptorsLeft[i] < needed[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void DescriptorAllocator::createPool()
+{
+	// Room for setsPerPool of the largest set so far, which includes this one
+	Pool pool = {};
+	pool.maxSets = this->setsPerPool;
+	std::vector<VkDescriptorPoolSize> poolSizes;
+	for (uint32_t i = 0; i < DESCRIPTOR_TYPE_COUNT; i++) {
+		pool.capacity[i] = this->largestSet[i] * this->setsPerPool;
+		if (pool.capacity[i] > 0) {
+			VkDescriptorPoolSize poolSize = {};
+			poolSize.type = static_cast<VkDescriptorType>(i);
+			poolSize.descriptorCount = pool.capacity[i];
+			poolSizes.push_back(poolSize);
+		}
+	}
+	if (poolSizes.empty()) {
+		throw std::runtime_error("Descriptor set layout has no descriptors to allocate");
+	}
+	pool.setsLeft = pool.maxSets;
+	pool.descriptorsLeft = pool.capacity;
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = pool.maxSets;
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+
+	VkResult result = vkCreateDescriptorPool(this->device, &poolCreateInfo, nullptr, &pool.pool);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create descriptor pool");
+	}
+
+	this->pools.push_back(pool);
+	this->currentPool = this->pools.size() - 1;
+	this->stats.pools++;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+struct DescriptorAllocatorStats {
+	uint32_t pools = 0; // Pools created so far, kept and reused across resets
+	uint64_t setsAllocated = 0; // Since creation, over every reset
+	uint64_t setsCached = 0; // Requests for a set with the same contents as one already written since the last reset
+	uint32_t resets = 0;
+};
+
+// Descriptor sets from a chain of pools. When the current pool has no room for a set, the next one is used, and a new pool
+// is created once they're all full, so allocation never fails for lack of space. Each pool holds setsPerPool sets of the
+// most descriptors of each type any set so far has needed, so the pools follow the layouts without being sized up front.
+// Sets can't be freed individually, only all together with reset, which makes it suited to one allocator per frame in
+// flight, reset once the frame has finished. Owns its pools
+class DescriptorAllocator
+{
+public:
+	DescriptorAllocator();
+
+	void create(VkDevice newDevice, uint32_t newSetsPerPool);
+
+	// A new set. The bindings are the layout's, as they were given to create it, for counting its descriptors
+	VkDescriptorSet allocate(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+
+	// A set with these writes (their dstSet is filled in), allocated and written the first time, then the same set for the
+	// same layout and contents until the next reset. Nothing a set refers to may be destroyed before then
+	VkDescriptorSet getSet(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings, std::vector<VkWriteDescriptorSet> writes);
+
+	// Frees every set at once (vkResetDescriptorPool), keeping the pools for the next ones
+	void reset();
+
+	DescriptorAllocatorStats getStats();
+
+	// Destroys every pool, and with them every set
+	void destroy();
+
+	~DescriptorAllocator();
+
+private:
+	// VK_DESCRIPTOR_TYPE_SAMPLER to VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT
+	static const uint32_t DESCRIPTOR_TYPE_COUNT = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT + 1;
+	typedef std::array<uint32_t, DESCRIPTOR_TYPE_COUNT> DescriptorCounts;
+
+	struct Pool {
+		VkDescriptorPool pool;
+		uint32_t maxSets;
+		DescriptorCounts capacity;
+		uint32_t setsLeft;
+		DescriptorCounts descriptorsLeft;
+	};
+
+	struct CachedSet {
+		std::vector<uint64_t> contents; // Compared as well as the key, so a hash collision can't return the wrong set
+		VkDescriptorSet descriptorSet;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	uint32_t setsPerPool = 0;
+	DescriptorCounts largestSet = {}; // Most descriptors of each type any set has needed, what new pools are sized for
+
+	std::vector<Pool> pools;
+	size_t currentPool = 0; // Those before it are full until the next reset
+
+	std::unordered_multimap<uint64_t, CachedSet> cachedSets;
+
+	DescriptorAllocatorStats stats;
+
+	bool hasRoom(const Pool& pool, const DescriptorCounts& needed);
+	void createPool();
+};
@@ -0,0 +1,63 @@
+#include "DeviceMemory.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+// Size and memory type of every live allocation so it can be subtracted again when freed
+struct AllocationRecord {
+	VkDeviceSize size;
+	uint32_t memoryType;
+};
+static std::unordered_map<VkDeviceMemory, AllocationRecord> allocationSizes;
+static DeviceMemoryStats memoryStats;
+static std::mutex memoryStatsMutex;
+
+VkResult allocateDeviceMemory(VkDevice device, const VkMemoryAllocateInfo* allocateInfo, VkDeviceMemory* memory)
+{
+	VkResult result = vkAllocateMemory(device, allocateInfo, nullptr, memory);
+	if (result != VK_SUCCESS) {
+		return result;
+	}
+
+	std::lock_guard<std::mutex> lock(memoryStatsMutex);
+	allocationSizes[*memory] = { allocateInfo->allocationSize, allocateInfo->memoryTypeIndex };
+	memoryStats.allocatedBytes += allocateInfo->allocationSize;
+	memoryStats.typeBytes[allocateInfo->memoryTypeIndex] += allocateInfo->allocationSize;
+	memoryStats.peakBytes = std::max(memoryStats.peakBytes, memoryStats.allocatedBytes);
+	memoryStats.allocationCount++;
+
+	return result;
+}
+
+void freeDeviceMemory(VkDevice device, VkDeviceMemory memory)
+{
+	if (memory == VK_NULL_HANDLE) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(memoryStatsMutex);
+		auto allocation = allocationSizes.find(memory);
+		if (allocation != allocationSizes.end()) {
+			memoryStats.allocatedBytes -= allocation->second.size;
+			memoryStats.typeBytes[allocation->second.memoryType] -= allocation->second.size;
+			memoryStats.allocationCount--;
+			allocationSizes.erase(allocation);
+		}
+	}
+
+	vkFreeMemory(device, memory, nullptr);
+}
+
+DeviceMemoryStats getDeviceMemoryStats()
+{
+	std::lock_guard<std::mutex> lock(memoryStatsMutex);
+	return memoryStats;
+}
+
+void resetDeviceMemoryPeak()
+{
+	std::lock_guard<std::mutex> lock(memoryStatsMutex);
+	memoryStats.peakBytes = memoryStats.allocatedBytes;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// Running totals of all device memory allocated through allocateDeviceMemory
+struct DeviceMemoryStats {
+	VkDeviceSize allocatedBytes = 0; // Bytes currently allocated
+	VkDeviceSize peakBytes = 0; // Highest value allocatedBytes has reached since the last reset
+	uint32_t allocationCount = 0; // Number of live VkDeviceMemory objects
+	VkDeviceSize typeBytes[VK_MAX_MEMORY_TYPES] = {}; // allocatedBytes split by memory type, so usage of each heap can be found
+};
+
+// Wrapper around vkAllocateMemory that records the size of the allocation
+VkResult allocateDeviceMemory(VkDevice device, const VkMemoryAllocateInfo* allocateInfo, VkDeviceMemory* memory);
+
+// Wrapper around vkFreeMemory that removes the allocation from the running totals
+void freeDeviceMemory(VkDevice device, VkDeviceMemory memory);
+
+DeviceMemoryStats getDeviceMemoryStats();
+
+// Sets the peak back to the amount currently allocated (eg before starting a measurement)
+void resetDeviceMemoryPeak();
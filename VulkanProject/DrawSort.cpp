@@ -0,0 +1,60 @@
+#include "DrawSort.h"
+
+#include <algorithm>
+#include <array>
+
+uint64_t makeSortKey(uint32_t pipelineId, uint32_t textureId, uint32_t meshId, float depth, float farPlane)
+{
+	// Clamp to the view range, anything behind the camera sorts first
+	float normalisedDepth = std::min(std::max(depth / farPlane, 0.0f), 1.0f);
+	uint64_t quantisedDepth = static_cast<uint64_t>(normalisedDepth * SORT_KEY_DEPTH_MAX);
+
+	return (static_cast<uint64_t>(pipelineId & 0xFF) << SORT_KEY_PIPELINE_SHIFT)
+		| (static_cast<uint64_t>(textureId & 0xFFFF) << SORT_KEY_TEXTURE_SHIFT)
+		| (static_cast<uint64_t>(meshId & 0xFFFF) << SORT_KEY_MESH_SHIFT)
+		| quantisedDepth;
+}
+
+void radixSortDraws(std::vector<DrawCommand>* draws, std::vector<DrawCommand>* scratch)
+{
+	size_t count = draws->size();
+	if (count < 2) {
+		return;
+	}
+	scratch->resize(count);
+
+	std::vector<DrawCommand>* source = draws;
+	std::vector<DrawCommand>* destination = scratch;
+
+	for (int shift = 0; shift < 64; shift += 8) {
+		// Count how many keys have each value of this byte
+		std::array<size_t, 256> counts = {};
+		for (const DrawCommand& draw : *source) {
+			counts[(draw.sortKey >> shift) & 0xFF]++;
+		}
+
+		// Every key has the same byte, so this pass wouldn't change the order
+		if (counts[((*source)[0].sortKey >> shift) & 0xFF] == count) {
+			continue;
+		}
+
+		// Turn counts into the start position of each bucket
+		size_t offset = 0;
+		for (size_t& bucket : counts) {
+			size_t bucketCount = bucket;
+			bucket = offset;
+			offset += bucketCount;
+		}
+
+		// Stable scatter into buckets
+		for (const DrawCommand& draw : *source) {
+			(*destination)[counts[(draw.sortKey >> shift) & 0xFF]++] = draw;
+		}
+		std::swap(source, destination);
+	}
+
+	// Odd number of passes leaves the result in scratch
+	if (source != draws) {
+		draws->swap(*scratch);
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// One mesh draw, identified by the model and mesh within it, with a key that orders draws to minimise state changes
+struct DrawCommand {
+	uint64_t sortKey;
+	uint32_t modelIndex;
+	uint32_t meshIndex;
+	uint32_t lodIndex;
+	uint32_t textureIndex; // The mesh's texture, or the default texture while the mesh's own isn't resident
+	bool textured; // Whether its material has a texture, which G-buffer pipeline permutation it's drawn with
+};
+
+// Sort key layout, most significant first so the most expensive state changes are grouped first:
+// | pipeline (8 bits) | texture (16 bits) | mesh (16 bits) | depth (24 bits) |
+// Depth is quantised distance from the camera, so draws sharing all state are drawn front to back (less overdraw)
+const int SORT_KEY_PIPELINE_SHIFT = 56;
+const int SORT_KEY_TEXTURE_SHIFT = 40;
+const int SORT_KEY_MESH_SHIFT = 24;
+const uint32_t SORT_KEY_DEPTH_MAX = (1u << 24) - 1;
+
+uint64_t makeSortKey(uint32_t pipelineId, uint32_t textureId, uint32_t meshId, float depth, float farPlane);
+
+// LSD radix sort on sortKey, a byte at a time. Bytes that are the same for every key are skipped, which is most of them
+// when there are few pipelines and textures. scratch is reused between calls to avoid allocating every frame
+void radixSortDraws(std::vector<DrawCommand>* draws, std::vector<DrawCommand>* scratch);
@@ -0,0 +1,56 @@
+#include "FrameLimiter.h"
+
+#include <thread>
+
+FrameLimiter::FrameLimiter()
+{
+	this->nextFrame = Clock::now();
+}
+
+FrameLimiter::FrameLimiter(double targetFps)
+{
+	this->setTargetFps(targetFps);
+}
+
+void FrameLimiter::setTargetFps(double targetFps)
+{
+	// A target of 0 (or less) turns limiting off
+	if (targetFps > 0.0) {
+		this->frameDuration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFps));
+	}
+	else {
+		this->frameDuration = Clock::duration::zero();
+	}
+	this->nextFrame = Clock::now();
+}
+
+void FrameLimiter::wait()
+{
+	if (this->frameDuration == Clock::duration::zero()) {
+		return;
+	}
+
+	// Coarse sleep for most of the remaining time
+	Clock::time_point now = Clock::now();
+	while (this->nextFrame - now > this->spinThreshold) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		now = Clock::now();
+	}
+
+	// Spin (yielding) for the last part so the deadline is hit precisely
+	while (now < this->nextFrame) {
+		std::this_thread::yield();
+		now = Clock::now();
+	}
+
+	// Step from the deadline rather than from now so the average rate doesn't drift,
+	// unless we've fallen more than a frame behind in which case catching up would just cause a burst
+	this->nextFrame += this->frameDuration;
+	if (now - this->nextFrame > this->frameDuration) {
+		this->nextFrame = now + this->frameDuration;
+	}
+}
+
+FrameLimiter::~FrameLimiter()
+{
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <chrono>
+
+// Holds frames to a target rate. Sleeping alone overshoots by the scheduler's granularity (up to ~15ms on Windows),
+// so it sleeps until just before the deadline and spins the remainder
+class FrameLimiter
+{
+public:
+	FrameLimiter();
+	FrameLimiter(double targetFps);
+
+	void setTargetFps(double targetFps);
+
+	// Blocks until the next frame is due, does nothing if no target is set
+	void wait();
+
+	~FrameLimiter();
+
+private:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	Clock::duration frameDuration = Clock::duration::zero();
+	Clock::time_point nextFrame;
+
+	// How far before the deadline to stop sleeping and start spinning
+	Clock::duration spinThreshold = std::chrono::milliseconds(2);
+};
@@ -0,0 +1,72 @@
+#include "GeometryCache.h"
+
+GeometryCache::GeometryCache()
+{
+}
+
+int GeometryCache::find(const std::string& key)
+{
+	auto found = this->keyAssets.find(key);
+	return found != this->keyAssets.end() ? found->second : -1;
+}
+
+int GeometryCache::add(GeometryAsset asset)
+{
+	asset.refCount = 1;
+
+	// Assigning into a released asset's slot keeps every other asset where it is
+	int assetId;
+	if (!this->freeAssetIds.empty()) {
+		assetId = this->freeAssetIds.back();
+		this->freeAssetIds.pop_back();
+		this->assets[assetId] = std::move(asset);
+	}
+	else {
+		assetId = static_cast<int>(this->assets.size());
+		this->assets.push_back(std::move(asset));
+	}
+	this->keyAssets[this->assets[assetId].key] = assetId;
+
+	return assetId;
+}
+
+GeometryAsset* GeometryCache::getAsset(int assetId)
+{
+	return &this->assets[assetId];
+}
+
+size_t GeometryCache::getAssetCount()
+{
+	return this->assets.size();
+}
+
+void GeometryCache::acquire(int assetId)
+{
+	this->assets[assetId].refCount++;
+}
+
+bool GeometryCache::release(int assetId)
+{
+	GeometryAsset& asset = this->assets[assetId];
+	if (asset.refCount == 0 || --asset.refCount > 0) {
+		return false;
+	}
+
+	// Last model gone, so a later load creates the asset again
+	this->keyAssets.erase(asset.key);
+	this->freeAssetIds.push_back(assetId);
+	return true;
+}
+
+void GeometryCache::destroy()
+{
+	for (GeometryAsset& asset : this->assets) {
+		for (Mesh& mesh : asset.meshes) {
+			mesh.destroyBuffers();
+		}
+	}
+}
+
+GeometryCache::~GeometryCache()
+{
+}
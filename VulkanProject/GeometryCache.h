@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+
+#include "Mesh.h"
+#include "SceneGraph.h"
+
+// Everything loaded from one model file (or one set of vertices and indices), shared by every model created from it.
+// Never changed once loaded, apart from its meshes' buffers being evicted and reloaded
+struct GeometryAsset {
+	std::string key; // File and import flags, or a hash of the geometry for models created from memory
+	std::vector<Mesh> meshes; // Each mesh's node is one of the asset's own nodes
+	SceneGraph nodes; // The file's node hierarchy under a root (node 0), copied into the scene for every model
+	std::vector<int> textureIds; // Texture references held by the asset, one per material with a texture (0 for those without)
+	std::vector<uint32_t> meshResidency; // Residency id of each mesh, shared by every model using it
+	uint32_t refCount = 0;
+};
+
+// Geometry assets by key, with a count of the models using each. Assets are kept in a deque so the pointers models hold
+// to them stay valid as more are added
+class GeometryCache
+{
+public:
+	GeometryCache();
+
+	// Asset loaded with this key, -1 if there isn't one
+	int find(const std::string& key);
+
+	// Takes ownership of a newly loaded asset with one reference, returns its id (reusing a released asset's)
+	int add(GeometryAsset asset);
+	GeometryAsset* getAsset(int assetId);
+	// Including released assets (which have no resident meshes), so every id below it can be passed to getAsset
+	size_t getAssetCount();
+
+	void acquire(int assetId);
+	// Returns true if that was the last reference, in which case the asset is forgotten and its meshes' buffers should be
+	// freed. Its id is reused by the next asset added, so it has to be cleaned up before then
+	bool release(int assetId);
+
+	// Frees every asset's buffers
+	void destroy();
+
+	~GeometryCache();
+
+private:
+	std::deque<GeometryAsset> assets;
+	std::unordered_map<std::string, int> keyAssets;
+	std::vector<int> freeAssetIds;
+};
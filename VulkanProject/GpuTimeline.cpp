@@ -0,0 +1,116 @@
+#include "GpuTimeline.h"
+
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+
+GpuTimeline::GpuTimeline()
+{
+}
+
+void GpuTimeline::create(VkDevice newDevice)
+{
+	this->device = newDevice;
+
+	// Timeline semaphores are created as normal semaphores with a type chained on
+	VkSemaphoreTypeCreateInfo typeCreateInfo = {};
+	typeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	typeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeCreateInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreCreateInfo.pNext = &typeCreateInfo;
+
+	VkResult result = vkCreateSemaphore(this->device, &semaphoreCreateInfo, nullptr, &this->semaphore);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create timeline semaphore");
+	}
+}
+
+uint64_t GpuTimeline::nextValue()
+{
+	return ++this->submittedValue;
+}
+
+uint64_t GpuTimeline::lastSubmittedValue()
+{
+	return this->submittedValue;
+}
+
+uint64_t GpuTimeline::completedValue()
+{
+	uint64_t value = 0;
+	vkGetSemaphoreCounterValue(this->device, this->semaphore, &value);
+	this->knownCompletedValue = value;
+
+	return value;
+}
+
+bool GpuTimeline::isComplete(uint64_t value)
+{
+	return value <= this->knownCompletedValue || value <= this->completedValue();
+}
+
+void GpuTimeline::wait(uint64_t value)
+{
+	if (value <= this->knownCompletedValue) {
+		return;
+	}
+
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &this->semaphore;
+	waitInfo.pValues = &value;
+
+	VkResult result = vkWaitSemaphores(this->device, &waitInfo, std::numeric_limits<uint64_t>::max());
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to wait on timeline semaphore");
+	}
+	this->knownCompletedValue = std::max(this->knownCompletedValue, value);
+}
+
+void GpuTimeline::retire(uint64_t value, std::function<void()> deleter)
+{
+	this->retirements.push_back({ value, deleter });
+}
+
+void GpuTimeline::collect()
+{
+	if (this->retirements.empty()) {
+		return;
+	}
+
+	uint64_t completed = this->completedValue();
+
+	// Retirements are in value order, so stop at the first one still in use
+	size_t count = 0;
+	while (count < this->retirements.size() && this->retirements[count].value <= completed) {
+		this->retirements[count].deleter();
+		count++;
+	}
+	this->retirements.erase(this->retirements.begin(), this->retirements.begin() + count);
+}
+
+VkSemaphore GpuTimeline::getSemaphore()
+{
+	return this->semaphore;
+}
+
+void GpuTimeline::destroy()
+{
+	if (this->semaphore == VK_NULL_HANDLE) {
+		return;
+	}
+
+	this->wait(this->submittedValue);
+	this->collect();
+
+	vkDestroySemaphore(this->device, this->semaphore, nullptr);
+	this->semaphore = VK_NULL_HANDLE;
+}
+
+GpuTimeline::~GpuTimeline()
+{
+}
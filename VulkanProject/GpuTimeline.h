@@ -0,0 +1,54 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <functional>
+
+// A timeline semaphore shared by every submission to a queue. Each submission signals the next value in order, so
+// "has value N completed" answers whether that submission (and everything submitted before it) has finished.
+// Anything that has to outlive GPU work (staging buffers, one-off command buffers, deleted resources) is retired
+// against the value of the last submission using it and freed once that value is reached
+class GpuTimeline
+{
+public:
+	GpuTimeline();
+
+	void create(VkDevice newDevice);
+
+	// Value the next submission should signal, submissions must be made in the order values are handed out
+	uint64_t nextValue();
+	// Value of the most recent submission (0 before anything is submitted)
+	uint64_t lastSubmittedValue();
+	// Value the GPU has reached
+	uint64_t completedValue();
+
+	bool isComplete(uint64_t value);
+	void wait(uint64_t value);
+
+	// Run deleter once the GPU has reached value
+	void retire(uint64_t value, std::function<void()> deleter);
+	// Run the deleters whose value has been reached
+	void collect();
+
+	VkSemaphore getSemaphore();
+
+	// Waits for all submitted work and runs every outstanding deleter
+	void destroy();
+
+	~GpuTimeline();
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+
+	uint64_t submittedValue = 0;
+	uint64_t knownCompletedValue = 0; // Cached so repeated checks for old values don't have to query the device
+
+	struct Retirement {
+		uint64_t value;
+		std::function<void()> deleter;
+	};
+	std::vector<Retirement> retirements; // In increasing value order, as values are retired as they're submitted
+};
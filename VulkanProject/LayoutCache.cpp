@@ -0,0 +1,140 @@
+#include "LayoutCache.h"
+
+#include <stdexcept>
+
+#include "Utilities.h"
+
+static bool sameBindings(const std::vector<VkDescriptorSetLayoutBinding>& a, const std::vector<VkDescriptorSetLayoutBinding>& b)
+{
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); i++) {
+		if (a[i].binding != b[i].binding || a[i].descriptorType != b[i].descriptorType || a[i].descriptorCount != b[i].descriptorCount
+			|| a[i].stageFlags != b[i].stageFlags || a[i].pImmutableSamplers != b[i].pImmutableSamplers) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool sameRanges(const std::vector<VkPushConstantRange>& a, const std::vector<VkPushConstantRange>& b)
+{
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); i++) {
+		if (a[i].stageFlags != b[i].stageFlags || a[i].offset != b[i].offset || a[i].size != b[i].size) {
+			return false;
+		}
+	}
+	return true;
+}
+
+LayoutCache::LayoutCache()
+{
+}
+
+void LayoutCache::create(VkDevice newDevice)
+{
+	this->device = newDevice;
+}
+
+VkDescriptorSetLayout LayoutCache::getSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->stats.requests++;
+
+	// Field by field, as the structs have padding
+	uint32_t bindingCount = static_cast<uint32_t>(bindings.size());
+	uint64_t key = hashContent(&bindingCount, sizeof(bindingCount));
+	for (const VkDescriptorSetLayoutBinding& binding : bindings) {
+		uint32_t fields[] = { binding.binding, static_cast<uint32_t>(binding.descriptorType), binding.descriptorCount, binding.stageFlags };
+		key = hashContent(fields, sizeof(fields), key);
+	}
+
+	auto range = this->setLayouts.equal_range(key);
+	for (auto found = range.first; found != range.second; ++found) {
+		if (sameBindings(found->second.bindings, bindings)) {
+			return found->second.layout;
+		}
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutCreateInfo.pBindings = bindings.data();
+
+	SetLayoutEntry entry = { bindings, VK_NULL_HANDLE };
+	VkResult result = vkCreateDescriptorSetLayout(this->device, &layoutCreateInfo, nullptr, &entry.layout);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create descriptor set layout");
+	}
+
+	this->setLayouts.insert(std::make_pair(key, entry));
+	this->stats.setLayouts++;
+	return entry.layout;
+}
+
+VkPipelineLayout LayoutCache::getPipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, const std::vector<VkPushConstantRange>& pushConstantRanges)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->stats.requests++;
+
+	// Set layouts are deduplicated above, so equal handles mean equal layouts
+	uint64_t key = hashContent(setLayouts.data(), sizeof(VkDescriptorSetLayout) * setLayouts.size());
+	for (const VkPushConstantRange& range : pushConstantRanges) {
+		uint32_t fields[] = { range.stageFlags, range.offset, range.size };
+		key = hashContent(fields, sizeof(fields), key);
+	}
+
+	auto range = this->pipelineLayouts.equal_range(key);
+	for (auto found = range.first; found != range.second; ++found) {
+		if (found->second.setLayouts == setLayouts && sameRanges(found->second.pushConstantRanges, pushConstantRanges)) {
+			return found->second.layout;
+		}
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+	pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
+	pipelineLayoutCreateInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+	pipelineLayoutCreateInfo.pPushConstantRanges = pushConstantRanges.data();
+
+	PipelineLayoutEntry entry = { setLayouts, pushConstantRanges, VK_NULL_HANDLE };
+	VkResult result = vkCreatePipelineLayout(this->device, &pipelineLayoutCreateInfo, nullptr, &entry.layout);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create pipeline layout");
+	}
+
+	this->pipelineLayouts.insert(std::make_pair(key, entry));
+	this->stats.pipelineLayouts++;
+	return entry.layout;
+}
+
+LayoutCacheStats LayoutCache::getStats()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->stats;
+}
+
+void LayoutCache::destroy()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	// Pipeline layouts first, as they refer to the set layouts
+	for (auto& entry : this->pipelineLayouts) {
+		vkDestroyPipelineLayout(this->device, entry.second.layout, nullptr);
+	}
+	this->pipelineLayouts.clear();
+
+	for (auto& entry : this->setLayouts) {
+		vkDestroyDescriptorSetLayout(this->device, entry.second.layout, nullptr);
+	}
+	this->setLayouts.clear();
+}
+
+LayoutCache::~LayoutCache()
+{
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct LayoutCacheStats {
+	uint32_t setLayouts = 0; // Distinct descriptor set layouts created
+	uint32_t pipelineLayouts = 0; // Distinct pipeline layouts created
+	uint32_t requests = 0; // Of either kind, those beyond the distinct ones shared an existing layout
+};
+
+// Descriptor set and pipeline layouts by content, so pipelines whose shaders need the same layout get the same object.
+// Pipelines sharing a pipeline layout (or the layouts of its first sets) can keep descriptor sets bound between them.
+// Safe to use from several threads. Owns the layouts it creates
+class LayoutCache
+{
+public:
+	LayoutCache();
+
+	void create(VkDevice newDevice);
+
+	// Bindings in binding order, as mergeSetBindings returns them
+	VkDescriptorSetLayout getSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+	VkPipelineLayout getPipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, const std::vector<VkPushConstantRange>& pushConstantRanges);
+
+	LayoutCacheStats getStats();
+
+	// Destroys every layout
+	void destroy();
+
+	~LayoutCache();
+
+private:
+	struct SetLayoutEntry {
+		std::vector<VkDescriptorSetLayoutBinding> bindings; // Compared as well as the key, so a hash collision can't return the wrong layout
+		VkDescriptorSetLayout layout;
+	};
+
+	struct PipelineLayoutEntry {
+		std::vector<VkDescriptorSetLayout> setLayouts;
+		std::vector<VkPushConstantRange> pushConstantRanges;
+		VkPipelineLayout layout;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	std::mutex mutex; // Guards the layouts and stats
+	std::unordered_multimap<uint64_t, SetLayoutEntry> setLayouts;
+	std::unordered_multimap<uint64_t, PipelineLayoutEntry> pipelineLayouts;
+
+	LayoutCacheStats stats;
+};
@@ -0,0 +1,108 @@
+#include "LightClusters.h"
+
+#include <algorithm>
+#include <cmath>
+
+Light makePointLight(glm::vec3 position, glm::vec3 colour, float intensity, float range)
+{
+	Light light = {};
+	light.position = position;
+	light.range = range;
+	light.colour = colour;
+	light.intensity = intensity;
+	light.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+	light.spotInnerCos = -1.0f;
+	light.spotOuterCos = -1.0f;
+	return light;
+}
+
+Light makeSpotLight(glm::vec3 position, glm::vec3 direction, glm::vec3 colour, float intensity, float range,
+	float innerAngle, float outerAngle)
+{
+	Light light = makePointLight(position, colour, intensity, range);
+	light.direction = glm::normalize(direction);
+	light.spotInnerCos = std::cos(innerAngle);
+	light.spotOuterCos = std::cos(outerAngle);
+	return light;
+}
+
+uint32_t getClusterIndex(uint32_t x, uint32_t y, uint32_t z)
+{
+	return x + y * CLUSTER_GRID_X + z * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+}
+
+// View space direction through a pixel, scaled to be one unit in front of the camera
+static glm::vec3 clusterRay(const LightBufferHeader& header, glm::vec2 pixel)
+{
+	glm::vec2 ndc = pixel / glm::vec2(header.screen) * 2.0f - 1.0f;
+	glm::vec4 point = header.inverseProjection * glm::vec4(ndc, 0.0f, 1.0f);
+	glm::vec3 viewPoint = glm::vec3(point) / point.w;
+	return viewPoint / -viewPoint.z;
+}
+
+// Distance in front of the camera that depth slice starts at
+static float sliceDepth(const LightBufferHeader& header, uint32_t slice)
+{
+	return header.screen.z * std::pow(header.screen.w / header.screen.z, static_cast<float>(slice) / CLUSTER_GRID_Z);
+}
+
+AABB computeClusterBounds(const LightBufferHeader& header, uint32_t cluster)
+{
+	uint32_t x = cluster % CLUSTER_GRID_X;
+	uint32_t y = (cluster / CLUSTER_GRID_X) % CLUSTER_GRID_Y;
+	uint32_t z = cluster / (CLUSTER_GRID_X * CLUSTER_GRID_Y);
+
+	glm::vec2 tileSize = glm::vec2(header.screen) / glm::vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y);
+	glm::vec3 minRay = clusterRay(header, glm::vec2(x, y) * tileSize);
+	glm::vec3 maxRay = clusterRay(header, glm::vec2(x + 1, y + 1) * tileSize);
+	float nearDepth = sliceDepth(header, z);
+	float farDepth = sliceDepth(header, z + 1);
+
+	// The tile's corners at the slice's near and far depth, as the frustum widens with depth
+	AABB bounds;
+	bounds.grow(minRay * nearDepth);
+	bounds.grow(minRay * farDepth);
+	bounds.grow(maxRay * nearDepth);
+	bounds.grow(maxRay * farDepth);
+	return bounds;
+}
+
+uint32_t findCluster(const LightBufferHeader& header, glm::vec2 fragCoord, float viewDepth)
+{
+	glm::vec2 tileSize = glm::vec2(header.screen) / glm::vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y);
+	int x = static_cast<int>(std::floor(fragCoord.x / tileSize.x));
+	int y = static_cast<int>(std::floor(fragCoord.y / tileSize.y));
+	int z = static_cast<int>(std::floor(std::log(viewDepth / header.screen.z) / std::log(header.screen.w / header.screen.z) * CLUSTER_GRID_Z));
+
+	x = std::min(std::max(x, 0), static_cast<int>(CLUSTER_GRID_X) - 1);
+	y = std::min(std::max(y, 0), static_cast<int>(CLUSTER_GRID_Y) - 1);
+	z = std::min(std::max(z, 0), static_cast<int>(CLUSTER_GRID_Z) - 1);
+	return getClusterIndex(x, y, z);
+}
+
+bool lightTouchesBounds(const glm::mat4& view, const Light& light, const AABB& bounds)
+{
+	// Spot lights are culled by their range alone, which is conservative but cheap
+	glm::vec3 centre = glm::vec3(view * glm::vec4(light.position, 1.0f));
+	glm::vec3 closest = glm::clamp(centre, bounds.min, bounds.max);
+	glm::vec3 offset = centre - closest;
+	return glm::dot(offset, offset) <= light.range * light.range;
+}
+
+void assignLightsToClusters(const LightBufferHeader& header, const std::vector<Light>& lights, std::vector<uint32_t>* clusterData)
+{
+	clusterData->assign(CLUSTER_COUNT * (1 + MAX_LIGHTS_PER_CLUSTER), 0);
+	uint32_t lightCount = std::min(header.counts.x, static_cast<uint32_t>(lights.size()));
+
+	for (uint32_t cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+		AABB bounds = computeClusterBounds(header, cluster);
+		uint32_t count = 0;
+		for (uint32_t i = 0; i < lightCount && count < MAX_LIGHTS_PER_CLUSTER; i++) {
+			if (lightTouchesBounds(header.view, lights[i], bounds)) {
+				(*clusterData)[CLUSTER_COUNT + cluster * MAX_LIGHTS_PER_CLUSTER + count] = i;
+				count++;
+			}
+		}
+		(*clusterData)[cluster] = count;
+	}
+}
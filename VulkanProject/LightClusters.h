@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Bvh.h"
+#include "Utilities.h"
+
+// Froxel grid the view frustum is split into for light culling: tiles across the screen, slices exponentially spaced in
+// depth. The shaders are compiled with the same values defined (see VulkanRenderer::createShaderCompiler)
+const uint32_t CLUSTER_GRID_X = 16;
+const uint32_t CLUSTER_GRID_Y = 9;
+const uint32_t CLUSTER_GRID_Z = 24;
+const uint32_t CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+const uint32_t MAX_LIGHTS = 1024; // Lights in each frame's light buffer, any more are ignored
+const uint32_t MAX_LIGHTS_PER_CLUSTER = 128; // Lights touching a cluster beyond this many are dropped from it
+
+// Point or spot light (std430, the same as Light in the shaders). A point light is a spot light whose cone is everything
+struct Light {
+	glm::vec3 position; // World space
+	float range; // Distance the light reaches, it has no effect on anything further away
+	glm::vec3 colour;
+	float intensity;
+	glm::vec3 direction; // World space, spot lights only
+	float spotInnerCos; // Cosine of the angle full intensity reaches out to
+	float spotOuterCos; // Cosine of the angle the light fades out by, -1 for point lights
+	float padding[3];
+};
+
+Light makePointLight(glm::vec3 position, glm::vec3 colour, float intensity, float range);
+// Angles are in radians, from the direction to the edge of the cone
+Light makeSpotLight(glm::vec3 position, glm::vec3 direction, glm::vec3 colour, float intensity, float range,
+	float innerAngle, float outerAngle);
+
+// Start of each frame's light buffer (std430, the same as LightBuffer in the shaders), the lights follow it
+struct LightBufferHeader {
+	glm::mat4 view;
+	glm::mat4 inverseView; // Lighting works in world space, from positions rebuilt from the depth buffer
+	glm::mat4 inverseProjection;
+	glm::vec4 screen; // Width and height in pixels, near and far plane
+	glm::vec4 ambient; // Light every surface gets, rgb
+	glm::uvec4 counts; // Number of lights in x
+	// Sun and its shadow cascades
+	glm::mat4 cascadeViewProjections[MAX_SHADOW_CASCADES];
+	glm::vec4 cascadeSplits; // View depth each cascade ends at
+	glm::vec4 cascadeTexelSizes; // World space width of a shadow map texel in each cascade
+	glm::vec4 sunDirection; // World space direction the light travels in xyz, number of cascades in w (0 without a sun)
+	glm::vec4 sunColour; // Colour times intensity
+};
+
+// The cluster buffer holds the number of lights in each cluster, then MAX_LIGHTS_PER_CLUSTER light indices per cluster
+const size_t CLUSTER_BUFFER_SIZE = sizeof(uint32_t) * CLUSTER_COUNT * (1 + MAX_LIGHTS_PER_CLUSTER);
+
+// -- CPU reference of the cluster assignment done by Shaders/cluster.comp (and the lookup in Shaders/second.frag), with
+// the same maths in the same order so results can be checked against the GPU's
+
+uint32_t getClusterIndex(uint32_t x, uint32_t y, uint32_t z);
+
+// View space bounds of a cluster
+AABB computeClusterBounds(const LightBufferHeader& header, uint32_t cluster);
+
+// Cluster a fragment at fragCoord (pixels) and viewDepth (distance in front of the camera) is lit from
+uint32_t findCluster(const LightBufferHeader& header, glm::vec2 fragCoord, float viewDepth);
+
+// Whether the light's sphere of influence reaches the view space box
+bool lightTouchesBounds(const glm::mat4& view, const Light& light, const AABB& bounds);
+
+// Fills clusterData with what the cluster buffer would hold: counts then lights in index order, capped per cluster
+void assignLightsToClusters(const LightBufferHeader& header, const std::vector<Light>& lights, std::vector<uint32_t>* clusterData);
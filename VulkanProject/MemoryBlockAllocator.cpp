@@ -0,0 +1,353 @@
+#include "MemoryBlockAllocator.h"
+
+#include <algorithm>
+
+MemoryBlockAllocator::MemoryBlockAllocator()
+{
+}
+
+void MemoryBlockAllocator::create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice)
+{
+	this->physicalDevice = newPhysicalDevice;
+	this->device = newDevice;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(this->physicalDevice, &properties);
+	this->bufferImageGranularity = std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+}
+
+MemoryAllocation MemoryBlockAllocator::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer* buffer)
+{
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkResult result = vkCreateBuffer(this->device, &bufferInfo, nullptr, buffer);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a buffer");
+	}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetBufferMemoryRequirements(this->device, *buffer, &memoryRequirements);
+	MemoryAllocation allocation = this->allocate(memoryRequirements, properties);
+
+	result = vkBindBufferMemory(this->device, *buffer, allocation.memory, allocation.offset);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to bind buffer to memory");
+	}
+	return allocation;
+}
+
+MemoryAllocation MemoryBlockAllocator::createImage(const VkImageCreateInfo& imageCreateInfo, VkMemoryPropertyFlags properties, VkImage* image)
+{
+	VkResult result = vkCreateImage(this->device, &imageCreateInfo, nullptr, image);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create image");
+	}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(this->device, *image, &memoryRequirements);
+	MemoryAllocation allocation = this->allocate(memoryRequirements, properties);
+
+	result = vkBindImageMemory(this->device, *image, allocation.memory, allocation.offset);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to bind image to memory");
+	}
+	return allocation;
+}
+
+void MemoryBlockAllocator::free(const MemoryAllocation& allocation)
+{
+	if (allocation.block == MEMORY_BLOCK_NONE) {
+		return;
+	}
+
+	MemoryBlock& block = this->blocks[allocation.block];
+	block.usedBytes -= allocation.size;
+	block.allocations.erase(std::find_if(block.allocations.begin(), block.allocations.end(),
+		[&allocation](const BlockAllocation& placed) { return placed.offset == allocation.offset; }));
+
+	// Nothing left in it, so its memory goes back to the driver
+	if (block.allocations.empty()) {
+		freeDeviceMemory(this->device, block.memory);
+		block = MemoryBlock();
+		return;
+	}
+
+	// Insert the range back in offset order, merging it with the ranges either side if they touch
+	auto next = std::lower_bound(block.freeRanges.begin(), block.freeRanges.end(), allocation.offset,
+		[](const FreeRange& range, VkDeviceSize offset) { return range.offset < offset; });
+	FreeRange freed = { allocation.offset, allocation.size };
+	if (next != block.freeRanges.end() && freed.offset + freed.size == next->offset) {
+		freed.size += next->size;
+		next = block.freeRanges.erase(next);
+	}
+	if (next != block.freeRanges.begin()) {
+		auto previous = next - 1;
+		if (previous->offset + previous->size == freed.offset) {
+			previous->size += freed.size;
+			return;
+		}
+	}
+	block.freeRanges.insert(next, freed);
+}
+
+FragmentationStats MemoryBlockAllocator::getStats()
+{
+	FragmentationStats stats;
+	for (const MemoryBlock& block : this->blocks) {
+		if (block.memory == VK_NULL_HANDLE) {
+			continue;
+		}
+
+		stats.blockCount++;
+		stats.blockBytes += block.size;
+		stats.usedBytes += block.usedBytes;
+		for (const FreeRange& range : block.freeRanges) {
+			stats.freeBytes += range.size;
+			stats.largestFreeRange = std::max(stats.largestFreeRange, range.size);
+			stats.freeRangeCount++;
+		}
+	}
+
+	if (stats.freeBytes > 0) {
+		stats.fragmentation = 1.0f - static_cast<float>(stats.largestFreeRange) / static_cast<float>(stats.freeBytes);
+	}
+	return stats;
+}
+
+MemoryTypeUsage MemoryBlockAllocator::getTypeUsage(uint32_t memoryType)
+{
+	MemoryTypeUsage usage;
+	for (const MemoryBlock& block : this->blocks) {
+		if (block.memory != VK_NULL_HANDLE && block.memoryType == memoryType) {
+			usage.blockBytes += block.size;
+			usage.usedBytes += block.usedBytes;
+		}
+	}
+	return usage;
+}
+
+bool MemoryBlockAllocator::fitsInBlocks(uint32_t memoryType, VkDeviceSize size)
+{
+	// Anything this large gets a block of its own
+	if (size > MEMORY_BLOCK_SIZE / 2) {
+		return false;
+	}
+
+	for (const MemoryBlock& block : this->blocks) {
+		if (!this->isSharedBlock(block, memoryType)) {
+			continue;
+		}
+
+		std::vector<FreeRange> freeRanges = block.freeRanges;
+		VkDeviceSize offset;
+		if (takeRange(&freeRanges, size, this->bufferImageGranularity, &offset)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32_t MemoryBlockAllocator::beginEvacuation(float maxUsage)
+{
+	// Emptiest blocks first, as they have the least to move for the memory they give back
+	std::vector<uint32_t> candidates;
+	for (uint32_t i = 0; i < this->blocks.size(); i++) {
+		const MemoryBlock& block = this->blocks[i];
+		if (block.memory != VK_NULL_HANDLE && !block.dedicated && !block.evacuating
+			&& static_cast<float>(block.usedBytes) < maxUsage * static_cast<float>(block.size)) {
+			candidates.push_back(i);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b) {
+		return this->blocks[a].usedBytes < this->blocks[b].usedBytes;
+	});
+
+	// The free ranges of every block as they'll be once the contents of the blocks being emptied have moved in. Contents
+	// are placed largest first, into the first range they fit in, as allocate would place them
+	std::vector<std::vector<FreeRange>> placedRanges(this->blocks.size());
+	for (uint32_t i = 0; i < this->blocks.size(); i++) {
+		placedRanges[i] = this->blocks[i].freeRanges;
+	}
+	std::vector<bool> receiving(this->blocks.size(), false);
+	auto placeContents = [this, &placedRanges, &receiving](uint32_t source) {
+		std::vector<BlockAllocation> contents = this->blocks[source].allocations;
+		std::sort(contents.begin(), contents.end(), [](const BlockAllocation& a, const BlockAllocation& b) { return a.size > b.size; });
+
+		std::vector<std::vector<FreeRange>> ranges = placedRanges;
+		std::vector<bool> received = receiving;
+		for (const BlockAllocation& content : contents) {
+			bool placed = false;
+			for (uint32_t i = 0; i < this->blocks.size() && !placed; i++) {
+				VkDeviceSize offset;
+				if (i != source && this->isSharedBlock(this->blocks[i], this->blocks[source].memoryType)
+					&& takeRange(&ranges[i], content.size, content.alignment, &offset)) {
+					received[i] = true;
+					placed = true;
+				}
+			}
+			if (!placed) {
+				return false;
+			}
+		}
+
+		placedRanges = ranges;
+		receiving = received;
+		return true;
+	};
+
+	// Anything still being emptied from an earlier pass has its space promised already
+	for (uint32_t i = 0; i < this->blocks.size(); i++) {
+		if (this->blocks[i].memory != VK_NULL_HANDLE && this->blocks[i].evacuating) {
+			placeContents(i);
+		}
+	}
+
+	// Blocks given contents stay, so nothing is moved twice
+	uint32_t chosen = 0;
+	for (uint32_t candidate : candidates) {
+		if (!receiving[candidate] && placeContents(candidate)) {
+			this->blocks[candidate].evacuating = true;
+			chosen++;
+		}
+	}
+
+	return chosen;
+}
+
+bool MemoryBlockAllocator::isEvacuating(uint32_t block)
+{
+	return block != MEMORY_BLOCK_NONE && this->blocks[block].evacuating;
+}
+
+uint32_t MemoryBlockAllocator::getEvacuatingCount()
+{
+	uint32_t count = 0;
+	for (const MemoryBlock& block : this->blocks) {
+		if (block.evacuating) {
+			count++;
+		}
+	}
+	return count;
+}
+
+void MemoryBlockAllocator::destroy()
+{
+	for (MemoryBlock& block : this->blocks) {
+		if (block.memory != VK_NULL_HANDLE) {
+			freeDeviceMemory(this->device, block.memory);
+		}
+	}
+	this->blocks.clear();
+}
+
+MemoryBlockAllocator::~MemoryBlockAllocator()
+{
+}
+
+MemoryAllocation MemoryBlockAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties)
+{
+	uint32_t memoryType = findMemoryTypeIndex(this->physicalDevice, requirements.memoryTypeBits, properties);
+	VkDeviceSize alignment = std::max(requirements.alignment, this->bufferImageGranularity);
+	VkDeviceSize size = (requirements.size + alignment - 1) / alignment * alignment;
+
+	MemoryAllocation allocation;
+
+	// Large resources would leave little room for anything else, so they're given the whole of a block
+	if (size > MEMORY_BLOCK_SIZE / 2) {
+		this->allocateFromBlock(this->createBlock(size, memoryType, true), size, alignment, &allocation);
+		return allocation;
+	}
+
+	// First block of the type with a free range it fits in (skipping blocks being emptied)
+	for (uint32_t i = 0; i < this->blocks.size(); i++) {
+		if (this->isSharedBlock(this->blocks[i], memoryType) && this->allocateFromBlock(i, size, alignment, &allocation)) {
+			return allocation;
+		}
+	}
+
+	this->allocateFromBlock(this->createBlock(MEMORY_BLOCK_SIZE, memoryType, false), size, alignment, &allocation);
+	return allocation;
+}
+
+bool MemoryBlockAllocator::allocateFromBlock(uint32_t blockIndex, VkDeviceSize size, VkDeviceSize alignment, MemoryAllocation* allocation)
+{
+	MemoryBlock& block = this->blocks[blockIndex];
+	VkDeviceSize offset;
+	if (!takeRange(&block.freeRanges, size, alignment, &offset)) {
+		return false;
+	}
+
+	block.usedBytes += size;
+	block.allocations.push_back({ offset, size, alignment });
+
+	allocation->memory = block.memory;
+	allocation->offset = offset;
+	allocation->size = size;
+	allocation->block = blockIndex;
+	return true;
+}
+
+bool MemoryBlockAllocator::takeRange(std::vector<FreeRange>* freeRanges, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset)
+{
+	for (size_t i = 0; i < freeRanges->size(); i++) {
+		FreeRange range = (*freeRanges)[i];
+		VkDeviceSize alignedOffset = (range.offset + alignment - 1) / alignment * alignment;
+		if (alignedOffset + size > range.offset + range.size) {
+			continue;
+		}
+
+		// Whatever is left before and after the allocation stays free
+		freeRanges->erase(freeRanges->begin() + i);
+		if (alignedOffset + size < range.offset + range.size) {
+			freeRanges->insert(freeRanges->begin() + i, { alignedOffset + size, range.offset + range.size - alignedOffset - size });
+		}
+		if (alignedOffset > range.offset) {
+			freeRanges->insert(freeRanges->begin() + i, { range.offset, alignedOffset - range.offset });
+		}
+
+		*offset = alignedOffset;
+		return true;
+	}
+
+	return false;
+}
+
+bool MemoryBlockAllocator::isSharedBlock(const MemoryBlock& block, uint32_t memoryType)
+{
+	// Blocks new allocations of the type can go in
+	return block.memory != VK_NULL_HANDLE && !block.dedicated && !block.evacuating && block.memoryType == memoryType;
+}
+
+uint32_t MemoryBlockAllocator::createBlock(VkDeviceSize size, uint32_t memoryType, bool dedicated)
+{
+	MemoryBlock block;
+	block.size = size;
+	block.memoryType = memoryType;
+	block.dedicated = dedicated;
+	block.freeRanges.push_back({ 0, size });
+
+	VkMemoryAllocateInfo memoryAllocateInfo = {};
+	memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memoryAllocateInfo.allocationSize = size;
+	memoryAllocateInfo.memoryTypeIndex = memoryType;
+
+	VkResult result = allocateDeviceMemory(this->device, &memoryAllocateInfo, &block.memory);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate memory block");
+	}
+
+	// A freed block's slot is reused, so the block indices held by live allocations never change
+	for (uint32_t i = 0; i < this->blocks.size(); i++) {
+		if (this->blocks[i].memory == VK_NULL_HANDLE) {
+			this->blocks[i] = block;
+			return i;
+		}
+	}
+
+	this->blocks.push_back(block);
+	return static_cast<uint32_t>(this->blocks.size() - 1);
+}
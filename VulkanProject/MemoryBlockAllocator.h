@@ -0,0 +1,119 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "Utilities.h"
+
+const uint32_t MEMORY_BLOCK_NONE = 0xFFFFFFFF;
+
+// Range of a memory block given to one buffer or image
+struct MemoryAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	uint32_t block = MEMORY_BLOCK_NONE;
+};
+
+// How usable the free space left in the blocks is, over every block
+struct FragmentationStats {
+	uint32_t blockCount = 0;
+	VkDeviceSize blockBytes = 0; // Device memory allocated for blocks
+	VkDeviceSize usedBytes = 0; // Given to buffers and images
+	VkDeviceSize freeBytes = 0;
+	VkDeviceSize largestFreeRange = 0;
+	uint32_t freeRangeCount = 0;
+	float fragmentation = 0.0f; // 1 - largestFreeRange / freeBytes, 0 when the free space is all in one range
+};
+
+// Blocks of one memory type, where memory budgets count what's given out of them rather than the blocks' whole size
+struct MemoryTypeUsage {
+	VkDeviceSize blockBytes = 0; // Device memory allocated for the type's blocks
+	VkDeviceSize usedBytes = 0; // Given to buffers and images
+};
+
+// One defragmentation pass, from the blocks being chosen to the last of them being freed
+struct DefragmentationStats {
+	bool active = false;
+	uint64_t startFrame = 0;
+	uint64_t endFrame = 0;
+	uint32_t blocksEmptied = 0; // Blocks chosen to be emptied and freed
+	uint32_t resourcesMoved = 0;
+	VkDeviceSize bytesMoved = 0;
+	FragmentationStats before; // When the pass started
+	FragmentationStats after; // When the last emptied block was freed
+};
+
+// Places buffers and images in large blocks of device memory rather than giving each its own allocation. Blocks whose
+// contents have mostly been freed can be emptied (by the renderer moving what's left in them) so their memory is returned
+class MemoryBlockAllocator
+{
+public:
+	MemoryBlockAllocator();
+
+	void create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice);
+
+	// Creates a buffer or image and binds it to memory from a block, anything too large to share a block gets one of its own
+	MemoryAllocation createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer* buffer);
+	MemoryAllocation createImage(const VkImageCreateInfo& imageCreateInfo, VkMemoryPropertyFlags properties, VkImage* image);
+	// Returns the range to its block, the block's memory is freed once nothing is left in it
+	void free(const MemoryAllocation& allocation);
+
+	FragmentationStats getStats();
+	MemoryTypeUsage getTypeUsage(uint32_t memoryType);
+	// Whether size bytes would go in a free range of a block the type already has, so no new block would be allocated.
+	// Aligned to bufferImageGranularity, a resource needing more alignment may still not fit
+	bool fitsInBlocks(uint32_t memoryType, VkDeviceSize size);
+
+	// Chooses the blocks less than maxUsage full (emptiest first) whose contents fit in the free ranges of the other blocks
+	// of their memory type, placing them as allocate would. Nothing new is put in them, so they're freed once everything in them has been moved or freed.
+	// Returns the number of blocks chosen
+	uint32_t beginEvacuation(float maxUsage);
+	bool isEvacuating(uint32_t block);
+	// Blocks chosen by beginEvacuation that still have something in them
+	uint32_t getEvacuatingCount();
+
+	// Frees every block, whatever is still in them
+	void destroy();
+
+	~MemoryBlockAllocator();
+
+private:
+	struct FreeRange {
+		VkDeviceSize offset;
+		VkDeviceSize size;
+	};
+
+	struct BlockAllocation {
+		VkDeviceSize offset;
+		VkDeviceSize size;
+		VkDeviceSize alignment;
+	};
+
+	struct MemoryBlock {
+		VkDeviceMemory memory = VK_NULL_HANDLE; // Null once freed, so its slot can be reused
+		VkDeviceSize size = 0;
+		uint32_t memoryType = 0;
+		VkDeviceSize usedBytes = 0;
+		std::vector<BlockAllocation> allocations; // What's in it, so emptying it can check its contents fit elsewhere
+		bool dedicated = false; // Holds one large resource, never shared or emptied
+		bool evacuating = false;
+		std::vector<FreeRange> freeRanges; // Sorted by offset, neighbouring ranges are always merged
+	};
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	// Allocations are aligned to at least this, so buffers and optimally tiled images can share a block
+	VkDeviceSize bufferImageGranularity = 1;
+
+	std::vector<MemoryBlock> blocks;
+
+	MemoryAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties);
+	bool allocateFromBlock(uint32_t block, VkDeviceSize size, VkDeviceSize alignment, MemoryAllocation* allocation);
+	// First free range size fits in once aligned, taken out of freeRanges (leaving what's either side free)
+	static bool takeRange(std::vector<FreeRange>* freeRanges, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset);
+	bool isSharedBlock(const MemoryBlock& block, uint32_t memoryType);
+	uint32_t createBlock(VkDeviceSize size, uint32_t memoryType, bool dedicated);
+};
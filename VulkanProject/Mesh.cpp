@@ -12,15 +12,37 @@ Mesh::Mesh(
 		VkCommandPool transferCommandPool,
 		std::vector<Vertex>* vertices,
 		std::vector<uint32_t>* indices,
-		int newTexId)
+		int newTexId,
+		MemoryBlockAllocator* newAllocator,
+		GpuTimeline* uploadTimeline)
 {
 	this->vertexCount = vertices->size();
 	this->indexCount = indices->size();
 	this->physicalDevice = newPhysicalDevice;
 	this->device = newDevice;
-	this->createVertexBuffer(transferQueue, transferCommandPool, vertices);
-	this->createIndexBuffer(transferQueue, transferCommandPool, indices);
+	this->allocator = newAllocator;
+	this->cpuVertices = *vertices;
+	this->cpuIndices = *indices;
+	this->createVertexBuffer(transferQueue, transferCommandPool, vertices, uploadTimeline);
+	this->createIndexBuffer(transferQueue, transferCommandPool, indices, uploadTimeline);
+
+	// Size and type of memory the buffers take, for residency budgeting
+	VkMemoryRequirements vertexRequirements, indexRequirements;
+	vkGetBufferMemoryRequirements(this->device, this->vertexBuffer, &vertexRequirements);
+	vkGetBufferMemoryRequirements(this->device, this->indexBuffer, &indexRequirements);
+	this->deviceBytes = vertexRequirements.size + indexRequirements.size;
+	this->memoryType = findMemoryTypeIndex(this->physicalDevice, vertexRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	this->texId = newTexId;
+	this->node = SCENE_NODE_NONE;
+
+	// Everything in the index buffer is the single full detail level until told otherwise
+	MeshLod fullDetail;
+	fullDetail.indexCount = this->indexCount;
+	this->lods = { fullDetail };
+	computeBoundingSphere(*vertices, &this->boundsCentre, &this->boundsRadius);
+	for (const Vertex& vertex : *vertices) {
+		this->localBounds.grow(vertex.pos);
+	}
 
 	model.model = glm::mat4(1.0f);
 }
@@ -40,11 +62,26 @@ int Mesh::getTexId()
 	return this->texId;
 }
 
+void Mesh::setNode(uint32_t newNode)
+{
+	this->node = newNode;
+}
+
+uint32_t Mesh::getNode()
+{
+	return this->node;
+}
+
 int Mesh::getVertexCount()
 {
 	return this->vertexCount;
 }
 
+VkDeviceSize Mesh::getPositionOffset()
+{
+	return sizeof(Vertex) * this->vertexCount;
+}
+
 VkBuffer Mesh::getVertexBuffer()
 {
 	return this->vertexBuffer;
@@ -52,7 +89,8 @@ VkBuffer Mesh::getVertexBuffer()
 
 int Mesh::getIndexCount()
 {
-	return this->indexCount;
+	// Full detail level, rather than the whole buffer which also holds the lower levels
+	return this->lods.empty() ? this->indexCount : this->lods[0].indexCount;
 }
 
 VkBuffer Mesh::getIndexBuffer()
@@ -60,12 +98,158 @@ VkBuffer Mesh::getIndexBuffer()
 	return this->indexBuffer;
 }
 
+VkIndexType Mesh::getIndexType()
+{
+	return this->indexType;
+}
+
+void Mesh::setLods(std::vector<MeshLod> newLods)
+{
+	for (const MeshLod& lod : newLods) {
+		if (lod.firstIndex + lod.indexCount > static_cast<uint32_t>(this->indexCount)) {
+			throw std::runtime_error("Mesh LOD is outside of the index buffer");
+		}
+	}
+
+	if (!newLods.empty()) {
+		this->lods = newLods;
+	}
+}
+
+size_t Mesh::getLodCount()
+{
+	return this->lods.size();
+}
+
+const MeshLod& Mesh::getLod(size_t index)
+{
+	// Clamp rather than fail, asking for a coarser level than exists just gets the coarsest
+	return this->lods[std::min(index, this->lods.size() - 1)];
+}
+
+glm::vec3 Mesh::getBoundsCentre()
+{
+	return this->boundsCentre;
+}
+
+float Mesh::getBoundsRadius()
+{
+	return this->boundsRadius;
+}
+
+AABB Mesh::getLocalBounds()
+{
+	return this->localBounds;
+}
+
+void Mesh::buildTriangleBvh()
+{
+	this->triangleBvh.build(this->cpuVertices, this->cpuIndices, this->lods[0].firstIndex, this->lods[0].indexCount);
+}
+
+const TriangleBvh& Mesh::getTriangleBvh()
+{
+	return this->triangleBvh;
+}
+
+bool Mesh::isResident()
+{
+	return this->vertexBuffer != VK_NULL_HANDLE;
+}
+
+void Mesh::evictBuffers()
+{
+	this->destroyBuffers();
+	this->vertexBuffer = VK_NULL_HANDLE;
+	this->vertexAllocation = MemoryAllocation();
+	this->indexBuffer = VK_NULL_HANDLE;
+	this->indexAllocation = MemoryAllocation();
+}
+
+void Mesh::retireBuffers(GpuTimeline* timeline)
+{
+	VkDevice retireDevice = this->device;
+	MemoryBlockAllocator* retireAllocator = this->allocator;
+	VkBuffer retireVertexBuffer = this->vertexBuffer;
+	MemoryAllocation retireVertexAllocation = this->vertexAllocation;
+	VkBuffer retireIndexBuffer = this->indexBuffer;
+	MemoryAllocation retireIndexAllocation = this->indexAllocation;
+	timeline->retire(timeline->lastSubmittedValue(), [=]() {
+		vkDestroyBuffer(retireDevice, retireVertexBuffer, nullptr);
+		retireAllocator->free(retireVertexAllocation);
+		vkDestroyBuffer(retireDevice, retireIndexBuffer, nullptr);
+		retireAllocator->free(retireIndexAllocation);
+	});
+
+	this->vertexBuffer = VK_NULL_HANDLE;
+	this->vertexAllocation = MemoryAllocation();
+	this->indexBuffer = VK_NULL_HANDLE;
+	this->indexAllocation = MemoryAllocation();
+}
+
+void Mesh::reloadBuffers(VkQueue transferQueue, VkCommandPool transferCommandPool, GpuTimeline* uploadTimeline)
+{
+	if (this->isResident()) {
+		return;
+	}
+
+	this->createVertexBuffer(transferQueue, transferCommandPool, &this->cpuVertices, uploadTimeline);
+	this->createIndexBuffer(transferQueue, transferCommandPool, &this->cpuIndices, uploadTimeline);
+}
+
+VkDeviceSize Mesh::getDeviceBytes()
+{
+	return this->deviceBytes;
+}
+
+uint32_t Mesh::getMemoryType()
+{
+	return this->memoryType;
+}
+
+bool Mesh::isInEvacuatingBlock()
+{
+	return this->allocator->isEvacuating(this->vertexAllocation.block) || this->allocator->isEvacuating(this->indexAllocation.block);
+}
+
+std::function<void()> Mesh::moveBuffers(VkCommandBuffer commandBuffer)
+{
+	VkBuffer oldVertexBuffer = this->vertexBuffer;
+	MemoryAllocation oldVertexAllocation = this->vertexAllocation;
+	VkBuffer oldIndexBuffer = this->indexBuffer;
+	MemoryAllocation oldIndexAllocation = this->indexAllocation;
+
+	// The allocator never places new buffers in the blocks it's emptying
+	VkDeviceSize vertexSize = this->getVertexBufferSize();
+	this->vertexAllocation = this->allocator->createBuffer(vertexSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &this->vertexBuffer);
+	VkDeviceSize indexSize = this->getIndexBufferSize();
+	this->indexAllocation = this->allocator->createBuffer(indexSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &this->indexBuffer);
+
+	VkBufferCopy vertexRegion = { 0, 0, vertexSize };
+	vkCmdCopyBuffer(commandBuffer, oldVertexBuffer, this->vertexBuffer, 1, &vertexRegion);
+	VkBufferCopy indexRegion = { 0, 0, indexSize };
+	vkCmdCopyBuffer(commandBuffer, oldIndexBuffer, this->indexBuffer, 1, &indexRegion);
+
+	VkDevice moveDevice = this->device;
+	MemoryBlockAllocator* moveAllocator = this->allocator;
+	return [=]() {
+		vkDestroyBuffer(moveDevice, oldVertexBuffer, nullptr);
+		moveAllocator->free(oldVertexAllocation);
+		vkDestroyBuffer(moveDevice, oldIndexBuffer, nullptr);
+		moveAllocator->free(oldIndexAllocation);
+	};
+}
+
 void Mesh::destroyBuffers()
 {
 	vkDestroyBuffer(this->device, this->vertexBuffer, nullptr);
-	vkFreeMemory(this->device, this->vertexBufferMemory, nullptr);
+	this->allocator->free(this->vertexAllocation);
 	vkDestroyBuffer(this->device, this->indexBuffer, nullptr);
-	vkFreeMemory(this->device, this->indexBufferMemory, nullptr);
+	this->allocator->free(this->indexAllocation);
 }
 
 Mesh::~Mesh()
@@ -75,10 +259,11 @@ Mesh::~Mesh()
 void Mesh::createVertexBuffer(
 		VkQueue transferQueue,
 		VkCommandPool transferCommandPool, 
-		std::vector<Vertex>* vertices)
+		std::vector<Vertex>* vertices,
+		GpuTimeline* uploadTimeline)
 {
-	// Get size of buffer needed for vertices
-	VkDeviceSize bufferSize = sizeof(Vertex) * vertices->size();
+	// Get size of buffer needed for vertices, and their positions after them
+	VkDeviceSize bufferSize = this->getVertexBufferSize();
 
 	// Temporary buffer to "stage" vertex data before transferring to GPU
 	VkBuffer stagingBuffer;
@@ -93,27 +278,47 @@ void Mesh::createVertexBuffer(
 	// -- Map memory to vertex data --
 	void* data; // 1. Create pointer to point in normal memory (initialised with null)
 	vkMapMemory(this->device, stagingBufferMemory, 0, bufferSize, 0, &data); // 2. "Map" the vertex buffer memory to that point
-	memcpy(data, vertices->data(), (size_t)bufferSize); // 3. Copy memory from vertices vector to the pointer
+	memcpy(data, vertices->data(), sizeof(Vertex) * vertices->size()); // 3. Copy memory from vertices vector to the pointer
+	glm::vec3* positions = reinterpret_cast<glm::vec3*>(static_cast<char*>(data) + this->getPositionOffset());
+	for (size_t i = 0; i < vertices->size(); i++) {
+		positions[i] = (*vertices)[i].pos;
+	}
 	vkUnmapMemory(this->device, stagingBufferMemory); // 4. Unmap vertex buffer memory
 
 	// Create buffer with TRANSFER_DST_BIT to mark as recipient of transfer data ( Also vertex buffer)
-	createBuffer(this->physicalDevice, this->device, bufferSize, 
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, // This will be the destination buffer (from the source above) but also is a vertex buffer
+	// TRANSFER_SRC_BIT too, so it can be copied elsewhere when its memory block is emptied
+	this->vertexAllocation = this->allocator->createBuffer(bufferSize, 
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, // This will be the destination buffer (from the source above) but also is a vertex buffer
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, // Memory device_local is on the GPU and only accessible by it and not CPU (host)
-		&this->vertexBuffer, &this->vertexBufferMemory);
+		&this->vertexBuffer);
 
 	// Copy staging buffer into vertex buffer on GPU
-	copyBuffer(this->device, transferQueue, transferCommandPool, stagingBuffer, this->vertexBuffer, bufferSize);
+	copyBuffer(this->device, transferQueue, transferCommandPool, stagingBuffer, this->vertexBuffer, bufferSize, uploadTimeline);
 
-	// Clean up staging buffer parts
-	vkDestroyBuffer(this->device, stagingBuffer, nullptr);
-	vkFreeMemory(this->device, stagingBufferMemory, nullptr);
+	// Clean up staging buffer parts (once the copy has finished)
+	destroyStagingBuffer(this->device, stagingBuffer, stagingBufferMemory, uploadTimeline);
 }
 
-void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>* indices)
+void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>* indices, GpuTimeline* uploadTimeline)
 {
+	// Narrow to 16 bit indices if the vertices all fit, halving the buffer and the index fetch bandwidth
+	std::vector<uint16_t> shortIndices;
+	const void* indexData = indices->data();
+	VkDeviceSize indexSize = sizeof(uint32_t);
+	this->indexType = VK_INDEX_TYPE_UINT32;
+
+	if (this->vertexCount <= 0xFFFF) {
+		shortIndices.reserve(indices->size());
+		for (uint32_t index : *indices) {
+			shortIndices.push_back(static_cast<uint16_t>(index));
+		}
+		indexData = shortIndices.data();
+		indexSize = sizeof(uint16_t);
+		this->indexType = VK_INDEX_TYPE_UINT16;
+	}
+
 	// Get size of buffer needed for indeices
-	VkDeviceSize bufferSize = sizeof(uint32_t) * indices->size();
+	VkDeviceSize bufferSize = indexSize * indices->size();
 
 	// Temporary buffer to "stage" index data before transfering to GPU
 	VkBuffer stagingBuffer;
@@ -127,15 +332,29 @@ void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferComman
 	// Map memory to index buffer
 	void* data;
 	vkMapMemory(this->device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices->data(), (size_t)bufferSize);
+	memcpy(data, indexData, (size_t)bufferSize);
 	vkUnmapMemory(this->device, stagingBufferMemory);
 
 	// Create buffer for INDEX data on GPU access only area
-	createBuffer(this->physicalDevice, this->device, bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+	this->indexAllocation = this->allocator->createBuffer(bufferSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
-		&this->indexBuffer, &this->indexBufferMemory);
+		&this->indexBuffer);
 
 	// Copy from staging buffer to GPU access buffer
-	copyBuffer(this->device, transferQueue, transferCommandPool, stagingBuffer, this->indexBuffer, bufferSize);
+	copyBuffer(this->device, transferQueue, transferCommandPool, stagingBuffer, this->indexBuffer, bufferSize, uploadTimeline);
+
+	// Clean up staging buffer parts (once the copy has finished)
+	destroyStagingBuffer(this->device, stagingBuffer, stagingBufferMemory, uploadTimeline);
+}
+
+VkDeviceSize Mesh::getVertexBufferSize()
+{
+	return (sizeof(Vertex) + sizeof(glm::vec3)) * this->vertexCount;
+}
+
+VkDeviceSize Mesh::getIndexBufferSize()
+{
+	VkDeviceSize indexSize = this->indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	return indexSize * this->indexCount;
 }
@@ -4,7 +4,13 @@
 #include <GLFW/glfw3.h>
 
 #include <vector>
+#include <functional>
 #include "Utilities.h"
+#include "MemoryBlockAllocator.h"
+#include "MeshSimplifier.h"
+#include "SceneGraph.h"
+#include "Bvh.h"
+#include "TriangleBvh.h"
 
 struct Model {
 	glm::mat4 model;
@@ -20,18 +26,59 @@ public:
 		VkCommandPool transferCommandPool,
 		std::vector<Vertex>* vertices,
 		std::vector<uint32_t>* indices,
-		int newTexId);
+		int newTexId,
+		MemoryBlockAllocator* newAllocator,
+		GpuTimeline* uploadTimeline = nullptr);
 
 	void setModel(glm::mat4 newModel);
 	Model getModel();
 
 	int getTexId();
 
+	// Node in its geometry asset's hierarchy, which each model using the asset maps to a scene graph node of its own
+	void setNode(uint32_t newNode);
+	uint32_t getNode();
+
 	int getVertexCount();
 	VkBuffer getVertexBuffer();
+	// The vertex buffer holds the interleaved vertices, then every position again on its own (a position only stream for
+	// depth only passes, so they don't fetch attributes they don't use). Offset of the positions in the buffer
+	VkDeviceSize getPositionOffset();
 
 	int getIndexCount();
 	VkBuffer getIndexBuffer();
+	VkIndexType getIndexType();
+
+	// Levels of detail as ranges of the index buffer, level 0 is full detail (and the only level unless setLods is called)
+	void setLods(std::vector<MeshLod> newLods);
+	size_t getLodCount();
+	const MeshLod& getLod(size_t index);
+
+	// Bounding sphere in the mesh's local space, used to estimate its size on screen
+	glm::vec3 getBoundsCentre();
+	float getBoundsRadius();
+	AABB getLocalBounds();
+
+	// Full detail triangles in the mesh's local space, for ray casts. Built from the CPU copy of the vertices and indices
+	// once the LODs are set
+	void buildTriangleBvh();
+	const TriangleBvh& getTriangleBvh();
+
+	// Residency: buffers can be freed to make room in device memory and uploaded again from the CPU copy when needed
+	bool isResident();
+	void evictBuffers();
+	// Like evictBuffers, but for buffers frames in flight may still be using, they're destroyed once the GPU has
+	// finished everything submitted so far
+	void retireBuffers(GpuTimeline* timeline);
+	void reloadBuffers(VkQueue transferQueue, VkCommandPool transferCommandPool, GpuTimeline* uploadTimeline = nullptr);
+	VkDeviceSize getDeviceBytes();
+	uint32_t getMemoryType();
+
+	// Defragmentation: whether either buffer is in a block the allocator is emptying
+	bool isInEvacuatingBlock();
+	// Records copying the buffers into new ones placed by the allocator, which the mesh then uses. Returns what frees the
+	// old buffers, to be retired once the copy has been submitted
+	std::function<void()> moveBuffers(VkCommandBuffer commandBuffer);
 
 	void destroyBuffers();
 
@@ -41,25 +88,44 @@ private:
 	Model model;
 
 	int texId;
+	uint32_t node;
 
 	int vertexCount;
 	VkBuffer vertexBuffer; 
-	VkDeviceMemory vertexBufferMemory;
+	MemoryAllocation vertexAllocation;
 
 	int indexCount;
 	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
+	MemoryAllocation indexAllocation;
+	VkIndexType indexType; // 16 bit when every vertex can be addressed with it, halving the index buffer
+
+	std::vector<MeshLod> lods;
+	glm::vec3 boundsCentre;
+	float boundsRadius;
+	AABB localBounds;
+	TriangleBvh triangleBvh;
+
+	// The vertices and indices the buffers were made from (after LOD generation and optimisation), kept for reloading
+	std::vector<Vertex> cpuVertices;
+	std::vector<uint32_t> cpuIndices;
+	VkDeviceSize deviceBytes;
+	uint32_t memoryType;
 
 	VkPhysicalDevice physicalDevice;
 	VkDevice device;
+	MemoryBlockAllocator* allocator; // Places the device local buffers, owned by the renderer
 
 	void createVertexBuffer(
 		VkQueue transferQueue,
 		VkCommandPool transferCommandPool, 
-		std::vector<Vertex>* vertices);
+		std::vector<Vertex>* vertices,
+		GpuTimeline* uploadTimeline);
 	void createIndexBuffer(
 		VkQueue transferQueue,
 		VkCommandPool transferCommandPool,
-		std::vector<uint32_t>* indices);
+		std::vector<uint32_t>* indices,
+		GpuTimeline* uploadTimeline);
+	VkDeviceSize getVertexBufferSize();
+	VkDeviceSize getIndexBufferSize();
 };
 
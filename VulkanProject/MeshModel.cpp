@@ -4,41 +4,55 @@ MeshModel::MeshModel()
 {
 }
 
-MeshModel::MeshModel(std::vector<Mesh> newMeshList)
+MeshModel::MeshModel(int newAssetId, GeometryAsset* newAsset, std::vector<uint32_t> newNodes)
 {
-	this->meshList = newMeshList;
-	this->model = glm::mat4(1.0f);
+	this->assetId = newAssetId;
+	this->asset = newAsset;
+	this->nodes = newNodes;
 }
 
 size_t MeshModel::getMeshCount()
 {
-	return this->meshList.size();
+	return this->asset->meshes.size();
 }
 
 Mesh* MeshModel::getMesh(size_t index)
 {
-	if (index >= meshList.size()) {
+	if (index >= this->asset->meshes.size()) {
 		throw std::runtime_error("Attempted to access invalid mesh index");
 	}
 
-	return &this->meshList[index];
+	return &this->asset->meshes[index];
 }
 
-glm::mat4 MeshModel::getModel()
+uint32_t MeshModel::getMeshNode(size_t index)
 {
-	return this->model;
+	return this->nodes[this->getMesh(index)->getNode()];
 }
 
-void MeshModel::setModel(glm::mat4 newModel)
+uint32_t MeshModel::getRootNode()
 {
-	this->model = newModel;
+	return this->nodes[0];
 }
 
-void MeshModel::destroyMeshModel()
+int MeshModel::getAssetId()
 {
-	for (auto& mesh : this->meshList) {
-		mesh.destroyBuffers();
-	}
+	return this->assetId;
+}
+
+const std::vector<uint32_t>& MeshModel::getNodes()
+{
+	return this->nodes;
+}
+
+bool MeshModel::isStatic()
+{
+	return this->staticModel;
+}
+
+void MeshModel::setStatic(bool newStatic)
+{
+	this->staticModel = newStatic;
 }
 
 std::vector<std::string> MeshModel::LoadMaterials(const aiScene* scene)
@@ -70,10 +84,13 @@ std::vector<std::string> MeshModel::LoadMaterials(const aiScene* scene)
 	return textureList;
 }
 
-std::vector<Mesh> MeshModel::LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiNode* node, const aiScene* scene, std::vector<int> matToTex)
+std::vector<Mesh> MeshModel::LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiNode* node, const aiScene* scene, std::vector<int> matToTex, SceneGraph* sceneGraph, uint32_t parentNode, MemoryBlockAllocator* allocator, GpuTimeline* uploadTimeline)
 {
 	std::vector<Mesh> meshList;
 
+	// Add this node's transform to the hierarchy (assimp matrices are row major, glm's are column major)
+	uint32_t sceneNode = sceneGraph->addNode(parentNode, glm::transpose(glm::make_mat4(&node->mTransformation.a1)));
+
 	// Go through each mesh at this node and create it, then add it to our meshList
 	for (size_t i = 0; i < node->mNumMeshes; i++) {
 		meshList.push_back(LoadMesh(
@@ -83,7 +100,10 @@ std::vector<Mesh> MeshModel::LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevi
 			transferCommandPool,
 			scene->mMeshes[node->mMeshes[i]],
 			scene,
-			matToTex));
+			matToTex,
+			allocator,
+			uploadTimeline));
+		meshList.back().setNode(sceneNode);
 	}
 
 	// Go through each node attached to this node an dload it, then append their meshes to this node's mesh list
@@ -95,36 +115,45 @@ std::vector<Mesh> MeshModel::LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevi
 			transferCommandPool,
 			node->mChildren[i],
 			scene,
-			matToTex);
+			matToTex,
+			sceneGraph,
+			sceneNode,
+			allocator,
+			uploadTimeline);
 		meshList.insert(meshList.end(), newList.begin(), newList.end());
 	}
 
 	return meshList;
 }
 
-Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex)
+void MeshModel::LoadMeshData(aiMesh* mesh, std::vector<Vertex>* vertices, std::vector<uint32_t>* indices)
 {
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
-
 	// Resize vertext list to hold all vertices for mesh
-	vertices.resize(mesh->mNumVertices);
+	vertices->resize(mesh->mNumVertices);
 
 	// Go through each vertex and copy it across to our vertices
 	for (size_t i = 0; i < mesh->mNumVertices; i++) {
 		// Set position
-		vertices[i].pos = { mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z };
+		(*vertices)[i].pos = { mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z };
 
 		// Set texture coordinates (if they exist)
 		if (mesh->mTextureCoords[0]) {
-			vertices[i].tex = { mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y };
+			(*vertices)[i].tex = { mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y };
 		} 
 		else {
-			vertices[i].tex = { 0.0f, 0.0f };
+			(*vertices)[i].tex = { 0.0f, 0.0f };
+		}
+
+		// Set normal (generated by assimp if the file has none)
+		if (mesh->mNormals) {
+			(*vertices)[i].normal = { mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z };
+		}
+		else {
+			(*vertices)[i].normal = { 0.0f, 0.0f, 0.0f };
 		}
 
 		// set colour (just use white for now)
-		vertices[i].col = { 1.0f, 1.0f, 1.0f, };
+		(*vertices)[i].col = { 1.0f, 1.0f, 1.0f, };
 	}
 
 	// Iterate over indices through faces and copy across
@@ -134,9 +163,54 @@ Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice,
 
 		// Go through face's indices and add to list
 		for (size_t j = 0; j < face.mNumIndices; j++) {
-			indices.push_back(face.mIndices[j]);
+			indices->push_back(face.mIndices[j]);
+		}
+	}
+}
+
+void MeshModel::GenerateNormals(std::vector<Vertex>* vertices, const std::vector<uint32_t>& indices)
+{
+	for (const Vertex& vertex : *vertices) {
+		if (vertex.normal != glm::vec3(0.0f)) {
+			return;
+		}
+	}
+
+	// The cross product's length is twice the triangle's area, so larger triangles count for more
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		Vertex& a = (*vertices)[indices[i]];
+		Vertex& b = (*vertices)[indices[i + 1]];
+		Vertex& c = (*vertices)[indices[i + 2]];
+		glm::vec3 faceNormal = glm::cross(b.pos - a.pos, c.pos - a.pos);
+		a.normal += faceNormal;
+		b.normal += faceNormal;
+		c.normal += faceNormal;
+	}
+
+	for (Vertex& vertex : *vertices) {
+		if (vertex.normal != glm::vec3(0.0f)) {
+			vertex.normal = glm::normalize(vertex.normal);
 		}
 	}
+}
+
+MeshOptimizationReport MeshModel::PrepareMeshData(std::vector<Vertex>* vertices, std::vector<uint32_t>* indices, std::vector<MeshLod>* lods)
+{
+	// Append the lower levels of detail to the index list so they all go in the one index buffer
+	*lods = generateLodChain(*vertices, indices);
+
+	// Then reorder for the vertex cache, overdraw and vertex fetch (which renumbers the vertices for every level)
+	return optimizeMesh(vertices, indices, *lods);
+}
+
+Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex, MemoryBlockAllocator* allocator, GpuTimeline* uploadTimeline)
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<MeshLod> lods;
+
+	LoadMeshData(mesh, &vertices, &indices);
+	PrepareMeshData(&vertices, &indices, &lods);
 
 	// Create new mesh with details and return it
 	Mesh newMesh = Mesh(
@@ -146,7 +220,11 @@ Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice,
 		transferCommandPool,
 		&vertices,
 		&indices,
-		matToTex[mesh->mMaterialIndex]);
+		matToTex[mesh->mMaterialIndex],
+		allocator,
+		uploadTimeline);
+	newMesh.setLods(lods);
+	newMesh.buildTriangleBvh();
 
 	return newMesh;
 }
@@ -2,25 +2,43 @@
 
 #include <vector>
 #include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #include <assimp/scene.h>
 
 #include "Mesh.h"
+#include "MeshOptimizer.h"
+#include "GeometryCache.h"
 
+// One placement of a geometry asset in the scene: the asset's meshes are shared with every other model using it, the
+// model only has its own copy of the asset's nodes (so it has its own transforms)
 class MeshModel
 {
 public:
 	MeshModel();
-	MeshModel(std::vector<Mesh> newMeshList);
+	// newNodes are the scene graph nodes made for each of the asset's nodes, the first being the model's root
+	MeshModel(int newAssetId, GeometryAsset* newAsset, std::vector<uint32_t> newNodes);
 
 	size_t getMeshCount();
 	Mesh* getMesh(size_t index);
+	// Scene graph node the mesh is drawn with in this model
+	uint32_t getMeshNode(size_t index);
 
-	glm::mat4 getModel();
-	void setModel(glm::mat4 newModel);;
+	// Scene graph node above all of the model's nodes, its local transform is the model matrix
+	uint32_t getRootNode();
 
-	void destroyMeshModel();
+	// -1 once the model has been destroyed
+	int getAssetId();
+	const std::vector<uint32_t>& getNodes();
+
+	// Static models (the default) are drawn into the cached shadow cascades, dynamic ones are drawn into them every frame
+	bool isStatic();
+	void setStatic(bool newStatic);
 
 	static std::vector<std::string> LoadMaterials(const aiScene* scene);
+	static void LoadMeshData(aiMesh* mesh, std::vector<Vertex>* vertices, std::vector<uint32_t>* indices);
+	// Area weighted normals from the triangles, only if the vertices were given none
+	static void GenerateNormals(std::vector<Vertex>* vertices, const std::vector<uint32_t>& indices);
+	static MeshOptimizationReport PrepareMeshData(std::vector<Vertex>* vertices, std::vector<uint32_t>* indices, std::vector<MeshLod>* lods);
 	static std::vector<Mesh> LoadNode(
 		VkPhysicalDevice newPhysicalDevice, 
 		VkDevice newDevice, 
@@ -28,7 +46,11 @@ public:
 		VkCommandPool transferCommandPool, 
 		aiNode* node, 
 		const aiScene* scene, 
-		std::vector<int> matToTex);
+		std::vector<int> matToTex,
+		SceneGraph* sceneGraph,
+		uint32_t parentNode,
+		MemoryBlockAllocator* allocator,
+		GpuTimeline* uploadTimeline = nullptr);
 	static Mesh LoadMesh(
 		VkPhysicalDevice newPhysicalDevice,
 		VkDevice newDevice,
@@ -36,11 +58,15 @@ public:
 		VkCommandPool transferCommandPool,
 		aiMesh* mesh,
 		const aiScene* scene,
-		std::vector<int> matToTex);
+		std::vector<int> matToTex,
+		MemoryBlockAllocator* allocator,
+		GpuTimeline* uploadTimeline = nullptr);
 
 	~MeshModel();
 private:
-	std::vector<Mesh> meshList;
-	glm::mat4 model;
+	int assetId = -1;
+	GeometryAsset* asset = nullptr;
+	std::vector<uint32_t> nodes; // Indexed by the asset's node
+	bool staticModel = true;
 };
 
@@ -0,0 +1,330 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Scoring from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+const int FORSYTH_CACHE_SIZE = 32;
+const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+static float forsythVertexScore(int cachePosition, uint32_t remainingTriangles)
+{
+	// Nothing left to draw with this vertex
+	if (remainingTriangles == 0) {
+		return -1.0f;
+	}
+
+	float score = 0.0f;
+	if (cachePosition >= 0) {
+		if (cachePosition < 3) {
+			// Used by the last triangle, fixed score so the next triangle doesn't just reuse the same edge in a strip
+			score = FORSYTH_LAST_TRIANGLE_SCORE;
+		}
+		else {
+			float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+			score = std::pow(1.0f - (cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+		}
+	}
+
+	// Boost vertices with few triangles left, so they get finished off rather than left as stragglers
+	score += FORSYTH_VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingTriangles), -FORSYTH_VALENCE_BOOST_POWER);
+
+	return score;
+}
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+	VertexCacheStats stats;
+	if (indexCount == 0) {
+		return stats;
+	}
+
+	// Timestamp each vertex was last added to the cache, it's still cached if it was added within the last cacheSize misses
+	std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+	uint32_t timestamp = cacheSize + 1;
+	size_t misses = 0;
+	size_t uniqueVertices = 0;
+	std::vector<bool> seen(vertexCount, false);
+
+	for (size_t i = 0; i < indexCount; i++) {
+		uint32_t index = indices[i];
+		if (timestamp - cacheTimestamps[index] > cacheSize) {
+			cacheTimestamps[index] = timestamp++;
+			misses++;
+		}
+		if (!seen[index]) {
+			seen[index] = true;
+			uniqueVertices++;
+		}
+	}
+
+	stats.acmr = static_cast<float>(misses) / (indexCount / 3);
+	stats.atvr = static_cast<float>(misses) / uniqueVertices;
+
+	return stats;
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+
+	// -- Triangles around each vertex (compressed rows), the first remainingTriangles entries of each row are still to draw
+	std::vector<uint32_t> remainingTriangles(vertexCount, 0);
+	for (size_t i = 0; i < indexCount; i++) {
+		remainingTriangles[indices[i]]++;
+	}
+
+	std::vector<uint32_t> triangleOffsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++) {
+		triangleOffsets[v + 1] = triangleOffsets[v] + remainingTriangles[v];
+	}
+
+	std::vector<uint32_t> triangleList(indexCount);
+	std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+	for (size_t i = 0; i < indexCount; i++) {
+		triangleList[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	// -- Initial scores, nothing is in the cache yet
+	std::vector<int> cachePositions(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++) {
+		vertexScores[v] = forsythVertexScore(-1, remainingTriangles[v]);
+	}
+
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> output;
+	output.reserve(indexCount);
+
+	// Cache holds up to FORSYTH_CACHE_SIZE vertices, plus room for the 3 pushed in before the overflow is dropped
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> newCache;
+	cache.reserve(FORSYTH_CACHE_SIZE + 3);
+	newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+	size_t inputCursor = 0;
+	int64_t bestTriangle = -1;
+
+	for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+		// No cached vertex has triangles left, so start again from the next triangle not yet drawn
+		if (bestTriangle < 0) {
+			while (emitted[inputCursor]) {
+				inputCursor++;
+			}
+			bestTriangle = static_cast<int64_t>(inputCursor);
+		}
+
+		// -- Emit the triangle and remove it from its vertices' rows
+		uint32_t triangle = static_cast<uint32_t>(bestTriangle);
+		emitted[triangle] = true;
+
+		for (int i = 0; i < 3; i++) {
+			uint32_t vertex = indices[triangle * 3 + i];
+			output.push_back(vertex);
+
+			uint32_t* row = &triangleList[triangleOffsets[vertex]];
+			uint32_t count = remainingTriangles[vertex];
+			for (uint32_t j = 0; j < count; j++) {
+				if (row[j] == triangle) {
+					row[j] = row[count - 1];
+					row[count - 1] = triangle;
+					break;
+				}
+			}
+			remainingTriangles[vertex]--;
+		}
+
+		// -- Move the triangle's vertices to the front of the cache, the rest shift back
+		newCache.clear();
+		for (int i = 0; i < 3; i++) {
+			newCache.push_back(indices[triangle * 3 + i]);
+		}
+		for (uint32_t vertex : cache) {
+			if (vertex != newCache[0] && vertex != newCache[1] && vertex != newCache[2]) {
+				newCache.push_back(vertex);
+			}
+		}
+
+		// Anything past the end has been evicted
+		for (size_t i = FORSYTH_CACHE_SIZE; i < newCache.size(); i++) {
+			uint32_t vertex = newCache[i];
+			cachePositions[vertex] = -1;
+			vertexScores[vertex] = forsythVertexScore(-1, remainingTriangles[vertex]);
+		}
+		if (newCache.size() > FORSYTH_CACHE_SIZE) {
+			newCache.resize(FORSYTH_CACHE_SIZE);
+		}
+		cache.swap(newCache);
+
+		// -- Rescore the cached vertices and their triangles, the best of those is drawn next
+		for (size_t i = 0; i < cache.size(); i++) {
+			uint32_t vertex = cache[i];
+			cachePositions[vertex] = static_cast<int>(i);
+			vertexScores[vertex] = forsythVertexScore(static_cast<int>(i), remainingTriangles[vertex]);
+		}
+
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (uint32_t vertex : cache) {
+			const uint32_t* row = &triangleList[triangleOffsets[vertex]];
+			for (uint32_t j = 0; j < remainingTriangles[vertex]; j++) {
+				uint32_t t = row[j];
+				float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+				if (score > bestScore) {
+					bestScore = score;
+					bestTriangle = t;
+				}
+			}
+		}
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const std::vector<Vertex>& vertices)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2) {
+		return;
+	}
+
+	// -- Split into clusters where the cache order had to restart (all three vertices missed), reordering whole clusters
+	// leaves almost all of the cache reuse in place
+	std::vector<size_t> clusterStarts;
+	std::vector<uint32_t> cacheTimestamps(vertices.size(), 0);
+	uint32_t timestamp = VERTEX_CACHE_ANALYSIS_SIZE + 1;
+
+	for (size_t t = 0; t < triangleCount; t++) {
+		int misses = 0;
+		for (int i = 0; i < 3; i++) {
+			uint32_t index = indices[t * 3 + i];
+			if (timestamp - cacheTimestamps[index] > VERTEX_CACHE_ANALYSIS_SIZE) {
+				cacheTimestamps[index] = timestamp++;
+				misses++;
+			}
+		}
+		if (t == 0 || misses == 3) {
+			clusterStarts.push_back(t);
+		}
+	}
+
+	if (clusterStarts.size() < 2) {
+		return;
+	}
+
+	// -- Centre of the whole mesh, for judging which way each cluster faces
+	glm::vec3 meshCentre(0.0f);
+	float meshArea = 0.0f;
+	for (size_t t = 0; t < triangleCount; t++) {
+		glm::vec3 p0 = vertices[indices[t * 3]].pos;
+		glm::vec3 p1 = vertices[indices[t * 3 + 1]].pos;
+		glm::vec3 p2 = vertices[indices[t * 3 + 2]].pos;
+		float area = glm::length(glm::cross(p1 - p0, p2 - p0));
+		meshCentre += (p0 + p1 + p2) * (area / 3.0f);
+		meshArea += area;
+	}
+	if (meshArea <= 0.0f) {
+		return;
+	}
+	meshCentre /= meshArea;
+
+	// -- Clusters facing away from the centre are on the outside, so are likely to hide the others and should go first
+	struct Cluster {
+		size_t start;
+		size_t end;
+		float sortKey;
+	};
+	std::vector<Cluster> clusters(clusterStarts.size());
+
+	for (size_t c = 0; c < clusterStarts.size(); c++) {
+		Cluster& cluster = clusters[c];
+		cluster.start = clusterStarts[c];
+		cluster.end = c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : triangleCount;
+
+		glm::vec3 centre(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+		for (size_t t = cluster.start; t < cluster.end; t++) {
+			glm::vec3 p0 = vertices[indices[t * 3]].pos;
+			glm::vec3 p1 = vertices[indices[t * 3 + 1]].pos;
+			glm::vec3 p2 = vertices[indices[t * 3 + 2]].pos;
+			glm::vec3 triangleNormal = glm::cross(p1 - p0, p2 - p0);
+			float triangleArea = glm::length(triangleNormal);
+			centre += (p0 + p1 + p2) * (triangleArea / 3.0f);
+			normal += triangleNormal;
+			area += triangleArea;
+		}
+
+		float normalLength = glm::length(normal);
+		cluster.sortKey = (area > 0.0f && normalLength > 0.0f)
+			? glm::dot(centre / area - meshCentre, normal / normalLength)
+			: 0.0f;
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+	std::vector<uint32_t> output;
+	output.reserve(indexCount);
+	for (const Cluster& cluster : clusters) {
+		output.insert(output.end(), indices + cluster.start * 3, indices + cluster.end * 3);
+	}
+	std::copy(output.begin(), output.end(), indices);
+}
+
+size_t optimizeVertexFetch(std::vector<Vertex>* vertices, std::vector<uint32_t>* indices)
+{
+	const uint32_t unused = 0xFFFFFFFF;
+	std::vector<uint32_t> remap(vertices->size(), unused);
+	std::vector<Vertex> newVertices;
+	newVertices.reserve(vertices->size());
+
+	// New position of each vertex is the order it's first referenced in
+	for (uint32_t& index : *indices) {
+		if (remap[index] == unused) {
+			remap[index] = static_cast<uint32_t>(newVertices.size());
+			newVertices.push_back((*vertices)[index]);
+		}
+		index = remap[index];
+	}
+
+	vertices->swap(newVertices);
+
+	return vertices->size();
+}
+
+MeshOptimizationReport optimizeMesh(std::vector<Vertex>* vertices, std::vector<uint32_t>* indices,
+	const std::vector<MeshLod>& lods, bool reorderForOverdraw)
+{
+	MeshOptimizationReport report;
+	report.verticesBefore = vertices->size();
+
+	// Levels are separate draws, so each is ordered on its own
+	for (const MeshLod& lod : lods) {
+		uint32_t* lodIndices = indices->data() + lod.firstIndex;
+
+		if (&lod == &lods.front()) {
+			report.before = analyzeVertexCache(lodIndices, lod.indexCount, vertices->size());
+		}
+
+		optimizeVertexCache(lodIndices, lod.indexCount, vertices->size());
+		if (reorderForOverdraw) {
+			optimizeOverdraw(lodIndices, lod.indexCount, *vertices);
+		}
+	}
+
+	// Fetch order comes last as it renumbers the vertices, and across all levels as they share the vertex buffer
+	// (the full detail level comes first in the indices, so it's the one laid out in order)
+	report.verticesAfter = optimizeVertexFetch(vertices, indices);
+
+	if (!lods.empty()) {
+		report.after = analyzeVertexCache(indices->data() + lods[0].firstIndex, lods[0].indexCount, vertices->size());
+	}
+
+	return report;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+
+#include "Utilities.h"
+#include "MeshSimplifier.h"
+
+// How well an index order reuses the GPU's post-transform vertex cache, simulated on the CPU
+struct VertexCacheStats {
+	float acmr = 0.0f; // Average cache miss ratio, vertex shader invocations per triangle (0.5 is ideal on a large regular mesh, 3 is worst)
+	float atvr = 0.0f; // Average transform to vertex ratio, vertex shader invocations per unique vertex (1 is ideal)
+};
+
+struct MeshOptimizationReport {
+	VertexCacheStats before;
+	VertexCacheStats after;
+	size_t verticesBefore = 0;
+	size_t verticesAfter = 0;
+};
+
+// Size of the FIFO cache used when analysing, small enough to be pessimistic for current GPUs
+const uint32_t VERTEX_CACHE_ANALYSIS_SIZE = 16;
+
+// Simulates a FIFO post-transform cache over the triangles
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+	uint32_t cacheSize = VERTEX_CACHE_ANALYSIS_SIZE);
+
+// Reorders triangles so consecutive triangles share vertices while they're still cached (Forsyth's linear-speed algorithm)
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+// Reorders clusters of triangles so the outward facing ones (that tend to occlude the rest) are drawn first.
+// Clusters are runs of the cache optimised order, so the vertex cache efficiency is mostly kept
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const std::vector<Vertex>& vertices);
+
+// Reorders vertices in the order the indices first use them, so vertex fetches walk memory forwards, and drops unused
+// vertices. Returns the new vertex count
+size_t optimizeVertexFetch(std::vector<Vertex>* vertices, std::vector<uint32_t>* indices);
+
+// Runs the whole import time optimisation on a mesh and its levels of detail: cache and (optionally) overdraw order within
+// each level, then fetch order across the shared vertex buffer. Reports the full detail level before and after
+MeshOptimizationReport optimizeMesh(std::vector<Vertex>* vertices, std::vector<uint32_t>* indices,
+	const std::vector<MeshLod>& lods, bool reorderForOverdraw = true);
@@ -0,0 +1,317 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+
+// Symmetric 4x4 matrix storing the sum of squared distances to a set of planes
+struct Quadric {
+	double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+	double a11 = 0, a12 = 0, a13 = 0;
+	double a22 = 0, a23 = 0;
+	double a33 = 0;
+	double weight = 0;
+
+	void addPlane(glm::dvec3 normal, double d, double weight)
+	{
+		a00 += weight * normal.x * normal.x; a01 += weight * normal.x * normal.y; a02 += weight * normal.x * normal.z; a03 += weight * normal.x * d;
+		a11 += weight * normal.y * normal.y; a12 += weight * normal.y * normal.z; a13 += weight * normal.y * d;
+		a22 += weight * normal.z * normal.z; a23 += weight * normal.z * d;
+		a33 += weight * d * d;
+		this->weight += weight;
+	}
+
+	void add(const Quadric& other)
+	{
+		a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+		a11 += other.a11; a12 += other.a12; a13 += other.a13;
+		a22 += other.a22; a23 += other.a23;
+		a33 += other.a33;
+		weight += other.weight;
+	}
+
+	// Weighted mean of squared distances from point to the planes
+	double error(glm::dvec3 p) const
+	{
+		if (weight <= 0.0) {
+			return 0.0;
+		}
+
+		double result = a00 * p.x * p.x + 2.0 * a01 * p.x * p.y + 2.0 * a02 * p.x * p.z + 2.0 * a03 * p.x
+			+ a11 * p.y * p.y + 2.0 * a12 * p.y * p.z + 2.0 * a13 * p.y
+			+ a22 * p.z * p.z + 2.0 * a23 * p.z
+			+ a33;
+		return std::max(result / weight, 0.0);
+	}
+};
+
+struct Collapse {
+	uint32_t from;
+	uint32_t to;
+	double cost;
+};
+
+// True if moving vertex "from" onto "to" would flip or flatten any triangle that survives the collapse
+static bool collapseFlips(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	const std::vector<uint32_t>& triangleOffsets, const std::vector<uint32_t>& triangleList, uint32_t from, uint32_t to)
+{
+	for (uint32_t t = triangleOffsets[from]; t < triangleOffsets[from + 1]; t++) {
+		const uint32_t* triangle = &indices[triangleList[t] * 3];
+
+		// Triangles containing both vertices become degenerate and are removed anyway
+		if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+			continue;
+		}
+
+		glm::vec3 before[3];
+		glm::vec3 after[3];
+		for (int i = 0; i < 3; i++) {
+			before[i] = vertices[triangle[i]].pos;
+			after[i] = triangle[i] == from ? vertices[to].pos : before[i];
+		}
+
+		glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+		glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+
+		// Allow a little rotation but not facing away (or collapsing to a sliver)
+		if (glm::dot(normalBefore, normalAfter) <= 0.25f * glm::length(normalBefore) * glm::length(normalAfter)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	size_t targetIndexCount, float maxError, float* resultError)
+{
+	size_t vertexCount = vertices.size();
+	std::vector<uint32_t> result = indices;
+	double worstError = 0.0;
+	double maxErrorSquared = static_cast<double>(maxError) * maxError;
+
+	// -- Lock vertices that can't move without opening holes
+	std::vector<bool> locked(vertexCount, false);
+
+	// Seams: separate vertices at the same position (eg different UVs), moving one would tear it from the other
+	std::unordered_map<uint64_t, uint32_t> positionCounts;
+	auto positionKey = [&](uint32_t vertex) {
+		const glm::vec3& pos = vertices[vertex].pos;
+		// Quantise so positions that are equal up to float noise match
+		uint64_t x = static_cast<uint64_t>(static_cast<int64_t>(std::floor(pos.x * 100000.0f)) & 0x1FFFFF);
+		uint64_t y = static_cast<uint64_t>(static_cast<int64_t>(std::floor(pos.y * 100000.0f)) & 0x1FFFFF);
+		uint64_t z = static_cast<uint64_t>(static_cast<int64_t>(std::floor(pos.z * 100000.0f)) & 0x1FFFFF);
+		return (x << 42) | (y << 21) | z;
+	};
+	for (uint32_t v = 0; v < vertexCount; v++) {
+		positionCounts[positionKey(v)]++;
+	}
+	for (uint32_t v = 0; v < vertexCount; v++) {
+		locked[v] = positionCounts[positionKey(v)] > 1;
+	}
+
+	// Borders: edges used by only one triangle
+	std::unordered_map<uint64_t, uint32_t> edgeCounts;
+	for (size_t i = 0; i < result.size(); i += 3) {
+		for (int e = 0; e < 3; e++) {
+			uint32_t a = result[i + e];
+			uint32_t b = result[i + (e + 1) % 3];
+			edgeCounts[(static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b)]++;
+		}
+	}
+	for (const auto& edge : edgeCounts) {
+		if (edge.second == 1) {
+			locked[edge.first >> 32] = true;
+			locked[edge.first & 0xFFFFFFFF] = true;
+		}
+	}
+
+	// -- Quadric for each vertex from the planes of the triangles around it, weighted by area
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t i = 0; i < result.size(); i += 3) {
+		glm::dvec3 p0 = vertices[result[i]].pos;
+		glm::dvec3 p1 = vertices[result[i + 1]].pos;
+		glm::dvec3 p2 = vertices[result[i + 2]].pos;
+
+		glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+		double area = glm::length(normal);
+		if (area <= 0.0) {
+			continue;
+		}
+		normal /= area;
+
+		Quadric quadric;
+		quadric.addPlane(normal, -glm::dot(normal, p0), area * 0.5);
+		quadrics[result[i]].add(quadric);
+		quadrics[result[i + 1]].add(quadric);
+		quadrics[result[i + 2]].add(quadric);
+	}
+
+	std::vector<uint32_t> collapseTo(vertexCount);
+	std::vector<bool> touched(vertexCount);
+	std::vector<uint32_t> triangleOffsets(vertexCount + 1);
+	std::vector<uint32_t> triangleList;
+	std::vector<Collapse> collapses;
+
+	// -- Collapse in passes, each pass picking the cheapest collapses that don't interfere with each other
+	while (result.size() > targetIndexCount) {
+		size_t triangleCount = result.size() / 3;
+
+		// Triangles around each vertex (compressed rows, offsets then list)
+		std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+		for (uint32_t index : result) {
+			triangleOffsets[index + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++) {
+			triangleOffsets[v + 1] += triangleOffsets[v];
+		}
+		triangleList.resize(result.size());
+		std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+		for (size_t i = 0; i < result.size(); i++) {
+			triangleList[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		// Every edge can collapse either way (unless the moving vertex is locked)
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3) {
+			for (int e = 0; e < 3; e++) {
+				uint32_t a = result[i + e];
+				uint32_t b = result[i + (e + 1) % 3];
+
+				Quadric combined = quadrics[a];
+				combined.add(quadrics[b]);
+
+				if (!locked[a]) {
+					collapses.push_back({ a, b, combined.error(glm::dvec3(vertices[b].pos)) });
+				}
+				if (!locked[b]) {
+					collapses.push_back({ b, a, combined.error(glm::dvec3(vertices[a].pos)) });
+				}
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+		// Each collapse removes about 2 triangles
+		size_t collapsesWanted = std::max<size_t>(1, (triangleCount - targetIndexCount / 3) / 2);
+		size_t collapsesApplied = 0;
+
+		for (size_t v = 0; v < vertexCount; v++) {
+			collapseTo[v] = static_cast<uint32_t>(v);
+		}
+		std::fill(touched.begin(), touched.end(), false);
+
+		for (const Collapse& collapse : collapses) {
+			if (collapse.cost > maxErrorSquared || collapsesApplied >= collapsesWanted) {
+				break;
+			}
+			if (touched[collapse.from] || touched[collapse.to]) {
+				continue;
+			}
+			if (collapseFlips(vertices, result, triangleOffsets, triangleList, collapse.from, collapse.to)) {
+				continue;
+			}
+
+			collapseTo[collapse.from] = collapse.to;
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			worstError = std::max(worstError, collapse.cost);
+			collapsesApplied++;
+
+			// Anything sharing a triangle with the moved vertex has stale flip checks this pass
+			for (uint32_t t = triangleOffsets[collapse.from]; t < triangleOffsets[collapse.from + 1]; t++) {
+				const uint32_t* triangle = &result[triangleList[t] * 3];
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+			}
+		}
+
+		if (collapsesApplied == 0) {
+			break;
+		}
+
+		// Rewrite triangles with the collapses applied, dropping ones that became degenerate
+		size_t writeIndex = 0;
+		for (size_t i = 0; i < result.size(); i += 3) {
+			uint32_t a = collapseTo[result[i]];
+			uint32_t b = collapseTo[result[i + 1]];
+			uint32_t c = collapseTo[result[i + 2]];
+			if (a != b && b != c && a != c) {
+				result[writeIndex++] = a;
+				result[writeIndex++] = b;
+				result[writeIndex++] = c;
+			}
+		}
+		result.resize(writeIndex);
+	}
+
+	if (resultError) {
+		*resultError = static_cast<float>(std::sqrt(worstError));
+	}
+
+	return result;
+}
+
+std::vector<MeshLod> generateLodChain(const std::vector<Vertex>& vertices, std::vector<uint32_t>* indices, LodSettings settings)
+{
+	std::vector<MeshLod> lods(1);
+	lods[0].firstIndex = 0;
+	lods[0].indexCount = static_cast<uint32_t>(indices->size());
+
+	glm::vec3 centre;
+	float radius;
+	computeBoundingSphere(vertices, &centre, &radius);
+	if (radius <= 0.0f) {
+		return lods;
+	}
+
+	// Each level is simplified from the one before, which is quicker and keeps the levels consistent with each other
+	std::vector<uint32_t> current = *indices;
+	float accumulatedError = 0.0f;
+
+	for (uint32_t level = 1; level < settings.maxLods; level++) {
+		size_t target = static_cast<size_t>(current.size() / 3 * settings.reduction) * 3;
+		float levelError = 0.0f;
+		std::vector<uint32_t> simplified = simplifyMesh(vertices, current, target, settings.maxError * radius, &levelError);
+
+		// Not worth another index range (and draw) if the mesh barely got simpler
+		if (simplified.empty() || simplified.size() > current.size() * 9 / 10) {
+			break;
+		}
+
+		accumulatedError += levelError / radius;
+
+		MeshLod lod;
+		lod.firstIndex = static_cast<uint32_t>(indices->size());
+		lod.indexCount = static_cast<uint32_t>(simplified.size());
+		lod.error = accumulatedError;
+		lods.push_back(lod);
+
+		indices->insert(indices->end(), simplified.begin(), simplified.end());
+		current.swap(simplified);
+	}
+
+	return lods;
+}
+
+void computeBoundingSphere(const std::vector<Vertex>& vertices, glm::vec3* centre, float* radius)
+{
+	if (vertices.empty()) {
+		*centre = glm::vec3(0.0f);
+		*radius = 0.0f;
+		return;
+	}
+
+	// Centre of the bounding box, then the furthest vertex from it (not minimal, but close and cheap)
+	glm::vec3 minimum = vertices[0].pos;
+	glm::vec3 maximum = vertices[0].pos;
+	for (const Vertex& vertex : vertices) {
+		minimum = glm::min(minimum, vertex.pos);
+		maximum = glm::max(maximum, vertex.pos);
+	}
+	*centre = (minimum + maximum) * 0.5f;
+
+	float radiusSquared = 0.0f;
+	for (const Vertex& vertex : vertices) {
+		glm::vec3 offset = vertex.pos - *centre;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+	*radius = std::sqrt(radiusSquared);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+#include "Utilities.h"
+
+// A range of a mesh's index buffer holding one level of detail, all levels share the mesh's vertex buffer
+struct MeshLod {
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+	float error = 0.0f; // Approximate deviation from the full detail mesh, relative to the mesh's bounding radius
+};
+
+struct LodSettings {
+	uint32_t maxLods = 4; // Including the full detail level
+	float reduction = 0.5f; // Fraction of triangles each level keeps from the one before
+	float maxError = 0.05f; // Largest deviation allowed, relative to the mesh's bounding radius
+};
+
+// Reduces the triangle count towards targetIndexCount by collapsing edges onto existing vertices, picking the collapses
+// with the lowest quadric error first. Only existing vertices are used so the result can share the original vertex buffer.
+// Border and seam vertices (shared positions, eg UV seams) are never moved so the mesh doesn't crack or tear.
+// maxError is absolute (in the mesh's units), the largest error actually introduced is written to resultError
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	size_t targetIndexCount, float maxError, float* resultError);
+
+// Appends successively simplified copies of the indices to the end of indices, returning the range of each level
+// (level 0 being the original indices). Stops early once simplifying stops making progress
+std::vector<MeshLod> generateLodChain(const std::vector<Vertex>& vertices, std::vector<uint32_t>* indices,
+	LodSettings settings = LodSettings());
+
+// Centre and radius of a sphere enclosing all the vertices
+void computeBoundingSphere(const std::vector<Vertex>& vertices, glm::vec3* centre, float* radius);
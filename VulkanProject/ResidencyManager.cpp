@@ -0,0 +1,287 @@
+#include "ResidencyManager.h"
+
+#include <algorithm>
+
+#include "DeviceMemory.h"
+
+// Share of a heap's size used as its budget when the driver can't say (leaving room for other processes and the driver)
+const float RESIDENCY_FALLBACK_BUDGET = 0.8f;
+
+ResidencyManager::ResidencyManager()
+{
+}
+
+void ResidencyManager::create(VkPhysicalDevice newPhysicalDevice, MemoryBlockAllocator* newAllocator, bool newMemoryBudgetExtension, VkDeviceSize newBudgetOverride)
+{
+	this->physicalDevice = newPhysicalDevice;
+	this->allocator = newAllocator;
+	this->memoryBudgetExtension = newMemoryBudgetExtension;
+	this->budgetOverride = newBudgetOverride;
+
+	vkGetPhysicalDeviceMemoryProperties(this->physicalDevice, &this->memoryProperties);
+	this->heaps.resize(this->memoryProperties.memoryHeapCount);
+	for (uint32_t i = 0; i < this->memoryProperties.memoryHeapCount; i++) {
+		this->heaps[i].size = this->memoryProperties.memoryHeaps[i].size;
+	}
+
+	this->beginFrame(0);
+}
+
+uint32_t ResidencyManager::getHeapIndex(uint32_t memoryType)
+{
+	return this->memoryProperties.memoryTypes[memoryType].heapIndex;
+}
+
+uint32_t ResidencyManager::addResource(ResidentType type, uint32_t owner, VkDeviceSize bytes, uint32_t memoryType, bool pinned, uint32_t part)
+{
+	ResidentResource resource = {};
+	resource.type = type;
+	resource.owner = owner;
+	resource.part = part;
+	resource.bytes = bytes;
+	resource.memoryType = memoryType;
+	resource.heapIndex = this->getHeapIndex(memoryType);
+	resource.resident = true;
+	resource.pinned = pinned;
+	resource.lastUsedFrame = this->currentFrame + 1;
+	resource.importance = 0.0f;
+
+	if (!this->freeIds.empty()) {
+		uint32_t id = this->freeIds.back();
+		this->freeIds.pop_back();
+		this->resources[id] = resource;
+		return id;
+	}
+
+	this->resources.push_back(resource);
+	return static_cast<uint32_t>(this->resources.size() - 1);
+}
+
+void ResidencyManager::removeResource(uint32_t id)
+{
+	// Not resident and no size, so it's never evicted or counted until it's reused
+	this->resources[id].resident = false;
+	this->resources[id].bytes = 0;
+	this->freeIds.push_back(id);
+}
+
+void ResidencyManager::setResident(uint32_t id, bool resident)
+{
+	this->resources[id].resident = resident;
+
+	// Uploads are waited on by the next frame submitted, which is the next frame if this is between frames, so they count
+	// as used by it and can't be evicted before it has finished
+	if (resident) {
+		this->resources[id].lastUsedFrame = this->currentFrame + 1;
+	}
+}
+
+void ResidencyManager::setSize(uint32_t id, VkDeviceSize bytes, uint32_t memoryType)
+{
+	this->resources[id].bytes = bytes;
+	this->resources[id].memoryType = memoryType;
+	this->resources[id].heapIndex = this->getHeapIndex(memoryType);
+}
+
+bool ResidencyManager::isResident(uint32_t id)
+{
+	return this->resources[id].resident;
+}
+
+const ResidentResource& ResidencyManager::getResource(uint32_t id)
+{
+	return this->resources[id];
+}
+
+void ResidencyManager::beginFrame(uint64_t frame)
+{
+	this->currentFrame = frame;
+	this->trackedAtRefresh = this->getTrackedHeapBytes();
+
+	if (this->memoryBudgetExtension) {
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+		budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+		VkPhysicalDeviceMemoryProperties2 properties = {};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		properties.pNext = &budgetProperties;
+		vkGetPhysicalDeviceMemoryProperties2(this->physicalDevice, &properties);
+
+		// The driver counts the blocks whole, their free space is room for more rather than usage
+		std::vector<VkDeviceSize> blockFree = this->getBlockFreeBytes();
+		for (size_t i = 0; i < this->heaps.size(); i++) {
+			this->heaps[i].budget = budgetProperties.heapBudget[i];
+			this->heaps[i].usage = budgetProperties.heapUsage[i] - std::min(budgetProperties.heapUsage[i], blockFree[i]);
+		}
+	}
+	else {
+		for (size_t i = 0; i < this->heaps.size(); i++) {
+			this->heaps[i].budget = static_cast<VkDeviceSize>(this->heaps[i].size * RESIDENCY_FALLBACK_BUDGET);
+			this->heaps[i].usage = this->trackedAtRefresh[i];
+		}
+	}
+
+	if (this->budgetOverride > 0) {
+		for (size_t i = 0; i < this->heaps.size(); i++) {
+			if (this->memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+				this->heaps[i].budget = std::min(this->heaps[i].budget, this->budgetOverride);
+			}
+		}
+	}
+}
+
+void ResidencyManager::markUsed(uint32_t id, float importance)
+{
+	ResidentResource& resource = this->resources[id];
+
+	// Importance is from the most recent frame only, so something that was once close up doesn't stay important
+	if (resource.lastUsedFrame != this->currentFrame) {
+		resource.importance = importance;
+	}
+	else {
+		resource.importance = std::max(resource.importance, importance);
+	}
+	resource.lastUsedFrame = this->currentFrame;
+}
+
+bool ResidencyManager::hasRoom(uint32_t memoryType, VkDeviceSize bytes)
+{
+	uint32_t heapIndex = this->getHeapIndex(memoryType);
+	std::vector<VkDeviceSize> tracked = this->getTrackedHeapBytes();
+	VkDeviceSize usage = this->getHeapUsage(heapIndex, tracked);
+	if (usage + bytes > this->heaps[heapIndex].budget) {
+		return false;
+	}
+
+	// Free space in the blocks already allocated is used first, and takes no more device memory
+	if (this->allocator->fitsInBlocks(memoryType, bytes)) {
+		return true;
+	}
+
+	// Otherwise a new block is allocated, all of which is device memory in use until more is put in it
+	VkDeviceSize blockSize = bytes > MEMORY_BLOCK_SIZE / 2 ? bytes : MEMORY_BLOCK_SIZE;
+	return usage + this->getBlockFreeBytes()[heapIndex] + blockSize <= this->heaps[heapIndex].budget;
+}
+
+std::vector<uint32_t> ResidencyManager::chooseEvictions(uint64_t lastCompletedFrame, const std::vector<VkDeviceSize>& required)
+{
+	std::vector<uint32_t> evictions;
+
+	// -- How far over budget each heap is
+	std::vector<VkDeviceSize> tracked = this->getTrackedHeapBytes();
+	std::vector<VkDeviceSize> excess(this->heaps.size(), 0);
+	bool overBudget = false;
+	for (uint32_t i = 0; i < this->heaps.size(); i++) {
+		VkDeviceSize usage = this->getHeapUsage(i, tracked) + (i < required.size() ? required[i] : 0);
+		if (usage > this->heaps[i].budget) {
+			excess[i] = usage - this->heaps[i].budget;
+			overBudget = true;
+		}
+	}
+
+	if (!overBudget) {
+		return evictions;
+	}
+
+	// -- Least recently used first, and of those used in the same frame, the smallest on screen first
+	std::vector<uint32_t> candidates;
+	for (uint32_t i = 0; i < this->resources.size(); i++) {
+		const ResidentResource& resource = this->resources[i];
+		if (resource.resident && !resource.pinned && excess[resource.heapIndex] > 0 && resource.lastUsedFrame <= lastCompletedFrame) {
+			candidates.push_back(i);
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b) {
+		const ResidentResource& first = this->resources[a];
+		const ResidentResource& second = this->resources[b];
+		if (first.lastUsedFrame != second.lastUsedFrame) {
+			return first.lastUsedFrame < second.lastUsedFrame;
+		}
+		return first.importance < second.importance;
+	});
+
+	for (uint32_t candidate : candidates) {
+		const ResidentResource& resource = this->resources[candidate];
+		if (excess[resource.heapIndex] == 0) {
+			continue;
+		}
+
+		evictions.push_back(candidate);
+		excess[resource.heapIndex] -= std::min(excess[resource.heapIndex], resource.bytes);
+	}
+
+	return evictions;
+}
+
+std::vector<HeapBudget> ResidencyManager::getHeapBudgets()
+{
+	std::vector<VkDeviceSize> tracked = this->getTrackedHeapBytes();
+	std::vector<HeapBudget> budgets = this->heaps;
+	for (uint32_t i = 0; i < budgets.size(); i++) {
+		budgets[i].usage = this->getHeapUsage(i, tracked);
+	}
+
+	return budgets;
+}
+
+VkDeviceSize ResidencyManager::getResidentBytes()
+{
+	VkDeviceSize bytes = 0;
+	for (const ResidentResource& resource : this->resources) {
+		if (resource.resident) {
+			bytes += resource.bytes;
+		}
+	}
+
+	return bytes;
+}
+
+VkDeviceSize ResidencyManager::getEvictedBytes()
+{
+	VkDeviceSize bytes = 0;
+	for (const ResidentResource& resource : this->resources) {
+		if (!resource.resident) {
+			bytes += resource.bytes;
+		}
+	}
+
+	return bytes;
+}
+
+std::vector<VkDeviceSize> ResidencyManager::getTrackedHeapBytes()
+{
+	DeviceMemoryStats stats = getDeviceMemoryStats();
+
+	// Blocks count by what's been given out of them, anything else allocated counts whole
+	std::vector<VkDeviceSize> tracked(this->heaps.size(), 0);
+	for (uint32_t i = 0; i < this->memoryProperties.memoryTypeCount; i++) {
+		MemoryTypeUsage usage = this->allocator->getTypeUsage(i);
+		tracked[this->memoryProperties.memoryTypes[i].heapIndex] += stats.typeBytes[i] - usage.blockBytes + usage.usedBytes;
+	}
+
+	return tracked;
+}
+
+std::vector<VkDeviceSize> ResidencyManager::getBlockFreeBytes()
+{
+	std::vector<VkDeviceSize> blockFree(this->heaps.size(), 0);
+	for (uint32_t i = 0; i < this->memoryProperties.memoryTypeCount; i++) {
+		MemoryTypeUsage usage = this->allocator->getTypeUsage(i);
+		blockFree[this->memoryProperties.memoryTypes[i].heapIndex] += usage.blockBytes - usage.usedBytes;
+	}
+
+	return blockFree;
+}
+
+VkDeviceSize ResidencyManager::getHeapUsage(uint32_t heapIndex, const std::vector<VkDeviceSize>& tracked)
+{
+	// The driver's figure from the start of the frame, adjusted by what this renderer has allocated or freed since
+	VkDeviceSize usage = this->heaps[heapIndex].usage + tracked[heapIndex];
+	VkDeviceSize freed = this->trackedAtRefresh[heapIndex];
+	return usage > freed ? usage - freed : 0;
+}
+
+ResidencyManager::~ResidencyManager()
+{
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "MemoryBlockAllocator.h"
+
+enum class ResidentType {
+	Texture,
+	Mesh
+};
+
+// Something whose device memory can be freed while it isn't being drawn and loaded back when it is
+struct ResidentResource {
+	ResidentType type;
+	uint32_t owner; // Texture id or geometry asset id, so the renderer knows what to evict
+	uint32_t part; // Mesh within the geometry asset (0 for textures)
+	VkDeviceSize bytes; // Device memory used while resident
+	uint32_t memoryType;
+	uint32_t heapIndex;
+	bool resident;
+	bool pinned; // Never evicted (eg the default texture)
+	uint64_t lastUsedFrame;
+	float importance; // Largest fraction of the screen height it covered in its last used frame
+};
+
+// Budget and usage of one memory heap, in bytes
+struct HeapBudget {
+	VkDeviceSize size = 0;
+	VkDeviceSize budget = 0; // What the driver says this process can use (VK_EXT_memory_budget), otherwise a fraction of size
+	VkDeviceSize usage = 0; // Memory in use, counting the renderer's blocks by what's been given out of them
+};
+
+// Book keeping for keeping textures and meshes within each heap's memory budget. It doesn't own any Vulkan objects, the
+// renderer tells it what it loads and uses each frame, and asks it what to evict. Memory in the block allocator's blocks
+// counts by the bytes given out of them, so evicting something makes room even while its block stays allocated
+class ResidencyManager
+{
+public:
+	ResidencyManager();
+
+	// budgetOverride caps the budget of every device local heap (0 for no cap), to test eviction on machines with memory to
+	// spare. Without memoryBudgetExtension budgets come from heap sizes and usage from allocateDeviceMemory's totals.
+	// The allocator is the renderer's, whose blocks the resources are placed in
+	void create(VkPhysicalDevice newPhysicalDevice, MemoryBlockAllocator* newAllocator, bool newMemoryBudgetExtension, VkDeviceSize newBudgetOverride);
+
+	// Heap a memory type allocates from
+	uint32_t getHeapIndex(uint32_t memoryType);
+
+	// Tracks a new resource, resident (as it has just been loaded) and counting as used by the next frame. Returns its id
+	uint32_t addResource(ResidentType type, uint32_t owner, VkDeviceSize bytes, uint32_t memoryType, bool pinned, uint32_t part = 0);
+	void setResident(uint32_t id, bool resident);
+	// Stops tracking a resource (which must no longer be resident), its id is reused by the next resource added
+	void removeResource(uint32_t id);
+	// For resources whose size changes while resident (eg textures as mip levels stream in)
+	void setSize(uint32_t id, VkDeviceSize bytes, uint32_t memoryType);
+	bool isResident(uint32_t id);
+	const ResidentResource& getResource(uint32_t id);
+
+	// Refreshes heap budgets and usage, once a frame before anything is used
+	void beginFrame(uint64_t frame);
+	void markUsed(uint32_t id, float importance);
+
+	// Whether bytes more of the memory type would still be within its heap's budget. If they don't fit in the free space
+	// of the type's blocks, the whole of the new block they'd need has to be within budget too
+	bool hasRoom(uint32_t memoryType, VkDeviceSize bytes);
+
+	// Resident resources to evict to bring every heap back within budget with required[heap] bytes to spare: least recently
+	// used first, then least important. Only those last used in or before lastCompletedFrame are considered
+	std::vector<uint32_t> chooseEvictions(uint64_t lastCompletedFrame, const std::vector<VkDeviceSize>& required);
+
+	std::vector<HeapBudget> getHeapBudgets();
+	VkDeviceSize getResidentBytes();
+	VkDeviceSize getEvictedBytes();
+
+	~ResidencyManager();
+
+private:
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	MemoryBlockAllocator* allocator = nullptr;
+	bool memoryBudgetExtension = false;
+	VkDeviceSize budgetOverride = 0;
+
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	std::vector<HeapBudget> heaps;
+	std::vector<VkDeviceSize> trackedAtRefresh; // This renderer's allocations in each heap when budgets were last refreshed
+
+	std::vector<ResidentResource> resources;
+	std::vector<uint32_t> freeIds; // Removed resources' ids, to reuse
+	uint64_t currentFrame = 0;
+
+	std::vector<VkDeviceSize> getTrackedHeapBytes();
+	// Allocated for blocks but not given out of them, in each heap
+	std::vector<VkDeviceSize> getBlockFreeBytes();
+	VkDeviceSize getHeapUsage(uint32_t heapIndex, const std::vector<VkDeviceSize>& tracked);
+};
@@ -0,0 +1,175 @@
+#include "SceneGraph.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+SceneGraph::SceneGraph()
+{
+	this->firstDirty = 0;
+}
+
+uint32_t SceneGraph::addNode(uint32_t parent, const glm::mat4& localTransform)
+{
+	uint32_t node = static_cast<uint32_t>(this->parents.size());
+
+	if (parent != SCENE_NODE_NONE && parent >= node) {
+		throw std::runtime_error("Scene graph node parent must be added before its children");
+	}
+
+	this->parents.push_back(parent);
+	this->localTransforms.push_back(localTransform);
+	this->worldTransforms.push_back(glm::mat4(1.0f));
+	this->dirty.push_back(1);
+	this->firstDirty = std::min(this->firstDirty, static_cast<size_t>(node));
+
+	return node;
+}
+
+uint32_t SceneGraph::allocateNodes(uint32_t count)
+{
+	// First run of freed nodes that fits, the rest of the run stays free
+	for (size_t i = 0; i < this->freeRanges.size(); i++) {
+		if (this->freeRanges[i].second >= count) {
+			uint32_t first = this->freeRanges[i].first;
+			this->freeRanges[i].first += count;
+			this->freeRanges[i].second -= count;
+			if (this->freeRanges[i].second == 0) {
+				this->freeRanges.erase(this->freeRanges.begin() + i);
+			}
+			return first;
+		}
+	}
+
+	uint32_t first = static_cast<uint32_t>(this->parents.size());
+	for (uint32_t i = 0; i < count; i++) {
+		this->addNode(SCENE_NODE_NONE, glm::mat4(1.0f));
+	}
+
+	return first;
+}
+
+void SceneGraph::setNode(uint32_t node, uint32_t parent, const glm::mat4& localTransform)
+{
+	if (node >= this->parents.size()) {
+		throw std::runtime_error("Attempted to access invalid scene graph node");
+	}
+	if (parent != SCENE_NODE_NONE && parent >= node) {
+		throw std::runtime_error("Scene graph node parent must be added before its children");
+	}
+
+	this->parents[node] = parent;
+	this->localTransforms[node] = localTransform;
+	this->dirty[node] = 1;
+	this->firstDirty = std::min(this->firstDirty, static_cast<size_t>(node));
+}
+
+void SceneGraph::freeNodes(uint32_t first, uint32_t count)
+{
+	// Roots with identity transforms, so nothing freed depends on a node that gets reused for something else
+	for (uint32_t node = first; node < first + count; node++) {
+		this->setNode(node, SCENE_NODE_NONE, glm::mat4(1.0f));
+	}
+
+	auto position = std::lower_bound(this->freeRanges.begin(), this->freeRanges.end(), std::make_pair(first, count));
+	position = this->freeRanges.insert(position, std::make_pair(first, count));
+
+	// Merge with the runs either side if they touch
+	size_t index = position - this->freeRanges.begin();
+	if (index + 1 < this->freeRanges.size() && this->freeRanges[index].first + this->freeRanges[index].second == this->freeRanges[index + 1].first) {
+		this->freeRanges[index].second += this->freeRanges[index + 1].second;
+		this->freeRanges.erase(this->freeRanges.begin() + index + 1);
+	}
+	if (index > 0 && this->freeRanges[index - 1].first + this->freeRanges[index - 1].second == this->freeRanges[index].first) {
+		this->freeRanges[index - 1].second += this->freeRanges[index].second;
+		this->freeRanges.erase(this->freeRanges.begin() + index);
+	}
+}
+
+void SceneGraph::setLocalTransform(uint32_t node, const glm::mat4& localTransform)
+{
+	if (node >= this->parents.size()) {
+		throw std::runtime_error("Attempted to access invalid scene graph node");
+	}
+
+	this->localTransforms[node] = localTransform;
+	this->dirty[node] = 1;
+	this->firstDirty = std::min(this->firstDirty, static_cast<size_t>(node));
+}
+
+void SceneGraph::setLocalTransforms(const uint32_t* nodes, const glm::mat4* localTransforms, size_t count)
+{
+	size_t nodeCount = this->parents.size();
+	size_t lowest = this->firstDirty;
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t node = nodes[i];
+		if (node >= nodeCount) {
+			throw std::runtime_error("Attempted to access invalid scene graph node");
+		}
+
+		this->localTransforms[node] = localTransforms[i];
+		this->dirty[node] = 1;
+		lowest = std::min(lowest, static_cast<size_t>(node));
+	}
+
+	this->firstDirty = lowest;
+}
+
+const glm::mat4& SceneGraph::getLocalTransform(uint32_t node)
+{
+	return this->localTransforms[node];
+}
+
+uint32_t SceneGraph::getParent(uint32_t node)
+{
+	return this->parents[node];
+}
+
+const glm::mat4& SceneGraph::getWorldTransform(uint32_t node)
+{
+	return this->worldTransforms[node];
+}
+
+const glm::mat4* SceneGraph::getWorldTransforms()
+{
+	return this->worldTransforms.data();
+}
+
+size_t SceneGraph::getNodeCount()
+{
+	return this->parents.size();
+}
+
+size_t SceneGraph::update()
+{
+	size_t nodeCount = this->parents.size();
+	size_t updated = 0;
+
+	// Parents come first, so by the time a node is reached its parent's world transform and dirty flag are final.
+	// A dirty parent marks the child dirty, which carries the change down the whole subtree
+	for (size_t i = this->firstDirty; i < nodeCount; i++) {
+		uint32_t parent = this->parents[i];
+		if (parent != SCENE_NODE_NONE && this->dirty[parent]) {
+			this->dirty[i] = 1;
+		}
+
+		if (this->dirty[i]) {
+			this->worldTransforms[i] = parent == SCENE_NODE_NONE
+				? this->localTransforms[i]
+				: this->worldTransforms[parent] * this->localTransforms[i];
+			updated++;
+		}
+	}
+
+	// Flags are cleared afterwards, as children read their parent's flag during the pass
+	if (this->firstDirty < nodeCount) {
+		std::fill(this->dirty.begin() + this->firstDirty, this->dirty.end(), 0);
+	}
+	this->firstDirty = nodeCount;
+
+	return updated;
+}
+
+SceneGraph::~SceneGraph()
+{
+}
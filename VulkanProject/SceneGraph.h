@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+const uint32_t SCENE_NODE_NONE = 0xFFFFFFFF;
+
+// Transform hierarchy stored as flat arrays (one entry per node in each), with every parent before its children.
+// That ordering means world transforms can be brought up to date in a single forward pass, and only nodes under a
+// changed transform are recomputed
+class SceneGraph
+{
+public:
+	SceneGraph();
+
+	// Parent must already exist (or be SCENE_NODE_NONE for a root), so the arrays stay parent sorted
+	uint32_t addNode(uint32_t parent, const glm::mat4& localTransform);
+
+	// First of count consecutive nodes, reusing freed ones where a long enough run of them is free. Each has to be set
+	// with setNode, in order, so a run filled parents first stays parent sorted
+	uint32_t allocateNodes(uint32_t count);
+	void setNode(uint32_t node, uint32_t parent, const glm::mat4& localTransform);
+	// Nodes that are no longer used (and nor are any beneath them), reset to roots until they're allocated again
+	void freeNodes(uint32_t first, uint32_t count);
+
+	void setLocalTransform(uint32_t node, const glm::mat4& localTransform);
+	void setLocalTransforms(const uint32_t* nodes, const glm::mat4* localTransforms, size_t count);
+	const glm::mat4& getLocalTransform(uint32_t node);
+	uint32_t getParent(uint32_t node);
+
+	// Only valid after update() if any transforms above the node have changed
+	const glm::mat4& getWorldTransform(uint32_t node);
+	const glm::mat4* getWorldTransforms(); // All nodes, in node order
+
+	size_t getNodeCount();
+
+	// Recomputes world transforms of dirty nodes and everything beneath them, returns the number recomputed
+	size_t update();
+
+	~SceneGraph();
+
+private:
+	std::vector<uint32_t> parents;
+	std::vector<glm::mat4> localTransforms;
+	std::vector<glm::mat4> worldTransforms;
+	std::vector<uint8_t> dirty;
+
+	// Lowest dirty node, the update pass can start from here as nothing before it needs recomputing
+	size_t firstDirty;
+
+	// Runs of freed nodes as (first, count), in node order with adjacent runs merged
+	std::vector<std::pair<uint32_t, uint32_t>> freeRanges;
+};
@@ -0,0 +1,256 @@
+#include "ShaderCompiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "Utilities.h"
+
+// What an include callback hands to shaderc, freed by includeRelease
+struct IncludeData {
+	std::string name;
+	std::string content;
+	shaderc_include_result result;
+};
+
+static bool readTextFile(const std::string& path, std::string* text)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	*text = contents.str();
+	return true;
+}
+
+static std::string directoryOf(const std::string& path)
+{
+	size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+static bool fileExists(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	return file.is_open();
+}
+
+ShaderCompiler::ShaderCompiler()
+{
+}
+
+void ShaderCompiler::create(const std::string& newShaderDirectory, const std::string& newCacheDirectory)
+{
+	this->shaderDirectory = newShaderDirectory;
+	this->cacheDirectory = newCacheDirectory;
+
+	this->compiler = shaderc_compiler_initialize();
+	if (this->compiler == nullptr) {
+		throw std::runtime_error("Failed to create shader compiler");
+	}
+
+	// Fails harmlessly if it's already there. If it can't be made, shaders are still compiled, just never cached
+#ifdef _WIN32
+	_mkdir(this->cacheDirectory.c_str());
+#else
+	mkdir(this->cacheDirectory.c_str(), 0755);
+#endif
+}
+
+std::vector<char> ShaderCompiler::compile(const std::string& fileName, const std::vector<ShaderDefine>& defines)
+{
+	std::string path = this->shaderDirectory + "/" + fileName;
+
+	shaderc_shader_kind kind;
+	std::string extension = fileName.substr(fileName.find_last_of('.') + 1);
+	if (extension == "vert") kind = shaderc_vertex_shader;
+	else if (extension == "frag") kind = shaderc_fragment_shader;
+	else if (extension == "comp") kind = shaderc_compute_shader;
+	else throw std::runtime_error("Unknown shader stage (" + fileName + ")");
+
+	std::string source;
+	if (!readTextFile(path, &source)) {
+		throw std::runtime_error("Failed to open shader (" + path + ")");
+	}
+
+	// -- Cache key: the compiler settings, the defines in name order and every file that makes up the source
+	std::vector<ShaderDefine> sortedDefines = defines;
+	std::sort(sortedDefines.begin(), sortedDefines.end(), [](const ShaderDefine& a, const ShaderDefine& b) { return a.name < b.name; });
+
+	uint64_t hash = hashContent(&SHADER_CACHE_VERSION, sizeof(SHADER_CACHE_VERSION));
+	hash = hashContent(&kind, sizeof(kind), hash);
+	for (const ShaderDefine& define : sortedDefines) {
+		// Separated so "A" "BC" and "AB" "C" differ
+		std::string entry = define.name + "=" + define.value + "\n";
+		hash = hashContent(entry.data(), entry.size(), hash);
+	}
+	std::vector<std::string> visited;
+	hash = this->hashSource(path, source, hash, &visited);
+
+	char hashName[17];
+	std::snprintf(hashName, sizeof(hashName), "%016llx", static_cast<unsigned long long>(hash));
+	std::string cachePath = this->cacheDirectory + "/" + hashName + ".spv";
+
+	// -- Warm start: the same source has been compiled with the same defines before
+	std::ifstream cachedFile(cachePath, std::ios::binary | std::ios::ate);
+	if (cachedFile.is_open()) {
+		size_t size = static_cast<size_t>(cachedFile.tellg());
+		// Anything that isn't whole SPIR-V words was cut short, so it's compiled again and overwritten
+		if (size > 0 && size % sizeof(uint32_t) == 0) {
+			std::vector<char> code(size);
+			cachedFile.seekg(0);
+			cachedFile.read(code.data(), size);
+			if (cachedFile) {
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->stats.cacheHits++;
+				return code;
+			}
+		}
+	}
+	cachedFile.close();
+
+	// -- Cold start: compile it
+	auto compileStart = std::chrono::high_resolution_clock::now();
+
+	shaderc_compile_options_t options = shaderc_compile_options_initialize();
+	shaderc_compile_options_set_target_env(options, shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+	shaderc_compile_options_set_optimization_level(options, shaderc_optimization_level_performance);
+	shaderc_compile_options_set_include_callbacks(options, &ShaderCompiler::includeResolve, &ShaderCompiler::includeRelease, this);
+	for (const ShaderDefine& define : sortedDefines) {
+		shaderc_compile_options_add_macro_definition(options, define.name.c_str(), define.name.size(), define.value.c_str(), define.value.size());
+	}
+
+	shaderc_compilation_result_t result = shaderc_compile_into_spv(this->compiler, source.data(), source.size(), kind, path.c_str(), "main", options);
+	shaderc_compile_options_release(options);
+
+	if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) {
+		std::string message = shaderc_result_get_error_message(result);
+		shaderc_result_release(result);
+		throw std::runtime_error("Failed to compile shader (" + path + "):\n" + message);
+	}
+
+	std::vector<char> code(shaderc_result_get_bytes(result), shaderc_result_get_bytes(result) + shaderc_result_get_length(result));
+	shaderc_result_release(result);
+
+	// Two threads compiling the same shader write the same file, so they take turns
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->stats.compiled++;
+	this->stats.compileTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - compileStart).count();
+
+	// Written under another name and renamed, so a run that stops partway never leaves a cut short file under the real one
+	std::string tempPath = cachePath + ".tmp";
+	std::ofstream outFile(tempPath, std::ios::binary | std::ios::trunc);
+	if (outFile.is_open()) {
+		outFile.write(code.data(), code.size());
+		outFile.close();
+		std::remove(cachePath.c_str());
+		if (!outFile || std::rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+			std::remove(tempPath.c_str());
+		}
+	}
+
+	return code;
+}
+
+ShaderCompilerStats ShaderCompiler::getStats()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->stats;
+}
+
+void ShaderCompiler::destroy()
+{
+	if (this->compiler != nullptr) {
+		shaderc_compiler_release(this->compiler);
+		this->compiler = nullptr;
+	}
+}
+
+ShaderCompiler::~ShaderCompiler()
+{
+}
+
+std::string ShaderCompiler::resolveInclude(const std::string& requestedName, const std::string& requestingPath)
+{
+	std::string relativePath = directoryOf(requestingPath) + requestedName;
+	if (fileExists(relativePath)) {
+		return relativePath;
+	}
+
+	std::string shaderPath = this->shaderDirectory + "/" + requestedName;
+	if (fileExists(shaderPath)) {
+		return shaderPath;
+	}
+
+	return std::string();
+}
+
+uint64_t ShaderCompiler::hashSource(const std::string& path, const std::string& source, uint64_t hash, std::vector<std::string>* visited)
+{
+	visited->push_back(path);
+	hash = hashContent(path.data(), path.size(), hash);
+	hash = hashContent(source.data(), source.size(), hash);
+
+	// Only needs to find the files the preprocessor could include, a missing one fails the compile rather than the hash
+	std::istringstream lines(source);
+	std::string line;
+	while (std::getline(lines, line)) {
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+			continue;
+		}
+
+		size_t open = line.find('"', start + 8);
+		size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+		if (close == std::string::npos) {
+			continue;
+		}
+
+		std::string includePath = this->resolveInclude(line.substr(open + 1, close - open - 1), path);
+		std::string includeSource;
+		if (includePath.empty() || std::find(visited->begin(), visited->end(), includePath) != visited->end()
+			|| !readTextFile(includePath, &includeSource)) {
+			continue;
+		}
+		hash = this->hashSource(includePath, includeSource, hash, visited);
+	}
+
+	return hash;
+}
+
+shaderc_include_result* ShaderCompiler::includeResolve(void* userData, const char* requestedSource, int /*type*/, const char* requestingSource, size_t /*includeDepth*/)
+{
+	ShaderCompiler* shaderCompiler = static_cast<ShaderCompiler*>(userData);
+
+	IncludeData* data = new IncludeData();
+	data->name = shaderCompiler->resolveInclude(requestedSource, requestingSource);
+	// An empty name tells shaderc the include failed, with the content as the error
+	if (data->name.empty() || !readTextFile(data->name, &data->content)) {
+		data->name.clear();
+		data->content = std::string("Can't find include \"") + requestedSource + "\"";
+	}
+
+	data->result.source_name = data->name.c_str();
+	data->result.source_name_length = data->name.size();
+	data->result.content = data->content.c_str();
+	data->result.content_length = data->content.size();
+	data->result.user_data = data;
+	return &data->result;
+}
+
+void ShaderCompiler::includeRelease(void* /*userData*/, shaderc_include_result* includeResult)
+{
+	delete static_cast<IncludeData*>(includeResult->user_data);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <shaderc/shaderc.h>
+
+const uint32_t SHADER_CACHE_VERSION = 1; // Part of every cache key, bump it when the compile options change
+
+// Macro defined before the shader's source, as if by #define name value
+struct ShaderDefine {
+	std::string name;
+	std::string value;
+};
+
+struct ShaderCompilerStats {
+	uint32_t compiled = 0; // Shaders compiled from GLSL
+	uint32_t cacheHits = 0; // Shaders whose SPIR-V was read from the disk cache instead
+	double compileTime = 0.0; // Milliseconds spent compiling, cache reads not included
+};
+
+// Compiles GLSL to SPIR-V at runtime with shaderc, resolving #include "file" relative to the including file and then to
+// the shader directory. Results are kept on disk under a hash of the source, everything it includes and the defines, so
+// unchanged shaders are only compiled once. compile can be called from several threads at once, as pipelines are built on
+// worker threads
+class ShaderCompiler
+{
+public:
+	ShaderCompiler();
+
+	void create(const std::string& newShaderDirectory, const std::string& newCacheDirectory);
+
+	// SPIR-V of the file (relative to the shader directory), the stage is taken from its extension (.vert, .frag or .comp).
+	// Throws with the compiler's messages if it doesn't compile
+	std::vector<char> compile(const std::string& fileName, const std::vector<ShaderDefine>& defines);
+
+	ShaderCompilerStats getStats();
+
+	void destroy();
+
+	~ShaderCompiler();
+
+private:
+	std::string shaderDirectory;
+	std::string cacheDirectory;
+	shaderc_compiler_t compiler = nullptr; // shaderc allows compiles on several threads with one compiler
+
+	std::mutex mutex; // Guards the stats and cache file writes
+	ShaderCompilerStats stats;
+
+	// Path of an included file, empty if it can't be found
+	std::string resolveInclude(const std::string& requestedName, const std::string& requestingPath);
+	// Cache key of the source and (recursively) the files it includes, each file counted once
+	uint64_t hashSource(const std::string& path, const std::string& source, uint64_t hash, std::vector<std::string>* visited);
+
+	static shaderc_include_result* includeResolve(void* userData, const char* requestedSource, int type, const char* requestingSource, size_t includeDepth);
+	static void includeRelease(void* userData, shaderc_include_result* includeResult);
+};
@@ -0,0 +1,249 @@
+#include "ShaderPermutation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "Utilities.h"
+
+ShaderPermutation::ShaderPermutation(uint32_t newPipelineType)
+{
+	this->pipelineType = newPipelineType;
+}
+
+void ShaderPermutation::set(uint32_t constantId, uint32_t value)
+{
+	if (constantId >= SHADER_CONSTANT_COUNT) {
+		throw std::runtime_error("Unknown specialization constant");
+	}
+
+	this->values[constantId] = value;
+	this->setMask |= 1u << constantId;
+}
+
+uint32_t ShaderPermutation::get(uint32_t constantId) const
+{
+	return this->values[constantId];
+}
+
+uint32_t ShaderPermutation::getPipelineType() const
+{
+	return this->pipelineType;
+}
+
+uint64_t ShaderPermutation::getKey() const
+{
+	// Values of constants that aren't set are always 0, so hashing them all still gives equal keys for equal permutations
+	uint64_t hash = hashContent(&this->pipelineType, sizeof(this->pipelineType));
+	hash = hashContent(&this->setMask, sizeof(this->setMask), hash);
+	return hashContent(this->values.data(), sizeof(uint32_t) * this->values.size(), hash);
+}
+
+bool ShaderPermutation::operator==(const ShaderPermutation& other) const
+{
+	return this->pipelineType == other.pipelineType && this->setMask == other.setMask && this->values == other.values;
+}
+
+VkSpecializationInfo ShaderPermutation::getSpecializationInfo(std::vector<VkSpecializationMapEntry>* entries) const
+{
+	entries->clear();
+	for (uint32_t i = 0; i < SHADER_CONSTANT_COUNT; i++) {
+		if (this->setMask & (1u << i)) {
+			VkSpecializationMapEntry entry = {};
+			entry.constantID = i;
+			entry.offset = sizeof(uint32_t) * i;
+			entry.size = sizeof(uint32_t); // bools are VkBool32, so every constant is 32 bits
+			entries->push_back(entry);
+		}
+	}
+
+	VkSpecializationInfo specializationInfo = {};
+	specializationInfo.mapEntryCount = static_cast<uint32_t>(entries->size());
+	specializationInfo.pMapEntries = entries->data();
+	specializationInfo.dataSize = sizeof(uint32_t) * this->values.size();
+	specializationInfo.pData = this->values.data();
+	return specializationInfo;
+}
+
+PipelineVariantCache::PipelineVariantCache()
+{
+}
+
+void PipelineVariantCache::create(VkDevice newDevice, Builder newBuilder, uint32_t workerCount)
+{
+	this->device = newDevice;
+	this->builder = newBuilder;
+
+	this->stopping = false;
+	for (uint32_t i = 0; i < workerCount; i++) {
+		this->workers.push_back(std::thread(&PipelineVariantCache::run, this));
+	}
+}
+
+VkPipeline PipelineVariantCache::get(const ShaderPermutation& permutation)
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->stats.requests++;
+
+	Variant* variant = this->find(permutation);
+	if (variant == nullptr) {
+		// First time this permutation has been asked for
+		variant = this->add(permutation, VariantState::Building);
+		this->build(variant, lock);
+	}
+	else if (variant->state == VariantState::Queued) {
+		// Needed now, so it's built here rather than waiting its turn
+		this->queue.erase(std::find(this->queue.begin(), this->queue.end(), variant));
+		variant->state = VariantState::Building;
+		this->stats.pending--;
+		this->build(variant, lock);
+	}
+	else if (variant->state == VariantState::Building) {
+		this->variantBuilt.wait(lock, [variant]() { return variant->state != VariantState::Building; });
+	}
+
+	if (variant->state == VariantState::Failed) {
+		throw std::runtime_error(variant->error);
+	}
+	return variant->pipeline;
+}
+
+VkPipeline PipelineVariantCache::request(const ShaderPermutation& permutation)
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->stats.requests++;
+
+	Variant* variant = this->find(permutation);
+	if (variant == nullptr && this->workers.empty()) {
+		variant = this->add(permutation, VariantState::Building);
+		this->build(variant, lock);
+	}
+	else if (variant == nullptr) {
+		// First time this permutation has been asked for, it's drawn without until a worker has built it
+		variant = this->add(permutation, VariantState::Queued);
+		this->queue.push_back(variant);
+		this->stats.pending++;
+		this->requestAdded.notify_one();
+	}
+
+	if (variant->state == VariantState::Failed) {
+		throw std::runtime_error(variant->error);
+	}
+	return variant->pipeline;
+}
+
+PipelineVariantStats PipelineVariantCache::getStats()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->stats;
+}
+
+void PipelineVariantCache::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+		this->stats.pending -= static_cast<uint32_t>(this->queue.size());
+		this->queue.clear();
+
+		// Never started, so they're forgotten rather than left waiting for a worker
+		for (auto variant = this->variants.begin(); variant != this->variants.end();) {
+			if (variant->second.state == VariantState::Queued) {
+				variant = this->variants.erase(variant);
+			}
+			else {
+				++variant;
+			}
+		}
+	}
+	this->requestAdded.notify_all();
+
+	for (std::thread& worker : this->workers) {
+		worker.join();
+	}
+	this->workers.clear();
+}
+
+void PipelineVariantCache::destroy()
+{
+	this->stop();
+
+	for (auto& variant : this->variants) {
+		if (variant.second.pipeline != VK_NULL_HANDLE) {
+			vkDestroyPipeline(this->device, variant.second.pipeline, nullptr);
+		}
+	}
+	this->variants.clear();
+}
+
+PipelineVariantCache::~PipelineVariantCache()
+{
+	this->stop();
+}
+
+PipelineVariantCache::Variant* PipelineVariantCache::find(const ShaderPermutation& permutation)
+{
+	auto range = this->variants.equal_range(permutation.getKey());
+	for (auto found = range.first; found != range.second; ++found) {
+		if (found->second.permutation == permutation) {
+			return &found->second;
+		}
+	}
+	return nullptr;
+}
+
+PipelineVariantCache::Variant* PipelineVariantCache::add(const ShaderPermutation& permutation, VariantState state)
+{
+	Variant variant = { permutation, VK_NULL_HANDLE, state, std::string() };
+	auto added = this->variants.insert(std::make_pair(permutation.getKey(), variant));
+	return &added->second;
+}
+
+void PipelineVariantCache::build(Variant* variant, std::unique_lock<std::mutex>& lock)
+{
+	ShaderPermutation permutation = variant->permutation;
+	lock.unlock();
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	std::string error;
+	auto buildStart = std::chrono::high_resolution_clock::now();
+	try {
+		pipeline = this->builder(permutation);
+	}
+	catch (const std::exception& e) {
+		// Kept for the thread that asks for it next, a worker has nowhere to throw it
+		error = e.what();
+	}
+	catch (...) {
+		// Anything else thrown on a worker would end the program, and an empty error reads as built
+		error = "Unknown error building pipeline";
+	}
+	double buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count();
+
+	lock.lock();
+	variant->pipeline = pipeline;
+	variant->error = error;
+	variant->state = error.empty() ? VariantState::Built : VariantState::Failed;
+	if (error.empty()) {
+		this->stats.variants++;
+	}
+	this->stats.buildTime += buildTime;
+	this->variantBuilt.notify_all();
+}
+
+void PipelineVariantCache::run()
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	while (true) {
+		this->requestAdded.wait(lock, [this]() { return this->stopping || !this->queue.empty(); });
+		if (this->stopping) {
+			return;
+		}
+
+		Variant* variant = this->queue.front();
+		this->queue.pop_front();
+		variant->state = VariantState::Building;
+		this->build(variant, lock);
+		this->stats.pending--;
+	}
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Specialization constant ids. The shaders are compiled with these defined (SHADER_CONSTANT_TEXTURED etc.), so they're
+// only numbered here
+const uint32_t SHADER_CONSTANT_TEXTURED = 0; // bool, shader.frag samples the texture rather than using the vertex colour
+const uint32_t SHADER_CONSTANT_LIGHTING_MODE = 1; // LightingMode, in second.frag
+const uint32_t SHADER_CONSTANT_SUN = 2; // bool, second.frag lights and shadows with the sun
+const uint32_t SHADER_CONSTANT_SCREEN_WIDTH = 3; // Pixels, second.frag
+const uint32_t SHADER_CONSTANT_SCREEN_HEIGHT = 4;
+const uint32_t SHADER_CONSTANT_COUNT = 5;
+
+// Which pipeline to build and the values of the specialization constants to build it with. Constants that aren't set
+// keep the shader's default. Two permutations setting the same values (in any order) have the same key
+class ShaderPermutation
+{
+public:
+	ShaderPermutation(uint32_t newPipelineType = 0);
+
+	void set(uint32_t constantId, uint32_t value);
+	uint32_t get(uint32_t constantId) const;
+	uint32_t getPipelineType() const;
+
+	uint64_t getKey() const;
+	bool operator==(const ShaderPermutation& other) const;
+
+	// Every set constant as a 32-bit value, pointing into the permutation and entries, which have to outlive it
+	VkSpecializationInfo getSpecializationInfo(std::vector<VkSpecializationMapEntry>* entries) const;
+
+private:
+	uint32_t pipelineType;
+	uint32_t setMask = 0; // Bit per constant id
+	std::array<uint32_t, SHADER_CONSTANT_COUNT> values = {};
+};
+
+struct PipelineVariantStats {
+	uint32_t variants = 0; // Built so far, each one a distinct key
+	uint64_t requests = 0;
+	double buildTime = 0.0; // Milliseconds spent building variants, summed over every thread building them
+	uint32_t pending = 0; // Requested but not built yet, queued or being built on a worker thread
+};
+
+// Pipelines by permutation, each built the first time it's asked for and shared by every later request with the same
+// key. get builds on the calling thread, request hands the build to worker threads and returns without waiting, so a
+// frame recording its draws is never held up by one. The builder is called from several threads at once. Owns the
+// pipelines it builds
+class PipelineVariantCache
+{
+public:
+	typedef std::function<VkPipeline(const ShaderPermutation&)> Builder;
+
+	PipelineVariantCache();
+
+	// workerCount threads build requested pipelines. With none, request builds them on the calling thread like get
+	void create(VkDevice newDevice, Builder newBuilder, uint32_t workerCount);
+
+	// The pipeline, built now if it hasn't been, or waited for if a worker is building it. Throws if it can't be built
+	VkPipeline get(const ShaderPermutation& permutation);
+
+	// The pipeline if it's built, otherwise VK_NULL_HANDLE, queueing it for the workers the first time it's asked for.
+	// Throws if building it failed
+	VkPipeline request(const ShaderPermutation& permutation);
+
+	PipelineVariantStats getStats();
+
+	// Finishes the builds under way and drops the queued ones, then joins the workers
+	void stop();
+
+	// Destroys every variant
+	void destroy();
+
+	~PipelineVariantCache();
+
+private:
+	enum class VariantState {
+		Queued,
+		Building,
+		Built,
+		Failed
+	};
+
+	struct Variant {
+		ShaderPermutation permutation; // Compared as well as the key, so a hash collision can't return the wrong pipeline
+		VkPipeline pipeline; // VK_NULL_HANDLE until built
+		VariantState state;
+		std::string error; // Why it couldn't be built
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	Builder builder;
+	// Elements of an unordered_multimap stay where they are as others are added, so the queue can point at them
+	std::unordered_multimap<uint64_t, Variant> variants;
+
+	std::vector<std::thread> workers;
+	std::mutex mutex; // Guards the variants, queue and stats
+	std::condition_variable requestAdded;
+	std::condition_variable variantBuilt;
+	bool stopping = false;
+	std::deque<Variant*> queue;
+
+	PipelineVariantStats stats;
+
+	// Each with the lock held
+	Variant* find(const ShaderPermutation& permutation);
+	Variant* add(const ShaderPermutation& permutation, VariantState state);
+	// Builds without the lock, so other threads can carry on meanwhile
+	void build(Variant* variant, std::unique_lock<std::mutex>& lock);
+
+	void run();
+};
@@ -0,0 +1,377 @@
+#include "ShaderReflection.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// SPIR-V opcodes, decorations and enumerants read here (numbered as in the SPIR-V specification)
+const uint32_t SPIRV_MAGIC = 0x07230203;
+const uint32_t SPIRV_HEADER_WORDS = 5;
+
+const uint32_t OP_ENTRY_POINT = 15;
+const uint32_t OP_TYPE_BOOL = 20;
+const uint32_t OP_TYPE_INT = 21;
+const uint32_t OP_TYPE_FLOAT = 22;
+const uint32_t OP_TYPE_VECTOR = 23;
+const uint32_t OP_TYPE_MATRIX = 24;
+const uint32_t OP_TYPE_IMAGE = 25;
+const uint32_t OP_TYPE_SAMPLER = 26;
+const uint32_t OP_TYPE_SAMPLED_IMAGE = 27;
+const uint32_t OP_TYPE_ARRAY = 28;
+const uint32_t OP_TYPE_RUNTIME_ARRAY = 29;
+const uint32_t OP_TYPE_STRUCT = 30;
+const uint32_t OP_TYPE_POINTER = 32;
+const uint32_t OP_CONSTANT = 43;
+const uint32_t OP_VARIABLE = 59;
+const uint32_t OP_DECORATE = 71;
+const uint32_t OP_MEMBER_DECORATE = 72;
+
+const uint32_t DECORATION_BLOCK = 2;
+const uint32_t DECORATION_BUFFER_BLOCK = 3;
+const uint32_t DECORATION_ARRAY_STRIDE = 6;
+const uint32_t DECORATION_MATRIX_STRIDE = 7;
+const uint32_t DECORATION_BUILT_IN = 11;
+const uint32_t DECORATION_LOCATION = 30;
+const uint32_t DECORATION_BINDING = 33;
+const uint32_t DECORATION_DESCRIPTOR_SET = 34;
+const uint32_t DECORATION_OFFSET = 35;
+
+const uint32_t STORAGE_UNIFORM_CONSTANT = 0;
+const uint32_t STORAGE_INPUT = 1;
+const uint32_t STORAGE_UNIFORM = 2;
+const uint32_t STORAGE_PUSH_CONSTANT = 9;
+const uint32_t STORAGE_STORAGE_BUFFER = 12;
+
+const uint32_t EXECUTION_MODEL_VERTEX = 0;
+const uint32_t EXECUTION_MODEL_FRAGMENT = 4;
+const uint32_t EXECUTION_MODEL_GL_COMPUTE = 5;
+
+const uint32_t DIM_BUFFER = 5;
+const uint32_t DIM_SUBPASS_DATA = 6;
+
+const uint32_t NO_VALUE = 0xffffffff;
+
+// Everything known about one result id: the instruction declaring it (types, constants and variables) and its decorations
+struct SpirvId {
+	uint32_t opcode = 0;
+	std::vector<uint32_t> operands; // Words after the result id (for OpVariable and OpConstant, after the result type too)
+	uint32_t resultType = 0; // OpVariable and OpConstant only
+
+	uint32_t set = NO_VALUE;
+	uint32_t binding = NO_VALUE;
+	uint32_t location = NO_VALUE;
+	uint32_t arrayStride = 0;
+	bool builtIn = false;
+	bool block = false;
+	bool bufferBlock = false;
+	std::vector<uint32_t> memberOffsets; // Struct types only, by member
+	std::vector<uint32_t> memberMatrixStrides;
+};
+
+static void setMemberDecoration(std::vector<uint32_t>* values, uint32_t member, uint32_t value)
+{
+	if (values->size() <= member) {
+		values->resize(member + 1, 0);
+	}
+	(*values)[member] = value;
+}
+
+static const SpirvId& findId(const std::vector<SpirvId>& ids, uint32_t id)
+{
+	if (id >= ids.size() || ids[id].opcode == 0) {
+		throw std::runtime_error("SPIR-V refers to an undeclared id");
+	}
+	return ids[id];
+}
+
+// Bytes a type takes in a push constant block, from its explicit layout decorations
+static uint32_t typeSize(const std::vector<SpirvId>& ids, uint32_t typeId, uint32_t matrixStride)
+{
+	const SpirvId& type = findId(ids, typeId);
+	switch (type.opcode) {
+	case OP_TYPE_BOOL:
+		return 4;
+	case OP_TYPE_INT:
+	case OP_TYPE_FLOAT:
+		return type.operands[0] / 8;
+	case OP_TYPE_VECTOR:
+		return typeSize(ids, type.operands[0], 0) * type.operands[1];
+	case OP_TYPE_MATRIX:
+		// Column major, so each column is MatrixStride bytes apart
+		return (matrixStride != 0 ? matrixStride : typeSize(ids, type.operands[0], 0)) * type.operands[1];
+	case OP_TYPE_ARRAY: {
+		const SpirvId& length = findId(ids, type.operands[1]);
+		return type.arrayStride * (length.opcode == OP_CONSTANT ? length.operands[0] : 1);
+	}
+	case OP_TYPE_STRUCT: {
+		// Members can be laid out in any order, the struct ends where its furthest member does
+		uint32_t size = 0;
+		for (size_t i = 0; i < type.operands.size(); i++) {
+			uint32_t offset = i < type.memberOffsets.size() ? type.memberOffsets[i] : 0;
+			uint32_t memberStride = i < type.memberMatrixStrides.size() ? type.memberMatrixStrides[i] : 0;
+			size = std::max(size, offset + typeSize(ids, type.operands[i], memberStride));
+		}
+		return size;
+	}
+	default:
+		throw std::runtime_error("Unsupported type in SPIR-V push constant block");
+	}
+}
+
+static VkFormat vertexInputFormat(const std::vector<SpirvId>& ids, uint32_t typeId)
+{
+	const SpirvId& type = findId(ids, typeId);
+	uint32_t components = 1;
+	const SpirvId* component = &type;
+	if (type.opcode == OP_TYPE_VECTOR) {
+		components = type.operands[1];
+		component = &findId(ids, type.operands[0]);
+	}
+
+	if (component->opcode == OP_TYPE_FLOAT && component->operands[0] == 32) {
+		const VkFormat formats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+		return formats[components - 1];
+	}
+	if (component->opcode == OP_TYPE_INT && component->operands[0] == 32) {
+		const VkFormat signedFormats[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+		const VkFormat unsignedFormats[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+		return component->operands[1] != 0 ? signedFormats[components - 1] : unsignedFormats[components - 1];
+	}
+	throw std::runtime_error("Unsupported vertex input type in SPIR-V");
+}
+
+ShaderReflection reflectShader(const std::vector<char>& code)
+{
+	if (code.size() % sizeof(uint32_t) != 0 || code.size() < SPIRV_HEADER_WORDS * sizeof(uint32_t)) {
+		throw std::runtime_error("SPIR-V isn't a whole number of words");
+	}
+	std::vector<uint32_t> words(code.size() / sizeof(uint32_t));
+	std::memcpy(words.data(), code.data(), code.size());
+	if (words[0] != SPIRV_MAGIC) {
+		throw std::runtime_error("SPIR-V has the wrong magic number");
+	}
+
+	// -- Read every declaration and decoration. Decorations come before the ids they decorate, so this is one pass
+	std::vector<SpirvId> ids(words[3]); // Id bound
+	std::vector<uint32_t> variables;
+	uint32_t executionModel = NO_VALUE;
+
+	size_t position = SPIRV_HEADER_WORDS;
+	while (position < words.size()) {
+		uint32_t wordCount = words[position] >> 16;
+		uint32_t opcode = words[position] & 0xffff;
+		if (wordCount == 0 || position + wordCount > words.size()) {
+			throw std::runtime_error("SPIR-V instruction runs past the end of the module");
+		}
+		const uint32_t* operands = &words[position + 1];
+		uint32_t operandCount = wordCount - 1;
+
+		switch (opcode) {
+		case OP_ENTRY_POINT:
+			// Shaders here have a single entry point
+			executionModel = operands[0];
+			break;
+		case OP_DECORATE:
+			if (operandCount >= 2 && operands[0] < ids.size()) {
+				SpirvId& target = ids[operands[0]];
+				uint32_t value = operandCount >= 3 ? operands[2] : 0;
+				switch (operands[1]) {
+				case DECORATION_BLOCK: target.block = true; break;
+				case DECORATION_BUFFER_BLOCK: target.bufferBlock = true; break;
+				case DECORATION_ARRAY_STRIDE: target.arrayStride = value; break;
+				case DECORATION_BUILT_IN: target.builtIn = true; break;
+				case DECORATION_LOCATION: target.location = value; break;
+				case DECORATION_BINDING: target.binding = value; break;
+				case DECORATION_DESCRIPTOR_SET: target.set = value; break;
+				}
+			}
+			break;
+		case OP_MEMBER_DECORATE:
+			if (operandCount >= 4 && operands[0] < ids.size()) {
+				SpirvId& target = ids[operands[0]];
+				if (operands[2] == DECORATION_OFFSET) {
+					setMemberDecoration(&target.memberOffsets, operands[1], operands[3]);
+				}
+				else if (operands[2] == DECORATION_MATRIX_STRIDE) {
+					setMemberDecoration(&target.memberMatrixStrides, operands[1], operands[3]);
+				}
+				else if (operands[2] == DECORATION_BUILT_IN) {
+					// gl_PerVertex blocks, which aren't vertex inputs
+					target.builtIn = true;
+				}
+			}
+			break;
+		case OP_TYPE_BOOL:
+		case OP_TYPE_INT:
+		case OP_TYPE_FLOAT:
+		case OP_TYPE_VECTOR:
+		case OP_TYPE_MATRIX:
+		case OP_TYPE_IMAGE:
+		case OP_TYPE_SAMPLER:
+		case OP_TYPE_SAMPLED_IMAGE:
+		case OP_TYPE_ARRAY:
+		case OP_TYPE_RUNTIME_ARRAY:
+		case OP_TYPE_STRUCT:
+		case OP_TYPE_POINTER:
+			if (operandCount >= 1 && operands[0] < ids.size()) {
+				ids[operands[0]].opcode = opcode;
+				ids[operands[0]].operands.assign(operands + 1, operands + operandCount);
+			}
+			break;
+		case OP_CONSTANT:
+		case OP_VARIABLE:
+			if (operandCount >= 3 && operands[1] < ids.size()) {
+				ids[operands[1]].opcode = opcode;
+				ids[operands[1]].resultType = operands[0];
+				ids[operands[1]].operands.assign(operands + 2, operands + operandCount);
+				if (opcode == OP_VARIABLE) {
+					variables.push_back(operands[1]);
+				}
+			}
+			break;
+		}
+
+		position += wordCount;
+	}
+
+	ShaderReflection reflection;
+	switch (executionModel) {
+	case EXECUTION_MODEL_VERTEX: reflection.stage = VK_SHADER_STAGE_VERTEX_BIT; break;
+	case EXECUTION_MODEL_FRAGMENT: reflection.stage = VK_SHADER_STAGE_FRAGMENT_BIT; break;
+	case EXECUTION_MODEL_GL_COMPUTE: reflection.stage = VK_SHADER_STAGE_COMPUTE_BIT; break;
+	default: throw std::runtime_error("Unsupported SPIR-V execution model");
+	}
+
+	// -- Turn the variables into descriptors, push constants and vertex inputs
+	for (uint32_t variableId : variables) {
+		const SpirvId& variable = ids[variableId];
+		uint32_t storageClass = variable.operands[0];
+		const SpirvId& pointer = findId(ids, variable.resultType);
+		uint32_t typeId = pointer.operands[1];
+
+		if (storageClass == STORAGE_PUSH_CONSTANT) {
+			reflection.pushConstantSize = std::max(reflection.pushConstantSize, typeSize(ids, typeId, 0));
+			continue;
+		}
+
+		if (storageClass == STORAGE_INPUT) {
+			if (reflection.stage == VK_SHADER_STAGE_VERTEX_BIT && !variable.builtIn && !findId(ids, typeId).builtIn
+				&& variable.location != NO_VALUE) {
+				ReflectedVertexInput input = { variable.location, vertexInputFormat(ids, typeId) };
+				reflection.vertexInputs.push_back(input);
+			}
+			continue;
+		}
+
+		if (storageClass != STORAGE_UNIFORM_CONSTANT && storageClass != STORAGE_UNIFORM && storageClass != STORAGE_STORAGE_BUFFER) {
+			continue;
+		}
+
+		// Arrays of descriptors take one binding with a descriptor per element
+		uint32_t count = 1;
+		const SpirvId* type = &findId(ids, typeId);
+		if (type->opcode == OP_TYPE_ARRAY) {
+			const SpirvId& length = findId(ids, type->operands[1]);
+			count = length.opcode == OP_CONSTANT ? length.operands[0] : 1;
+			type = &findId(ids, type->operands[0]);
+		}
+		else if (type->opcode == OP_TYPE_RUNTIME_ARRAY) {
+			throw std::runtime_error("Unsized descriptor arrays aren't supported by reflection");
+		}
+
+		ReflectedBinding binding = {};
+		binding.set = variable.set != NO_VALUE ? variable.set : 0;
+		binding.binding = variable.binding != NO_VALUE ? variable.binding : 0;
+		binding.count = count;
+
+		if (storageClass == STORAGE_STORAGE_BUFFER) {
+			binding.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		}
+		else if (storageClass == STORAGE_UNIFORM) {
+			// Older SPIR-V marks storage buffers as BufferBlock structs in the Uniform storage class
+			binding.type = type->bufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		}
+		else if (type->opcode == OP_TYPE_SAMPLED_IMAGE) {
+			binding.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		}
+		else if (type->opcode == OP_TYPE_SAMPLER) {
+			binding.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+		}
+		else if (type->opcode == OP_TYPE_IMAGE) {
+			// Operands: sampled type, dim, depth, arrayed, multisampled, sampled (1 with a sampler, 2 for storage)
+			uint32_t dim = type->operands[1];
+			bool storage = type->operands[5] == 2;
+			if (dim == DIM_SUBPASS_DATA) binding.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			else if (dim == DIM_BUFFER) binding.type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+			else binding.type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		}
+		else {
+			throw std::runtime_error("Unsupported descriptor type in SPIR-V");
+		}
+
+		reflection.bindings.push_back(binding);
+	}
+
+	std::sort(reflection.bindings.begin(), reflection.bindings.end(), [](const ReflectedBinding& a, const ReflectedBinding& b) {
+		return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+	});
+	std::sort(reflection.vertexInputs.begin(), reflection.vertexInputs.end(), [](const ReflectedVertexInput& a, const ReflectedVertexInput& b) {
+		return a.location < b.location;
+	});
+
+	return reflection;
+}
+
+std::vector<VkDescriptorSetLayoutBinding> mergeSetBindings(const std::vector<const ShaderReflection*>& shaders, uint32_t set)
+{
+	std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
+	for (const ShaderReflection* shader : shaders) {
+		for (const ReflectedBinding& binding : shader->bindings) {
+			if (binding.set != set) {
+				continue;
+			}
+
+			auto existing = std::find_if(layoutBindings.begin(), layoutBindings.end(), [&binding](const VkDescriptorSetLayoutBinding& layoutBinding) {
+				return layoutBinding.binding == binding.binding;
+			});
+			if (existing == layoutBindings.end()) {
+				VkDescriptorSetLayoutBinding layoutBinding = {};
+				layoutBinding.binding = binding.binding;
+				layoutBinding.descriptorType = binding.type;
+				layoutBinding.descriptorCount = binding.count;
+				layoutBinding.stageFlags = shader->stage;
+				layoutBinding.pImmutableSamplers = nullptr;
+				layoutBindings.push_back(layoutBinding);
+			}
+			else if (existing->descriptorType != binding.type || existing->descriptorCount != binding.count) {
+				throw std::runtime_error("Shaders declare set " + std::to_string(set) + " binding " + std::to_string(binding.binding) + " differently");
+			}
+			else {
+				existing->stageFlags |= shader->stage;
+			}
+		}
+	}
+
+	std::sort(layoutBindings.begin(), layoutBindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+		return a.binding < b.binding;
+	});
+	return layoutBindings;
+}
+
+std::vector<VkPushConstantRange> mergePushConstants(const std::vector<const ShaderReflection*>& shaders)
+{
+	VkPushConstantRange range = {};
+	for (const ShaderReflection* shader : shaders) {
+		if (shader->pushConstantSize > 0) {
+			range.stageFlags |= shader->stage;
+			range.size = std::max(range.size, shader->pushConstantSize);
+		}
+	}
+
+	std::vector<VkPushConstantRange> ranges;
+	if (range.size > 0) {
+		ranges.push_back(range);
+	}
+	return ranges;
+}
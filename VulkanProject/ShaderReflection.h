@@ -0,0 +1,39 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+// A descriptor a shader declares, from its DescriptorSet and Binding decorations
+struct ReflectedBinding {
+	uint32_t set;
+	uint32_t binding;
+	VkDescriptorType type;
+	uint32_t count; // Array length, 1 for a single descriptor
+};
+
+// A vertex shader input, from its Location decoration and type
+struct ReflectedVertexInput {
+	uint32_t location;
+	VkFormat format;
+};
+
+// What a shader's pipeline layout and vertex input state have to provide for it
+struct ShaderReflection {
+	VkShaderStageFlagBits stage;
+	std::vector<ReflectedBinding> bindings; // Ordered by set then binding
+	uint32_t pushConstantSize = 0; // Bytes of the push constant block, 0 without one
+	std::vector<ReflectedVertexInput> vertexInputs; // Vertex stage only, ordered by location
+};
+
+// Reads the resources declared by SPIR-V (as compiled, before specialization). Throws if it isn't valid SPIR-V or uses a
+// resource type there's no descriptor type for
+ShaderReflection reflectShader(const std::vector<char>& code);
+
+// Bindings of one descriptor set across the shaders, each binding visible to every stage that declares it. Throws if two
+// shaders declare the same binding differently, as one layout can't satisfy both
+std::vector<VkDescriptorSetLayoutBinding> mergeSetBindings(const std::vector<const ShaderReflection*>& shaders, uint32_t set);
+
+// One range covering every stage's push constants (they all start at offset 0), none if no shader has any
+std::vector<VkPushConstantRange> mergePushConstants(const std::vector<const ShaderReflection*>& shaders);
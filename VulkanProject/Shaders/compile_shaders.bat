@@ -1,5 +0,0 @@
-C:\VulkanSDK\1.2.141.2\Bin32\glslangValidator.exe -V shader.vert
-C:\VulkanSDK\1.2.141.2\Bin32\glslangValidator.exe -V shader.frag
-C:\VulkanSDK\1.2.141.2\Bin32\glslangValidator.exe -o second_vert.spv -V second.vert
-C:\VulkanSDK\1.2.141.2\Bin32\glslangValidator.exe -o second_frag.spv -V second.frag
-pause
\ No newline at end of file
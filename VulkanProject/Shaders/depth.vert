@@ -0,0 +1,16 @@
+#version 450
+
+// Depth only, for the pre-pass before the G-buffer subpass. There's no fragment shader, depth is all that's written
+
+// The position only stream after the interleaved vertices
+layout(location = 0) in vec3 pos;
+
+#include "include/object_transforms.glsl"
+
+// The G-buffer subpass only shades fragments whose depth equals the pre-pass's, so both must compute positions exactly
+// the same way
+invariant gl_Position;
+
+void main() {
+	gl_Position = objectTransforms.objects[gl_InstanceIndex].mvp * vec4(pos, 1.0);
+}
@@ -0,0 +1,35 @@
+#ifndef LIGHT_BUFFER_GLSL
+#define LIGHT_BUFFER_GLSL
+
+// CLUSTER_GRID_X/Y/Z, MAX_LIGHTS_PER_CLUSTER and MAX_SHADOW_CASCADES are defined by the renderer, from LightClusters.h and
+// Utilities.h
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+
+// Same layout as Light in LightClusters.h
+struct Light {
+	vec3 position;
+	float range;
+	vec3 colour;
+	float intensity;
+	vec3 direction;
+	float spotInnerCos;
+	float spotOuterCos;
+};
+
+// Same layout as LightBufferHeader in LightClusters.h, followed by the lights
+layout(std430, set = 0, binding = 2) readonly buffer LightBuffer {
+	mat4 view;
+	mat4 inverseView;
+	mat4 inverseProjection;
+	vec4 screen; // Width, height, near plane, far plane
+	vec4 ambient;
+	uvec4 counts; // Number of lights in x
+	mat4 cascadeViewProjections[MAX_SHADOW_CASCADES];
+	vec4 cascadeSplits; // View depth each cascade ends at
+	vec4 cascadeTexelSizes;
+	vec4 sunDirection; // Direction the light travels, number of cascades in w
+	vec4 sunColour;
+	Light lights[];
+} lightBuffer;
+
+#endif
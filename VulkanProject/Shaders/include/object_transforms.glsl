@@ -0,0 +1,14 @@
+#ifndef OBJECT_TRANSFORMS_GLSL
+#define OBJECT_TRANSFORMS_GLSL
+
+// Model and premultiplied MVP of every scene graph node, the draw's first instance is the mesh's node
+struct ObjectTransform {
+	mat4 model;
+	mat4 mvp;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer ObjectTransforms {
+	ObjectTransform objects[];
+} objectTransforms;
+
+#endif
@@ -1,24 +1,150 @@
 #version 450
 
-// Colour output from subpass 1
-layout(input_attachment_index = 0, binding = 0) uniform subpassInput inputColour; 
-// Depth output from subpass 1
-layout(input_attachment_index = 1, binding = 1) uniform subpassInput inputDepth; 
+// Full screen lighting from the G-buffer written by subpass 1, read with subpassLoad so it can stay in tile memory
+
+#include "include/light_buffer.glsl"
+
+// Written by cluster.comp before the render pass
+layout(std430, set = 0, binding = 3) readonly buffer ClusterBuffer {
+	uint data[]; // Light count of each cluster, then MAX_LIGHTS_PER_CLUSTER light indices per cluster
+} clusterBuffer;
+
+// Sun shadow cascades, one layer each, compared against with hardware filtering
+layout(set = 0, binding = 4) uniform sampler2DArrayShadow shadowMap;
+
+// G-buffer from subpass 1
+layout(input_attachment_index = 0, set = 1, binding = 0) uniform subpassInput inputAlbedo;
+layout(input_attachment_index = 1, set = 1, binding = 1) uniform subpassInput inputDepth;
+layout(input_attachment_index = 2, set = 1, binding = 2) uniform subpassInput inputNormal;
+layout(input_attachment_index = 3, set = 1, binding = 3) uniform subpassInput inputMaterial;
 
 layout(location = 0) out vec4 colour;
 
+// Specialization constants, so the branches on them are removed when each pipeline is built
+layout(constant_id = SHADER_CONSTANT_LIGHTING_MODE) const uint LIGHTING_MODE = LIGHTING_MODE_LIT;
+layout(constant_id = SHADER_CONSTANT_SUN) const bool SUN = true; // Sun lighting and shadows, off while it has no intensity
+layout(constant_id = SHADER_CONSTANT_SCREEN_WIDTH) const uint SCREEN_WIDTH = 1920u;
+layout(constant_id = SHADER_CONSTANT_SCREEN_HEIGHT) const uint SCREEN_HEIGHT = 1080u;
+
+// Converting to float isn't a specialization constant operation, so this can't be a constant itself
+vec2 screenSize() {
+	return vec2(SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+vec3 decodeNormal(vec2 f) {
+	vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+	float t = clamp(-n.z, 0.0, 1.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+uint findCluster(float viewDepth) {
+	vec2 tileSize = screenSize() / vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y);
+	int x = int(floor(gl_FragCoord.x / tileSize.x));
+	int y = int(floor(gl_FragCoord.y / tileSize.y));
+	int z = int(floor(log(viewDepth / lightBuffer.screen.z) / log(lightBuffer.screen.w / lightBuffer.screen.z) * float(CLUSTER_GRID_Z)));
+
+	x = clamp(x, 0, int(CLUSTER_GRID_X) - 1);
+	y = clamp(y, 0, int(CLUSTER_GRID_Y) - 1);
+	z = clamp(z, 0, int(CLUSTER_GRID_Z) - 1);
+	return uint(x) + uint(y) * CLUSTER_GRID_X + uint(z) * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+}
+
+// Fraction of the sun's light reaching the position, from the first cascade reaching its view depth (fully lit beyond them)
+float sunShadow(vec3 worldPos, vec3 normal, float viewDepth) {
+	uint cascadeCount = uint(lightBuffer.sunDirection.w);
+	uint cascade = 0;
+	while (cascade < cascadeCount && viewDepth > lightBuffer.cascadeSplits[cascade]) {
+		cascade++;
+	}
+	if (cascade == cascadeCount) {
+		return 1.0;
+	}
+
+	// Pushed out along the normal by a texel or so, so surfaces don't shadow themselves
+	vec3 offsetPos = worldPos + normal * lightBuffer.cascadeTexelSizes[cascade] * 1.5;
+	vec4 shadowPos = lightBuffer.cascadeViewProjections[cascade] * vec4(offsetPos, 1.0);
+	vec2 uv = shadowPos.xy * 0.5 + 0.5;
+
+	// 3x3 taps, each filtered over 2x2 texels by the comparison sampler
+	vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+	float lit = 0.0;
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			lit += texture(shadowMap, vec4(uv + vec2(x, y) * texelSize, float(cascade), min(shadowPos.z, 1.0)));
+		}
+	}
+	return lit / 9.0;
+}
+
 void main() {
-	// colour = subpassLoad(inputColour).rgba;
-	int xHalf = 1920 / 2;
-	if(gl_FragCoord.x > xHalf) {
-		float lowerBound = 0.99;
-		float upperBound = 1;
-
-		float depth = subpassLoad(inputDepth).r;
-		float depthColourScaled = 1.0f - ((depth - lowerBound) / (upperBound - lowerBound));
-
-		colour = vec4(subpassLoad(inputColour).rgb * depthColourScaled, 1.0f);
-	} else {
-		colour = subpassLoad(inputColour).rgba;
+	vec4 albedo = subpassLoad(inputAlbedo);
+	vec4 material = subpassLoad(inputMaterial);
+	float depth = subpassLoad(inputDepth).r;
+
+	// Nothing was drawn here, or it asked not to be lit
+	if (depth >= 1.0 || material.w == 0.0 || LIGHTING_MODE == LIGHTING_MODE_UNLIT) {
+		colour = albedo;
+		return;
 	}
+
+	// Position back from the depth buffer, through the same inverse projection the clusters were built with
+	vec2 ndc = gl_FragCoord.xy / screenSize() * 2.0 - 1.0;
+	vec4 viewPoint = lightBuffer.inverseProjection * vec4(ndc, depth, 1.0);
+	vec3 viewPos = viewPoint.xyz / viewPoint.w;
+	vec3 worldPos = (lightBuffer.inverseView * vec4(viewPos, 1.0)).xyz;
+	vec3 toEye = normalize(lightBuffer.inverseView[3].xyz - worldPos);
+
+	vec3 normal = decodeNormal(subpassLoad(inputNormal).xy);
+	if (LIGHTING_MODE == LIGHTING_MODE_NORMALS) {
+		colour = vec4(normal * 0.5 + 0.5, 1.0);
+		return;
+	}
+
+	float shininess = exp2(10.0 * (1.0 - material.y) + 1.0);
+
+	// Only the lights binned into this pixel's cluster, however many there are in the scene
+	uint cluster = findCluster(-viewPos.z);
+	uint count = clusterBuffer.data[cluster];
+	vec3 lighting = lightBuffer.ambient.rgb;
+	vec3 specular = vec3(0.0);
+
+	// The sun, if there is one, shadowed by its cascades
+	if (SUN && lightBuffer.sunDirection.w > 0.0) {
+		vec3 direction = -lightBuffer.sunDirection.xyz;
+		float diffuse = max(dot(normal, direction), 0.0);
+		if (diffuse > 0.0) {
+			vec3 radiance = lightBuffer.sunColour.rgb * sunShadow(worldPos, normal, -viewPos.z);
+			lighting += radiance * diffuse;
+			if (material.x > 0.0) {
+				specular += radiance * material.x * pow(max(dot(normal, normalize(direction + toEye)), 0.0), shininess);
+			}
+		}
+	}
+
+	for (uint i = 0; i < count; i++) {
+		Light light = lightBuffer.lights[clusterBuffer.data[CLUSTER_COUNT + cluster * MAX_LIGHTS_PER_CLUSTER + i]];
+
+		vec3 toLight = light.position - worldPos;
+		float distance = length(toLight);
+		vec3 direction = toLight / max(distance, 0.0001);
+
+		// Inverse square falloff, windowed to reach zero at the light's range
+		float window = clamp(1.0 - pow(distance / light.range, 4.0), 0.0, 1.0);
+		float attenuation = window * window / (distance * distance + 1.0);
+
+		float spot = 1.0;
+		if (light.spotOuterCos > -1.0) {
+			spot = smoothstep(light.spotOuterCos, light.spotInnerCos, dot(-direction, light.direction));
+		}
+
+		vec3 radiance = light.colour * light.intensity * attenuation * spot;
+		float diffuse = max(dot(normal, direction), 0.0);
+		lighting += radiance * diffuse;
+		if (material.x > 0.0 && diffuse > 0.0) {
+			specular += radiance * material.x * pow(max(dot(normal, normalize(direction + toEye)), 0.0), shininess);
+		}
+	}
+
+	colour = vec4(albedo.rgb * lighting + specular, albedo.a);
 }
@@ -1,13 +1,34 @@
 #version 450
 
+// Writes the G-buffer, lighting is done from it by the second subpass (second.frag)
+
 layout(location = 0) in vec3 fragCol;
 layout(location = 1) in vec2 fragTex;
+layout(location = 2) in vec3 fragNormal;
 
 layout (set = 1, binding = 0) uniform sampler2D textureSampler;
 
-layout(location = 0) out vec4 outColour; // Final output colour (must also have location)
+// Meshes whose material has no texture are drawn with their vertex colours, without sampling the default texture
+layout(constant_id = SHADER_CONSTANT_TEXTURED) const bool TEXTURED = true;
+
+layout(location = 0) out vec4 outAlbedo;
+layout(location = 1) out vec2 outNormal; // World space, octahedral encoded
+layout(location = 2) out vec4 outMaterial; // Specular intensity, roughness, unused, lit (0 leaves the albedo as it is)
+
+// Folds the lower hemisphere of the octahedron over the upper one
+vec2 octahedralWrap(vec2 v) {
+	return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Unit vector to two components in [-1, 1], decoded by second.frag
+vec2 encodeNormal(vec3 n) {
+	n /= max(abs(n.x) + abs(n.y) + abs(n.z), 0.0001);
+	return n.z >= 0.0 ? n.xy : octahedralWrap(n.xy);
+}
 
 void main() {
-	// outColour = vec4(fragCol, 1.0); // Add colours
-	outColour = texture(textureSampler, fragTex);
+	outAlbedo = TEXTURED ? texture(textureSampler, fragTex) : vec4(fragCol, 1.0);
+	outNormal = encodeNormal(normalize(fragNormal));
+	// Models don't carry material parameters yet, so every surface is fully rough with no specular
+	outMaterial = vec4(0.0, 1.0, 0.0, 1.0);
 }
@@ -3,6 +3,7 @@
 layout(location = 0) in vec3 pos;
 layout(location = 1) in vec3 col;
 layout(location = 2) in vec2 tex;
+layout(location = 3) in vec3 normal;
 
 // This is a different binding than the one above
 layout(set = 0, binding = 0) uniform UboViewProjection {
@@ -16,15 +17,27 @@ layout(set = 0, binding = 0) uniform UboViewProjection {
 // 	   mat4 model;
 //   } uboModel;
 
-layout(push_constant) uniform PushModel {
-	mat4 model;
-} pushModel;
+// NOT IN USE, LEFT ONLY FOR REFERENCE / SHOW
+// 	(This is what we were using before adding the object buffer below)
+//   layout(push_constant) uniform PushModel {
+// 	   mat4 model;
+//   } pushModel;
+
+#include "include/object_transforms.glsl"
 
 layout(location = 0) out vec3 fragCol;
 layout(location = 1) out vec2 fragTex;
+layout(location = 2) out vec3 fragNormal;
+
+// Depth must match depth.vert's exactly, for the EQUAL depth test after the pre-pass
+invariant gl_Position;
 
 void main() {
-	gl_Position = uboViewProjection.projection * uboViewProjection.view * pushModel.model * vec4(pos, 1.0);
+	ObjectTransform object = objectTransforms.objects[gl_InstanceIndex];
+	gl_Position = object.mvp * vec4(pos, 1.0);
+
+	// Fine for rotations and uniform scales, which is all the scene graph's transforms are composed from in practice
+	fragNormal = mat3(object.model) * normal;
 
 	fragCol = col;
 	fragTex = tex;
@@ -0,0 +1,18 @@
+#version 450
+
+// Depth only, for the sun's shadow cascades. There's no fragment shader, depth is all that's written
+
+// The position only stream after the interleaved vertices
+layout(location = 0) in vec3 pos;
+
+// The same object buffer the main pass reads, only the models are used (its MVPs are for the camera)
+#include "include/object_transforms.glsl"
+
+// The cascade being drawn
+layout(push_constant) uniform PushCascade {
+	mat4 viewProjection;
+} pushCascade;
+
+void main() {
+	gl_Position = pushCascade.viewProjection * objectTransforms.objects[gl_InstanceIndex].model * vec4(pos, 1.0);
+}
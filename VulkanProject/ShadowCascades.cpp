@@ -0,0 +1,60 @@
+#include "ShadowCascades.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+void computeCascadeSplits(float nearPlane, float shadowDistance, uint32_t count, float lambda, float* splits)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		float fraction = static_cast<float>(i + 1) / count;
+		float logSplit = nearPlane * std::pow(shadowDistance / nearPlane, fraction);
+		float evenSplit = nearPlane + (shadowDistance - nearPlane) * fraction;
+		splits[i] = lambda * logSplit + (1.0f - lambda) * evenSplit;
+	}
+}
+
+void computeSliceSphere(const glm::mat4& inverseView, float tanHalfFov, float aspect, float startDepth, float endDepth,
+	glm::vec3* centre, float* radius)
+{
+	// Corners at depth d are d * k from the view axis. The centre is on the axis, where the near and far corners are the
+	// same distance away, unless that's beyond the far end (wide, shallow slices)
+	float kSquared = tanHalfFov * tanHalfFov * (1.0f + aspect * aspect);
+	float centreDepth = std::min(0.5f * (1.0f + kSquared) * (startDepth + endDepth), endDepth);
+
+	float farOffset = endDepth - centreDepth;
+	float nearOffset = centreDepth - startDepth;
+	*radius = std::sqrt(std::max(kSquared * endDepth * endDepth + farOffset * farOffset, kSquared * startDepth * startDepth + nearOffset * nearOffset));
+	*centre = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -centreDepth, 1.0f));
+}
+
+bool cascadeCovers(const ShadowCascade& cascade, glm::vec3 centre, float radius)
+{
+	return cascade.radius > 0.0f && glm::length(centre - cascade.centre) + radius <= cascade.radius;
+}
+
+ShadowCascade fitCascade(glm::vec3 lightDirection, glm::vec3 centre, float radius, uint32_t mapSize)
+{
+	glm::vec3 direction = glm::normalize(lightDirection);
+	glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+	ShadowCascade cascade;
+	cascade.radius = radius * SHADOW_CASCADE_PADDING;
+
+	// Snap the centre across the light's view to the texel grid, leaving it as it was along the light's direction
+	glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), direction, up);
+	glm::vec3 lightCentre = glm::vec3(lightRotation * glm::vec4(centre, 1.0f));
+	float texelSize = 2.0f * cascade.radius / mapSize;
+	lightCentre.x = std::floor(lightCentre.x / texelSize) * texelSize;
+	lightCentre.y = std::floor(lightCentre.y / texelSize) * texelSize;
+	cascade.centre = glm::vec3(glm::inverse(lightRotation) * glm::vec4(lightCentre, 1.0f));
+
+	// Looking along the light from far enough back that casters outside the area can still shadow into it
+	float backDistance = cascade.radius + SHADOW_CASTER_DEPTH;
+	glm::mat4 view = glm::lookAt(cascade.centre - direction * backDistance, cascade.centre, up);
+	glm::mat4 projection = glm::orthoRH_ZO(-cascade.radius, cascade.radius, -cascade.radius, cascade.radius, 0.0f, backDistance + cascade.radius);
+	cascade.viewProjection = projection * view;
+
+	return cascade;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Utilities.h"
+
+const float SHADOW_CASCADE_PADDING = 1.25f; // Cascades cover this much more than their slice, so the camera can move before they're refit
+const float SHADOW_CASTER_DEPTH = 50.0f; // Distance towards the sun beyond a cascade's area that casters are still drawn from
+
+// Area one shadow cascade covers, an orthographic box along the sun's direction around part of the view frustum
+struct ShadowCascade {
+	glm::vec3 centre = glm::vec3(0.0f); // World space
+	float radius = 0.0f; // Half the width of the box, 0 until the cascade is first fit
+	glm::mat4 viewProjection = glm::mat4(1.0f); // World space to the cascade's shadow map (Vulkan clip space, [0, 1] depth)
+};
+
+// View depths the cascades end at, between nearPlane and shadowDistance. Blends logarithmic and even splits by lambda
+// (the practical split scheme), so near cascades cover less and get more texels per unit
+void computeCascadeSplits(float nearPlane, float shadowDistance, uint32_t count, float lambda, float* splits);
+
+// Smallest sphere around the part of the view frustum between two view depths. Its size only depends on the depths and
+// the projection, so cascades fit around it don't change size (and shimmer) as the camera turns
+void computeSliceSphere(const glm::mat4& inverseView, float tanHalfFov, float aspect, float startDepth, float endDepth,
+	glm::vec3* centre, float* radius);
+
+// Whether the cascade's box still holds the whole sphere
+bool cascadeCovers(const ShadowCascade& cascade, glm::vec3 centre, float radius);
+
+// Cascade around the sphere, padded by SHADOW_CASCADE_PADDING. The centre is snapped to whole shadow map texels, so
+// static geometry lands on the same texels whenever the cascade is refit
+ShadowCascade fitCascade(glm::vec3 lightDirection, glm::vec3 centre, float radius, uint32_t mapSize);
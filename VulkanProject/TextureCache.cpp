@@ -0,0 +1,130 @@
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <cctype>
+
+TextureCache::TextureCache()
+{
+}
+
+int TextureCache::findPath(const std::string& path)
+{
+	auto found = this->pathTextures.find(path);
+	return found != this->pathTextures.end() ? found->second : -1;
+}
+
+int TextureCache::findContent(uint64_t contentHash, size_t contentSize)
+{
+	// Size is checked too, so a hash collision would also need the same size to give the wrong texture
+	auto range = this->contentTextures.equal_range(contentHash);
+	for (auto found = range.first; found != range.second; ++found) {
+		if (this->entries[found->second].contentSize == contentSize) {
+			return found->second;
+		}
+	}
+
+	return -1;
+}
+
+void TextureCache::add(int textureId, const std::string& path, uint64_t contentHash, size_t contentSize)
+{
+	if (static_cast<size_t>(textureId) >= this->entries.size()) {
+		this->entries.resize(textureId + 1);
+	}
+
+	TextureCacheEntry& entry = this->entries[textureId];
+	entry = TextureCacheEntry();
+	entry.contentHash = contentHash;
+	entry.contentSize = contentSize;
+	entry.refCount = 1;
+	this->contentTextures.insert(std::make_pair(contentHash, textureId));
+
+	if (!path.empty()) {
+		this->addPath(textureId, path);
+	}
+}
+
+void TextureCache::addPath(int textureId, const std::string& path)
+{
+	this->entries[textureId].paths.push_back(path);
+	this->pathTextures[path] = textureId;
+}
+
+void TextureCache::acquire(int textureId)
+{
+	this->entries[textureId].refCount++;
+}
+
+bool TextureCache::release(int textureId)
+{
+	TextureCacheEntry& entry = this->entries[textureId];
+	if (entry.refCount == 0 || --entry.refCount > 0) {
+		return false;
+	}
+
+	// Last user gone, so a later load creates the texture again
+	for (const std::string& path : entry.paths) {
+		this->pathTextures.erase(path);
+	}
+
+	auto range = this->contentTextures.equal_range(entry.contentHash);
+	for (auto found = range.first; found != range.second; ++found) {
+		if (found->second == textureId) {
+			this->contentTextures.erase(found);
+			break;
+		}
+	}
+
+	entry = TextureCacheEntry();
+	return true;
+}
+
+uint32_t TextureCache::getRefCount(int textureId)
+{
+	return static_cast<size_t>(textureId) < this->entries.size() ? this->entries[textureId].refCount : 0;
+}
+
+std::string TextureCache::canonicalPath(const std::string& path)
+{
+	std::string normalized = path;
+	std::replace(normalized.begin(), normalized.end(), '\\', '/');
+#ifdef _WIN32
+	// Only folded where paths are case insensitive, elsewhere two names differing in case are two files
+	std::transform(normalized.begin(), normalized.end(), normalized.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+#endif
+
+	// Split into segments, dropping empty and "." ones and letting ".." remove the one before (if there is one to remove)
+	std::vector<std::string> segments;
+	size_t start = 0;
+	while (start <= normalized.size()) {
+		size_t end = normalized.find('/', start);
+		if (end == std::string::npos) {
+			end = normalized.size();
+		}
+
+		std::string segment = normalized.substr(start, end - start);
+		if (segment == "..") {
+			if (!segments.empty() && segments.back() != "..") {
+				segments.pop_back();
+			}
+			else {
+				segments.push_back(segment);
+			}
+		}
+		else if (!segment.empty() && segment != ".") {
+			segments.push_back(segment);
+		}
+		start = end + 1;
+	}
+
+	std::string canonical = (!normalized.empty() && normalized[0] == '/') ? "/" : "";
+	for (size_t i = 0; i < segments.size(); i++) {
+		canonical += (i > 0 ? "/" : "") + segments[i];
+	}
+
+	return canonical;
+}
+
+TextureCache::~TextureCache()
+{
+}
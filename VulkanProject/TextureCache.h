@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// What is known about a loaded texture so a later load of the same file, or of the same content under another path, gets
+// the same texture rather than a copy
+struct TextureCacheEntry {
+	std::vector<std::string> paths; // Canonical paths loaded as this texture, empty for textures created from pixels
+	uint64_t contentHash = 0;
+	size_t contentSize = 0;
+	uint32_t refCount = 0;
+};
+
+// Texture ids by canonical path and by content hash (FNV-1a of the file's bytes, or of the pixels and their size), with a
+// count of how many users each texture has. It doesn't own any Vulkan objects, the renderer frees a texture when release
+// says its last user has gone
+class TextureCache
+{
+public:
+	TextureCache();
+
+	// Texture loaded from path (already canonical) or with this content, -1 if there isn't one
+	int findPath(const std::string& path);
+	int findContent(uint64_t contentHash, size_t contentSize);
+
+	// Records a newly created texture with one reference, path is empty if it has none
+	void add(int textureId, const std::string& path, uint64_t contentHash, size_t contentSize);
+	// Another path found to have the same content as textureId
+	void addPath(int textureId, const std::string& path);
+
+	void acquire(int textureId);
+	// Returns true if that was the last reference, in which case the texture is forgotten and should be freed
+	bool release(int textureId);
+	uint32_t getRefCount(int textureId);
+
+	// Forward slashes, no "." or "dir/.." segments and, on Windows where paths are case insensitive, lower case, so
+	// different spellings of the same file give the same key
+	static std::string canonicalPath(const std::string& path);
+
+	~TextureCache();
+
+private:
+	std::vector<TextureCacheEntry> entries; // Indexed by texture id
+	std::unordered_map<std::string, int> pathTextures;
+	std::unordered_multimap<uint64_t, int> contentTextures;
+};
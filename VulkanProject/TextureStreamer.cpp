@@ -0,0 +1,197 @@
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <fstream>
+
+TextureMips generateMips(const stbi_uc* pixels, int width, int height)
+{
+	TextureMips mips;
+	mips.levels.push_back(std::vector<stbi_uc>(pixels, pixels + static_cast<size_t>(width) * height * 4));
+	mips.widths.push_back(static_cast<uint32_t>(width));
+	mips.heights.push_back(static_cast<uint32_t>(height));
+
+	while (mips.widths.back() > 1 || mips.heights.back() > 1) {
+		const std::vector<stbi_uc>& source = mips.levels.back();
+		uint32_t sourceWidth = mips.widths.back();
+		uint32_t sourceHeight = mips.heights.back();
+		uint32_t levelWidth = std::max(1u, sourceWidth / 2);
+		uint32_t levelHeight = std::max(1u, sourceHeight / 2);
+
+		// Each texel averages the 2x2 block above it, clamped at the edge for odd (or 1 texel) dimensions
+		std::vector<stbi_uc> level(static_cast<size_t>(levelWidth) * levelHeight * 4);
+		for (uint32_t y = 0; y < levelHeight; y++) {
+			uint32_t y0 = std::min(y * 2, sourceHeight - 1);
+			uint32_t y1 = std::min(y * 2 + 1, sourceHeight - 1);
+			for (uint32_t x = 0; x < levelWidth; x++) {
+				uint32_t x0 = std::min(x * 2, sourceWidth - 1);
+				uint32_t x1 = std::min(x * 2 + 1, sourceWidth - 1);
+				for (uint32_t channel = 0; channel < 4; channel++) {
+					uint32_t sum = source[(static_cast<size_t>(y0) * sourceWidth + x0) * 4 + channel]
+						+ source[(static_cast<size_t>(y0) * sourceWidth + x1) * 4 + channel]
+						+ source[(static_cast<size_t>(y1) * sourceWidth + x0) * 4 + channel]
+						+ source[(static_cast<size_t>(y1) * sourceWidth + x1) * 4 + channel];
+					level[(static_cast<size_t>(y) * levelWidth + x) * 4 + channel] = static_cast<stbi_uc>((sum + 2) / 4);
+				}
+			}
+		}
+
+		mips.levels.push_back(level);
+		mips.widths.push_back(levelWidth);
+		mips.heights.push_back(levelHeight);
+	}
+
+	return mips;
+}
+
+uint32_t findMipLevel(const TextureMips& mips, uint32_t maxSize)
+{
+	uint32_t level = 0;
+	while (level + 1 < mips.levels.size() && std::max(mips.widths[level], mips.heights[level]) > maxSize) {
+		level++;
+	}
+
+	return level;
+}
+
+size_t getMipLevelBytes(const TextureMips& mips, uint32_t level)
+{
+	return static_cast<size_t>(mips.widths[level]) * mips.heights[level] * 4;
+}
+
+bool hasMipPixels(const TextureMips& mips)
+{
+	// Level 0 is never empty while held, it has at least one texel
+	return !mips.levels.empty() && !mips.levels[0].empty();
+}
+
+void freeMipPixels(TextureMips* mips)
+{
+	for (std::vector<stbi_uc>& level : mips->levels) {
+		std::vector<stbi_uc>().swap(level);
+	}
+}
+
+TextureMips decodeTexture(const std::vector<stbi_uc>& fileData)
+{
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load_from_memory(fileData.data(), static_cast<int>(fileData.size()), &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels) {
+		return TextureMips();
+	}
+
+	TextureMips mips = generateMips(pixels, width, height);
+	stbi_image_free(pixels);
+
+	return mips;
+}
+
+TextureStreamer::TextureStreamer()
+{
+}
+
+void TextureStreamer::start()
+{
+	if (this->worker.joinable()) {
+		return;
+	}
+
+	this->stopping = false;
+	this->worker = std::thread(&TextureStreamer::run, this);
+}
+
+void TextureStreamer::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+		this->requests.clear();
+	}
+	this->requestAdded.notify_all();
+
+	if (this->worker.joinable()) {
+		this->worker.join();
+	}
+
+	// The dropped requests won't be collected, only results already finished still can be
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->pendingCount = this->finished.size();
+}
+
+void TextureStreamer::requestFile(int textureId, const std::string& fileName, std::vector<stbi_uc> fileData)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		Request request = { textureId, fileName, std::move(fileData), "" };
+		this->requests.push_back(std::move(request));
+		this->pendingCount++;
+	}
+	this->requestAdded.notify_one();
+}
+
+void TextureStreamer::requestFile(int textureId, const std::string& fileName, const std::string& filePath)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		Request request = { textureId, fileName, std::vector<stbi_uc>(), filePath };
+		this->requests.push_back(std::move(request));
+		this->pendingCount++;
+	}
+	this->requestAdded.notify_one();
+}
+
+std::vector<DecodedTexture> TextureStreamer::collect()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	std::vector<DecodedTexture> results;
+	results.swap(this->finished);
+	this->pendingCount -= results.size();
+
+	return results;
+}
+
+size_t TextureStreamer::getPendingCount()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->pendingCount;
+}
+
+void TextureStreamer::run()
+{
+	while (true) {
+		Request request;
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->requestAdded.wait(lock, [this]() { return this->stopping || !this->requests.empty(); });
+			if (this->stopping) {
+				return;
+			}
+
+			request = std::move(this->requests.front());
+			this->requests.erase(this->requests.begin());
+		}
+
+		// Reading, decoding and filtering happen without the lock, so the render thread is never held up by them. A file
+		// that can't be read decodes to no mips, the same as one that can't be decoded
+		if (request.fileData.empty() && !request.filePath.empty()) {
+			std::ifstream file(request.filePath, std::ios::binary | std::ios::ate);
+			if (file.is_open()) {
+				request.fileData.resize(static_cast<size_t>(file.tellg()));
+				file.seekg(0);
+				file.read(reinterpret_cast<char*>(request.fileData.data()), request.fileData.size());
+			}
+		}
+
+		DecodedTexture decoded;
+		decoded.textureId = request.textureId;
+		decoded.fileName = request.fileName;
+		decoded.mips = decodeTexture(request.fileData);
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->finished.push_back(std::move(decoded));
+	}
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	this->stop();
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "stb_image.h"
+
+// A texture's full mip chain in RGBA8, level 0 at full size and each level after half the one before (down to 1x1). The
+// pixels can be freed while keeping the sizes, for textures whose levels are all on the device
+struct TextureMips {
+	std::vector<std::vector<stbi_uc>> levels;
+	std::vector<uint32_t> widths;
+	std::vector<uint32_t> heights;
+};
+
+// Box filters pixels down to 1x1
+TextureMips generateMips(const stbi_uc* pixels, int width, int height);
+
+// Most detailed level no bigger than maxSize in either dimension
+uint32_t findMipLevel(const TextureMips& mips, uint32_t maxSize);
+
+// Size of a level's pixels, whether or not they're held
+size_t getMipLevelBytes(const TextureMips& mips, uint32_t level);
+// Whether the levels' pixels are held rather than just their sizes
+bool hasMipPixels(const TextureMips& mips);
+// Frees every level's pixels, keeping their sizes
+void freeMipPixels(TextureMips* mips);
+
+// Decodes an image file's bytes to RGBA and generates its mips, empty if it couldn't be decoded
+TextureMips decodeTexture(const std::vector<stbi_uc>& fileData);
+
+// A texture file decoded (with its mips generated) on the streaming thread
+struct DecodedTexture {
+	int textureId;
+	std::string fileName;
+	TextureMips mips; // Empty if the file couldn't be loaded
+};
+
+// Decodes texture files and generates their mips on a background thread, so loading a model doesn't wait for them.
+// The files are read by the caller (which hashes them for the texture cache), uploading stays on the render thread,
+// which picks up finished textures with collect
+class TextureStreamer
+{
+public:
+	TextureStreamer();
+
+	void start();
+	void stop();
+
+	// fileData is the file's bytes, textureId and fileName are handed back with the result
+	void requestFile(int textureId, const std::string& fileName, std::vector<stbi_uc> fileData);
+	// Same, but the file at filePath is read on the streaming thread too (eg to decode a texture again for mips that were freed)
+	void requestFile(int textureId, const std::string& fileName, const std::string& filePath);
+
+	// Textures finished since the last call, in the order they were requested
+	std::vector<DecodedTexture> collect();
+
+	// Number of requested textures not yet collected
+	size_t getPendingCount();
+
+	~TextureStreamer();
+
+private:
+	struct Request {
+		int textureId;
+		std::string fileName;
+		std::vector<stbi_uc> fileData;
+		std::string filePath; // Read on the streaming thread if there's no fileData
+	};
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable requestAdded;
+	bool stopping = false;
+
+	std::vector<Request> requests;
+	std::vector<DecodedTexture> finished;
+	size_t pendingCount = 0;
+
+	void run();
+};
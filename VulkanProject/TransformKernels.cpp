@@ -0,0 +1,188 @@
+#include "TransformKernels.h"
+
+#include <cstdint>
+
+void TransformSoA::resize(size_t count)
+{
+	// Padded to a multiple of 4 so the SIMD loop never reads past the end
+	size_t padded = (count + 3) & ~static_cast<size_t>(3);
+	AlignedFloats* components[] = { &positionX, &positionY, &positionZ, &rotationX, &rotationY, &rotationZ, &rotationW, &scaleX, &scaleY, &scaleZ };
+	for (AlignedFloats* component : components) {
+		component->resize(padded, 0.0f);
+	}
+
+	// Padding is left as identity
+	for (size_t i = count; i < padded; i++) {
+		this->set(i, glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+	}
+	this->count = count;
+}
+
+size_t TransformSoA::size() const
+{
+	return this->count;
+}
+
+void TransformSoA::set(size_t index, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	this->positionX[index] = position.x;
+	this->positionY[index] = position.y;
+	this->positionZ[index] = position.z;
+	this->rotationX[index] = rotation.x;
+	this->rotationY[index] = rotation.y;
+	this->rotationZ[index] = rotation.z;
+	this->rotationW[index] = rotation.w;
+	this->scaleX[index] = scale.x;
+	this->scaleY[index] = scale.y;
+	this->scaleZ[index] = scale.z;
+}
+
+void composeTransforms(const TransformSoA& transforms, glm::mat4* out)
+{
+	size_t count = transforms.size();
+	size_t i = 0;
+
+#ifdef TRANSFORM_KERNELS_SSE2
+	// 4 objects per iteration, one per lane, then transposed so each object's columns are stored together
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 x = _mm_load_ps(&transforms.rotationX[i]);
+		__m128 y = _mm_load_ps(&transforms.rotationY[i]);
+		__m128 z = _mm_load_ps(&transforms.rotationZ[i]);
+		__m128 w = _mm_load_ps(&transforms.rotationW[i]);
+		__m128 sx = _mm_load_ps(&transforms.scaleX[i]);
+		__m128 sy = _mm_load_ps(&transforms.scaleY[i]);
+		__m128 sz = _mm_load_ps(&transforms.scaleZ[i]);
+
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+		// Rotation matrix from the quaternion (same as glm::mat3_cast), with each column scaled
+		__m128 c0x = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+		__m128 c0y = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+		__m128 c0z = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+
+		__m128 c1x = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+		__m128 c1y = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+		__m128 c1z = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+
+		__m128 c2x = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+		__m128 c2y = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+		__m128 c2z = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+
+		__m128 c3x = _mm_load_ps(&transforms.positionX[i]);
+		__m128 c3y = _mm_load_ps(&transforms.positionY[i]);
+		__m128 c3z = _mm_load_ps(&transforms.positionZ[i]);
+		__m128 c3w = one;
+
+		__m128 c0w = zero, c1w = zero, c2w = zero;
+		_MM_TRANSPOSE4_PS(c0x, c0y, c0z, c0w);
+		_MM_TRANSPOSE4_PS(c1x, c1y, c1z, c1w);
+		_MM_TRANSPOSE4_PS(c2x, c2y, c2z, c2w);
+		_MM_TRANSPOSE4_PS(c3x, c3y, c3z, c3w);
+
+		// After transposing, register k of each group is object k's column
+		__m128 columns[4][4] = {
+			{ c0x, c1x, c2x, c3x },
+			{ c0y, c1y, c2y, c3y },
+			{ c0z, c1z, c2z, c3z },
+			{ c0w, c1w, c2w, c3w } };
+		for (int object = 0; object < 4; object++) {
+			float* matrix = &out[i + object][0][0];
+			_mm_storeu_ps(matrix, columns[object][0]);
+			_mm_storeu_ps(matrix + 4, columns[object][1]);
+			_mm_storeu_ps(matrix + 8, columns[object][2]);
+			_mm_storeu_ps(matrix + 12, columns[object][3]);
+		}
+	}
+#endif
+
+	// Whatever's left (or everything without SSE)
+	for (; i < count; i++) {
+		glm::quat rotation(transforms.rotationW[i], transforms.rotationX[i], transforms.rotationY[i], transforms.rotationZ[i]);
+		glm::mat3 rotationScale = glm::mat3_cast(rotation);
+		rotationScale[0] *= transforms.scaleX[i];
+		rotationScale[1] *= transforms.scaleY[i];
+		rotationScale[2] *= transforms.scaleZ[i];
+
+		out[i] = glm::mat4(rotationScale);
+		out[i][3] = glm::vec4(transforms.positionX[i], transforms.positionY[i], transforms.positionZ[i], 1.0f);
+	}
+}
+
+#ifdef TRANSFORM_KERNELS_SSE2
+// Column of lhs * rhs, where rhsColumn is a column of rhs: sum of lhs's columns weighted by rhsColumn's components
+static inline __m128 multiplyColumn(const __m128 lhs[4], __m128 rhsColumn)
+{
+	__m128 result = _mm_mul_ps(lhs[0], _mm_shuffle_ps(rhsColumn, rhsColumn, _MM_SHUFFLE(0, 0, 0, 0)));
+	result = _mm_add_ps(result, _mm_mul_ps(lhs[1], _mm_shuffle_ps(rhsColumn, rhsColumn, _MM_SHUFFLE(1, 1, 1, 1))));
+	result = _mm_add_ps(result, _mm_mul_ps(lhs[2], _mm_shuffle_ps(rhsColumn, rhsColumn, _MM_SHUFFLE(2, 2, 2, 2))));
+	result = _mm_add_ps(result, _mm_mul_ps(lhs[3], _mm_shuffle_ps(rhsColumn, rhsColumn, _MM_SHUFFLE(3, 3, 3, 3))));
+	return result;
+}
+#endif
+
+void multiplyTransforms(const glm::mat4& lhs, const glm::mat4* rhs, glm::mat4* out, size_t count)
+{
+#ifdef TRANSFORM_KERNELS_SSE2
+	// lhs stays in registers for the whole batch
+	const __m128 lhsColumns[4] = {
+		_mm_loadu_ps(&lhs[0][0]), _mm_loadu_ps(&lhs[1][0]), _mm_loadu_ps(&lhs[2][0]), _mm_loadu_ps(&lhs[3][0]) };
+
+	for (size_t i = 0; i < count; i++) {
+		const float* in = &rhs[i][0][0];
+		float* result = &out[i][0][0];
+		for (int column = 0; column < 4; column++) {
+			_mm_storeu_ps(result + column * 4, multiplyColumn(lhsColumns, _mm_loadu_ps(in + column * 4)));
+		}
+	}
+#else
+	for (size_t i = 0; i < count; i++) {
+		out[i] = lhs * rhs[i];
+	}
+#endif
+}
+
+void writeObjectTransforms(const glm::mat4& viewProjection, const glm::mat4* models, size_t count, ObjectTransform* out)
+{
+#ifdef TRANSFORM_KERNELS_SSE2
+	const __m128 vpColumns[4] = {
+		_mm_loadu_ps(&viewProjection[0][0]), _mm_loadu_ps(&viewProjection[1][0]),
+		_mm_loadu_ps(&viewProjection[2][0]), _mm_loadu_ps(&viewProjection[3][0]) };
+
+	// Streaming stores go straight out to (write combined) GPU memory without first reading the cache line in, but need
+	// 16 byte alignment, which mapped memory always has in practice
+	bool aligned = (reinterpret_cast<uintptr_t>(out) & 15) == 0;
+
+	for (size_t i = 0; i < count; i++) {
+		const float* model = &models[i][0][0];
+		float* destination = &out[i].model[0][0];
+
+		for (int column = 0; column < 4; column++) {
+			__m128 modelColumn = _mm_loadu_ps(model + column * 4);
+			__m128 mvpColumn = multiplyColumn(vpColumns, modelColumn);
+
+			if (aligned) {
+				_mm_stream_ps(destination + column * 4, modelColumn);
+				_mm_stream_ps(destination + 16 + column * 4, mvpColumn);
+			}
+			else {
+				_mm_storeu_ps(destination + column * 4, modelColumn);
+				_mm_storeu_ps(destination + 16 + column * 4, mvpColumn);
+			}
+		}
+	}
+
+	// Make the streamed writes visible before the GPU is told to read them
+	_mm_sfence();
+#else
+	for (size_t i = 0; i < count; i++) {
+		out[i].model = models[i];
+		out[i].mvp = viewProjection * models[i];
+	}
+#endif
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <cstdlib>
+#include <new>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+// Per object data read by the vertex shader (std430, indexed by instance)
+struct ObjectTransform {
+	glm::mat4 model;
+	glm::mat4 mvp;
+};
+
+// Allocator for SIMD arrays, so kernels can use aligned loads and each array starts on its own cache line
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+	typedef T value_type;
+
+	AlignedAllocator() {}
+	template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+	template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	T* allocate(size_t count)
+	{
+		// Round up so the size is a multiple of the alignment, as aligned_alloc requires
+		size_t bytes = (count * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+#ifdef _MSC_VER
+		void* memory = _aligned_malloc(bytes, Alignment);
+#else
+		void* memory = aligned_alloc(Alignment, bytes);
+#endif
+		if (!memory) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(memory);
+	}
+
+	void deallocate(T* memory, size_t)
+	{
+#ifdef _MSC_VER
+		_aligned_free(memory);
+#else
+		free(memory);
+#endif
+	}
+
+	template <typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+	template <typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+typedef std::vector<float, AlignedAllocator<float>> AlignedFloats;
+
+// Translation, rotation and scale of many objects, one array per component so 4 objects fit in an SSE register
+struct TransformSoA {
+	AlignedFloats positionX, positionY, positionZ;
+	AlignedFloats rotationX, rotationY, rotationZ, rotationW;
+	AlignedFloats scaleX, scaleY, scaleZ;
+
+	void resize(size_t count);
+	size_t size() const;
+	void set(size_t index, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+
+private:
+	size_t count = 0;
+};
+
+// Builds translation * rotation * scale matrices from the components
+void composeTransforms(const TransformSoA& transforms, glm::mat4* out);
+
+// out[i] = lhs * rhs[i]
+void multiplyTransforms(const glm::mat4& lhs, const glm::mat4* rhs, glm::mat4* out, size_t count);
+
+// Writes each model matrix and viewProjection * model to out, which can be mapped GPU memory (write only, as reading
+// back write combined memory is very slow)
+void writeObjectTransforms(const glm::mat4& viewProjection, const glm::mat4* models, size_t count, ObjectTransform* out);
@@ -0,0 +1,179 @@
+#include "TriangleBvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Hits closer than this to the ray's origin are ignored
+const float RAYCAST_EPSILON = 1e-7f;
+// Triangles this close to edge on are skipped, small enough not to lose tiny but valid triangles
+const float RAYCAST_DETERMINANT_EPSILON = 1e-20f;
+
+TriangleBvh::TriangleBvh()
+{
+}
+
+void TriangleBvh::build(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t firstIndex, uint32_t indexCount)
+{
+	size_t triangleCount = indexCount / 3;
+	const uint32_t* triangleIndices = indices.data() + firstIndex;
+
+	std::vector<AABB> triangleBounds(triangleCount);
+	for (size_t i = 0; i < triangleCount; i++) {
+		triangleBounds[i].grow(vertices[triangleIndices[i * 3]].pos);
+		triangleBounds[i].grow(vertices[triangleIndices[i * 3 + 1]].pos);
+		triangleBounds[i].grow(vertices[triangleIndices[i * 3 + 2]].pos);
+	}
+	this->bvh.build(triangleBounds);
+
+	// -- Copy triangles into leaf order
+	size_t padded = triangleCount + 3;
+	AlignedFloats* components[] = { &vertexX, &vertexY, &vertexZ, &edge1X, &edge1Y, &edge1Z, &edge2X, &edge2Y, &edge2Z };
+	for (AlignedFloats* component : components) {
+		component->assign(padded, 0.0f);
+	}
+
+	const std::vector<uint32_t>& order = this->bvh.getItemOrder();
+	this->triangleIds = order;
+
+	for (size_t i = 0; i < triangleCount; i++) {
+		uint32_t triangle = order[i];
+		glm::vec3 a = vertices[triangleIndices[triangle * 3]].pos;
+		glm::vec3 b = vertices[triangleIndices[triangle * 3 + 1]].pos;
+		glm::vec3 c = vertices[triangleIndices[triangle * 3 + 2]].pos;
+		glm::vec3 edge1 = b - a;
+		glm::vec3 edge2 = c - a;
+
+		this->vertexX[i] = a.x;
+		this->vertexY[i] = a.y;
+		this->vertexZ[i] = a.z;
+		this->edge1X[i] = edge1.x;
+		this->edge1Y[i] = edge1.y;
+		this->edge1Z[i] = edge1.z;
+		this->edge2X[i] = edge2.x;
+		this->edge2Y[i] = edge2.y;
+		this->edge2Z[i] = edge2.z;
+	}
+}
+
+bool TriangleBvh::raycast(const Ray& ray, float maxDistance, uint32_t* triangle, float* distance) const
+{
+	float closest = maxDistance;
+	uint32_t hit = UINT32_MAX;
+
+	this->bvh.traverseRay(ray, maxDistance, [&](uint32_t first, uint32_t count, float* leafMaxDistance) {
+		this->intersectLeaf(ray, first, count, leafMaxDistance, &hit);
+		closest = *leafMaxDistance;
+	});
+
+	if (hit == UINT32_MAX) {
+		return false;
+	}
+
+	*triangle = hit;
+	*distance = closest;
+	return true;
+}
+
+void TriangleBvh::intersectLeaf(const Ray& ray, uint32_t first, uint32_t count, float* maxDistance, uint32_t* triangle) const
+{
+	// Moller-Trumbore, for four triangles at a time
+#ifdef BVH_SSE2
+	__m128 originX = _mm_set1_ps(ray.origin.x);
+	__m128 originY = _mm_set1_ps(ray.origin.y);
+	__m128 originZ = _mm_set1_ps(ray.origin.z);
+	__m128 directionX = _mm_set1_ps(ray.direction.x);
+	__m128 directionY = _mm_set1_ps(ray.direction.y);
+	__m128 directionZ = _mm_set1_ps(ray.direction.z);
+	__m128 epsilon = _mm_set1_ps(RAYCAST_EPSILON);
+	__m128 determinantEpsilon = _mm_set1_ps(RAYCAST_DETERMINANT_EPSILON);
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 signMask = _mm_set1_ps(-0.0f);
+
+	for (uint32_t i = first; i < first + count; i += 4) {
+		__m128 edge1X = _mm_loadu_ps(&this->edge1X[i]);
+		__m128 edge1Y = _mm_loadu_ps(&this->edge1Y[i]);
+		__m128 edge1Z = _mm_loadu_ps(&this->edge1Z[i]);
+		__m128 edge2X = _mm_loadu_ps(&this->edge2X[i]);
+		__m128 edge2Y = _mm_loadu_ps(&this->edge2Y[i]);
+		__m128 edge2Z = _mm_loadu_ps(&this->edge2Z[i]);
+
+		// p = direction x edge2
+		__m128 pX = _mm_sub_ps(_mm_mul_ps(directionY, edge2Z), _mm_mul_ps(directionZ, edge2Y));
+		__m128 pY = _mm_sub_ps(_mm_mul_ps(directionZ, edge2X), _mm_mul_ps(directionX, edge2Z));
+		__m128 pZ = _mm_sub_ps(_mm_mul_ps(directionX, edge2Y), _mm_mul_ps(directionY, edge2X));
+
+		__m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1X, pX), _mm_mul_ps(edge1Y, pY)), _mm_mul_ps(edge1Z, pZ));
+		__m128 inverseDeterminant = _mm_div_ps(one, determinant);
+
+		__m128 tX = _mm_sub_ps(originX, _mm_loadu_ps(&this->vertexX[i]));
+		__m128 tY = _mm_sub_ps(originY, _mm_loadu_ps(&this->vertexY[i]));
+		__m128 tZ = _mm_sub_ps(originZ, _mm_loadu_ps(&this->vertexZ[i]));
+
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tX, pX), _mm_mul_ps(tY, pY)), _mm_mul_ps(tZ, pZ)), inverseDeterminant);
+
+		// q = t x edge1
+		__m128 qX = _mm_sub_ps(_mm_mul_ps(tY, edge1Z), _mm_mul_ps(tZ, edge1Y));
+		__m128 qY = _mm_sub_ps(_mm_mul_ps(tZ, edge1X), _mm_mul_ps(tX, edge1Z));
+		__m128 qZ = _mm_sub_ps(_mm_mul_ps(tX, edge1Y), _mm_mul_ps(tY, edge1X));
+
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, qX), _mm_mul_ps(directionY, qY)), _mm_mul_ps(directionZ, qZ)), inverseDeterminant);
+		__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2X, qX), _mm_mul_ps(edge2Y, qY)), _mm_mul_ps(edge2Z, qZ)), inverseDeterminant);
+
+		// Comparisons with NaN (from degenerate triangles) are false, so those lanes drop out too
+		__m128 hits = _mm_cmpgt_ps(_mm_andnot_ps(signMask, determinant), determinantEpsilon);
+		hits = _mm_and_ps(hits, _mm_cmpge_ps(u, zero));
+		hits = _mm_and_ps(hits, _mm_cmpge_ps(v, zero));
+		hits = _mm_and_ps(hits, _mm_cmple_ps(_mm_add_ps(u, v), one));
+		hits = _mm_and_ps(hits, _mm_cmpgt_ps(t, epsilon));
+		hits = _mm_and_ps(hits, _mm_cmplt_ps(t, _mm_set1_ps(*maxDistance)));
+
+		// Lanes past the end of the leaf belong to other leaves (or the padding)
+		int mask = _mm_movemask_ps(hits) & ((1 << std::min(4u, first + count - i)) - 1);
+		if (mask == 0) {
+			continue;
+		}
+
+		float distances[4];
+		_mm_storeu_ps(distances, t);
+		for (int lane = 0; lane < 4; lane++) {
+			if ((mask & (1 << lane)) && distances[lane] < *maxDistance) {
+				*maxDistance = distances[lane];
+				*triangle = this->triangleIds[i + lane];
+			}
+		}
+	}
+#else
+	for (uint32_t i = first; i < first + count; i++) {
+		glm::vec3 edge1 = glm::vec3(this->edge1X[i], this->edge1Y[i], this->edge1Z[i]);
+		glm::vec3 edge2 = glm::vec3(this->edge2X[i], this->edge2Y[i], this->edge2Z[i]);
+
+		glm::vec3 p = glm::cross(ray.direction, edge2);
+		float determinant = glm::dot(edge1, p);
+		if (std::abs(determinant) <= RAYCAST_DETERMINANT_EPSILON) {
+			continue;
+		}
+		float inverseDeterminant = 1.0f / determinant;
+
+		glm::vec3 toOrigin = ray.origin - glm::vec3(this->vertexX[i], this->vertexY[i], this->vertexZ[i]);
+		float u = glm::dot(toOrigin, p) * inverseDeterminant;
+		glm::vec3 q = glm::cross(toOrigin, edge1);
+		float v = glm::dot(ray.direction, q) * inverseDeterminant;
+		float t = glm::dot(edge2, q) * inverseDeterminant;
+
+		if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > RAYCAST_EPSILON && t < *maxDistance) {
+			*maxDistance = t;
+			*triangle = this->triangleIds[i];
+		}
+	}
+#endif
+}
+
+size_t TriangleBvh::getTriangleCount() const
+{
+	return this->triangleIds.size();
+}
+
+TriangleBvh::~TriangleBvh()
+{
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+
+#include "Utilities.h"
+#include "Bvh.h"
+#include "TransformKernels.h"
+
+// BVH over a mesh's triangles for ray casts on the CPU. Triangles are copied out of the vertex and index data in the
+// order the tree's leaves use them, as a vertex and two edges with one array per component, so a leaf's triangles can
+// be tested four at a time
+class TriangleBvh
+{
+public:
+	TriangleBvh();
+
+	// Triangles are indices[firstIndex, firstIndex + indexCount) in threes, numbered from 0 in raycast's results
+	void build(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t firstIndex, uint32_t indexCount);
+
+	// Nearest triangle the ray hits (from either side) closer than maxDistance. Distance is in units of the ray's
+	// direction, so it stays the same if the ray was transformed into this mesh's space
+	bool raycast(const Ray& ray, float maxDistance, uint32_t* triangle, float* distance) const;
+
+	size_t getTriangleCount() const;
+
+	~TriangleBvh();
+
+private:
+	Bvh bvh;
+
+	// In leaf order, padded by 3 degenerate triangles so four can always be loaded from any leaf
+	AlignedFloats vertexX, vertexY, vertexZ;
+	AlignedFloats edge1X, edge1Y, edge1Z;
+	AlignedFloats edge2X, edge2Y, edge2Z;
+	std::vector<uint32_t> triangleIds;
+
+	void intersectLeaf(const Ray& ray, uint32_t first, uint32_t count, float* maxDistance, uint32_t* triangle) const;
+};
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <fstream>
+#include <algorithm>
+#include <functional>
 
 #define GLFW_INCLUDE_VULKAN
 
@@ -8,8 +10,28 @@
 
 #include <glm/glm.hpp>
 
-const int MAX_FRAME_DRAWS = 2;
+#include "DeviceMemory.h"
+#include "GpuTimeline.h"
+
+const int MAX_FRAME_DRAWS = 2; // Default number of frames in flight, see RendererConfig
 const int MAX_OBJECTS = 20;
+const uint32_t INITIAL_OBJECT_CAPACITY = 1024; // Object transforms each object buffer starts with room for, doubled as needed
+const VkDeviceSize MAX_RELOAD_BYTES_PER_FRAME = 64 * 1024 * 1024; // Evicted textures and meshes reloaded in one frame, to bound the hitch
+const VkDeviceSize MAX_STREAM_BYTES_PER_FRAME = 32 * 1024 * 1024; // Texture mip levels uploaded in one frame
+const uint32_t TEXTURE_STREAM_INITIAL_SIZE = 64; // Textures start with their mips up to this size, the rest stream in as needed
+const uint32_t TEXTURE_STREAM_TRIM_FRAMES = 120; // Frames a texture's top mips go unneeded before they're freed
+const uint32_t TEXTURE_LEVEL_NONE = 0xFFFFFFFF; // No mip level of a texture is resident (or needed)
+const VkDeviceSize MEMORY_BLOCK_SIZE = 64 * 1024 * 1024; // Device memory blocks mesh buffers and texture images are placed in
+const VkDeviceSize MAX_DEFRAG_BYTES_PER_FRAME = 16 * 1024 * 1024; // Textures and meshes copied out of sparse blocks in one frame
+const double DEFRAG_TIME_BUDGET = 0.5; // Milliseconds of CPU time spent starting moves in one frame
+const float DEFRAG_BLOCK_USAGE = 0.5f; // Blocks less full than this are emptied by a defragmentation pass
+const uint32_t DEFRAG_CHECK_FRAMES = 600; // Frames between looking for blocks worth emptying
+const uint32_t MAX_SHADOW_CASCADES = 4; // Sun shadow cascades there can be, see RendererConfig
+const uint32_t DEPTH_PREPASS_PROBE_FRAMES = 120; // With the pre-pass chosen automatically, one frame in this many is drawn the other way to measure it
+const double DEPTH_PREPASS_SMOOTHING = 0.1; // Weight of each new measurement in the averages the pre-pass is chosen from
+const uint32_t TEXTURE_DESCRIPTOR_SETS_PER_POOL = 64; // Texture sets each of a frame's descriptor pools holds, more pools are added as needed
+const char* const PIPELINE_CACHE_FILE = "Shaders/cache/pipelines.bin"; // Pipeline cache data, loaded at startup and saved at cleanup
+const uint32_t TIMESTAMPS_PER_FRAME = 2 + 2 * MAX_SHADOW_CASCADES; // Start and end of the frame, then of each shadow cascade
 
 const std::vector<const char*> deviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
@@ -20,6 +42,7 @@ struct Vertex
 	glm::vec3 pos; // Vertex position (x, y, z)
 	glm::vec3 col; // Vertex colour (r, g, b)
 	glm::vec2 tex; // Texture coords (u, v)
+	glm::vec3 normal; // Vertex normal (x, y, z), for lighting
 };
 
 // Indices (locations) of queue families (if they exist at all)
@@ -44,6 +67,90 @@ struct SwapchainImage {
 	VkImageView imageView;
 };
 
+// Whether depth is laid down by a depth only subpass before the G-buffer is written, so only the visible surface is shaded
+enum class DepthPrePassMode {
+	Off,
+	On,
+	Auto // Used while the measured overdraw is above RendererConfig::depthPrePassOverdraw
+};
+
+// What the lighting subpass outputs. A specialization constant of its pipeline, so the unused paths cost nothing
+enum class LightingMode : uint32_t {
+	Lit,
+	Unlit, // Albedo only
+	Normals // World space normals, for debugging
+};
+
+// Runtime settings chosen when the renderer is initialised
+struct RendererConfig {
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR; // Falls back to FIFO (always supported) if unavailable
+	uint32_t framesInFlight = MAX_FRAME_DRAWS; // Frames the CPU can queue ahead of the GPU, more = throughput, fewer = latency
+	double targetFps = 0.0; // Frame rate limit, 0 for unlimited
+	std::string preferredDevice; // Part of the physical device name to prefer (eg "llvmpipe"), empty for first suitable device
+	// Mesh LOD switches to level i + 1 when its bounding sphere covers less than lodThresholds[i] of the screen height (descending)
+	std::vector<float> lodThresholds = { 0.25f, 0.1f, 0.04f };
+	VkDeviceSize memoryBudget = 0; // Caps the budget of device local heaps in bytes, 0 to use what the driver reports
+	uint32_t shadowMapSize = 2048; // Width and height of each sun shadow cascade in texels
+	uint32_t shadowCascades = 4; // Cascades the sun's shadow is split into, up to MAX_SHADOW_CASCADES
+	// Blend between logarithmic (1) and even (0) spacing of the cascade splits, logarithmic gives near cascades more detail
+	float shadowSplitLambda = 0.75f;
+	float shadowDistance = 50.0f; // Distance in front of the camera shadows reach, at most the far plane
+	DepthPrePassMode depthPrePass = DepthPrePassMode::Auto;
+	float depthPrePassOverdraw = 1.5f; // Fragments shaded per covered pixel above which the automatic pre-pass is used
+	LightingMode lightingMode = LightingMode::Lit;
+	// Threads building pipelines first needed while drawing, so recording never waits for one. 0 builds them on the render
+	// thread when they're first needed
+	uint32_t pipelineThreads = 2;
+};
+
+// A single mesh of a model, as returned by the renderer's spatial queries
+struct MeshInstance {
+	uint32_t modelIndex;
+	uint32_t meshIndex;
+};
+
+// Closest triangle hit by a ray cast into the scene
+struct RaycastHit {
+	uint32_t modelIndex;
+	uint32_t meshIndex;
+	uint32_t triangle; // Index / 3 into the mesh's full detail indices
+	float distance; // Along the ray, in world units
+};
+
+// Timings of the most recent frames, used for profiling and benchmarking
+struct FrameStats {
+	uint64_t frameNumber = 0; // Number of frames drawn so far
+	double cpuRecordTime = 0.0; // Milliseconds spent recording the last frame's command buffer
+	double cpuFrameTime = 0.0; // Milliseconds of CPU work for the last frame, from after the frame wait to present
+	double frameWaitTime = 0.0; // Milliseconds the last frame spent waiting for a free frame slot (high when GPU bound)
+	double gpuTime = -1.0; // Milliseconds the GPU spent on the last completed frame (negative if not available yet)
+	double latency = -1.0; // Milliseconds from starting the last completed frame on the CPU to first seeing its timeline value reached (negative if not available yet)
+	uint32_t drawCount = 0; // Draw calls in the last frame
+	uint32_t bindCount = 0; // Binds and push constants recorded in the last frame
+	uint32_t bindsSkipped = 0; // Binds and push constants not recorded as the state was already bound
+	uint64_t trianglesDrawn = 0; // Triangles submitted in the last frame, after LOD selection
+	uint32_t nodesUpdated = 0; // Scene graph world transforms recomputed for the last frame
+	uint32_t objectsCulled = 0; // Meshes outside the view frustum, skipped before sorting
+	double transformTime = 0.0; // Milliseconds updating world transforms and writing the object buffer for the last frame
+	uint32_t resourcesEvicted = 0; // Textures and meshes freed in the last frame to stay within the memory budget
+	uint32_t resourcesReloaded = 0; // Evicted textures and meshes loaded again in the last frame as they came into view
+	uint32_t resourcesPending = 0; // Visible but not resident (no room or reload limit reached), drawn with the default texture or not at all
+	uint32_t texturesRefined = 0; // Textures given more detailed mip levels in the last frame
+	uint32_t texturesTrimmed = 0; // Textures whose most detailed mip levels were freed in the last frame as they weren't needed
+	uint32_t resourcesMoved = 0; // Textures and meshes copied out of blocks being emptied in the last frame
+	uint32_t descriptorSetsWritten = 0; // Texture descriptor sets allocated and written for the last frame, one per texture bound
+	// Milliseconds the GPU spent on each sun shadow cascade in the last completed frame (negative if not drawn or not available)
+	double shadowCascadeTimes[MAX_SHADOW_CASCADES] = { -1.0, -1.0, -1.0, -1.0 };
+	uint32_t shadowCascadesRefreshed = 0; // Cascades whose cached static shadows were redrawn for the last frame
+	uint32_t shadowCasterDraws = 0; // Static (when refreshed) and dynamic caster draws over every cascade in the last frame
+	bool depthPrePass = false; // Whether the last frame drew a depth pre-pass
+	double overdraw = -1.0; // G-buffer fragments shaded per covered pixel without the pre-pass, averaged (negative if not measured)
+	double gpuTimeWithPrePass = -1.0; // Average milliseconds of frames drawn with the pre-pass (negative if none measured)
+	double gpuTimeWithoutPrePass = -1.0; // Average milliseconds of frames drawn without it
+	// Frames so far drawn with a stand-in pipeline (or without the pre-pass) as one they needed was still being built
+	uint64_t pipelineFallbackFrames = 0;
+};
+
 static std::vector<char> readFile(const std::string& filename) {
 	// OPen stream from given file
 	// std::ios::binary telsl stream to read file as binary
@@ -71,6 +178,18 @@ static std::vector<char> readFile(const std::string& filename) {
 	return fileBuffer;
 }
 
+// 64 bit FNV-1a, continuing from hash so several pieces of data can be hashed together
+static uint64_t hashContent(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
 static uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t allowedTypes, VkMemoryPropertyFlags properties)
 {
 	// Get properties of physical device memory
@@ -125,7 +244,7 @@ static void createBuffer(
 		bufferProperties); // VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT: CPU can interact with memory. VK_MEMORY_PROERTY_HOST_COHERENT_BIT: allows placement of data straight into buffer after mapping (otherwise would have to specify manually)
 
 	// Allocate memory to vkDeviceMemory
-	result = vkAllocateMemory(device, &memoryAllocInfo, nullptr, bufferMemory);
+	result = allocateDeviceMemory(device, &memoryAllocInfo, bufferMemory);
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate vertext buffer memory");
 	}
@@ -159,7 +278,7 @@ static VkCommandBuffer beginCommandBuffer(VkDevice device, VkCommandPool command
 	return commandBuffer;
 }
 
-static void endAndSubmitCommandBuffer(VkDevice device, VkCommandPool commandPool, VkQueue queue, VkCommandBuffer commandBuffer) {
+static void endAndSubmitCommandBuffer(VkDevice device, VkCommandPool commandPool, VkQueue queue, VkCommandBuffer commandBuffer, GpuTimeline* timeline = nullptr) {
 
 	// End commands
 	vkEndCommandBuffer(commandBuffer);
@@ -170,14 +289,53 @@ static void endAndSubmitCommandBuffer(VkDevice device, VkCommandPool commandPool
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
 
-	// Submit transfer command 
-	// Because we don't have many meshes we can have a simple wait for queue to be done (instead of setting the fences/semaphores)
-	vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(queue);
+	if (timeline == nullptr) {
+		// Without a timeline, have a simple wait for queue to be done
+		vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+		vkQueueWaitIdle(queue);
+
+		// Free temporary command buffer back to pool
+		vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+		return;
+	}
+
+	// Signal the timeline instead of waiting, anything using the result waits on this value
+	uint64_t signalValue = timeline->nextValue();
+	VkSemaphore timelineSemaphore = timeline->getSemaphore();
+
+	VkTimelineSemaphoreSubmitInfo timelineSubmitInfo = {};
+	timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineSubmitInfo.signalSemaphoreValueCount = 1;
+	timelineSubmitInfo.pSignalSemaphoreValues = &signalValue;
+
+	submitInfo.pNext = &timelineSubmitInfo;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &timelineSemaphore;
+
+	VkResult result = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to submit transfer command buffer");
+	}
+
+	// Free temporary command buffer back to pool once the GPU is done with it
+	timeline->retire(signalValue, [device, commandPool, commandBuffer]() {
+		vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+	});
+}
 
-	// Free temporary command buffer back to pool
-	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+// Destroys a staging buffer once the last submission (that copied from it) is done, or straight away without a timeline
+static void destroyStagingBuffer(VkDevice device, VkBuffer buffer, VkDeviceMemory bufferMemory, GpuTimeline* timeline = nullptr)
+{
+	if (timeline == nullptr) {
+		vkDestroyBuffer(device, buffer, nullptr);
+		freeDeviceMemory(device, bufferMemory);
+		return;
+	}
 
+	timeline->retire(timeline->lastSubmittedValue(), [device, buffer, bufferMemory]() {
+		vkDestroyBuffer(device, buffer, nullptr);
+		freeDeviceMemory(device, bufferMemory);
+	});
 }
 
 static void copyBuffer(
@@ -186,7 +344,8 @@ static void copyBuffer(
 	VkCommandPool transferCommandPool,
 	VkBuffer srcBuffer,
 	VkBuffer dstBuffer,
-	VkDeviceSize bufferSize)
+	VkDeviceSize bufferSize,
+	GpuTimeline* timeline = nullptr)
 {
 	// Create buffer
 	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
@@ -201,11 +360,11 @@ static void copyBuffer(
 	vkCmdCopyBuffer(transferCommandBuffer, srcBuffer, dstBuffer, 1, &bufferCopyRegion);
 
 	// End and submit buffer to dst buffer
-	endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
+	endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer, timeline);
 }
 
 static void copyImageBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
-	VkBuffer srcBuffer, VkImage dstImage, uint32_t width, uint32_t height) {
+	VkBuffer srcBuffer, VkImage dstImage, uint32_t width, uint32_t height, GpuTimeline* timeline = nullptr) {
 
 	// Create buffer
 	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
@@ -226,11 +385,24 @@ static void copyImageBuffer(VkDevice device, VkQueue transferQueue, VkCommandPoo
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageRegion);
 
 	// End and submit buffer to dst buffer
-	endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
+	endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer, timeline);
+}
+
+// Copies each region (one per mip level) from srcBuffer in a single submission
+static void copyImageBufferLevels(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
+	VkBuffer srcBuffer, VkImage dstImage, const std::vector<VkBufferImageCopy>& regions, GpuTimeline* timeline = nullptr) {
+
+	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
+
+	vkCmdCopyBufferToImage(transferCommandBuffer, srcBuffer, dstImage,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+	endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer, timeline);
 }
 
 static void transitionImageLayout(VkDevice device, VkQueue queue,
-	VkCommandPool commandPool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout) {
+	VkCommandPool commandPool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, GpuTimeline* timeline = nullptr,
+	uint32_t levelCount = 1) {
 
 	// Create buffer
 	VkCommandBuffer commandBuffer = beginCommandBuffer(device, commandPool);
@@ -244,7 +416,7 @@ static void transitionImageLayout(VkDevice device, VkQueue queue,
 	imageMemoryBarrier.image = image;
 	imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT; // ASpect of image being altered
 	imageMemoryBarrier.subresourceRange.baseMipLevel = 0; // Firsst mip level to start alteations on
-	imageMemoryBarrier.subresourceRange.levelCount = 1; // Number of mip levels to start from base
+	imageMemoryBarrier.subresourceRange.levelCount = levelCount; // Number of mip levels to start from base
 	imageMemoryBarrier.subresourceRange.baseArrayLayer = 0; // First layer to start alterations on
 	imageMemoryBarrier.subresourceRange.layerCount = 1; // Number of layers to alter starting from baseArrayLayer
 
@@ -278,5 +450,139 @@ static void transitionImageLayout(VkDevice device, VkQueue queue,
 	);
 
 	// End and submit buffer to dst buffer
-	endAndSubmitCommandBuffer(device, commandPool, queue, commandBuffer);
+	endAndSubmitCommandBuffer(device, commandPool, queue, commandBuffer, timeline);
+}
+
+// Records copying each region (one per mip level) from srcImage, a texture frames may have been sampling, to dstImage, a
+// new image. The regions read levelCount levels of srcImage from srcBaseLevel. dstImage is left shader readable, srcImage
+// isn't usable afterwards
+static void recordImageCopyLevels(VkCommandBuffer commandBuffer, VkImage srcImage, VkImage dstImage, uint32_t srcBaseLevel, uint32_t levelCount,
+	const std::vector<VkImageCopy>& regions) {
+
+	VkImageMemoryBarrier barriers[2] = {};
+	for (VkImageMemoryBarrier& barrier : barriers) {
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = levelCount;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+	}
+
+	// Earlier submissions only read the source, so its layout can change once their fragment shaders are done
+	barriers[0].image = srcImage;
+	barriers[0].subresourceRange.baseMipLevel = srcBaseLevel;
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barriers[0].srcAccessMask = 0;
+	barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	barriers[1].image = dstImage;
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[1].srcAccessMask = 0;
+	barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr, 0, nullptr, 2, barriers);
+
+	vkCmdCopyImage(commandBuffer, srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		static_cast<uint32_t>(regions.size()), regions.data());
+
+	// Same as the end of an upload, so it's ready for the frames that wait on this submission
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &barriers[1]);
+}
+
+// Names used for present modes on the command line and in reports
+static std::string presentModeName(VkPresentModeKHR presentMode)
+{
+	switch (presentMode) {
+	case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+	case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+	case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo_relaxed";
+	default: return "unknown";
+	}
+}
+
+// Applies a renderer command line option (eg "--present-mode fifo") to config, returns false if arg isn't a renderer option
+static bool parseRendererConfigArg(const std::string& arg, const std::string& value, RendererConfig* config)
+{
+	if (arg == "--present-mode") {
+		if (value == "immediate") config->presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+		else if (value == "mailbox") config->presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+		else if (value == "fifo") config->presentMode = VK_PRESENT_MODE_FIFO_KHR;
+		else if (value == "fifo_relaxed") config->presentMode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+		else throw std::runtime_error("Unknown present mode (" + value + ")");
+	}
+	else if (arg == "--frames-in-flight") {
+		config->framesInFlight = static_cast<uint32_t>(std::max(1, std::atoi(value.c_str())));
+	}
+	else if (arg == "--target-fps") {
+		config->targetFps = std::atof(value.c_str());
+	}
+	else if (arg == "--device") {
+		config->preferredDevice = value;
+	}
+	else if (arg == "--vram-budget") {
+		// In megabytes
+		config->memoryBudget = static_cast<VkDeviceSize>(std::max(0.0, std::atof(value.c_str())) * 1024.0 * 1024.0);
+	}
+	else if (arg == "--shadow-map-size") {
+		config->shadowMapSize = static_cast<uint32_t>(std::max(16, std::atoi(value.c_str())));
+	}
+	else if (arg == "--shadow-cascades") {
+		config->shadowCascades = static_cast<uint32_t>(std::min(std::max(1, std::atoi(value.c_str())), static_cast<int>(MAX_SHADOW_CASCADES)));
+	}
+	else if (arg == "--shadow-split-lambda") {
+		config->shadowSplitLambda = static_cast<float>(std::min(std::max(0.0, std::atof(value.c_str())), 1.0));
+	}
+	else if (arg == "--shadow-distance") {
+		config->shadowDistance = static_cast<float>(std::max(0.1, std::atof(value.c_str())));
+	}
+	else if (arg == "--depth-prepass") {
+		if (value == "off") config->depthPrePass = DepthPrePassMode::Off;
+		else if (value == "on") config->depthPrePass = DepthPrePassMode::On;
+		else if (value == "auto") config->depthPrePass = DepthPrePassMode::Auto;
+		else throw std::runtime_error("Unknown depth pre-pass mode (" + value + ")");
+	}
+	else if (arg == "--depth-prepass-overdraw") {
+		config->depthPrePassOverdraw = static_cast<float>(std::max(1.0, std::atof(value.c_str())));
+	}
+	else if (arg == "--lighting") {
+		if (value == "lit") config->lightingMode = LightingMode::Lit;
+		else if (value == "unlit") config->lightingMode = LightingMode::Unlit;
+		else if (value == "normals") config->lightingMode = LightingMode::Normals;
+		else throw std::runtime_error("Unknown lighting mode (" + value + ")");
+	}
+	else if (arg == "--pipeline-threads") {
+		config->pipelineThreads = static_cast<uint32_t>(std::max(0, std::atoi(value.c_str())));
+	}
+	else if (arg == "--lod-thresholds") {
+		// Comma separated, eg "0.25,0.1,0.04", or "none" to always draw full detail
+		config->lodThresholds.clear();
+		size_t start = 0;
+		while (value != "none" && start < value.size()) {
+			size_t end = value.find(',', start);
+			if (end == std::string::npos) {
+				end = value.size();
+			}
+			config->lodThresholds.push_back(static_cast<float>(std::atof(value.substr(start, end - start).c_str())));
+			start = end + 1;
+		}
+		std::sort(config->lodThresholds.begin(), config->lodThresholds.end(), std::greater<float>());
+	}
+	else {
+		return false;
+	}
+
+	return true;
 }
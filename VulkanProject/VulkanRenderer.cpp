@@ -4,31 +4,77 @@ VulkanRenderer::VulkanRenderer()
 {
 }
 
-int VulkanRenderer::init(GLFWwindow* newWindow)
+int VulkanRenderer::init(GLFWwindow* newWindow, RendererConfig newConfig)
 {
 	this->window = newWindow;
-	
+	this->headless = false;
+	this->config = newConfig;
+
+	return this->initRenderer();
+}
+
+int VulkanRenderer::initHeadless(uint32_t width, uint32_t height, RendererConfig newConfig)
+{
+	// No window or surface, so the extent has to be given instead of taken from the surface
+	this->window = nullptr;
+	this->headless = true;
+	this->config = newConfig;
+	this->swapchainExtent = { width, height };
+
+	return this->initRenderer();
+}
+
+int VulkanRenderer::initRenderer()
+{
+	this->config.framesInFlight = std::max(this->config.framesInFlight, 1u);
+	this->config.shadowCascades = std::min(std::max(this->config.shadowCascades, 1u), MAX_SHADOW_CASCADES);
+	this->frameLimiter.setTargetFps(this->config.targetFps);
+
 	try {
 		std::cout << "Creating instance" << std::endl;
 		this->createInstance();
-		std::cout << "Creating surface" << std::endl;
-		this->createSurface();
+		if (!this->headless) {
+			std::cout << "Creating surface" << std::endl;
+			this->createSurface();
+		}
 		std::cout << "Creating physical device" << std::endl;
 		this->getPhysicalDevice();
 		std::cout << "Creating logical device" << std::endl;
 		this->createLogicalDevice();
-		std::cout << "Creating swapchain" << std::endl;
-		this->createSwapchain();
+		this->memoryAllocator.create(this->mainDevice.physicalDevice, this->mainDevice.logicalDevice);
+		this->residency.create(this->mainDevice.physicalDevice, &this->memoryAllocator, this->memoryBudgetSupported, this->config.memoryBudget);
+		if (this->headless) {
+			std::cout << "Creating offscreen images" << std::endl;
+			this->createOffscreenImages();
+		}
+		else {
+			std::cout << "Creating swapchain" << std::endl;
+			this->createSwapchain();
+		}
 		std::cout << "Creating render pass" << std::endl;
 		this->createRenderPass();
+		std::cout << "Creating shadow render passes" << std::endl;
+		this->createShadowRenderPasses();
+		std::cout << "Creating shader compiler" << std::endl;
+		this->createShaderCompiler();
+		std::cout << "Creating pipeline cache" << std::endl;
+		this->createPipelineCache();
 		std::cout << "Creating descriptor set layout" << std::endl;
 		this->createDescriptorSetLayout();
-		std::cout << "Creating push constant range" << std::endl;
-		this->createPushConstantRange();
 		std::cout << "Creating graphics pipeline" << std::endl;
 		this->createGraphicsPipeline();
-		std::cout << "Creating colour buffer" << std::endl;
-		this->createColourBufferImage();
+		std::cout << "Creating cluster pipeline" << std::endl;
+		this->createClusterPipeline();
+		std::cout << "Creating shadow pipeline" << std::endl;
+		this->createShadowPipeline();
+		ShaderCompilerStats shaderStats = this->shaderCompiler.getStats();
+		std::cout << "Shaders compiled: " << shaderStats.compiled << " (" << shaderStats.compileTime << "ms), read from cache: "
+			<< shaderStats.cacheHits << std::endl;
+		LayoutCacheStats layoutStats = this->layoutCache.getStats();
+		std::cout << "Layouts from shader reflection: " << layoutStats.setLayouts << " descriptor set, " << layoutStats.pipelineLayouts
+			<< " pipeline, for " << layoutStats.requests << " requests" << std::endl;
+		std::cout << "Creating G-buffer" << std::endl;
+		this->createGBufferImages();
 		std::cout << "Creating depth buffer image" << std::endl;
 		this->createDepthBufferImage();
 		std::cout << "Creating framebuffers" << std::endl;
@@ -39,24 +85,30 @@ int VulkanRenderer::init(GLFWwindow* newWindow)
 		this->createCommandBuffers();
 		std::cout << "Creating texture sampler" << std::endl;
 		this->createTextureSampler();
+		std::cout << "Creating shadow maps" << std::endl;
+		this->createShadowMaps();
 		//// NO LONGER USED BELOW BUT KEEPING FOR REFERENCE, AS THAT'S HOW MODEL WAS DONE VIA DYNAMIC BUFFERS
 		//std::cout << "Allocating dynamic buffer transfer space" << std::endl;
 		//this->allocateDynamicBufferTransferSpace();
 		std::cout << "Creating uniform buffers" << std::endl;
 		this->createUniformBuffers();
-		std::cout << "Creating descriptor pool" << std::endl;
-		this->createDescriptorPool();
+		std::cout << "Creating descriptor allocators" << std::endl;
+		this->createDescriptorAllocators();
 		std::cout << "Creating descriptor set" << std::endl;
 		this->createDescriptorSets();
 		std::cout << "Creating input descriptor set" << std::endl;
 		this->createInputDescriptorSets();
 		std::cout << "Creating synchronisation" << std::endl;
 		this->createSynchronization();
+		std::cout << "Creating timestamp query pool" << std::endl;
+		this->createTimestampQueryPool();
+		std::cout << "Creating pipeline statistics query pool" << std::endl;
+		this->createStatisticsQueryPool();
 
 		this->uboViewProjection.projection = glm::perspective(
-			glm::radians(45.0f),
+			this->fieldOfView,
 			(float)this->swapchainExtent.width / (float)this->swapchainExtent.height,
-			0.1f, 100.0f);
+			this->nearPlane, this->farPlane);
 		this->uboViewProjection.view = glm::lookAt(
 			glm::vec3(5.0f, 3.0f, 0.0f), // Where the camara is
 			glm::vec3(0.0f, 0.0f, 0.0f), // The target / centre (set to origin here)
@@ -65,8 +117,9 @@ int VulkanRenderer::init(GLFWwindow* newWindow)
 		// Vulkan inverts the coordinates, so we need to invert the y coordinate
 		uboViewProjection.projection[1][1] *= -1;
 
-		// Fallback / default texture (index 0)
-		this->createTexture("plain.png");
+		// Fallback / default texture (index 0), loaded in full now as it stands in for textures still streaming
+		this->textureStreamer.start();
+		this->createTexture("plain.png", false);
 
 	}
 	catch (const std::runtime_error& e) {
@@ -81,85 +134,325 @@ int VulkanRenderer::init(GLFWwindow* newWindow)
 
 void VulkanRenderer::updateModel(int modelId, glm::mat4 newModel)
 {
-	if (modelId >= this->modelList.size()) return;
+	if (modelId >= this->modelList.size() || this->modelList[modelId].getAssetId() < 0) return;
+
+	// Cached shadows have the static model where it was
+	if (this->modelList[modelId].isStatic()) {
+		this->staticShadowVersion++;
+	}
+	this->sceneGraph.setLocalTransform(this->modelList[modelId].getRootNode(), newModel);
+}
+
+void VulkanRenderer::updateModels(const int* modelIds, const glm::mat4* newModels, size_t count)
+{
+	this->batchNodes.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		if (modelIds[i] < 0 || modelIds[i] >= static_cast<int>(this->modelList.size()) || this->modelList[modelIds[i]].getAssetId() < 0) {
+			throw std::runtime_error("Attempted to update invalid model");
+		}
+		this->batchNodes[i] = this->modelList[modelIds[i]].getRootNode();
+		if (this->modelList[modelIds[i]].isStatic()) {
+			this->staticShadowVersion++;
+		}
+	}
+
+	this->sceneGraph.setLocalTransforms(this->batchNodes.data(), newModels, count);
+}
+
+void VulkanRenderer::updateModels(const int* modelIds, const TransformSoA& transforms)
+{
+	// Compose all the matrices in one SIMD pass, then set them as a batch
+	this->batchTransforms.resize(transforms.size());
+	composeTransforms(transforms, this->batchTransforms.data());
+	this->updateModels(modelIds, this->batchTransforms.data(), transforms.size());
+}
+
+void VulkanRenderer::updateView(glm::mat4 newView)
+{
+	this->uboViewProjection.view = newView;
+}
+
+void VulkanRenderer::setLights(const std::vector<Light>& newLights)
+{
+	this->lights.assign(newLights.begin(), newLights.begin() + std::min<size_t>(newLights.size(), MAX_LIGHTS));
+}
+
+void VulkanRenderer::setAmbientLight(glm::vec3 colour)
+{
+	this->ambientLight = colour;
+}
+
+void VulkanRenderer::setDirectionalLight(glm::vec3 direction, glm::vec3 colour, float intensity)
+{
+	// Cached shadows were drawn along the old direction, colour and intensity are only used when lighting
+	glm::vec3 newDirection = glm::normalize(direction);
+	if (newDirection != this->sunDirection) {
+		this->sunDirection = newDirection;
+		this->staticShadowVersion++;
+	}
+	this->sunColour = colour;
+	this->sunIntensity = intensity;
+}
+
+void VulkanRenderer::setModelStatic(int modelId, bool isStatic)
+{
+	if (modelId < 0 || modelId >= static_cast<int>(this->modelList.size()) || this->modelList[modelId].getAssetId() < 0) {
+		throw std::runtime_error("Attempted to change invalid model");
+	}
+
+	// Either way the model moves between the cached shadows and the ones drawn every frame
+	if (this->modelList[modelId].isStatic() != isStatic) {
+		this->modelList[modelId].setStatic(isStatic);
+		this->staticShadowVersion++;
+	}
+}
+
+void VulkanRenderer::setLightingMode(LightingMode mode)
+{
+	// Command buffers are recorded every frame, so the mode's pipeline is bound once a worker has built it
+	this->config.lightingMode = mode;
+}
+
+FrameStats VulkanRenderer::getFrameStats()
+{
+	return this->frameStats;
+}
+
+RendererConfig VulkanRenderer::getConfig()
+{
+	return this->config;
+}
+
+std::string VulkanRenderer::getDeviceName()
+{
+	return this->deviceName;
+}
+
+ShaderCompilerStats VulkanRenderer::getShaderCompilerStats()
+{
+	return this->shaderCompiler.getStats();
+}
+
+PipelineVariantStats VulkanRenderer::getPipelineVariantStats()
+{
+	return this->scenePipelines.getStats();
+}
+
+DescriptorAllocatorStats VulkanRenderer::getDescriptorAllocatorStats()
+{
+	DescriptorAllocatorStats stats = this->descriptorAllocator.getStats();
+	for (DescriptorAllocator& frameDescriptorAllocator : this->frameDescriptorAllocators) {
+		DescriptorAllocatorStats frameStats = frameDescriptorAllocator.getStats();
+		stats.pools += frameStats.pools;
+		stats.setsAllocated += frameStats.setsAllocated;
+		stats.setsCached += frameStats.setsCached;
+		stats.resets += frameStats.resets;
+	}
+	return stats;
+}
+
+void VulkanRenderer::readClusterBuffer(LightBufferHeader* header, std::vector<Light>* frameLights, std::vector<uint32_t>* clusterData)
+{
+	if (this->frameStats.frameNumber == 0) {
+		throw std::runtime_error("No frame has been drawn to read the clusters of");
+	}
+
+	// Neither buffer is written again until the next frame using this image, so once this one is through they match
+	this->timeline.wait(this->imageValues[this->lastImageIndex]);
 
-	this->modelList[modelId].setModel(newModel);
+	const char* data = static_cast<const char*>(this->lightBufferMapped[this->lastImageIndex]);
+	memcpy(header, data, sizeof(LightBufferHeader));
+	frameLights->resize(header->counts.x);
+	if (!frameLights->empty()) {
+		memcpy(frameLights->data(), data + sizeof(LightBufferHeader), sizeof(Light) * frameLights->size());
+	}
+
+	// The cluster buffer is device local, so it's copied out through a staging buffer
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	createBuffer(this->mainDevice.physicalDevice, this->mainDevice.logicalDevice, CLUSTER_BUFFER_SIZE,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&stagingBuffer, &stagingBufferMemory);
+
+	VkCommandBuffer commandBuffer = beginCommandBuffer(this->mainDevice.logicalDevice, this->graphicsCommandPool);
+
+	// The cluster shader's writes have to be visible to the copy, not just to the fragment shaders the frame's barrier was for
+	VkBufferMemoryBarrier clusterBarrier = {};
+	clusterBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	clusterBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	clusterBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	clusterBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	clusterBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	clusterBarrier.buffer = this->clusterBuffers[this->lastImageIndex];
+	clusterBarrier.offset = 0;
+	clusterBarrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 1, &clusterBarrier, 0, nullptr);
+
+	VkBufferCopy bufferCopyRegion = {};
+	bufferCopyRegion.size = CLUSTER_BUFFER_SIZE;
+	vkCmdCopyBuffer(commandBuffer, this->clusterBuffers[this->lastImageIndex], stagingBuffer, 1, &bufferCopyRegion);
+
+	// Without a timeline the submission is waited for, so the staging buffer can be read straight after
+	endAndSubmitCommandBuffer(this->mainDevice.logicalDevice, this->graphicsCommandPool, this->graphicsQueue, commandBuffer);
+
+	void* mapped;
+	vkMapMemory(this->mainDevice.logicalDevice, stagingBufferMemory, 0, CLUSTER_BUFFER_SIZE, 0, &mapped);
+	clusterData->resize(CLUSTER_BUFFER_SIZE / sizeof(uint32_t));
+	memcpy(clusterData->data(), mapped, CLUSTER_BUFFER_SIZE);
+	vkUnmapMemory(this->mainDevice.logicalDevice, stagingBufferMemory);
+
+	destroyStagingBuffer(this->mainDevice.logicalDevice, stagingBuffer, stagingBufferMemory);
 }
 
 void VulkanRenderer::cleanup()
 {
+	// Pipeline builds under way finish first, as they use the shader compiler
+	this->scenePipelines.stop();
+
 	// Wait until no actions are being run until destroying
 	vkDeviceWaitIdle(this->mainDevice.logicalDevice);
+	this->textureStreamer.stop();
+
+	// Run any deferred deletions (staging buffers, transfer command buffers) before their pools and device go
+	this->timeline.destroy();
+	this->shaderCompiler.destroy();
 
 	// NO LONGER USED BELOW BUT KEEPING FOR REFERENCE, AS THAT'S HOW MODEL WAS DONE VIA DYNAMIC BUFFERS
 	//_aligned_free(this->modelTransferSpace);
 
-	for (size_t i = 0; i < this->modelList.size(); i++) {
-		this->modelList[i].destroyMeshModel();
-	}
-
-	vkDestroyDescriptorPool(this->mainDevice.logicalDevice, this->inputDescriptorPool, nullptr);
-	vkDestroyDescriptorSetLayout(this->mainDevice.logicalDevice, this->inputDescriptorSetLayout, nullptr);
+	// Meshes belong to the geometry assets, models only use them
+	this->geometryCache.destroy();
 
-	vkDestroyDescriptorPool(this->mainDevice.logicalDevice, this->samplerDescriptorPool, nullptr);
-	vkDestroyDescriptorSetLayout(this->mainDevice.logicalDevice, this->descriptorSetLayout, nullptr);
+	// Every descriptor set goes with its pool
+	this->descriptorAllocator.destroy();
+	for (DescriptorAllocator& frameDescriptorAllocator : this->frameDescriptorAllocators) {
+		frameDescriptorAllocator.destroy();
+	}
 
 	vkDestroySampler(this->mainDevice.logicalDevice, this->textureSampler, nullptr);
 
 	for (size_t i = 0; i < this->textureImages.size(); i++) {
 		vkDestroyImageView(this->mainDevice.logicalDevice, this->textureImageViews[i], nullptr);
 		vkDestroyImage(this->mainDevice.logicalDevice, this->textureImages[i], nullptr);
-		vkFreeMemory(this->mainDevice.logicalDevice, this->textureImageMemory[i], nullptr);
+		this->memoryAllocator.free(this->textureImageAllocations[i]);
 	} 
 
+	// Anything left in the blocks has been destroyed by now
+	this->memoryAllocator.destroy();
+
 	for (size_t i = 0; i < this->depthBufferImages.size(); i++) {
 		vkDestroyImageView(this->mainDevice.logicalDevice, this->colourBufferImageViews[i], nullptr);
 		vkDestroyImage(this->mainDevice.logicalDevice, this->colourBufferImages[i], nullptr);
-		vkFreeMemory(this->mainDevice.logicalDevice, this->colourBufferImageMemories[i], nullptr);
+		freeDeviceMemory(this->mainDevice.logicalDevice, this->colourBufferImageMemories[i]);
+
+		vkDestroyImageView(this->mainDevice.logicalDevice, this->normalBufferImageViews[i], nullptr);
+		vkDestroyImage(this->mainDevice.logicalDevice, this->normalBufferImages[i], nullptr);
+		freeDeviceMemory(this->mainDevice.logicalDevice, this->normalBufferImageMemories[i]);
+
+		vkDestroyImageView(this->mainDevice.logicalDevice, this->materialBufferImageViews[i], nullptr);
+		vkDestroyImage(this->mainDevice.logicalDevice, this->materialBufferImages[i], nullptr);
+		freeDeviceMemory(this->mainDevice.logicalDevice, this->materialBufferImageMemories[i]);
 	}
 
 	for (size_t i = 0; i < this->depthBufferImages.size(); i++) {
 		vkDestroyImageView(this->mainDevice.logicalDevice, this->depthBufferImageViews[i], nullptr);
 		vkDestroyImage(this->mainDevice.logicalDevice, this->depthBufferImages[i], nullptr);
-		vkFreeMemory(this->mainDevice.logicalDevice, this->depthBufferImageMemories[i], nullptr);
+		freeDeviceMemory(this->mainDevice.logicalDevice, this->depthBufferImageMemories[i]);
 	}
 
-	// NO LONGER USED BELOW BUT KEEPING FOR REFERENCE, AS THAT'S HOW MODEL WAS DONE VIA DYNAMIC BUFFERS
-	vkDestroyDescriptorPool(this->mainDevice.logicalDevice, this->descriptorPool, nullptr);
-	vkDestroyDescriptorSetLayout(this->mainDevice.logicalDevice, this->descriptorSetLayout, nullptr);
+	vkDestroySampler(this->mainDevice.logicalDevice, this->shadowSampler, nullptr);
+	for (size_t i = 0; i < this->shadowMapLayerViews.size(); i++) {
+		vkDestroyFramebuffer(this->mainDevice.logicalDevice, this->shadowMapFramebuffers[i], nullptr);
+		vkDestroyImageView(this->mainDevice.logicalDevice, this->shadowMapLayerViews[i], nullptr);
+	}
+	for (size_t i = 0; i < this->shadowMapImages.size(); i++) {
+		vkDestroyImageView(this->mainDevice.logicalDevice, this->shadowMapImageViews[i], nullptr);
+		vkDestroyImage(this->mainDevice.logicalDevice, this->shadowMapImages[i], nullptr);
+		freeDeviceMemory(this->mainDevice.logicalDevice, this->shadowMapImageMemories[i]);
+	}
+	for (size_t i = 0; i < this->staticShadowLayerViews.size(); i++) {
+		vkDestroyFramebuffer(this->mainDevice.logicalDevice, this->staticShadowFramebuffers[i], nullptr);
+		vkDestroyImageView(this->mainDevice.logicalDevice, this->staticShadowLayerViews[i], nullptr);
+	}
+	vkDestroyImage(this->mainDevice.logicalDevice, this->staticShadowImage, nullptr);
+	freeDeviceMemory(this->mainDevice.logicalDevice, this->staticShadowImageMemory);
 
 	for (size_t i = 0; i < this->swapchainImages.size(); i++) {
 		vkDestroyBuffer(this->mainDevice.logicalDevice, this->vpUniformBuffer[i], nullptr);
-		vkFreeMemory(this->mainDevice.logicalDevice, this->vpUniformBufferMemory[i], nullptr);
+		freeDeviceMemory(this->mainDevice.logicalDevice, this->vpUniformBufferMemory[i]);
+		this->destroyObjectBuffer(i);
+		vkUnmapMemory(this->mainDevice.logicalDevice, this->lightBufferMemories[i]);
+		vkDestroyBuffer(this->mainDevice.logicalDevice, this->lightBuffers[i], nullptr);
+		freeDeviceMemory(this->mainDevice.logicalDevice, this->lightBufferMemories[i]);
+		vkDestroyBuffer(this->mainDevice.logicalDevice, this->clusterBuffers[i], nullptr);
+		freeDeviceMemory(this->mainDevice.logicalDevice, this->clusterBufferMemories[i]);
 		//// NO LONGER USED BELOW BUT KEEPING FOR REFERENCE, AS THAT'S HOW MODEL WAS DONE VIA DYNAMIC BUFFERS
 		//vkDestroyBuffer(this->mainDevice.logicalDevice, this->modelDynamicUniformBuffer[i], nullptr);
 		//vkFreeMemory(this->mainDevice.logicalDevice, this->modelDynamicUniformBufferMemory[i], nullptr);
 	}
 
-	for (size_t i = 0; i < MAX_FRAME_DRAWS; i++)
+	if (this->timestampQueryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(this->mainDevice.logicalDevice, this->timestampQueryPool, nullptr);
+	}
+	if (this->statisticsQueryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(this->mainDevice.logicalDevice, this->statisticsQueryPool, nullptr);
+	}
+
+	for (size_t i = 0; i < this->config.framesInFlight; i++)
 	{
 		vkDestroySemaphore(this->mainDevice.logicalDevice, this->renderFinished[i], nullptr);
 		vkDestroySemaphore(this->mainDevice.logicalDevice, this->imageAvailable[i], nullptr);
-		vkDestroyFence(this->mainDevice.logicalDevice, this->drawFences[i], nullptr);
 	}
 	vkDestroyCommandPool(this->mainDevice.logicalDevice, this->graphicsCommandPool, nullptr);
 	for (auto framebuffer : this->swapchainFramebuffers) {
 		vkDestroyFramebuffer(this->mainDevice.logicalDevice, framebuffer, nullptr);
 	}
 
-	vkDestroyPipeline(this->mainDevice.logicalDevice, this->secondPipeline, nullptr);
-	vkDestroyPipelineLayout(this->mainDevice.logicalDevice, this->secondPipelineLayout, nullptr);
+	this->scenePipelines.destroy();
+	vkDestroyPipeline(this->mainDevice.logicalDevice, this->clusterPipeline, nullptr);
+	vkDestroyPipeline(this->mainDevice.logicalDevice, this->shadowPipeline, nullptr);
+
+	// Saved for the next run, under another name and renamed so a cut short file is never read back
+	size_t pipelineCacheSize = 0;
+	vkGetPipelineCacheData(this->mainDevice.logicalDevice, this->pipelineCache, &pipelineCacheSize, nullptr);
+	std::vector<char> pipelineCacheData(pipelineCacheSize);
+	if (pipelineCacheSize > 0
+		&& vkGetPipelineCacheData(this->mainDevice.logicalDevice, this->pipelineCache, &pipelineCacheSize, pipelineCacheData.data()) == VK_SUCCESS) {
+		std::string tempPath = std::string(PIPELINE_CACHE_FILE) + ".tmp";
+		std::ofstream pipelineCacheFile(tempPath, std::ios::binary | std::ios::trunc);
+		if (pipelineCacheFile.is_open()) {
+			pipelineCacheFile.write(pipelineCacheData.data(), pipelineCacheSize);
+			pipelineCacheFile.close();
+			std::remove(PIPELINE_CACHE_FILE);
+			if (!pipelineCacheFile || std::rename(tempPath.c_str(), PIPELINE_CACHE_FILE) != 0) {
+				std::remove(tempPath.c_str());
+			}
+		}
+	}
+	vkDestroyPipelineCache(this->mainDevice.logicalDevice, this->pipelineCache, nullptr);
 
-	vkDestroyPipeline(this->mainDevice.logicalDevice, this->graphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(this->mainDevice.logicalDevice, this->pipelineLayout, nullptr);
+	// Every descriptor set and pipeline layout, once nothing uses them
+	this->layoutCache.destroy();
 
 	vkDestroyRenderPass(this->mainDevice.logicalDevice, this->renderPass, nullptr);
+	vkDestroyRenderPass(this->mainDevice.logicalDevice, this->staticShadowRenderPass, nullptr);
+	vkDestroyRenderPass(this->mainDevice.logicalDevice, this->shadowRenderPass, nullptr);
 
 	for (auto image : swapchainImages) {
 		vkDestroyImageView(this->mainDevice.logicalDevice, image.imageView, nullptr);
 	} 
-	vkDestroySwapchainKHR(this->mainDevice.logicalDevice, swapchain, nullptr);
-	vkDestroySurfaceKHR(this->instance, this->surface, nullptr);
+	if (this->headless) {
+		// Offscreen images were created by us rather than the swapchain, so they need destroying too
+		for (size_t i = 0; i < this->swapchainImages.size(); i++) {
+			vkDestroyImage(this->mainDevice.logicalDevice, this->swapchainImages[i].image, nullptr);
+			freeDeviceMemory(this->mainDevice.logicalDevice, this->offscreenImageMemories[i]);
+		}
+	}
+	else {
+		vkDestroySwapchainKHR(this->mainDevice.logicalDevice, swapchain, nullptr);
+		vkDestroySurfaceKHR(this->instance, this->surface, nullptr);
+	}
 	vkDestroyDevice(this->mainDevice.logicalDevice, nullptr);
 	vkDestroyInstance(instance, nullptr);
 }
@@ -173,42 +466,127 @@ void VulkanRenderer::draw()
 	// and signals when it has finished rendering
 	// 3. Present image to screen when it has signalled finished rendering 
 
+	// Frames that finished since the last frame was submitted
+	this->observeFrameCompletion();
+
+	// Hold back to the target frame rate (if any) before starting the frame
+	this->frameLimiter.wait();
+
 	// 0. Wait for lock
-    // Wait until the Fence is actually available in order to go further
-	vkWaitForFences(this->mainDevice.logicalDevice, 1, &this->drawFences[this->currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-	// Manually reset (close) fences
-	vkResetFences(this->mainDevice.logicalDevice, 1, &this->drawFences[this->currentFrame]);
+	// Wait until the last submission using this frame slot has finished on the GPU
+	auto waitStart = std::chrono::high_resolution_clock::now();
+	this->timeline.wait(this->frameValues[this->currentFrame]);
+	auto frameStart = std::chrono::high_resolution_clock::now();
+	this->frameStats.frameWaitTime = std::chrono::duration<double, std::milli>(frameStart - waitStart).count();
+
+	// Free anything retired against work that has now finished
+	this->timeline.collect();
+
+	// Along with the texture descriptor sets that frame wrote, all at once
+	this->frameDescriptorAllocators[this->currentFrame].reset();
+
+	// The frame that last used this slot has finished, so its GPU timings can be read back. If the wait blocked it has only
+	// just been seen to finish, so its latency is up to date
+	this->observeFrameCompletion();
+	this->readTimestamps();
+	this->readPipelineStatistics();
 
 	// -- 1. Get next image --
 	uint32_t imageIndex;
-	// Get index of next image to be drawn to and signal semaphore when ready to be drawn to
-	vkAcquireNextImageKHR(this->mainDevice.logicalDevice, this->swapchain, std::numeric_limits<uint64_t>::max(), this->imageAvailable[this->currentFrame], VK_NULL_HANDLE, &imageIndex);
+	if (this->headless) {
+		// Offscreen images are paired 1:1 with frames in flight, so this frame's image is free once its fence is through
+		imageIndex = this->currentFrame;
+	}
+	else {
+		// Get index of next image to be drawn to and signal semaphore when ready to be drawn to
+		vkAcquireNextImageKHR(this->mainDevice.logicalDevice, this->swapchain, std::numeric_limits<uint64_t>::max(), this->imageAvailable[this->currentFrame], VK_NULL_HANDLE, &imageIndex);
+	}
 
+	// With more frames in flight than swapchain images, an older frame may still be using this image's command buffer
+	this->timeline.wait(this->imageValues[imageIndex]);
+
+	// World transforms are only recomputed for nodes under a transform that changed since the last frame, but every MVP is
+	// rewritten as the camera may have moved
+	auto transformStart = std::chrono::high_resolution_clock::now();
+	this->frameStats.nodesUpdated = static_cast<uint32_t>(this->updateScene());
+	this->updateObjectTransforms(imageIndex);
+	this->updateShadowCascades();
+	this->updateLightBuffer(imageIndex);
+	auto transformEnd = std::chrono::high_resolution_clock::now();
+	this->frameStats.transformTime = std::chrono::duration<double, std::milli>(transformEnd - transformStart).count();
+
+	auto recordStart = std::chrono::high_resolution_clock::now();
 	this->recordCommands(imageIndex);
+	auto recordEnd = std::chrono::high_resolution_clock::now();
+	this->frameStats.cpuRecordTime = std::chrono::duration<double, std::milli>(recordEnd - recordStart).count();
+
 	this->updateUniformBuffers(imageIndex);
 
 	// -- 2. Submit command buffer to render --
+	// Semaphores to wait on: the acquired image (binary, not when headless) and any uploads made since the last frame (timeline)
+	std::vector<VkSemaphore> waitSemaphores;
+	std::vector<uint64_t> waitValues;
+	std::vector<VkPipelineStageFlags> waitStages;
+	if (!this->headless) {
+		waitSemaphores.push_back(this->imageAvailable[this->currentFrame]);
+		waitValues.push_back(0); // Ignored for binary semaphores
+		waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	}
+	uint64_t uploadValue = this->timeline.lastSubmittedValue();
+	if (uploadValue > this->lastFrameValue) {
+		waitSemaphores.push_back(this->timeline.getSemaphore());
+		waitValues.push_back(uploadValue);
+		waitStages.push_back(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+
+	// Semaphores to signal: the timeline with this frame's value, and the binary semaphore present waits on
+	uint64_t frameValue = this->timeline.nextValue();
+	std::vector<VkSemaphore> signalSemaphores = { this->timeline.getSemaphore() };
+	std::vector<uint64_t> signalValues = { frameValue };
+	if (!this->headless) {
+		signalSemaphores.push_back(this->renderFinished[this->currentFrame]);
+		signalValues.push_back(0);
+	}
+
+	VkTimelineSemaphoreSubmitInfo timelineSubmitInfo = {};
+	timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineSubmitInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+	timelineSubmitInfo.pWaitSemaphoreValues = waitValues.data();
+	timelineSubmitInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+	timelineSubmitInfo.pSignalSemaphoreValues = signalValues.data();
+
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.waitSemaphoreCount = 1; // Number of semaphores to wait on
-	submitInfo.pWaitSemaphores = &this->imageAvailable[this->currentFrame]; // List of semaphores to wait on
-	VkPipelineStageFlags waitStages[] = {
-		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
-	};
-	submitInfo.pWaitDstStageMask = waitStages; // Stages to check semaphores at
+	submitInfo.pNext = &timelineSubmitInfo;
+	submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size()); // Number of semaphores to wait on
+	submitInfo.pWaitSemaphores = waitSemaphores.data(); // List of semaphores to wait on
+	submitInfo.pWaitDstStageMask = waitStages.data(); // Stages to check semaphores at
 	submitInfo.commandBufferCount = 1; // Number of command buffers to submit
 	submitInfo.pCommandBuffers = &this->commandBuffers[imageIndex]; // Command buffer to submit
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &this->renderFinished[this->currentFrame];
+	submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+	submitInfo.pSignalSemaphores = signalSemaphores.data();
 
 	// Submit the command buffer selected (by imageIndex index) into the queue provided, which is the graphicsQueue
-	// and acquire the fence lock to make sure no other images start processing
-	VkResult result = vkQueueSubmit(this->graphicsQueue, 1, &submitInfo, this->drawFences[currentFrame]);
+	VkResult result = vkQueueSubmit(this->graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to submit command buffer to queue");
 	}
+	this->frameValues[this->currentFrame] = frameValue;
+	this->frameStartTimes[this->currentFrame] = frameStart;
+	this->latencyPending[this->currentFrame] = true;
+	this->imageValues[imageIndex] = frameValue;
+	this->lastImageIndex = imageIndex;
+	this->lastFrameValue = frameValue;
+	this->timestampsWritten[this->currentFrame] = this->timestampsSupported;
+	this->frameStats.frameNumber++;
 
 	// -- 3. Present rendered image to screen --
+	if (this->headless) {
+		this->frameStats.cpuFrameTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count();
+		this->currentFrame = (this->currentFrame + 1) % this->config.framesInFlight;
+		return;
+	}
+
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.waitSemaphoreCount = 1; // Number of semaphores to wait on
@@ -221,9 +599,13 @@ void VulkanRenderer::draw()
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to present image");
 	}
+	this->frameStats.cpuFrameTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count();
 
-	// Get next fame keeping value below max number of frame draws
-	this->currentFrame = (this->currentFrame + 1) % MAX_FRAME_DRAWS;
+	// Present can block, earlier frames may have finished meanwhile
+	this->observeFrameCompletion();
+
+	// Get next fame keeping value below number of frames in flight
+	this->currentFrame = (this->currentFrame + 1) % this->config.framesInFlight;
 }
 
 VulkanRenderer::~VulkanRenderer()
@@ -239,7 +621,7 @@ void VulkanRenderer::createInstance()
 	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	appInfo.pEngineName = "No Engine";
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	appInfo.apiVersion = VK_API_VERSION_1_2; // 1.2 for timeline semaphores
 
 	VkInstanceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -247,15 +629,17 @@ void VulkanRenderer::createInstance()
 
 	std::vector<const char*> instanceExtensions = std::vector<const char*>();
 
-	// Set up instance extensions instance will use
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions;
+	// Set up instance extensions instance will use (none are needed when rendering without a window)
+	if (!this->headless) {
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions;
 
-	// Get thes exact Vulkan extensions that GLFW requires to talk to vulkan to build windows
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		// Get thes exact Vulkan extensions that GLFW requires to talk to vulkan to build windows
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-	for (size_t i = 0; i < glfwExtensionCount; i++) {
-		instanceExtensions.push_back(glfwExtensions[i]);
+		for (size_t i = 0; i < glfwExtensionCount; i++) {
+			instanceExtensions.push_back(glfwExtensions[i]);
+		}
 	}
 
 	if (!checkInstanceExtensionSupport(&instanceExtensions)) {
@@ -304,16 +688,40 @@ void VulkanRenderer::createLogicalDevice()
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()); // Number of queue create infos
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data(); // List of queue create infos so device can create required queues
-	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size()); // number of enabled logical device extensions (no needd as its logical)
-	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	// No swapchain when headless. Memory budget is optional, without it residency works from heap sizes instead
+	std::vector<const char*> enabledExtensions;
+	if (!this->headless) {
+		enabledExtensions = deviceExtensions;
+	}
+
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(this->mainDevice.physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(this->mainDevice.physicalDevice, nullptr, &extensionCount, extensions.data());
+	for (const VkExtensionProperties& extension : extensions) {
+		if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+			this->memoryBudgetSupported = true;
+			enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		}
+	}
+
+	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size()); // number of enabled logical device extensions
+	deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 	// Physical device features the logical device will be using
 	// By default features will be false 
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.samplerAnisotropy = VK_TRUE; // Enabling anisotropy
+	deviceFeatures.pipelineStatisticsQuery = this->statisticsSupported ? VK_TRUE : VK_FALSE; // Only if the device has it
 
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures; // Phyiscal device features logical device will use
 
+	// Vulkan 1.2 features are enabled through a struct chained on to the create info
+	VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	vulkan12Features.timelineSemaphore = VK_TRUE;
+	deviceCreateInfo.pNext = &vulkan12Features;
+
 	// Create the logical device for the physical device
 	VkResult result = vkCreateDevice(this->mainDevice.physicalDevice, &deviceCreateInfo, nullptr, &this->mainDevice.logicalDevice);
 
@@ -349,6 +757,7 @@ void VulkanRenderer::createSwapchain()
 
 	// 2. CHOOSE BEST PRESENTATION MODE
 	VkPresentModeKHR presentMode = this->chooseBestPresentationMode(swapchainDetails.presentationModes);
+	this->config.presentMode = presentMode; // Keep the mode actually used so it can be reported
 
 	// 3. CHOOSE EBST SWAP CHAIN IMAGE RESOLUTION
 	VkExtent2D extent = this->chooseSwapExtent(swapchainDetails.surfaceCapabilities);
@@ -430,20 +839,39 @@ void VulkanRenderer::createSwapchain()
 	}
 }
 
+void VulkanRenderer::createOffscreenImages()
+{
+	// Stand in for the swapchain when headless, with one image per frame in flight
+	this->swapchainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	this->offscreenImageMemories.resize(this->config.framesInFlight);
+
+	for (size_t i = 0; i < this->config.framesInFlight; i++) {
+		SwapchainImage offscreenImage = {};
+		offscreenImage.image = this->createImage(this->swapchainExtent.width, this->swapchainExtent.height, this->swapchainImageFormat,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, // Transfer source so results could be read back
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&this->offscreenImageMemories[i]);
+		offscreenImage.imageView = this->createImageView(offscreenImage.image, this->swapchainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		this->swapchainImages.push_back(offscreenImage);
+	}
+}
+
 void VulkanRenderer::createRenderPass()
 {
 	// - ATTACHMENTS
 	// SUBPASS 1 ATTACHMENTS + REFERENCES (INPUT ATTACHMENTS)
 
-	// Array of subpasses
-	std::array<VkSubpassDescription, 2> subpasses = {};
+	// Array of subpasses: the depth pre-pass, the G-buffer and lighting
+	std::array<VkSubpassDescription, 3> subpasses = {};
 
-	// Colour attachment (input)
+	// Colour attachment (input), the G-buffer's albedo
 	VkAttachmentDescription colourAttachment = {};
 	colourAttachment.format = chooseSupportedFormat(
 		{ VK_FORMAT_R8G8B8A8_UNORM },
 		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT
 	);
 	colourAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
 	colourAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
@@ -468,22 +896,42 @@ void VulkanRenderer::createRenderPass()
 	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-	// Colour attachment (input) references
-	VkAttachmentReference colourAttachmentReference = {}; // Remember we need to match the order of these to their order in frame buffer
-	colourAttachmentReference.attachment = 1; // We need to make sure it's aligned to the index in the attachments array
-	colourAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	// Normal and material attachments (input), the rest of the G-buffer, only ever used within the render pass like the albedo
+	VkAttachmentDescription normalAttachment = colourAttachment;
+	normalAttachment.format = chooseSupportedFormat(
+		{ VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16_SFLOAT },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT
+	);
+
+	VkAttachmentDescription materialAttachment = colourAttachment;
+
+	// Colour attachment (input) references, one per G-buffer target (fragment shader output locations 0, 1 and 2)
+	std::array<VkAttachmentReference, 3> colourAttachmentReferences = {}; // Remember we need to match the order of these to their order in frame buffer
+	colourAttachmentReferences[0].attachment = 1; // We need to make sure it's aligned to the index in the attachments array
+	colourAttachmentReferences[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colourAttachmentReferences[1].attachment = 3;
+	colourAttachmentReferences[1].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colourAttachmentReferences[2].attachment = 4;
+	colourAttachmentReferences[2].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
 	// Depth attachment (input) references
 	VkAttachmentReference depthAttachmentReference = {};
 	depthAttachmentReference.attachment = 2; // Sam as abve need to be same index as attachment index
 	depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-	// Set subpass 1
+	// Depth pre-pass subpass, depth only. Left empty when the pre-pass isn't drawn, so the same render pass (and pipelines)
+	// are used either way
 	subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpasses[0].colorAttachmentCount = 1;
-	subpasses[0].pColorAttachments = &colourAttachmentReference;
+	subpasses[0].colorAttachmentCount = 0;
 	subpasses[0].pDepthStencilAttachment = &depthAttachmentReference;
 
+	// Set subpass 1
+	subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[1].colorAttachmentCount = static_cast<uint32_t>(colourAttachmentReferences.size());
+	subpasses[1].pColorAttachments = colourAttachmentReferences.data();
+	subpasses[1].pDepthStencilAttachment = &depthAttachmentReference;
+
 	// SUBPASS 2 - ATTACHMENTS + REFERENCES
 
 	// Swapchain Colour attachment 
@@ -499,6 +947,10 @@ void VulkanRenderer::createRenderPass()
 	// to give optimal use for certain operations
 	swapchainColourAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // Image data layout before render pass starts
 	swapchainColourAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // Image data layout after render pass (to change to)
+	if (this->headless) {
+		// Offscreen images are never presented, so leave them as they were rendered
+		swapchainColourAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	}
 
 	// Attachment reference uses an attachment indext that refers to in dex in the atachment list passed to renderpasscreateinfo
 	VkAttachmentReference swapchainColourAttachmentReference = {};
@@ -506,18 +958,23 @@ void VulkanRenderer::createRenderPass()
 	swapchainColourAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
 	// Referneces to attachments that subpass will take input from 
-	std::array<VkAttachmentReference, 2> inputReferences;
+	// (input_attachment_index in second.frag is the index in this list)
+	std::array<VkAttachmentReference, 4> inputReferences;
 	inputReferences[0].attachment = 1;
 	inputReferences[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // We want to make sure that the data is in a state where it can be read
 	inputReferences[1].attachment = 2;
 	inputReferences[1].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	inputReferences[2].attachment = 3;
+	inputReferences[2].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	inputReferences[3].attachment = 4;
+	inputReferences[3].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
 	// Setup subpass 2
-	subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpasses[1].colorAttachmentCount = 1;
-	subpasses[1].pColorAttachments = &swapchainColourAttachmentReference;
-	subpasses[1].inputAttachmentCount = static_cast<uint32_t>(inputReferences.size());
-	subpasses[1].pInputAttachments = inputReferences.data();
+	subpasses[2].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[2].colorAttachmentCount = 1;
+	subpasses[2].pColorAttachments = &swapchainColourAttachmentReference;
+	subpasses[2].inputAttachmentCount = static_cast<uint32_t>(inputReferences.size());
+	subpasses[2].pInputAttachments = inputReferences.data();
 
 	// SUBPASS DEPENDENCIES 
 
@@ -528,43 +985,64 @@ void VulkanRenderer::createRenderPass()
 
 	// Need to determine when layout transitions occur using subpass dependencies (which also create implicit layout transitions)
 	// The reason why it needs to be defined is because this is parallel processing
-	std::array<VkSubpassDependency, 3> subpassDependencies;
+	std::array<VkSubpassDependency, 5> subpassDependencies;
 
-	// Conversion from VK_IMAGE_LAYOUR_UNDEFINED to VK_IMAGE_LAYOUT_COLOR_ATTACHMEENT_OPTIMAL
+	// Depth is first used by the pre-pass subpass, after the previous frame using the depth buffer has finished testing against it
 	subpassDependencies[0].dependencyFlags = 0;
+	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[0].dstSubpass = 0;
+	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	// Conversion from VK_IMAGE_LAYOUR_UNDEFINED to VK_IMAGE_LAYOUT_COLOR_ATTACHMEENT_OPTIMAL
+	subpassDependencies[1].dependencyFlags = 0;
 	// ~> transition must happen after the following...
-	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL; // This is where we're coming from, subpass_external is a keyword that specifies everything that takes place outside subpasses
-	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT; // Which staage of the pipeline needs to happen first - This value means the end of the pipeline 
-	subpassDependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT; // This means the memory opeation that needs to happen before you can do the conversaion. Read bi tis whn you are reading / presenting to the screen. It needs to be read from before we can convert to optimal
+	subpassDependencies[1].srcSubpass = VK_SUBPASS_EXTERNAL; // This is where we're coming from, subpass_external is a keyword that specifies everything that takes place outside subpasses
+	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT; // Which staage of the pipeline needs to happen first - This value means the end of the pipeline 
+	subpassDependencies[1].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT; // This means the memory opeation that needs to happen before you can do the conversaion. Read bi tis whn you are reading / presenting to the screen. It needs to be read from before we can convert to optimal
 	// ~> but transition must happen before the following...
-	subpassDependencies[0].dstSubpass = 0; // THe index of the subpass that it's refering to, in this case we only have one
-	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // Transition from undefined to colour_optimal has to happend before the srcStageMask and before the dstStageMask
-	subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT; // Conversion to optimal has to happen before we get to the colour output and before it attempts to read and write to it.
+	subpassDependencies[1].dstSubpass = 1; // The G-buffer subpass, the first to use the colour attachments
+	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // Transition from undefined to colour_optimal has to happend before the srcStageMask and before the dstStageMask
+	subpassDependencies[1].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT; // Conversion to optimal has to happen before we get to the colour output and before it attempts to read and write to it.
+
+	// Pre-pass depth written before the G-buffer subpass tests against it, pixel by pixel like the lighting subpass below
+	subpassDependencies[2].srcSubpass = 0;
+	subpassDependencies[2].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[2].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[2].dstSubpass = 1;
+	subpassDependencies[2].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[2].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[2].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
 	// SUBPASS 1 layout (colour/depth) to subpass 2 Layout (shader read)
-	subpassDependencies[1].srcSubpass = 0;
-	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-	subpassDependencies[1].dstSubpass = 1;
-	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	subpassDependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-	subpassDependencies[1].dependencyFlags = 0;
+	subpassDependencies[3].srcSubpass = 1;
+	subpassDependencies[3].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[3].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[3].dstSubpass = 2;
+	subpassDependencies[3].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	subpassDependencies[3].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+	// Each pixel only reads its own G-buffer texel, so the lighting subpass can run tile by tile as the G-buffer is filled
+	subpassDependencies[3].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
 	// Conversion from VK_IMAGE_LAYOUT_COLOR_ATTACHMEENT_OPTIMAL to VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
-	subpassDependencies[2].dependencyFlags = 0;
+	subpassDependencies[4].dependencyFlags = 0;
 	// ~> transition must happen after the following...
-	subpassDependencies[2].srcSubpass = 0; // It has to happen after our main subpass has done its draw operation
-	subpassDependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // Basically specifies it has to happen after the dstSubpass of the previously defined rules in the subpass denednecy above
-	subpassDependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT; // Same as per the dstAccessMas of the subpass dependency above
+	subpassDependencies[4].srcSubpass = 2; // It has to happen after the lighting subpass has written the swapchain image
+	subpassDependencies[4].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // Basically specifies it has to happen after the dstSubpass of the previously defined rules in the subpass denednecy above
+	subpassDependencies[4].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT; // Same as per the dstAccessMas of the subpass dependency above
 	// ~> but transition must happen before the following...
-	subpassDependencies[2].dstSubpass = VK_SUBPASS_EXTERNAL; // Has to happen before "exiting" to outside 
-	subpassDependencies[2].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT; // Must happen before the start of the first subpass
-	subpassDependencies[2].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT; // Same as previous but with dst mask
+	subpassDependencies[4].dstSubpass = VK_SUBPASS_EXTERNAL; // Has to happen before "exiting" to outside 
+	subpassDependencies[4].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT; // Must happen before the start of the first subpass
+	subpassDependencies[4].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT; // Same as previous but with dst mask
 
-	std::array<VkAttachmentDescription, 3> renderPassAttachments = { 
+	std::array<VkAttachmentDescription, 5> renderPassAttachments = { 
 		swapchainColourAttachment, 
 		colourAttachment, 
-		depthAttachment 
+		depthAttachment,
+		normalAttachment,
+		materialAttachment
 	};
 
 	///  Create infor for render pass
@@ -583,106 +1061,289 @@ void VulkanRenderer::createRenderPass()
 	}
 }
 
-void VulkanRenderer::createDescriptorSetLayout()
+void VulkanRenderer::createShadowRenderPasses()
 {
-	// - Uniform values descriptor set layoutc
-	// MVP Binding info
-	VkDescriptorSetLayoutBinding vpLayoutBinding = {};
-	vpLayoutBinding.binding = 0; // this is linked to the vertex chader as per (binding = 0)
-	vpLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; // Type of descriptor (uniform, dynamic uniform, image sampler for textures, etc)
-	vpLayoutBinding.descriptorCount = 1;
-	vpLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // Shader stage to bind to
-	vpLayoutBinding.pImmutableSamplers = nullptr; // For textures: can make sampler data immutable
+	this->shadowFormat = this->chooseSupportedFormat(
+		{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+	);
 
-	//// NO LONGER USED BELOW BUT KEEPING FOR REFERENCE, AS THAT'S HOW MODEL WAS DONE VIA DYNAMIC BUFFERS
-	//// Model binding info
-	//VkDescriptorSetLayoutBinding modelLayoutBinding = {};
-	//modelLayoutBinding.binding = 1;
-	//modelLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	//modelLayoutBinding.descriptorCount = 1;
-	//modelLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	//modelLayoutBinding.pImmutableSamplers = nullptr;
-
-	std::vector<VkDescriptorSetLayoutBinding> layoutBindings = { vpLayoutBinding };
-
-	// Create descriptor set layout with given bindings
-	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
-	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutCreateInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size()); // Number of binding infos
-	layoutCreateInfo.pBindings = layoutBindings.data(); // Array of binding infos
-
-	// Create Descriptor set layout
-	VkResult result = vkCreateDescriptorSetLayout(this->mainDevice.logicalDevice, &layoutCreateInfo, nullptr, &this->descriptorSetLayout);
+	// - Static pass: draws a cascade's cached layer from scratch, which is then copied into the shadow maps
+	VkAttachmentDescription depthAttachment = {};
+	depthAttachment.format = this->shadowFormat;
+	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+	VkAttachmentReference depthAttachmentReference = {};
+	depthAttachmentReference.attachment = 0;
+	depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	// Depth only, nothing is shaded
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 0;
+	subpass.pDepthStencilAttachment = &depthAttachmentReference;
+
+	std::array<VkSubpassDependency, 2> subpassDependencies;
+	// Drawn once earlier frames' copies from the layer are done
+	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	subpassDependencies[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	subpassDependencies[0].dstSubpass = 0;
+	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[0].dependencyFlags = 0;
+	// Finished before it's copied from
+	subpassDependencies[1].srcSubpass = 0;
+	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	subpassDependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	subpassDependencies[1].dependencyFlags = 0;
+
+	VkRenderPassCreateInfo renderPassCreateInfo = {};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = 1;
+	renderPassCreateInfo.pAttachments = &depthAttachment;
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &subpass;
+	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(subpassDependencies.size());
+	renderPassCreateInfo.pDependencies = subpassDependencies.data();
+
+	VkResult result = vkCreateRenderPass(this->mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &this->staticShadowRenderPass);
 	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create descriptor set layout");
+		throw std::runtime_error("Failed to create static shadow render pass");
 	}
-	
-	// - Extra sampler descriptor set layout
-	// texture binding info
-	VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
-	samplerLayoutBinding.binding = 0;
-	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerLayoutBinding.descriptorCount = 1;
-	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	samplerLayoutBinding.pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutCreateInfo textureLayoutCreateInfo = {};
-	textureLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	textureLayoutCreateInfo.bindingCount = 1;
-	textureLayoutCreateInfo.pBindings = &samplerLayoutBinding;
-
-	// Create descriptro set layout
-	result = vkCreateDescriptorSetLayout(this->mainDevice.logicalDevice, &textureLayoutCreateInfo, nullptr, &this->samplerDescriptorSetLayout);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create descriptor set layout");
-	}
-
-	// - Create input attachment image descriptor set layout
-	// Colour input binding
-	VkDescriptorSetLayoutBinding colourInputLayoutBinding = {};
-	colourInputLayoutBinding.binding = 0;
-	colourInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	colourInputLayoutBinding.descriptorCount = 1;
-	colourInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-	// depth input binding
-	VkDescriptorSetLayoutBinding depthInputLayoutBinding = {};
-	depthInputLayoutBinding.binding = 1;
-	depthInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	depthInputLayoutBinding.descriptorCount = 1;
-	depthInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-	std::vector<VkDescriptorSetLayoutBinding> inputBindings = { colourInputLayoutBinding, depthInputLayoutBinding };
-
-	// Create a descriptor set layout for input attachments
-	VkDescriptorSetLayoutCreateInfo inputLayoutCreateInfo = {};
-	inputLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	inputLayoutCreateInfo.bindingCount = static_cast<uint32_t>(inputBindings.size());
-	inputLayoutCreateInfo.pBindings = inputBindings.data();
-
-	// Create descriptro set layout
-	result = vkCreateDescriptorSetLayout(this->mainDevice.logicalDevice, &inputLayoutCreateInfo, nullptr, &this->inputDescriptorSetLayout);
+
+	// - Dynamic pass: keeps the static shadows copied into the shadow map and draws the moving casters over them, leaving
+	// it for the lighting subpass to sample
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	subpassDependencies[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	subpassDependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	result = vkCreateRenderPass(this->mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &this->shadowRenderPass);
 	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create descriptor set layout");
+		throw std::runtime_error("Failed to create shadow render pass");
+	}
+}
+
+void VulkanRenderer::createDescriptorSetLayout()
+{
+	this->layoutCache.create(this->mainDevice.logicalDevice);
+
+	// Every shader is reflected up front, as set 0 is shared by all of them
+	const char* shaderFiles[] = { "shader.vert", "shader.frag", "depth.vert", "second.vert", "second.frag", "cluster.comp", "shadow.vert" };
+	std::vector<const ShaderReflection*> allShaders;
+	for (const char* shaderFile : shaderFiles) {
+		this->shaderReflections[shaderFile] = reflectShader(this->shaderCompiler.compile(shaderFile, this->shaderDefines));
+	}
+	for (const auto& reflection : this->shaderReflections) {
+		allShaders.push_back(&reflection.second);
+	}
+
+	// - Frame descriptor set layout (set 0): the view projection, object, light and cluster buffers and the shadow map. Its
+	// bindings are those of every shader together, so one set is bound for the whole frame, whichever pipelines use it
+	this->frameSetBindings = mergeSetBindings(allShaders, 0);
+	this->descriptorSetLayout = this->layoutCache.getSetLayout(this->frameSetBindings);
+
+	// - Texture descriptor set layout (set 1 of the G-buffer pipelines)
+	this->samplerSetBindings = mergeSetBindings(this->getShaderReflections({ "shader.vert", "shader.frag", "depth.vert" }), 1);
+	this->samplerDescriptorSetLayout = this->layoutCache.getSetLayout(this->samplerSetBindings);
+
+	// - Input attachment descriptor set layout (set 1 of the lighting pipeline), the G-buffer read back with subpassLoad
+	this->inputSetBindings = mergeSetBindings(this->getShaderReflections({ "second.vert", "second.frag" }), 1);
+	this->inputDescriptorSetLayout = this->layoutCache.getSetLayout(this->inputSetBindings);
+}
+
+std::vector<const ShaderReflection*> VulkanRenderer::getShaderReflections(const std::vector<std::string>& shaderFiles)
+{
+	std::vector<const ShaderReflection*> reflections;
+	for (const std::string& shaderFile : shaderFiles) {
+		auto found = this->shaderReflections.find(shaderFile);
+		if (found == this->shaderReflections.end()) {
+			throw std::runtime_error("Shader hasn't been reflected (" + shaderFile + ")");
+		}
+		reflections.push_back(&found->second);
+	}
+	return reflections;
+}
+
+VkPipelineLayout VulkanRenderer::getShaderPipelineLayout(const std::vector<std::string>& shaderFiles)
+{
+	std::vector<const ShaderReflection*> reflections = this->getShaderReflections(shaderFiles);
+
+	uint32_t setCount = 1;
+	for (const ShaderReflection* reflection : reflections) {
+		if (!reflection->bindings.empty()) {
+			setCount = std::max(setCount, reflection->bindings.back().set + 1);
+		}
+	}
+
+	// Set 0 is always the frame set, so it stays bound across every pipeline. The others have just these shaders' bindings,
+	// and are the same layout objects as any other set with the same bindings
+	std::vector<VkDescriptorSetLayout> setLayouts = { this->descriptorSetLayout };
+	for (uint32_t set = 1; set < setCount; set++) {
+		setLayouts.push_back(this->layoutCache.getSetLayout(mergeSetBindings(reflections, set)));
+	}
+
+	return this->layoutCache.getPipelineLayout(setLayouts, mergePushConstants(reflections));
+}
+
+std::vector<VkVertexInputAttributeDescription> VulkanRenderer::getVertexAttributes(const std::string& vertexShaderFile, bool positionStream)
+{
+	// Where each input is in a Vertex, by location
+	const uint32_t vertexOffsets[] = { offsetof(Vertex, pos), offsetof(Vertex, col), offsetof(Vertex, tex), offsetof(Vertex, normal) };
+
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+	for (const ReflectedVertexInput& input : this->getShaderReflections({ vertexShaderFile })[0]->vertexInputs) {
+		// The position-only stream has nothing but the position
+		if (input.location >= 4 || (positionStream && input.location != 0)) {
+			throw std::runtime_error("Vertex shader reads an input the vertex buffer doesn't have (" + vertexShaderFile + ")");
+		}
+
+		VkVertexInputAttributeDescription attributeDescription = {};
+		attributeDescription.binding = 0; // Which binding the data is at
+		attributeDescription.location = input.location; // Location in shader where data will be read from
+		attributeDescription.format = input.format; // Format the data will take (also helps define the size of the data)
+		attributeDescription.offset = positionStream ? 0 : vertexOffsets[input.location]; // Where this attribute is defined in the data for a single vertex
+		attributeDescriptions.push_back(attributeDescription);
 	}
+	return attributeDescriptions;
 }
 
+void VulkanRenderer::createShaderCompiler()
+{
+	// GLSL is compiled from Shaders at startup, and the SPIR-V kept in Shaders/cache so later runs only read it back
+	this->shaderCompiler.create("Shaders", "Shaders/cache");
+
+	// Constants the shaders share with the C++ side, so they're only written in one place (uint, hence the suffix)
+	this->shaderDefines = {
+		{ "CLUSTER_GRID_X", std::to_string(CLUSTER_GRID_X) + "u" },
+		{ "CLUSTER_GRID_Y", std::to_string(CLUSTER_GRID_Y) + "u" },
+		{ "CLUSTER_GRID_Z", std::to_string(CLUSTER_GRID_Z) + "u" },
+		{ "MAX_LIGHTS_PER_CLUSTER", std::to_string(MAX_LIGHTS_PER_CLUSTER) + "u" },
+		{ "MAX_SHADOW_CASCADES", std::to_string(MAX_SHADOW_CASCADES) + "u" },
+		// Specialization constant ids (which must be plain integers) and the values they can take
+		{ "SHADER_CONSTANT_TEXTURED", std::to_string(SHADER_CONSTANT_TEXTURED) },
+		{ "SHADER_CONSTANT_LIGHTING_MODE", std::to_string(SHADER_CONSTANT_LIGHTING_MODE) },
+		{ "SHADER_CONSTANT_SUN", std::to_string(SHADER_CONSTANT_SUN) },
+		{ "SHADER_CONSTANT_SCREEN_WIDTH", std::to_string(SHADER_CONSTANT_SCREEN_WIDTH) },
+		{ "SHADER_CONSTANT_SCREEN_HEIGHT", std::to_string(SHADER_CONSTANT_SCREEN_HEIGHT) },
+		{ "LIGHTING_MODE_LIT", std::to_string(static_cast<uint32_t>(LightingMode::Lit)) + "u" },
+		{ "LIGHTING_MODE_UNLIT", std::to_string(static_cast<uint32_t>(LightingMode::Unlit)) + "u" },
+		{ "LIGHTING_MODE_NORMALS", std::to_string(static_cast<uint32_t>(LightingMode::Normals)) + "u" },
+	};
+}
 
-void VulkanRenderer::createPushConstantRange()
+void VulkanRenderer::createPipelineCache()
 {
-	// Define push constant values (no "create" needed)
-	this->pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // Shader stage push constant will go to
-	this->pushConstantRange.offset = 0; // Offset into given data to pass to push constant
-	this->pushConstantRange.size = sizeof(Model); // Size of data being passed
+	// What the driver built on the last run, so pipelines it has seen before are quicker to build. Data from another
+	// device or driver version is ignored by the driver, which checks the header
+	std::vector<char> pipelineCacheData;
+	std::ifstream pipelineCacheFile(PIPELINE_CACHE_FILE, std::ios::binary | std::ios::ate);
+	if (pipelineCacheFile.is_open()) {
+		pipelineCacheData.resize(static_cast<size_t>(pipelineCacheFile.tellg()));
+		pipelineCacheFile.seekg(0);
+		pipelineCacheFile.read(pipelineCacheData.data(), pipelineCacheData.size());
+		if (!pipelineCacheFile) {
+			pipelineCacheData.clear();
+		}
+	}
+
+	// Not externally synchronized, so the pipeline worker threads can all build with it at once
+	VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+	pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	pipelineCacheCreateInfo.initialDataSize = pipelineCacheData.size();
+	pipelineCacheCreateInfo.pInitialData = pipelineCacheData.empty() ? nullptr : pipelineCacheData.data();
+
+	VkResult result = vkCreatePipelineCache(this->mainDevice.logicalDevice, &pipelineCacheCreateInfo, nullptr, &this->pipelineCache);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create pipeline cache");
+	}
 }
 
 void VulkanRenderer::createGraphicsPipeline()
 {
-	std::vector<char> vertexShaderCode = readFile("Shaders/vert.spv");
-	std::vector<char> fragmentShaderCode = readFile("Shaders/frag.spv");
+	// -- Pipeline layouts, from the shaders' reflected bindings. Model matrices come from the object buffer rather than push
+	// constants, so they're written once per frame in bulk
+	this->pipelineLayout = this->getShaderPipelineLayout({ "shader.vert", "shader.frag", "depth.vert" });
+	// Set 0 (lights and clusters) is the same as the first layout's so it stays bound, set 1 is the input attachments
+	this->secondPipelineLayout = this->getShaderPipelineLayout({ "second.vert", "second.frag" });
+
+	// Pipelines are built from their shaders and specialization constants the first time they're drawn with, on worker
+	// threads. createScenePipeline only reads renderer state set up before this, so it's safe to run on them
+	this->scenePipelines.create(this->mainDevice.logicalDevice, [this](const ShaderPermutation& permutation) {
+		return this->createScenePipeline(permutation);
+	}, this->config.pipelineThreads);
+
+	// The ones every frame can fall back on, built now so there's always something to draw with
+	this->scenePipelines.get(ShaderPermutation(static_cast<uint32_t>(ScenePipeline::DepthPrePass)));
+	this->scenePipelines.get(this->getGBufferPermutation(false, true));
+	this->lastLightingPipeline = this->scenePipelines.get(this->getLightingPermutation());
+
+	// And the other G-buffer ones in the background, as they're likely to be needed soon
+	this->scenePipelines.request(this->getGBufferPermutation(false, false));
+	this->scenePipelines.request(this->getGBufferPermutation(true, true));
+	this->scenePipelines.request(this->getGBufferPermutation(true, false));
+}
+
+VkPipeline VulkanRenderer::createScenePipeline(const ShaderPermutation& permutation)
+{
+	ScenePipeline type = static_cast<ScenePipeline>(permutation.getPipelineType());
+
+	// The depth pre-pass is vertex stage only, no fragment shader runs so fragments only cost the depth test and write
+	std::string vertexShaderName = "shader.vert";
+	std::string fragmentShaderName = "shader.frag";
+	if (type == ScenePipeline::DepthPrePass) {
+		vertexShaderName = "depth.vert";
+		fragmentShaderName.clear();
+	}
+	else if (type == ScenePipeline::Lighting) {
+		vertexShaderName = "second.vert";
+		fragmentShaderName = "second.frag";
+	}
+
+	// The depth pre-pass reads the position-only stream each mesh keeps after its interleaved vertices
+	bool positionStream = type == ScenePipeline::DepthPrePass;
+
+	// Everything that can throw is done before the shader modules are created, so only the pipeline creation can fail
+	// with them to destroy
+	std::vector<char> vertexShaderCode = this->shaderCompiler.compile(vertexShaderName, this->shaderDefines);
+	std::vector<char> fragmentShaderCode;
+	if (!fragmentShaderName.empty()) {
+		fragmentShaderCode = this->shaderCompiler.compile(fragmentShaderName, this->shaderDefines);
+	}
+
+	// How the data for each attribute the vertex shader reads is defined within a vertex, from the shader's reflected inputs
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions = this->getVertexAttributes(vertexShaderName, positionStream);
 
 	VkShaderModule vertexShaderModule = createShaderModule(vertexShaderCode);
-	VkShaderModule fragmentShaderModule = createShaderModule(fragmentShaderCode);
+	VkShaderModule fragmentShaderModule = VK_NULL_HANDLE;
+	if (!fragmentShaderCode.empty()) {
+		try {
+			fragmentShaderModule = createShaderModule(fragmentShaderCode);
+		}
+		catch (...) {
+			vkDestroyShaderModule(this->mainDevice.logicalDevice, vertexShaderModule, nullptr);
+			throw;
+		}
+	}
+
+	// The permutation's specialization constants, given to both stages. Each stage only reads the ones it declares, and
+	// branches on them are removed when the pipeline is built
+	std::vector<VkSpecializationMapEntry> specializationEntries;
+	VkSpecializationInfo specializationInfo = permutation.getSpecializationInfo(&specializationEntries);
 
 	// -- SHADER STAGE CREATION INFORMATION --
 	// Vertex Stage creation information
@@ -691,6 +1352,7 @@ void VulkanRenderer::createGraphicsPipeline()
 	vertexShaderCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT; // Shader stage name
 	vertexShaderCreateInfo.module = vertexShaderModule; // Shader module to be used by stage
 	vertexShaderCreateInfo.pName = "main"; // Name of entry point function in shader file
+	vertexShaderCreateInfo.pSpecializationInfo = &specializationInfo;
 
 	// Fragment stage creation information
 	VkPipelineShaderStageCreateInfo fragmentShaderCreateInfo = {};
@@ -698,6 +1360,7 @@ void VulkanRenderer::createGraphicsPipeline()
 	fragmentShaderCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT; // Shader stage name
 	fragmentShaderCreateInfo.module = fragmentShaderModule; // Shader module to be used by stage
 	fragmentShaderCreateInfo.pName = "main"; // Name of entry point function in shader file
+	fragmentShaderCreateInfo.pSpecializationInfo = &specializationInfo;
 
 	// Put shader stage creation info in to array
 	// Graphics Pipeline creation info requires array of shader stage creates
@@ -706,33 +1369,16 @@ void VulkanRenderer::createGraphicsPipeline()
 	// How the data for a single vertex (including such as positino, colour, texture coords, normals, etc) is as a whole
 	VkVertexInputBindingDescription bindingDescription = {};
 	bindingDescription.binding = 0; // Can bind multiple streams of data, this defines which one
-	bindingDescription.stride = sizeof(Vertex); // Size of a single vertex object
+	bindingDescription.stride = positionStream ? sizeof(glm::vec3) : sizeof(Vertex); // Size of a single vertex object
 	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX; // Here you select whether you want to draw one object at a time (VK_VERTEX_INPUT_RATE_VERTEX) or one of the vertex for each at a time (VK_VERTEX_INPUT_RATE_INSTANCE)
 
-	// How the data for an attribute is defined within a vertex
-	std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions;
-	// Position Attribute 
-	attributeDescriptions[0].binding = 0; // Which binding the data is at (should be same as above - unless you have stream of data)
-	attributeDescriptions[0].location = 0; // Location in shader where data will be read from
-	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT; // Format the data will take (also helps define the size of the data)
-	attributeDescriptions[0].offset = offsetof(Vertex, pos); // Where this attribute is defined in the data for a single vertex
-	// Colour Attribute 
-	attributeDescriptions[1].binding = 0; 
-	attributeDescriptions[1].location = 1;
-	attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT; 
-	attributeDescriptions[1].offset = offsetof(Vertex, col); 
-	// TExture Attribute
-	attributeDescriptions[2].binding = 0;
-	attributeDescriptions[2].location = 2;
-	attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-	attributeDescriptions[2].offset = offsetof(Vertex, tex);
-
 	// CREATE PIPELINE
 	// -- Vertex Input --
+	// No vertex data at all for the lighting subpass, its vertex shader makes a full screen triangle
 	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
 	vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputCreateInfo.vertexBindingDescriptionCount = 1; 
-	vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription; // List of Vertex Binding Descriptions (data spacing / stride info)
+	vertexInputCreateInfo.vertexBindingDescriptionCount = attributeDescriptions.empty() ? 0 : 1;
+	vertexInputCreateInfo.pVertexBindingDescriptions = attributeDescriptions.empty() ? nullptr : &bindingDescription; // List of Vertex Binding Descriptions (data spacing / stride info)
 	vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
 	vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data(); // List of vertex attr descriptions (data format and where from)
 
@@ -820,29 +1466,21 @@ void VulkanRenderer::createGraphicsPipeline()
 	colourState.alphaBlendOp = VK_BLEND_OP_ADD;
 	//Summarized: (1 * new alpha) + (0 * old alpha) = new alpha
 
+	// G-buffer targets hold surface properties rather than colours, so they're overwritten rather than blended. Only the
+	// lighting subpass's output (the swapchain image) uses the blend state above
+	VkPipelineColorBlendAttachmentState gBufferState = {};
+	gBufferState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	gBufferState.blendEnable = VK_FALSE;
+	std::array<VkPipelineColorBlendAttachmentState, 3> gBufferStates = { gBufferState, gBufferState, gBufferState };
+
 	VkPipelineColorBlendStateCreateInfo colourBlendingCreateInfo = { };
 	colourBlendingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
 	colourBlendingCreateInfo.logicOpEnable = VK_FALSE; // Alternative to calculations is to use logical operations
-	colourBlendingCreateInfo.attachmentCount = 1;
-	colourBlendingCreateInfo.pAttachments = &colourState;
+	colourBlendingCreateInfo.attachmentCount = static_cast<uint32_t>(gBufferStates.size());
+	colourBlendingCreateInfo.pAttachments = gBufferStates.data();
 	// We wont be using the logic operations, instead we wil be using the attachment (above)
 	//colourBlendingCreateInfo.logicOp = VK_LOGIC_OP_COPY; // What is the way that you want to do the operations
 
-	// -- Pipeline layout --
-	std::array<VkDescriptorSetLayout, 2> descriptorSetLayouts = { descriptorSetLayout, samplerDescriptorSetLayout };
-
-	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
-	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
-	pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-	pipelineLayoutCreateInfo.pPushConstantRanges = &this->pushConstantRange;
-
-	// Create pipelinelayout
-	VkResult result = vkCreatePipelineLayout(this->mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &this->pipelineLayout);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create Pipeline layout");
-	}
 
 	// -- DEPTH STENCIL TESTING --
 	VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo = {};
@@ -853,10 +1491,26 @@ void VulkanRenderer::createGraphicsPipeline()
 	depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE; // Depth bounds test: does the depth value exist between two bounds?
 	depthStencilCreateInfo.stencilTestEnable = VK_FALSE;
 
+	// -- Per pipeline state --
+	if (type == ScenePipeline::GBufferDepthEqual) {
+		// Depth already holds the nearest surface, so only fragments matching it pass (and are shaded), and nothing is
+		// written. shader.vert and depth.vert both mark gl_Position invariant so the depths match exactly
+		depthStencilCreateInfo.depthWriteEnable = VK_FALSE;
+		depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_EQUAL;
+	}
+	else if (type == ScenePipeline::Lighting) {
+		// Don't want to write to depth buffer
+		depthStencilCreateInfo.depthWriteEnable = VK_FALSE;
+
+		// One output, the swapchain image
+		colourBlendingCreateInfo.attachmentCount = 1;
+		colourBlendingCreateInfo.pAttachments = &colourState;
+	}
+
 	// -- Graphics Pipeline Creation --
 	VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
 	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineCreateInfo.stageCount = 2;
+	pipelineCreateInfo.stageCount = fragmentShaderModule != VK_NULL_HANDLE ? 2 : 1;
 	pipelineCreateInfo.pStages = shaderStages;
 	pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
 	pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
@@ -864,99 +1518,196 @@ void VulkanRenderer::createGraphicsPipeline()
 	pipelineCreateInfo.pDynamicState = nullptr;
 	pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
 	pipelineCreateInfo.pMultisampleState = &multisamplingCreateInfo;
-	pipelineCreateInfo.pColorBlendState = &colourBlendingCreateInfo;
+	pipelineCreateInfo.pColorBlendState = type == ScenePipeline::DepthPrePass ? nullptr : &colourBlendingCreateInfo; // No colour attachments in the pre-pass subpass
 	pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
-	pipelineCreateInfo.layout = this->pipelineLayout;
+	pipelineCreateInfo.layout = type == ScenePipeline::Lighting ? this->secondPipelineLayout : this->pipelineLayout; // The lighting subpass reads input attachment descriptor sets
 	pipelineCreateInfo.renderPass = this->renderPass;
-	pipelineCreateInfo.subpass = 0;
+	// Depth pre-pass, G-buffer then lighting
+	pipelineCreateInfo.subpass = type == ScenePipeline::DepthPrePass ? 0 : type == ScenePipeline::Lighting ? 2 : 1;
 
 	// Pipeline derivatives:  Can create multiple pipelines that derive from one another for optimisation
 	pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE; // Existing pipeline to derive from...
 	pipelineCreateInfo.basePipelineIndex = -1; // or index of pipeline being created to derive from (in case creating multiple pipelines at once)
 
 	// Create graphics pipeline
-	result = vkCreateGraphicsPipelines(this->mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &this->graphicsPipeline);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create graphics pipeline");
-	}
+	VkPipeline pipeline;
+	VkResult result = vkCreateGraphicsPipelines(this->mainDevice.logicalDevice, this->pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline);
 
-	// Destroy shader modules, no longer needed after pipeline created
-	vkDestroyShaderModule(this->mainDevice.logicalDevice, fragmentShaderModule, nullptr);
+	// Destroy shader modules, no longer needed after pipeline created, or if it couldn't be
+	if (fragmentShaderModule != VK_NULL_HANDLE) {
+		vkDestroyShaderModule(this->mainDevice.logicalDevice, fragmentShaderModule, nullptr);
+	}
 	vkDestroyShaderModule(this->mainDevice.logicalDevice, vertexShaderModule, nullptr);
 
-	// - Create Second Pass pipeline
-	// Second pass shaders
-	std::vector<char> secondVertexShaderCode = readFile("Shaders/second_vert.spv");
-	std::vector<char> secondFragmentShaderCode = readFile("Shaders/second_frag.spv");
-
-	// Build shaders
-	VkShaderModule secondVertexShaderModule = createShaderModule(secondVertexShaderCode);
-	VkShaderModule secondFragmentShaderModule = createShaderModule(secondFragmentShaderCode);
-
-	// We can reuse the same pipeline as above as it doesn't affect once the creation happened
-	vertexShaderCreateInfo.module = secondVertexShaderModule;
-	fragmentShaderCreateInfo.module = secondFragmentShaderModule;
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create graphics pipeline");
+	}
 
-	VkPipelineShaderStageCreateInfo secondShaderStages[] = { vertexShaderCreateInfo, fragmentShaderCreateInfo };
+	return pipeline;
+}
 
-	// No vertex data for second pass
-	vertexInputCreateInfo.vertexBindingDescriptionCount = 0;
-	vertexInputCreateInfo.pVertexBindingDescriptions = nullptr;
-	vertexInputCreateInfo.vertexBindingDescriptionCount = 0;
-	vertexInputCreateInfo.pVertexBindingDescriptions = nullptr;
+void VulkanRenderer::createClusterPipeline()
+{
+	std::vector<char> clusterShaderCode = this->shaderCompiler.compile("cluster.comp", this->shaderDefines);
+	VkShaderModule clusterShaderModule = createShaderModule(clusterShaderCode);
 
-	// Don't want to write to depth buffer
-	depthStencilCreateInfo.depthWriteEnable = VK_FALSE;
+	// Only set 0 is used, its light and cluster buffers
+	this->clusterPipelineLayout = this->getShaderPipelineLayout({ "cluster.comp" });
 
-	// Create new pipeline layout
-	VkPipelineLayoutCreateInfo secondPipelineLayoutCreateInfo = {};
-	secondPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	secondPipelineLayoutCreateInfo.setLayoutCount = 1;
-	secondPipelineLayoutCreateInfo.pSetLayouts = &this->inputDescriptorSetLayout;
-	secondPipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-	secondPipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = clusterShaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = this->clusterPipelineLayout;
 
-	result = vkCreatePipelineLayout(this->mainDevice.logicalDevice, &secondPipelineLayoutCreateInfo, nullptr, &this->secondPipelineLayout);
+	VkResult result = vkCreateComputePipelines(this->mainDevice.logicalDevice, this->pipelineCache, 1, &pipelineCreateInfo, nullptr, &this->clusterPipeline);
 	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create second pipeline layout");
+		throw std::runtime_error("Failed to create cluster pipeline");
 	}
 
-	pipelineCreateInfo.pStages = secondShaderStages; // Update second shader stage list
-	pipelineCreateInfo.layout = this->secondPipelineLayout; // Change pipeline layout for input attachment descriptor sets
-	pipelineCreateInfo.subpass = 1; // use second subpass
+	vkDestroyShaderModule(this->mainDevice.logicalDevice, clusterShaderModule, nullptr);
+}
 
-	// Create second pipeline
-	result = vkCreateGraphicsPipelines(
-		this->mainDevice.logicalDevice,
-		VK_NULL_HANDLE,
-		1,
-		&pipelineCreateInfo,
-		nullptr,
-		&this->secondPipeline);
+void VulkanRenderer::createShadowPipeline()
+{
+	std::vector<char> shadowShaderCode = this->shaderCompiler.compile("shadow.vert", this->shaderDefines);
+	VkShaderModule shadowShaderModule = createShaderModule(shadowShaderCode);
+
+	// Vertex stage only, depth is all that's written
+	VkPipelineShaderStageCreateInfo vertexShaderCreateInfo = {};
+	vertexShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	vertexShaderCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	vertexShaderCreateInfo.module = shadowShaderModule;
+	vertexShaderCreateInfo.pName = "main";
+
+	// The position-only stream after each mesh's interleaved vertices, the same one the depth pre-pass reads
+	VkVertexInputBindingDescription bindingDescription = {};
+	bindingDescription.binding = 0;
+	bindingDescription.stride = sizeof(glm::vec3);
+	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions = this->getVertexAttributes("shadow.vert", true);
+
+	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
+	vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
+	vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+	vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	// The whole shadow map layer
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(this->config.shadowMapSize);
+	viewport.height = static_cast<float>(this->config.shadowMapSize);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor = {};
+	scissor.offset = { 0, 0 };
+	scissor.extent = { this->config.shadowMapSize, this->config.shadowMapSize };
+
+	VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {};
+	viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportStateCreateInfo.viewportCount = 1;
+	viewportStateCreateInfo.pViewports = &viewport;
+	viewportStateCreateInfo.scissorCount = 1;
+	viewportStateCreateInfo.pScissors = &scissor;
+
+	// Both faces cast, so open meshes and single sided quads still shadow. Depth bias (scaled with the slope) keeps lit
+	// surfaces from shadowing themselves, the lighting subpass offsets along the normal for the rest
+	VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo = {};
+	rasterizerCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizerCreateInfo.depthClampEnable = VK_FALSE;
+	rasterizerCreateInfo.rasterizerDiscardEnable = VK_FALSE;
+	rasterizerCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizerCreateInfo.lineWidth = 1.0f;
+	rasterizerCreateInfo.cullMode = VK_CULL_MODE_NONE;
+	rasterizerCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterizerCreateInfo.depthBiasEnable = VK_TRUE;
+	rasterizerCreateInfo.depthBiasConstantFactor = 1.25f;
+	rasterizerCreateInfo.depthBiasSlopeFactor = 1.75f;
+
+	VkPipelineMultisampleStateCreateInfo multisamplingCreateInfo = {};
+	multisamplingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisamplingCreateInfo.sampleShadingEnable = VK_FALSE;
+	multisamplingCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo = {};
+	depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencilCreateInfo.depthTestEnable = VK_TRUE;
+	depthStencilCreateInfo.depthWriteEnable = VK_TRUE;
+	depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+	depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE;
+	depthStencilCreateInfo.stencilTestEnable = VK_FALSE;
+
+	// Set 0 for the object buffer's model matrices, the cascade's view-projection is pushed before its casters are drawn
+	this->shadowPipelineLayout = this->getShaderPipelineLayout({ "shadow.vert" });
+
+	// Created against the static pass, the dynamic pass is compatible with it (same attachment format, one subpass)
+	VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stageCount = 1;
+	pipelineCreateInfo.pStages = &vertexShaderCreateInfo;
+	pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
+	pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
+	pipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
+	pipelineCreateInfo.pDynamicState = nullptr;
+	pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
+	pipelineCreateInfo.pMultisampleState = &multisamplingCreateInfo;
+	pipelineCreateInfo.pColorBlendState = nullptr;
+	pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
+	pipelineCreateInfo.layout = this->shadowPipelineLayout;
+	pipelineCreateInfo.renderPass = this->staticShadowRenderPass;
+	pipelineCreateInfo.subpass = 0;
+	pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineCreateInfo.basePipelineIndex = -1;
 
+	VkResult result = vkCreateGraphicsPipelines(this->mainDevice.logicalDevice, this->pipelineCache, 1, &pipelineCreateInfo, nullptr, &this->shadowPipeline);
 	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create graphics pipeline");
+		throw std::runtime_error("Failed to create shadow pipeline");
 	}
 
-	// Destroy the second shader modules
-	vkDestroyShaderModule(this->mainDevice.logicalDevice, secondFragmentShaderModule, nullptr);
-	vkDestroyShaderModule(this->mainDevice.logicalDevice, secondVertexShaderModule, nullptr);
+	vkDestroyShaderModule(this->mainDevice.logicalDevice, shadowShaderModule, nullptr);
 }
 
-void VulkanRenderer::createColourBufferImage()
+void VulkanRenderer::createGBufferImages()
 {
 	// Resize supported format for colour attachment 
 	this->colourBufferImages.resize(this->swapchainImages.size());
 	this->colourBufferImageMemories.resize(this->swapchainImages.size());
 	this->colourBufferImageViews.resize(this->swapchainImages.size());
-
-	// Get supported format for colour attachment
+	this->normalBufferImages.resize(this->swapchainImages.size());
+	this->normalBufferImageMemories.resize(this->swapchainImages.size());
+	this->normalBufferImageViews.resize(this->swapchainImages.size());
+	this->materialBufferImages.resize(this->swapchainImages.size());
+	this->materialBufferImageMemories.resize(this->swapchainImages.size());
+	this->materialBufferImageViews.resize(this->swapchainImages.size());
+
+	// Get supported formats for the attachments (the same as createRenderPass chose)
 	VkFormat colourFormat = chooseSupportedFormat(
 		{ VK_FORMAT_R8G8B8A8_UNORM },
 		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT
+	);
+	VkFormat normalFormat = chooseSupportedFormat(
+		{ VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16_SFLOAT },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT
 	);
 
+	// Transient as they're never stored or sampled, only read as input attachments within the render pass
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT; // attachment input allows it to be an input to a subpass, but limits the computations
+	VkMemoryPropertyFlags memoryProperties = this->chooseTransientAttachmentMemory();
+
 	for (size_t i = 0; i < swapchainImages.size(); i++) {
 		// Create colour buffer image
 		this->colourBufferImages[i] = createImage(
@@ -964,8 +1715,8 @@ void VulkanRenderer::createColourBufferImage()
 			this->swapchainExtent.height,
 			colourFormat,
 			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, // attachment input allows it to be an input to a subpass, but limits the computations
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, // We only need for this to be available in gpu
+			usage,
+			memoryProperties, // We only need for this to be available in gpu
 			&this->colourBufferImageMemories[i]);
 
 		// Create coloour buffer image view
@@ -974,6 +1725,14 @@ void VulkanRenderer::createColourBufferImage()
 			colourFormat,
 			VK_IMAGE_ASPECT_COLOR_BIT // Here we're getting the colour bit of th eimage
 		);
+
+		this->normalBufferImages[i] = createImage(this->swapchainExtent.width, this->swapchainExtent.height, normalFormat,
+			VK_IMAGE_TILING_OPTIMAL, usage, memoryProperties, &this->normalBufferImageMemories[i]);
+		this->normalBufferImageViews[i] = createImageView(this->normalBufferImages[i], normalFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		this->materialBufferImages[i] = createImage(this->swapchainExtent.width, this->swapchainExtent.height, colourFormat,
+			VK_IMAGE_TILING_OPTIMAL, usage, memoryProperties, &this->materialBufferImageMemories[i]);
+		this->materialBufferImageViews[i] = createImageView(this->materialBufferImages[i], colourFormat, VK_IMAGE_ASPECT_COLOR_BIT);
 	}
 }
 
@@ -989,6 +1748,8 @@ void VulkanRenderer::createDepthBufferImage()
 		VK_IMAGE_TILING_OPTIMAL,
 		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
 	);
+	// Only read within the render pass, like the rest of the G-buffer
+	VkMemoryPropertyFlags transientMemory = this->chooseTransientAttachmentMemory();
 
 	for (size_t i = 0; i < swapchainImages.size(); i++) {
 		// Create depth buffer image
@@ -997,8 +1758,8 @@ void VulkanRenderer::createDepthBufferImage()
 			this->swapchainExtent.height,
 			depthFormat,
 			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+			transientMemory,
 			&this->depthBufferImageMemories[i]
 		);
 
@@ -1007,6 +1768,121 @@ void VulkanRenderer::createDepthBufferImage()
 	}
 }
 
+void VulkanRenderer::createShadowMaps()
+{
+	uint32_t mapSize = this->config.shadowMapSize;
+	uint32_t cascadeCount = this->config.shadowCascades;
+
+	VkFramebufferCreateInfo framebufferCreateInfo = {};
+	framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferCreateInfo.attachmentCount = 1;
+	framebufferCreateInfo.width = mapSize;
+	framebufferCreateInfo.height = mapSize;
+	framebufferCreateInfo.layers = 1;
+
+	// - Static shadows, one layer per cascade. Shared by every swapchain image, it's only written when a cascade is redrawn
+	this->staticShadowImage = this->createImage(mapSize, mapSize, this->shadowFormat, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&this->staticShadowImageMemory, 1, cascadeCount);
+
+	this->staticShadowLayerViews.resize(cascadeCount);
+	this->staticShadowFramebuffers.resize(cascadeCount);
+	framebufferCreateInfo.renderPass = this->staticShadowRenderPass;
+	for (uint32_t i = 0; i < cascadeCount; i++) {
+		this->staticShadowLayerViews[i] = this->createImageView(this->staticShadowImage, this->shadowFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1,
+			VK_IMAGE_VIEW_TYPE_2D, i, 1);
+
+		framebufferCreateInfo.pAttachments = &this->staticShadowLayerViews[i];
+		VkResult result = vkCreateFramebuffer(this->mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &this->staticShadowFramebuffers[i]);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create a static shadow framebuffer");
+		}
+	}
+
+	// - Shadow maps the lighting subpass samples, one per swapchain image as they're drawn every frame
+	this->shadowMapImages.resize(this->swapchainImages.size());
+	this->shadowMapImageMemories.resize(this->swapchainImages.size());
+	this->shadowMapImageViews.resize(this->swapchainImages.size());
+	this->shadowMapLayerViews.resize(this->swapchainImages.size() * cascadeCount);
+	this->shadowMapFramebuffers.resize(this->swapchainImages.size() * cascadeCount);
+	framebufferCreateInfo.renderPass = this->shadowRenderPass;
+
+	VkCommandBuffer commandBuffer = beginCommandBuffer(this->mainDevice.logicalDevice, this->graphicsCommandPool);
+	for (size_t i = 0; i < this->swapchainImages.size(); i++) {
+		this->shadowMapImages[i] = this->createImage(mapSize, mapSize, this->shadowFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &this->shadowMapImageMemories[i], 1, cascadeCount);
+
+		// Every cascade in one view for sampling, and a view of each for drawing into
+		this->shadowMapImageViews[i] = this->createImageView(this->shadowMapImages[i], this->shadowFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1,
+			VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0, cascadeCount);
+
+		for (uint32_t j = 0; j < cascadeCount; j++) {
+			size_t layer = i * cascadeCount + j;
+			this->shadowMapLayerViews[layer] = this->createImageView(this->shadowMapImages[i], this->shadowFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1,
+				VK_IMAGE_VIEW_TYPE_2D, j, 1);
+
+			framebufferCreateInfo.pAttachments = &this->shadowMapLayerViews[layer];
+			VkResult result = vkCreateFramebuffer(this->mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &this->shadowMapFramebuffers[layer]);
+			if (result != VK_SUCCESS) {
+				throw std::runtime_error("Failed to create a shadow map framebuffer");
+			}
+		}
+
+		// Readable from the start, as the lighting subpass has it bound whether or not there's a sun to draw it for
+		VkImageMemoryBarrier imageMemoryBarrier = {};
+		imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageMemoryBarrier.image = this->shadowMapImages[i];
+		imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+		imageMemoryBarrier.subresourceRange.levelCount = 1;
+		imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
+		imageMemoryBarrier.subresourceRange.layerCount = cascadeCount;
+		imageMemoryBarrier.srcAccessMask = 0;
+		imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+	}
+	endAndSubmitCommandBuffer(this->mainDevice.logicalDevice, this->graphicsCommandPool, this->graphicsQueue, commandBuffer);
+
+	// - Comparison sampler, so each tap returns how lit it is. Outside the map is white (the far plane), so nothing there
+	// is shadowed
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(this->mainDevice.physicalDevice, this->shadowFormat, &formatProperties);
+	VkFilter filter = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+	VkSamplerCreateInfo samplerCreateInfo = {};
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = filter;
+	samplerCreateInfo.minFilter = filter;
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+	samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+	samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.minLod = 0.0f;
+	samplerCreateInfo.maxLod = 0.0f;
+	samplerCreateInfo.anisotropyEnable = VK_FALSE;
+	samplerCreateInfo.compareEnable = VK_TRUE;
+	samplerCreateInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+	VkResult result = vkCreateSampler(this->mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &this->shadowSampler);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create shadow sampler");
+	}
+
+	// Nothing fit yet, so every cascade is drawn the first time there's a sun
+	this->shadowCascades.assign(cascadeCount, ShadowCascade());
+	this->shadowCascadeSplits.assign(cascadeCount, 0.0f);
+	this->shadowCascadeVersions.assign(cascadeCount, 0);
+}
+
 void VulkanRenderer::createFramebuffers()
 {
 	// Resize framebuffer count to equal to swapchain image count
@@ -1014,10 +1890,12 @@ void VulkanRenderer::createFramebuffers()
 
 	// Create a framebuffer for eachi swap chain image
 	for (size_t i = 0; i < this->swapchainFramebuffers.size(); i++) {
-		std::array<VkImageView, 3> attachments = {
+		std::array<VkImageView, 5> attachments = {
 			this->swapchainImages[i].imageView,
 			this->colourBufferImageViews[i],
-			this->depthBufferImageViews[i]
+			this->depthBufferImageViews[i],
+			this->normalBufferImageViews[i],
+			this->materialBufferImageViews[i]
 		};
 
 		VkFramebufferCreateInfo framebufferCreateInfo = {};
@@ -1078,29 +1956,75 @@ void VulkanRenderer::createCommandBuffers()
 
 void VulkanRenderer::createSynchronization()
 {
-	this->imageAvailable.resize(MAX_FRAME_DRAWS);
-	this->renderFinished.resize(MAX_FRAME_DRAWS);
-	this->drawFences.resize(MAX_FRAME_DRAWS);
-	
-	// Semaphore creation information
+	this->imageAvailable.resize(this->config.framesInFlight);
+	this->renderFinished.resize(this->config.framesInFlight);
+	// Value 0 is already reached, so nothing waits before a slot or image is first used
+	this->frameValues.assign(this->config.framesInFlight, 0);
+	this->imageValues.assign(this->swapchainImages.size(), 0);
+	this->frameStartTimes.resize(this->config.framesInFlight);
+	this->latencyPending.assign(this->config.framesInFlight, false);
+
+	// Timeline semaphore replaces per frame fences, and uploads use it instead of waiting for the queue to go idle
+	this->timeline.create(this->mainDevice.logicalDevice);
+
+	// Semaphore creation information (binary, for acquire and present)
 	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
-	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
-
-	// Fence creation information
-	VkFenceCreateInfo fenceCreateInfo = {};
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	for (size_t i = 0; i < MAX_FRAME_DRAWS; i++)
+	for (size_t i = 0; i < this->config.framesInFlight; i++)
 	{
 		if (vkCreateSemaphore(this->mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &this->imageAvailable[i]) != VK_SUCCESS ||
-			vkCreateSemaphore(this->mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &this->renderFinished[i]) != VK_SUCCESS ||
-			vkCreateFence(this->mainDevice.logicalDevice, &fenceCreateInfo, nullptr, &this->drawFences[i]) != VK_SUCCESS) {
+			vkCreateSemaphore(this->mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &this->renderFinished[i]) != VK_SUCCESS) {
 			throw std::runtime_error("Failed to create a Semaphore");
 		}
 	}
 }
 
+void VulkanRenderer::createTimestampQueryPool()
+{
+	this->timestampsWritten.assign(this->config.framesInFlight, false);
+	this->shadowCascadesTimed.assign(this->config.framesInFlight, 0);
+
+	if (!this->timestampsSupported) {
+		std::cout << "Timestamp queries not supported, GPU times will not be reported" << std::endl;
+		return;
+	}
+
+	// Start and end timestamp of the frame and of each shadow cascade, for each frame in flight
+	VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCreateInfo.queryCount = this->config.framesInFlight * TIMESTAMPS_PER_FRAME;
+
+	VkResult result = vkCreateQueryPool(this->mainDevice.logicalDevice, &queryPoolCreateInfo, nullptr, &this->timestampQueryPool);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create timestamp query pool");
+	}
+}
+
+void VulkanRenderer::createStatisticsQueryPool()
+{
+	this->statisticsWritten.assign(this->config.framesInFlight, false);
+	this->frameDepthPrePass.assign(this->config.framesInFlight, false);
+
+	if (!this->statisticsSupported) {
+		std::cout << "Pipeline statistics queries not supported, overdraw will not be measured" << std::endl;
+		return;
+	}
+
+	// One query per frame in flight, around the G-buffer subpass
+	VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+	queryPoolCreateInfo.queryCount = this->config.framesInFlight;
+	queryPoolCreateInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+	VkResult result = vkCreateQueryPool(this->mainDevice.logicalDevice, &queryPoolCreateInfo, nullptr, &this->statisticsQueryPool);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create pipeline statistics query pool");
+	}
+}
+
 void VulkanRenderer::createTextureSampler()
 {
 	// Sample creation info
@@ -1115,8 +2039,8 @@ void VulkanRenderer::createTextureSampler()
 	samplerCreateInfo.unnormalizedCoordinates = VK_FALSE; // Yes to normalised coordinates, between 0 and 1 - whether coords should be normalised between 0 and 1
 	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR; // Mipmap interpolation mode
 	samplerCreateInfo.mipLodBias = 0.0f; // Level of detail bias for mip level
-	samplerCreateInfo.minLod = 0.0f; // minimum level of detail to pick mip level, but we're not using mipmaps
-	samplerCreateInfo.maxLod = 0.0f;
+	samplerCreateInfo.minLod = 0.0f; // minimum level of detail to pick mip level
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE; // Texture images only hold their resident mip levels, so any level in the image can be used
 	samplerCreateInfo.anisotropyEnable = VK_TRUE; // Anisotropic is drawing a texture and stretching the borders to mimic eyesight borders (an antialiasing technique)
 	samplerCreateInfo.maxAnisotropy = 16; // Amount of samples level being taken for anisotropy
 
@@ -1162,98 +2086,110 @@ void VulkanRenderer::createUniformBuffers()
 		//	&this->modelDynamicUniformBuffer[i],
 		//	&this->modelDynamicUniformBufferMemory[i]);
 	}
-}
 
-void VulkanRenderer::createDescriptorPool()
-{
-	// - Create Uniform Descriptor Pool
-	// Type of descriptors + how many DESCRIPTORS, not descriptor sets (combined makes pool size)
-	VkDescriptorPoolSize vpPoolSize = {};
-	vpPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	vpPoolSize.descriptorCount = static_cast<uint32_t>(this->vpUniformBuffer.size());
-
-	//// NO LONGER USED BELOW BUT KEEPING FOR REFERENCE, AS THAT'S HOW MODEL WAS DONE VIA DYNAMIC BUFFERS
-	//// Model pool (dynamic)
-	//VkDescriptorPoolSize modelPoolSize = {};
-	//modelPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	//modelPoolSize.descriptorCount = static_cast<uint32_t>(this->modelDynamicUniformBuffer.size());
-
-	// List of pools
-	std::vector<VkDescriptorPoolSize> descriptorPoolSizes = { vpPoolSize };
-
-	// Data to create descriptor pool
-	VkDescriptorPoolCreateInfo poolCreateInfo = {};
-	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolCreateInfo.maxSets = static_cast<uint32_t>(this->swapchainImages.size()); // Max number of descriptor sets that can eb creataed from pool
-	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(descriptorPoolSizes.size()); // Amount of pool sizes being passed
-	poolCreateInfo.pPoolSizes = descriptorPoolSizes.data();
-
-	// Create descriptor pool
-	VkResult result = vkCreateDescriptorPool(this->mainDevice.logicalDevice, &poolCreateInfo, nullptr, &this->descriptorPool);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create descriptor pool");
+	// Object transform buffers, one for each image as well, grown later if the scene outgrows them
+	this->objectBuffers.resize(this->swapchainImages.size(), VK_NULL_HANDLE);
+	this->objectBufferMemories.resize(this->swapchainImages.size(), VK_NULL_HANDLE);
+	this->objectBufferMapped.resize(this->swapchainImages.size(), nullptr);
+	this->objectBufferCapacities.resize(this->swapchainImages.size(), 0);
+	for (size_t i = 0; i < this->swapchainImages.size(); i++) {
+		this->createObjectBuffer(i, INITIAL_OBJECT_CAPACITY);
 	}
 
-	// - Create Sampler Descriptor Pool
-	VkDescriptorPoolSize samplerPoolSize = {};
-	samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerPoolSize.descriptorCount = MAX_OBJECTS;
-
-	VkDescriptorPoolCreateInfo samplerPoolCreateInfo = {};
-	samplerPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	samplerPoolCreateInfo.maxSets = MAX_OBJECTS;
-	samplerPoolCreateInfo.pPoolSizes = &samplerPoolSize;
+	// Light and cluster buffers, sized for the most lights there can be so they never need regrowing
+	this->lightBuffers.resize(this->swapchainImages.size());
+	this->lightBufferMemories.resize(this->swapchainImages.size());
+	this->lightBufferMapped.resize(this->swapchainImages.size());
+	this->clusterBuffers.resize(this->swapchainImages.size());
+	this->clusterBufferMemories.resize(this->swapchainImages.size());
+	for (size_t i = 0; i < this->swapchainImages.size(); i++) {
+		createBuffer(
+			this->mainDevice.physicalDevice,
+			this->mainDevice.logicalDevice,
+			sizeof(LightBufferHeader) + sizeof(Light) * MAX_LIGHTS,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&this->lightBuffers[i],
+			&this->lightBufferMemories[i]);
+		vkMapMemory(this->mainDevice.logicalDevice, this->lightBufferMemories[i], 0, VK_WHOLE_SIZE, 0, &this->lightBufferMapped[i]);
 
-	result = vkCreateDescriptorPool(this->mainDevice.logicalDevice, &samplerPoolCreateInfo, nullptr, &this->samplerDescriptorPool);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create descriptor pool");
+		createBuffer(
+			this->mainDevice.physicalDevice,
+			this->mainDevice.logicalDevice,
+			CLUSTER_BUFFER_SIZE,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, // Copied from by readClusterBuffer
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&this->clusterBuffers[i],
+			&this->clusterBufferMemories[i]);
 	}
+}
 
-	// -- Create input attachment descriptor pool
-	// Colour attachment pool size
-	VkDescriptorPoolSize colourInputPoolSize = {};
-	colourInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	colourInputPoolSize.descriptorCount = static_cast<uint32_t>(this->colourBufferImageViews.size());
+void VulkanRenderer::createObjectBuffer(size_t imageIndex, uint32_t capacity)
+{
+	// Host visible and left mapped for the life of the buffer, so each frame's transforms are written straight in
+	createBuffer(
+		this->mainDevice.physicalDevice,
+		this->mainDevice.logicalDevice,
+		sizeof(ObjectTransform) * capacity,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&this->objectBuffers[imageIndex],
+		&this->objectBufferMemories[imageIndex]);
 
-	// Depth attachment pool size
-	VkDescriptorPoolSize depthInputPoolSize = {};
-	depthInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	depthInputPoolSize.descriptorCount = static_cast<uint32_t>(this->depthBufferImageViews.size());
+	void* data;
+	vkMapMemory(this->mainDevice.logicalDevice, this->objectBufferMemories[imageIndex], 0, VK_WHOLE_SIZE, 0, &data);
+	this->objectBufferMapped[imageIndex] = static_cast<ObjectTransform*>(data);
+	this->objectBufferCapacities[imageIndex] = capacity;
+}
 
-	std::vector<VkDescriptorPoolSize> inputPoolSizes = { colourInputPoolSize, depthInputPoolSize };
+void VulkanRenderer::destroyObjectBuffer(size_t imageIndex)
+{
+	vkUnmapMemory(this->mainDevice.logicalDevice, this->objectBufferMemories[imageIndex]);
+	vkDestroyBuffer(this->mainDevice.logicalDevice, this->objectBuffers[imageIndex], nullptr);
+	freeDeviceMemory(this->mainDevice.logicalDevice, this->objectBufferMemories[imageIndex]);
+	this->objectBufferMapped[imageIndex] = nullptr;
+	this->objectBufferCapacities[imageIndex] = 0;
+}
 
-	// Create input attachment pool
-	VkDescriptorPoolCreateInfo inputPoolCreateInfo = {};
-	inputPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	inputPoolCreateInfo.maxSets = this->swapchainImages.size();
-	inputPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(inputPoolSizes.size());
+void VulkanRenderer::writeObjectBufferDescriptor(size_t imageIndex)
+{
+	VkDescriptorBufferInfo objectBufferInfo = {};
+	objectBufferInfo.buffer = this->objectBuffers[imageIndex];
+	objectBufferInfo.offset = 0;
+	objectBufferInfo.range = VK_WHOLE_SIZE;
+
+	VkWriteDescriptorSet objectSetWrite = {};
+	objectSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	objectSetWrite.dstSet = this->descriptorSets[imageIndex];
+	objectSetWrite.dstBinding = 1;
+	objectSetWrite.dstArrayElement = 0;
+	objectSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	objectSetWrite.descriptorCount = 1;
+	objectSetWrite.pBufferInfo = &objectBufferInfo;
+
+	vkUpdateDescriptorSets(this->mainDevice.logicalDevice, 1, &objectSetWrite, 0, nullptr);
+}
 
-	result = vkCreateDescriptorPool(this->mainDevice.logicalDevice, &inputPoolCreateInfo, nullptr, &this->inputDescriptorPool);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create descriptor pool");
+void VulkanRenderer::createDescriptorAllocators()
+{
+	// Pools are sized for the sets allocated from them, and more are added as they fill, so these are only how many sets
+	// each pool holds. The frame and input attachment sets are one of each per swapchain image
+	this->descriptorAllocator.create(this->mainDevice.logicalDevice, static_cast<uint32_t>(this->swapchainImages.size()));
+
+	// Texture sets are written by each frame for what it binds, so there's one allocator per frame in flight
+	this->frameDescriptorAllocators.resize(this->config.framesInFlight);
+	for (DescriptorAllocator& frameDescriptorAllocator : this->frameDescriptorAllocators) {
+		frameDescriptorAllocator.create(this->mainDevice.logicalDevice, TEXTURE_DESCRIPTOR_SETS_PER_POOL);
 	}
 }
 
 
 void VulkanRenderer::createDescriptorSets()
 {
-	// Resize descriptor set list so one for every buffer
+	// One descriptor set for every buffer
 	this->descriptorSets.resize(this->swapchainImages.size());
-
-	// We create a list with all the values the same as that's how it references in the allocation
-	std::vector<VkDescriptorSetLayout> setLayouts(this->swapchainImages.size(), this->descriptorSetLayout);
-
-	// Descriptor set allocation info
-	VkDescriptorSetAllocateInfo setAllocInfo = {};
-	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	setAllocInfo.descriptorPool = this->descriptorPool; // Pool to allocate descriptorset from 
-	setAllocInfo.descriptorSetCount = static_cast<uint32_t>(this->swapchainImages.size()); // Number fo sets o allocate
-	setAllocInfo.pSetLayouts = setLayouts.data(); // Layouts to allocate sets (1:1 relation)
-
-	// Allocate descriptor sets (multipl)
-	VkResult result = vkAllocateDescriptorSets(this->mainDevice.logicalDevice, &setAllocInfo, this->descriptorSets.data());
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to allocate descriptor sets");
+	for (size_t i = 0; i < this->swapchainImages.size(); i++) {
+		this->descriptorSets[i] = this->descriptorAllocator.allocate(this->descriptorSetLayout, this->frameSetBindings);
 	}
 
 	// Update all of descriptor set bindings
@@ -1292,8 +2228,58 @@ void VulkanRenderer::createDescriptorSets()
 		//modelSetWrite.descriptorCount = 1;
 		//modelSetWrite.pBufferInfo = &modelBufferInfo;
 
-		// List of descriptor set writes
-		std::vector<VkWriteDescriptorSet> setWrites = { vpSetWrite };
+		// - Light and cluster descriptors
+		VkDescriptorBufferInfo lightBufferInfo = {};
+		lightBufferInfo.buffer = this->lightBuffers[i];
+		lightBufferInfo.offset = 0;
+		lightBufferInfo.range = VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet lightSetWrite = {};
+		lightSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		lightSetWrite.dstSet = this->descriptorSets[i];
+		lightSetWrite.dstBinding = 2;
+		lightSetWrite.dstArrayElement = 0;
+		lightSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		lightSetWrite.descriptorCount = 1;
+		lightSetWrite.pBufferInfo = &lightBufferInfo;
+
+		VkDescriptorBufferInfo clusterBufferInfo = {};
+		clusterBufferInfo.buffer = this->clusterBuffers[i];
+		clusterBufferInfo.offset = 0;
+		clusterBufferInfo.range = VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet clusterSetWrite = {};
+		clusterSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		clusterSetWrite.dstSet = this->descriptorSets[i];
+		clusterSetWrite.dstBinding = 3;
+		clusterSetWrite.dstArrayElement = 0;
+		clusterSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		clusterSetWrite.descriptorCount = 1;
+		clusterSetWrite.pBufferInfo = &clusterBufferInfo;
+
+		// - Shadow map descriptor
+		VkDescriptorImageInfo shadowMapImageInfo = {};
+		shadowMapImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		shadowMapImageInfo.imageView = this->shadowMapImageViews[i];
+		shadowMapImageInfo.sampler = this->shadowSampler;
+
+		VkWriteDescriptorSet shadowMapSetWrite = {};
+		shadowMapSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		shadowMapSetWrite.dstSet = this->descriptorSets[i];
+		shadowMapSetWrite.dstBinding = 4;
+		shadowMapSetWrite.dstArrayElement = 0;
+		shadowMapSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		shadowMapSetWrite.descriptorCount = 1;
+		shadowMapSetWrite.pImageInfo = &shadowMapImageInfo;
+
+		// List of descriptor set writes. Bindings no shader reads (the view projection buffer, now that the MVPs come from the
+		// object buffer) may have been left out of the reflected layout, so they aren't written
+		std::vector<VkWriteDescriptorSet> setWrites = { vpSetWrite, lightSetWrite, clusterSetWrite, shadowMapSetWrite };
+		setWrites.erase(std::remove_if(setWrites.begin(), setWrites.end(), [this](const VkWriteDescriptorSet& setWrite) {
+			return std::none_of(this->frameSetBindings.begin(), this->frameSetBindings.end(), [&setWrite](const VkDescriptorSetLayoutBinding& binding) {
+				return binding.binding == setWrite.dstBinding;
+			});
+		}), setWrites.end());
 
 		// Update the descriptor sets with new buffer/binding info
 		vkUpdateDescriptorSets(
@@ -1302,28 +2288,18 @@ void VulkanRenderer::createDescriptorSets()
 			setWrites.data(), 
 			0, 
 			nullptr);
+
+		// - Object transforms descriptor (also rewritten whenever the buffer is regrown)
+		this->writeObjectBufferDescriptor(i);
 	}
 }
 
 void VulkanRenderer::createInputDescriptorSets()
 {
-	// Resize array to hold descriptro set for each swapchain imaeg
+	// Descriptor set for each swapchain image
 	this->inputDescriptorSets.resize(this->swapchainImages.size());
-
-	// Fill array of layouts ready for set creation
-	std::vector<VkDescriptorSetLayout> setLayouts(this->swapchainImages.size(), this->inputDescriptorSetLayout);
-
-	// Input attachment descriptor set allocation info
-	VkDescriptorSetAllocateInfo setAllocInfo = {};
-	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	setAllocInfo.descriptorPool = this->inputDescriptorPool;
-	setAllocInfo.descriptorSetCount = static_cast<uint32_t>(this->swapchainImages.size());
-	setAllocInfo.pSetLayouts = setLayouts.data();
-
-	// Allocate descriptor sets
-	VkResult result = vkAllocateDescriptorSets(this->mainDevice.logicalDevice, &setAllocInfo, this->inputDescriptorSets.data());
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to allocate input attachment descriptor sets");
+	for (size_t i = 0; i < this->swapchainImages.size(); i++) {
+		this->inputDescriptorSets[i] = this->descriptorAllocator.allocate(this->inputDescriptorSetLayout, this->inputSetBindings);
 	}
 
 	// Update each descriptor set with input attachment
@@ -1361,41 +2337,926 @@ void VulkanRenderer::createInputDescriptorSets()
 		depthWrite.descriptorCount = 1;
 		depthWrite.pImageInfo = &depthAttachmentDescriptor;
 
-		// List of input descriptor set writes
-		std::vector<VkWriteDescriptorSet> setWrites = { colourWrite, depthWrite };
+		// Normal and material attachment descriptors
+		VkDescriptorImageInfo normalAttachmentDescriptor = colourAttachmentDescriptor;
+		normalAttachmentDescriptor.imageView = this->normalBufferImageViews[i];
+		VkWriteDescriptorSet normalWrite = colourWrite;
+		normalWrite.dstBinding = 2;
+		normalWrite.pImageInfo = &normalAttachmentDescriptor;
+
+		VkDescriptorImageInfo materialAttachmentDescriptor = colourAttachmentDescriptor;
+		materialAttachmentDescriptor.imageView = this->materialBufferImageViews[i];
+		VkWriteDescriptorSet materialWrite = colourWrite;
+		materialWrite.dstBinding = 3;
+		materialWrite.pImageInfo = &materialAttachmentDescriptor;
+
+		// List of input descriptor set writes
+		std::vector<VkWriteDescriptorSet> setWrites = { colourWrite, depthWrite, normalWrite, materialWrite };
+
+		// Update descriptor sets
+		vkUpdateDescriptorSets(this->mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+	}
+}
+
+void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
+{
+	// Copy VP Data
+	void* data;
+	vkMapMemory(this->mainDevice.logicalDevice, this->vpUniformBufferMemory[imageIndex], 0, sizeof(UboViewProjection), 0, &data);
+	memcpy(data, &this->uboViewProjection, sizeof(UboViewProjection));
+	vkUnmapMemory(this->mainDevice.logicalDevice, this->vpUniformBufferMemory[imageIndex]);
+
+	//// NO LONGER USED BELOW BUT KEEPING FOR REFERENCE, AS THAT'S HOW MODEL WAS DONE VIA DYNAMIC BUFFERS
+	//// Copy Model data
+	//for (size_t i = 0; i < this->meshList.size(); i++) {
+	//	// Here we first take the address of the modelTransfer space, point to the relevant address of the current mesh 
+	//	//	by adding the number of objects multipllied by their size, and retunring a pointer to the UboModel
+	//	Model* thisModel = (Model*)((uint64_t)modelTransferSpace + (i * this->modelUniformAlignment));
+	//	// Then assign the respective mesh model to the pointer location found above
+	//	*thisModel = meshList[i].getModel();
+	//}
+
+	//// Map the list of model data
+	//data = nullptr;
+	//vkMapMemory(this->mainDevice.logicalDevice, this->modelDynamicUniformBufferMemory[imageIndex], 0, this->modelUniformAlignment * this->meshList.size(), 0, &data);
+	//memcpy(data, modelTransferSpace, this->modelUniformAlignment * this->meshList.size());
+	//vkUnmapMemory(this->mainDevice.logicalDevice, this->modelDynamicUniformBufferMemory[imageIndex]);
+}
+
+void VulkanRenderer::updateObjectTransforms(uint32_t imageIndex)
+{
+	// Slot i of the object buffer holds scene graph node i, so draws just pass their node as the first instance
+	uint32_t objectCount = static_cast<uint32_t>(this->sceneGraph.getNodeCount());
+
+	// The image's previous frame has finished (waited on in draw), so its buffer can be swapped for a bigger one.
+	// This has to happen before recording, as updating a bound descriptor set invalidates the command buffer
+	if (objectCount > this->objectBufferCapacities[imageIndex]) {
+		uint32_t capacity = this->objectBufferCapacities[imageIndex];
+		while (capacity < objectCount) {
+			capacity *= 2;
+		}
+
+		this->destroyObjectBuffer(imageIndex);
+		this->createObjectBuffer(imageIndex, capacity);
+		this->writeObjectBufferDescriptor(imageIndex);
+	}
+
+	if (objectCount > 0) {
+		glm::mat4 viewProjection = this->uboViewProjection.projection * this->uboViewProjection.view;
+		writeObjectTransforms(viewProjection, this->sceneGraph.getWorldTransforms(), objectCount, this->objectBufferMapped[imageIndex]);
+	}
+}
+
+void VulkanRenderer::updateLightBuffer(uint32_t imageIndex)
+{
+	// The header has everything the cluster shader needs to rebuild the froxel grid from this frame's camera
+	LightBufferHeader header = {};
+	header.view = this->uboViewProjection.view;
+	header.inverseView = glm::inverse(this->uboViewProjection.view);
+	header.inverseProjection = glm::inverse(this->uboViewProjection.projection);
+	header.screen = glm::vec4(this->swapchainExtent.width, this->swapchainExtent.height, this->nearPlane, this->farPlane);
+	header.ambient = glm::vec4(this->ambientLight, 0.0f);
+	header.counts = glm::uvec4(static_cast<uint32_t>(this->lights.size()), 0, 0, 0);
+
+	// Sun and the cascades it's shadowed through, without a sun there are no cascades
+	if (this->sunIntensity > 0.0f) {
+		for (uint32_t i = 0; i < this->config.shadowCascades; i++) {
+			header.cascadeViewProjections[i] = this->shadowCascades[i].viewProjection;
+			header.cascadeSplits[i] = this->shadowCascadeSplits[i];
+			header.cascadeTexelSizes[i] = 2.0f * this->shadowCascades[i].radius / this->config.shadowMapSize;
+		}
+		header.sunDirection = glm::vec4(this->sunDirection, static_cast<float>(this->config.shadowCascades));
+		header.sunColour = glm::vec4(this->sunColour * this->sunIntensity, 0.0f);
+	}
+
+	char* data = static_cast<char*>(this->lightBufferMapped[imageIndex]);
+	memcpy(data, &header, sizeof(LightBufferHeader));
+	if (!this->lights.empty()) {
+		memcpy(data + sizeof(LightBufferHeader), this->lights.data(), sizeof(Light) * this->lights.size());
+	}
+}
+
+void VulkanRenderer::updateShadowCascades()
+{
+	if (this->sunIntensity <= 0.0f) {
+		return;
+	}
+
+	// Cascades only reach as far as the shadow distance, beyond it nothing is shadowed
+	float shadowDistance = std::min(this->config.shadowDistance, this->farPlane);
+	computeCascadeSplits(this->nearPlane, shadowDistance, this->config.shadowCascades, this->config.shadowSplitLambda,
+		this->shadowCascadeSplits.data());
+
+	glm::mat4 inverseView = glm::inverse(this->uboViewProjection.view);
+	float tanHalfFov = std::tan(this->fieldOfView * 0.5f);
+	float aspect = static_cast<float>(this->swapchainExtent.width) / static_cast<float>(this->swapchainExtent.height);
+
+	for (uint32_t i = 0; i < this->config.shadowCascades; i++) {
+		float startDepth = i == 0 ? this->nearPlane : this->shadowCascadeSplits[i - 1];
+		glm::vec3 centre;
+		float radius;
+		computeSliceSphere(inverseView, tanHalfFov, aspect, startDepth, this->shadowCascadeSplits[i], &centre, &radius);
+
+		// Cascades stay where they are while their slice is inside them, so their cached layer can be reused. Once it
+		// isn't (or the layer is out of date anyway) the cascade is refit and its layer redrawn
+		if (this->shadowCascadeVersions[i] != this->staticShadowVersion || !cascadeCovers(this->shadowCascades[i], centre, radius)) {
+			this->shadowCascades[i] = fitCascade(this->sunDirection, centre, radius, this->config.shadowMapSize);
+			this->shadowCascadeVersions[i] = 0;
+		}
+	}
+}
+
+size_t VulkanRenderer::updateScene()
+{
+	size_t nodesUpdated = this->sceneGraph.update();
+
+	// Mesh bounds only move when a transform does (or meshes are added or removed)
+	if (nodesUpdated > 0 || this->meshInstancesChanged) {
+		for (size_t i = 0; i < this->meshInstances.size(); i++) {
+			MeshModel& model = this->modelList[this->meshInstances[i].modelIndex];
+			Mesh* mesh = model.getMesh(this->meshInstances[i].meshIndex);
+			this->meshInstanceBounds[i] = mesh->getLocalBounds().transformed(this->sceneGraph.getWorldTransform(model.getMeshNode(this->meshInstances[i].meshIndex)));
+		}
+
+		// Refitting is far cheaper than building, until objects have moved far enough to make the tree loose
+		if (this->meshInstancesChanged || this->sceneBvh.needsRebuild()) {
+			this->sceneBvh.build(this->meshInstanceBounds);
+		}
+		else {
+			this->sceneBvh.refit(this->meshInstanceBounds);
+		}
+		this->meshInstancesChanged = false;
+	}
+
+	return nodesUpdated;
+}
+
+void VulkanRenderer::addMeshInstances(size_t modelIndex)
+{
+	for (size_t i = 0; i < this->modelList[modelIndex].getMeshCount(); i++) {
+		MeshInstance instance = {};
+		instance.modelIndex = static_cast<uint32_t>(modelIndex);
+		instance.meshIndex = static_cast<uint32_t>(i);
+		this->meshInstances.push_back(instance);
+		this->meshInstanceBounds.push_back(AABB());
+
+		// Shared with every other model using the same asset
+		GeometryAsset* asset = this->geometryCache.getAsset(this->modelList[modelIndex].getAssetId());
+		this->meshInstanceResidency.push_back(asset->meshResidency[i]);
+	}
+
+	this->meshInstancesChanged = true;
+}
+
+std::vector<MeshInstance> VulkanRenderer::toMeshInstances(const std::vector<uint32_t>& items)
+{
+	std::vector<MeshInstance> instances;
+	instances.reserve(items.size());
+	for (uint32_t item : items) {
+		instances.push_back(this->meshInstances[item]);
+	}
+
+	return instances;
+}
+
+std::vector<MeshInstance> VulkanRenderer::queryFrustum(const glm::mat4& viewProjection)
+{
+	this->updateScene();
+
+	std::vector<uint32_t> items;
+	this->sceneBvh.queryFrustum(Frustum::fromMatrix(viewProjection), &items);
+	return this->toMeshInstances(items);
+}
+
+std::vector<MeshInstance> VulkanRenderer::queryBox(const AABB& box)
+{
+	this->updateScene();
+
+	std::vector<uint32_t> items;
+	this->sceneBvh.queryBox(box, &items);
+	return this->toMeshInstances(items);
+}
+
+std::vector<MeshInstance> VulkanRenderer::querySphere(const glm::vec3& centre, float radius)
+{
+	this->updateScene();
+
+	std::vector<uint32_t> items;
+	this->sceneBvh.querySphere(centre, radius, &items);
+	return this->toMeshInstances(items);
+}
+
+bool VulkanRenderer::queryNearest(const glm::vec3& point, float maxDistance, MeshInstance* nearest, float* distance)
+{
+	this->updateScene();
+
+	uint32_t item;
+	if (!this->sceneBvh.queryNearest(point, maxDistance, &item, distance)) {
+		return false;
+	}
+
+	*nearest = this->meshInstances[item];
+	return true;
+}
+
+bool VulkanRenderer::raycast(const glm::vec3& origin, const glm::vec3& direction, RaycastHit* hit, float maxDistance)
+{
+	this->updateScene();
+
+	float length = glm::length(direction);
+	if (length <= 0.0f) {
+		return false;
+	}
+	Ray ray(origin, direction / length);
+	bool found = false;
+
+	// Meshes whose world bounds the ray passes through, nearest first, each tested in its own space. Distances along the
+	// transformed ray match the world ray's as its direction is transformed without normalising
+	const std::vector<uint32_t>& items = this->sceneBvh.getItemOrder();
+	this->sceneBvh.traverseRay(ray, maxDistance, [&](uint32_t first, uint32_t count, float* leafMaxDistance) {
+		for (uint32_t i = first; i < first + count; i++) {
+			const MeshInstance& instance = this->meshInstances[items[i]];
+			Mesh* mesh = this->modelList[instance.modelIndex].getMesh(instance.meshIndex);
+
+			float entry;
+			if (!intersectRayBox(ray, this->meshInstanceBounds[items[i]], *leafMaxDistance, &entry)) {
+				continue;
+			}
+
+			glm::mat4 worldToLocal = glm::inverse(this->sceneGraph.getWorldTransform(this->modelList[instance.modelIndex].getMeshNode(instance.meshIndex)));
+			Ray localRay(glm::vec3(worldToLocal * glm::vec4(ray.origin, 1.0f)), glm::vec3(worldToLocal * glm::vec4(ray.direction, 0.0f)));
+
+			uint32_t triangle;
+			float distance;
+			if (mesh->getTriangleBvh().raycast(localRay, *leafMaxDistance, &triangle, &distance)) {
+				*leafMaxDistance = distance;
+				hit->modelIndex = instance.modelIndex;
+				hit->meshIndex = instance.meshIndex;
+				hit->triangle = triangle;
+				hit->distance = distance;
+				found = true;
+			}
+		}
+	});
+
+	return found;
+}
+
+void VulkanRenderer::updateResidency()
+{
+	uint32_t reloaded = 0;
+	uint32_t evicted = 0;
+	uint32_t pending = 0;
+
+	// -- Everything visible that isn't resident, most important first
+	std::vector<uint32_t> needed;
+	for (uint32_t instanceIndex : this->visibleInstances) {
+		uint32_t meshId = this->meshInstanceResidency[instanceIndex];
+		if (!this->residency.isResident(meshId)) {
+			needed.push_back(meshId);
+		}
+
+		const MeshInstance& instance = this->meshInstances[instanceIndex];
+		uint32_t textureId = this->textureResidency[this->modelList[instance.modelIndex].getMesh(instance.meshIndex)->getTexId()];
+		if (!this->residency.isResident(textureId)) {
+			needed.push_back(textureId);
+		}
+	}
+
+	std::sort(needed.begin(), needed.end());
+	needed.erase(std::unique(needed.begin(), needed.end()), needed.end());
+	std::sort(needed.begin(), needed.end(), [this](uint32_t a, uint32_t b) {
+		return this->residency.getResource(a).importance > this->residency.getResource(b).importance;
+	});
+
+	// Only so much is reloaded each frame, the rest waits for later frames
+	std::vector<VkDeviceSize> required(this->residency.getHeapBudgets().size(), 0);
+	VkDeviceSize reloadBytes = 0;
+	size_t reloadCount = 0;
+	while (reloadCount < needed.size() && (reloadCount == 0 || reloadBytes + this->residency.getResource(needed[reloadCount]).bytes <= MAX_RELOAD_BYTES_PER_FRAME)) {
+		const ResidentResource& resource = this->residency.getResource(needed[reloadCount]);
+		required[resource.heapIndex] += resource.bytes;
+		reloadBytes += resource.bytes;
+		reloadCount++;
+	}
+
+	// -- Evict to get back within budget with room for the reloads, from frames the GPU has finished with
+	if (this->frameStats.frameNumber >= this->config.framesInFlight) {
+		uint64_t lastCompletedFrame = this->frameStats.frameNumber - this->config.framesInFlight;
+		for (uint32_t id : this->residency.chooseEvictions(lastCompletedFrame, required)) {
+			const ResidentResource& resource = this->residency.getResource(id);
+			if (resource.type == ResidentType::Texture) {
+				this->evictTexture(resource.owner);
+			}
+			else {
+				this->geometryCache.getAsset(resource.owner)->meshes[resource.part].evictBuffers();
+			}
+			this->residency.setResident(id, false);
+			evicted++;
+		}
+	}
+
+	// -- Reload as much as fits
+	for (size_t i = 0; i < needed.size(); i++) {
+		const ResidentResource& resource = this->residency.getResource(needed[i]);
+		if (i >= reloadCount || !this->residency.hasRoom(resource.memoryType, resource.bytes)) {
+			pending++;
+			continue;
+		}
+
+		if (resource.type == ResidentType::Texture) {
+			// Streamed textures can't be uploaded until their file is decoded
+			if (!this->reloadTexture(resource.owner)) {
+				pending++;
+				continue;
+			}
+		}
+		else {
+			this->geometryCache.getAsset(resource.owner)->meshes[resource.part].reloadBuffers(this->graphicsQueue, this->graphicsCommandPool, &this->timeline);
+			// The cached shadows were drawn without it
+			this->staticShadowVersion++;
+		}
+		this->residency.setResident(needed[i], true);
+		reloaded++;
+	}
+
+	this->frameStats.resourcesEvicted = evicted;
+	this->frameStats.resourcesReloaded = reloaded;
+	this->frameStats.resourcesPending = pending;
+}
+
+void VulkanRenderer::evictTexture(int textureId)
+{
+	// Frames only write descriptor sets for resident textures, so no set is written with the destroyed view
+	vkDestroyImageView(this->mainDevice.logicalDevice, this->textureImageViews[textureId], nullptr);
+	vkDestroyImage(this->mainDevice.logicalDevice, this->textureImages[textureId], nullptr);
+	this->memoryAllocator.free(this->textureImageAllocations[textureId]);
+	this->textureImageViews[textureId] = VK_NULL_HANDLE;
+	this->textureImages[textureId] = VK_NULL_HANDLE;
+	this->textureImageAllocations[textureId] = MemoryAllocation();
+	this->textureSources[textureId].residentLevel = TEXTURE_LEVEL_NONE;
+}
+
+bool VulkanRenderer::reloadTexture(int textureId)
+{
+	// Still being decoded, for the first time or again as its pixels were freed once it was uploaded
+	if (!this->requestTexturePixels(textureId)) {
+		return false;
+	}
+
+	// Back at its smallest levels, the rest stream in again as they're needed
+	this->createTextureLevels(textureId, this->getInitialTextureLevel(textureId));
+	return true;
+}
+
+bool VulkanRenderer::requestTexturePixels(int textureId)
+{
+	TextureSource& source = this->textureSources[textureId];
+	if (hasMipPixels(source.mips)) {
+		return true;
+	}
+
+	// Read and decoded on the streamer's thread, picked up by updateTextureStreaming
+	if (!source.decoding) {
+		this->textureStreamer.requestFile(textureId, source.fileName, "Textures/" + source.fileName);
+		source.decoding = true;
+	}
+	return false;
+}
+
+void VulkanRenderer::updateTextureStreaming()
+{
+	uint32_t refined = 0;
+	uint32_t trimmed = 0;
+
+	// -- Decoded files, ready to be uploaded by updateResidency the first time they're needed
+	for (DecodedTexture& decoded : this->textureStreamer.collect()) {
+		if (decoded.mips.levels.empty()) {
+			throw std::runtime_error("Failed to load a texture file (" + decoded.fileName + ")");
+		}
+
+		// Destroyed while it was being decoded (and maybe its id reused for another texture since)
+		TextureSource& source = this->textureSources[decoded.textureId];
+		if (this->textureCache.getRefCount(decoded.textureId) == 0 || source.fileName != decoded.fileName || !source.decoding) {
+			continue;
+		}
+
+		source.mips = std::move(decoded.mips);
+		source.decoding = false;
+		source.decodedFrame = this->frameStats.frameNumber;
+
+		// Estimate of its size at the initial levels, until it has an image to measure
+		if (source.residentLevel == TEXTURE_LEVEL_NONE) {
+			VkDeviceSize bytes = 0;
+			for (uint32_t level = this->getInitialTextureLevel(decoded.textureId); level < source.mips.levels.size(); level++) {
+				bytes += getMipLevelBytes(source.mips, level);
+			}
+			this->residency.setSize(this->textureResidency[decoded.textureId], bytes,
+				findMemoryTypeIndex(this->mainDevice.physicalDevice, 0xFFFFFFFF, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+		}
+	}
+
+	// -- Level each texture needs: one texel per pixel of its mesh's height on screen, at the most detailed it's drawn
+	for (TextureSource& source : this->textureSources) {
+		source.wantedLevel = TEXTURE_LEVEL_NONE;
+	}
+	for (size_t i = 0; i < this->visibleInstances.size(); i++) {
+		const MeshInstance& instance = this->meshInstances[this->visibleInstances[i]];
+		TextureSource& source = this->textureSources[this->modelList[instance.modelIndex].getMesh(instance.meshIndex)->getTexId()];
+		if (source.residentLevel == TEXTURE_LEVEL_NONE) {
+			continue;
+		}
+
+		uint32_t pixels = static_cast<uint32_t>(std::ceil(2.0f * this->visibleScreenSizes[i] * this->swapchainExtent.height));
+		uint32_t level = findMipLevel(source.mips, std::max(pixels, 1u));
+		if (level > 0 && std::max(source.mips.widths[level], source.mips.heights[level]) < pixels) {
+			level--;
+		}
+		source.wantedLevel = std::min(source.wantedLevel, level);
+	}
+
+	// -- Refine the most important textures needing more detail, a level at a time within the per frame upload limit
+	std::vector<int> refining;
+	for (size_t i = 0; i < this->textureSources.size(); i++) {
+		const TextureSource& source = this->textureSources[i];
+		if (source.residentLevel == TEXTURE_LEVEL_NONE || source.wantedLevel == TEXTURE_LEVEL_NONE) {
+			continue;
+		}
+
+		if (source.wantedLevel <= source.residentLevel) {
+			this->textureSources[i].lastDetailFrame = this->frameStats.frameNumber;
+		}
+
+		if (source.wantedLevel < source.residentLevel) {
+			refining.push_back(static_cast<int>(i));
+		}
+	}
+	std::sort(refining.begin(), refining.end(), [this](int a, int b) {
+		return this->residency.getResource(this->textureResidency[a]).importance > this->residency.getResource(this->textureResidency[b]).importance;
+	});
+
+	VkDeviceSize streamedBytes = 0;
+	for (int textureId : refining) {
+		// Its file is decoded again first if its pixels were freed, later frames refine it once they're back
+		if (!this->requestTexturePixels(textureId)) {
+			continue;
+		}
+
+		const TextureSource& source = this->textureSources[textureId];
+		uint32_t level = source.residentLevel - 1;
+		VkDeviceSize bytes = 0;
+		for (uint32_t i = level; i < source.mips.levels.size(); i++) {
+			bytes += getMipLevelBytes(source.mips, i);
+		}
+
+		const ResidentResource& resource = this->residency.getResource(this->textureResidency[textureId]);
+		if ((streamedBytes > 0 && streamedBytes + bytes > MAX_STREAM_BYTES_PER_FRAME) || !this->residency.hasRoom(resource.memoryType, bytes)) {
+			break;
+		}
+
+		this->createTextureLevels(textureId, level);
+		streamedBytes += bytes;
+		refined++;
+	}
+
+	// -- Free the pixels of files whose image has all the levels they need now, or that were decoded for a reload that
+	// didn't happen in time. They're decoded again if they're needed again
+	for (TextureSource& source : this->textureSources) {
+		if (source.fileName.empty() || !hasMipPixels(source.mips)) {
+			continue;
+		}
+
+		bool refining = source.residentLevel != TEXTURE_LEVEL_NONE && source.wantedLevel < source.residentLevel;
+		bool reloading = source.residentLevel == TEXTURE_LEVEL_NONE && this->frameStats.frameNumber < source.decodedFrame + TEXTURE_STREAM_TRIM_FRAMES;
+		if (!refining && !reloading) {
+			freeMipPixels(&source.mips);
+		}
+	}
+
+	// -- Free the most detailed levels of textures that haven't needed them for a while (from being further away or out
+	// of view), down to what they need now but never below their initial levels. The levels kept are copied on the GPU, so
+	// no pixels are needed for them
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	std::vector<std::function<void()>> releases;
+	for (size_t i = 0; i < this->textureSources.size(); i++) {
+		const TextureSource& source = this->textureSources[i];
+		if (source.residentLevel == TEXTURE_LEVEL_NONE) {
+			continue;
+		}
+
+		uint32_t initialLevel = this->getInitialTextureLevel(static_cast<int>(i));
+		if (source.residentLevel >= initialLevel
+			|| this->residency.getResource(this->textureResidency[i]).pinned
+			|| this->frameStats.frameNumber < source.lastDetailFrame + TEXTURE_STREAM_TRIM_FRAMES) {
+			continue;
+		}
+
+		if (commandBuffer == VK_NULL_HANDLE) {
+			commandBuffer = beginCommandBuffer(this->mainDevice.logicalDevice, this->graphicsCommandPool);
+		}
+		releases.push_back(this->copyTextureLevels(static_cast<int>(i), std::min(source.wantedLevel, initialLevel), commandBuffer));
+		// Not drawn for a while, so it'd be the first evicted, destroying the new image before the copy into it has finished
+		this->residency.setResident(this->textureResidency[i], true);
+		this->textureSources[i].lastDetailFrame = this->frameStats.frameNumber;
+		trimmed++;
+	}
+
+	// Old images go once the copies (and the frames in flight still drawing with them) have finished
+	if (commandBuffer != VK_NULL_HANDLE) {
+		endAndSubmitCommandBuffer(this->mainDevice.logicalDevice, this->graphicsCommandPool, this->graphicsQueue, commandBuffer, &this->timeline);
+		for (std::function<void()>& release : releases) {
+			this->timeline.retire(this->timeline.lastSubmittedValue(), release);
+		}
+	}
+
+	this->frameStats.texturesRefined = refined;
+	this->frameStats.texturesTrimmed = trimmed;
+}
+
+void VulkanRenderer::updateDefragmentation()
+{
+	this->frameStats.resourcesMoved = 0;
+
+	// -- Start a pass when asked, or now and then by itself, if any blocks are sparse enough to be worth emptying
+	if (!this->defragStats.active) {
+		if (!this->defragRequested && (this->frameStats.frameNumber == 0 || this->frameStats.frameNumber % DEFRAG_CHECK_FRAMES != 0)) {
+			return;
+		}
+		this->defragRequested = false;
+
+		FragmentationStats before = this->memoryAllocator.getStats();
+		uint32_t blocks = this->memoryAllocator.beginEvacuation(DEFRAG_BLOCK_USAGE);
+		if (blocks == 0) {
+			return;
+		}
+
+		this->defragStats = DefragmentationStats();
+		this->defragStats.active = true;
+		this->defragStats.startFrame = this->frameStats.frameNumber;
+		this->defragStats.blocksEmptied = blocks;
+		this->defragStats.before = before;
+	}
+
+	// -- The pass is over once the last emptied block has been freed (its contents' old copies are retired a few frames
+	// after they're moved)
+	if (this->memoryAllocator.getEvacuatingCount() == 0) {
+		this->defragStats.active = false;
+		this->defragStats.endFrame = this->frameStats.frameNumber;
+		this->defragStats.after = this->memoryAllocator.getStats();
+		return;
+	}
+
+	// -- Move what's left in the blocks being emptied, all in one submission, until this frame's time or bytes run out.
+	// Frames after this one wait for it like any other upload
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	VkDeviceSize movedBytes = 0;
+	auto hasBudget = [&start, &movedBytes]() {
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return movedBytes < MAX_DEFRAG_BYTES_PER_FRAME && elapsed < DEFRAG_TIME_BUDGET;
+	};
+
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	std::vector<std::function<void()>> releases;
+
+	for (size_t assetId = 0; assetId < this->geometryCache.getAssetCount() && hasBudget(); assetId++) {
+		GeometryAsset* asset = this->geometryCache.getAsset(static_cast<int>(assetId));
+		for (size_t i = 0; i < asset->meshes.size() && hasBudget(); i++) {
+			Mesh& mesh = asset->meshes[i];
+			if (!mesh.isResident() || !mesh.isInEvacuatingBlock()) {
+				continue;
+			}
+
+			if (commandBuffer == VK_NULL_HANDLE) {
+				commandBuffer = beginCommandBuffer(this->mainDevice.logicalDevice, this->graphicsCommandPool);
+			}
+			releases.push_back(mesh.moveBuffers(commandBuffer));
+			// Used by the copy into its new buffers, so it isn't evicted (destroying them) before the copy has finished
+			this->residency.setResident(asset->meshResidency[i], true);
+			movedBytes += mesh.getDeviceBytes();
+		}
+	}
+
+	// Textures get new images the same way as when streaming, frames in flight keep the old ones
+	for (size_t textureId = 0; textureId < this->textureImages.size() && hasBudget(); textureId++) {
+		if (this->textureImages[textureId] == VK_NULL_HANDLE
+			|| !this->memoryAllocator.isEvacuating(this->textureImageAllocations[textureId].block)) {
+			continue;
+		}
+
+		if (commandBuffer == VK_NULL_HANDLE) {
+			commandBuffer = beginCommandBuffer(this->mainDevice.logicalDevice, this->graphicsCommandPool);
+		}
+		releases.push_back(this->copyTextureLevels(static_cast<int>(textureId), this->textureSources[textureId].residentLevel, commandBuffer));
+		this->residency.setResident(this->textureResidency[textureId], true);
+		movedBytes += this->textureImageAllocations[textureId].size;
+	}
+
+	if (commandBuffer == VK_NULL_HANDLE) {
+		return;
+	}
+
+	// Old copies go once the copies (and the frames in flight still drawing with them) have finished
+	endAndSubmitCommandBuffer(this->mainDevice.logicalDevice, this->graphicsCommandPool, this->graphicsQueue, commandBuffer, &this->timeline);
+	for (std::function<void()>& release : releases) {
+		this->timeline.retire(this->timeline.lastSubmittedValue(), release);
+	}
+
+	this->frameStats.resourcesMoved = static_cast<uint32_t>(releases.size());
+	this->defragStats.resourcesMoved += static_cast<uint32_t>(releases.size());
+	this->defragStats.bytesMoved += movedBytes;
+}
+
+std::function<void()> VulkanRenderer::copyTextureLevels(int textureId, uint32_t baseLevel, VkCommandBuffer commandBuffer)
+{
+	TextureSource& source = this->textureSources[textureId];
+	const TextureMips& mips = source.mips;
+	uint32_t levelCount = static_cast<uint32_t>(mips.levels.size()) - baseLevel;
+	uint32_t srcBaseLevel = baseLevel - source.residentLevel; // Levels of the current image are counted from the resident level
+
+	MemoryAllocation texImageAllocation;
+	VkImage texImage = this->createTextureImage(mips.widths[baseLevel], mips.heights[baseLevel], levelCount, &texImageAllocation);
+
+	std::vector<VkImageCopy> regions(levelCount);
+	for (uint32_t i = 0; i < levelCount; i++) {
+		regions[i] = {};
+		regions[i].srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		regions[i].srcSubresource.mipLevel = srcBaseLevel + i;
+		regions[i].srcSubresource.baseArrayLayer = 0;
+		regions[i].srcSubresource.layerCount = 1;
+		regions[i].dstSubresource = regions[i].srcSubresource;
+		regions[i].dstSubresource.mipLevel = i;
+		regions[i].extent = { mips.widths[baseLevel + i], mips.heights[baseLevel + i], 1 };
+	}
+	recordImageCopyLevels(commandBuffer, this->textureImages[textureId], texImage, srcBaseLevel, levelCount, regions);
+
+	VkImageView texImageView = createImageView(texImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, levelCount);
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(this->mainDevice.logicalDevice, texImage, &memoryRequirements);
+	this->residency.setSize(this->textureResidency[textureId], memoryRequirements.size,
+		findMemoryTypeIndex(this->mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+	source.residentLevel = baseLevel;
+
+	// Same as when its levels change, frames in flight keep their sets and the old image, later frames write sets for the new one
+
+	VkDevice device = this->mainDevice.logicalDevice;
+	MemoryBlockAllocator* allocator = &this->memoryAllocator;
+	VkImage oldImage = this->textureImages[textureId];
+	VkImageView oldImageView = this->textureImageViews[textureId];
+	MemoryAllocation oldImageAllocation = this->textureImageAllocations[textureId];
+
+	this->textureImages[textureId] = texImage;
+	this->textureImageAllocations[textureId] = texImageAllocation;
+	this->textureImageViews[textureId] = texImageView;
+
+	return [device, allocator, oldImage, oldImageView, oldImageAllocation]() {
+		vkDestroyImageView(device, oldImageView, nullptr);
+		vkDestroyImage(device, oldImage, nullptr);
+		allocator->free(oldImageAllocation);
+	};
+}
+
+std::vector<HeapBudget> VulkanRenderer::getMemoryBudgets()
+{
+	return this->residency.getHeapBudgets();
+}
+
+void VulkanRenderer::defragmentMemory()
+{
+	this->defragRequested = true;
+}
+
+FragmentationStats VulkanRenderer::getMemoryFragmentation()
+{
+	return this->memoryAllocator.getStats();
+}
+
+DefragmentationStats VulkanRenderer::getDefragmentationStats()
+{
+	return this->defragStats;
+}
+
+void VulkanRenderer::readTimestamps()
+{
+	if (!this->timestampsWritten[this->currentFrame]) {
+		return;
+	}
+
+	// Only called once the frame's fence has been waited on, so the results are already available
+	uint32_t firstQuery = this->currentFrame * TIMESTAMPS_PER_FRAME;
+	std::array<uint64_t, 2> timestamps = {};
+	VkResult result = vkGetQueryPoolResults(this->mainDevice.logicalDevice, this->timestampQueryPool, firstQuery, 2,
+		sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+	if (result == VK_SUCCESS) {
+		this->frameStats.gpuTime = this->timestampDuration(timestamps[0], timestamps[1]);
+
+		// Averaged separately for frames with and without the depth pre-pass, so the two can be compared
+		double& modeTime = this->frameDepthPrePass[this->currentFrame] ? this->frameStats.gpuTimeWithPrePass : this->frameStats.gpuTimeWithoutPrePass;
+		modeTime = modeTime < 0.0 ? this->frameStats.gpuTime
+			: modeTime + (this->frameStats.gpuTime - modeTime) * DEPTH_PREPASS_SMOOTHING;
+	}
+
+	// Only the cascades that were drawn have results
+	for (uint32_t i = 0; i < MAX_SHADOW_CASCADES; i++) {
+		this->frameStats.shadowCascadeTimes[i] = -1.0;
+	}
+	uint32_t cascadesTimed = this->shadowCascadesTimed[this->currentFrame];
+	if (cascadesTimed > 0) {
+		std::array<uint64_t, 2 * MAX_SHADOW_CASCADES> cascadeTimestamps = {};
+		result = vkGetQueryPoolResults(this->mainDevice.logicalDevice, this->timestampQueryPool, firstQuery + 2, cascadesTimed * 2,
+			sizeof(uint64_t) * cascadesTimed * 2, cascadeTimestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+		if (result == VK_SUCCESS) {
+			for (uint32_t i = 0; i < cascadesTimed; i++) {
+				this->frameStats.shadowCascadeTimes[i] = this->timestampDuration(cascadeTimestamps[i * 2], cascadeTimestamps[i * 2 + 1]);
+			}
+		}
+	}
+	this->timestampsWritten[this->currentFrame] = false;
+}
+
+void VulkanRenderer::observeFrameCompletion()
+{
+	// Latency runs from the frame's CPU start to the first check that finds its timeline value reached, so it's checked
+	// wherever the CPU might have been busy or blocked. Of several frames found complete at once, the newest is reported
+	uint64_t completed = this->timeline.completedValue();
+	auto now = std::chrono::high_resolution_clock::now();
+	uint64_t newestValue = 0;
+	for (size_t i = 0; i < this->latencyPending.size(); i++) {
+		if (!this->latencyPending[i] || this->frameValues[i] > completed) {
+			continue;
+		}
+		this->latencyPending[i] = false;
+		if (this->frameValues[i] > newestValue) {
+			newestValue = this->frameValues[i];
+			this->frameStats.latency = std::chrono::duration<double, std::milli>(now - this->frameStartTimes[i]).count();
+		}
+	}
+}
+
+double VulkanRenderer::timestampDuration(uint64_t start, uint64_t end)
+{
+	// Ticks to nanoseconds to milliseconds
+	uint64_t ticks = ((end & this->timestampMask) - (start & this->timestampMask)) & this->timestampMask;
+	return static_cast<double>(ticks) * this->timestampPeriod / 1000000.0;
+}
+
+void VulkanRenderer::readPipelineStatistics()
+{
+	if (!this->statisticsWritten[this->currentFrame]) {
+		return;
+	}
+
+	// Already available, the frame's fence has been waited on
+	uint64_t fragmentInvocations = 0;
+	VkResult result = vkGetQueryPoolResults(this->mainDevice.logicalDevice, this->statisticsQueryPool, this->currentFrame, 1,
+		sizeof(fragmentInvocations), &fragmentInvocations, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+	if (result == VK_SUCCESS) {
+		double& shaded = this->frameDepthPrePass[this->currentFrame] ? this->shadedWithPrePass : this->shadedWithoutPrePass;
+		double invocations = static_cast<double>(fragmentInvocations);
+		shaded = shaded < 0.0 ? invocations : shaded + (invocations - shaded) * DEPTH_PREPASS_SMOOTHING;
+	}
+	this->statisticsWritten[this->currentFrame] = false;
+}
 
-		// Update descriptor sets
-		vkUpdateDescriptorSets(this->mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+bool VulkanRenderer::chooseDepthPrePass()
+{
+	if (this->config.depthPrePass == DepthPrePassMode::On) {
+		return true;
+	}
+	if (this->config.depthPrePass == DepthPrePassMode::Off || !this->statisticsSupported) {
+		return false;
 	}
+
+	// With the pre-pass each covered pixel is shaded about once, so the fragments shaded without it over those shaded
+	// with it is the overdraw. Until a pre-pass frame has been measured the whole screen stands in for the covered pixels
+	if (this->shadedWithoutPrePass >= 0.0) {
+		double coveredPixels = this->shadedWithPrePass > 0.0 ? this->shadedWithPrePass
+			: static_cast<double>(this->swapchainExtent.width) * this->swapchainExtent.height;
+		this->frameStats.overdraw = this->shadedWithoutPrePass / coveredPixels;
+
+		// Switched off a little below the threshold it's switched on at, so it doesn't flip back and forth around it
+		if (this->frameStats.overdraw > this->config.depthPrePassOverdraw) {
+			this->depthPrePassChosen = true;
+		}
+		else if (this->frameStats.overdraw < this->config.depthPrePassOverdraw * 0.9) {
+			this->depthPrePassChosen = false;
+		}
+	}
+
+	// Every so often a frame is drawn the other way, keeping both measurements up to date as the scene changes
+	bool probe = this->frameStats.frameNumber % DEPTH_PREPASS_PROBE_FRAMES == DEPTH_PREPASS_PROBE_FRAMES - 1;
+	return this->depthPrePassChosen != probe;
 }
 
-void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
+ShaderPermutation VulkanRenderer::getGBufferPermutation(bool depthEqual, bool textured)
 {
-	// Copy VP Data
-	void* data;
-	vkMapMemory(this->mainDevice.logicalDevice, this->vpUniformBufferMemory[imageIndex], 0, sizeof(UboViewProjection), 0, &data);
-	memcpy(data, &this->uboViewProjection, sizeof(UboViewProjection));
-	vkUnmapMemory(this->mainDevice.logicalDevice, this->vpUniformBufferMemory[imageIndex]);
+	ShaderPermutation permutation(static_cast<uint32_t>(depthEqual ? ScenePipeline::GBufferDepthEqual : ScenePipeline::GBuffer));
+	permutation.set(SHADER_CONSTANT_TEXTURED, textured ? VK_TRUE : VK_FALSE);
+	return permutation;
+}
 
-	//// NO LONGER USED BELOW BUT KEEPING FOR REFERENCE, AS THAT'S HOW MODEL WAS DONE VIA DYNAMIC BUFFERS
-	//// Copy Model data
-	//for (size_t i = 0; i < this->meshList.size(); i++) {
-	//	// Here we first take the address of the modelTransfer space, point to the relevant address of the current mesh 
-	//	//	by adding the number of objects multipllied by their size, and retunring a pointer to the UboModel
-	//	Model* thisModel = (Model*)((uint64_t)modelTransferSpace + (i * this->modelUniformAlignment));
-	//	// Then assign the respective mesh model to the pointer location found above
-	//	*thisModel = meshList[i].getModel();
-	//}
+ShaderPermutation VulkanRenderer::getLightingPermutation()
+{
+	ShaderPermutation permutation(static_cast<uint32_t>(ScenePipeline::Lighting));
+	permutation.set(SHADER_CONSTANT_LIGHTING_MODE, static_cast<uint32_t>(this->config.lightingMode));
+	// Without the sun its shadow lookups and lighting are left out altogether
+	permutation.set(SHADER_CONSTANT_SUN, this->sunIntensity > 0.0f ? VK_TRUE : VK_FALSE);
+	permutation.set(SHADER_CONSTANT_SCREEN_WIDTH, this->swapchainExtent.width);
+	permutation.set(SHADER_CONSTANT_SCREEN_HEIGHT, this->swapchainExtent.height);
+	return permutation;
+}
 
-	//// Map the list of model data
-	//data = nullptr;
-	//vkMapMemory(this->mainDevice.logicalDevice, this->modelDynamicUniformBufferMemory[imageIndex], 0, this->modelUniformAlignment * this->meshList.size(), 0, &data);
-	//memcpy(data, modelTransferSpace, this->modelUniformAlignment * this->meshList.size());
-	//vkUnmapMemory(this->mainDevice.logicalDevice, this->modelDynamicUniformBufferMemory[imageIndex]);
+void VulkanRenderer::buildDrawList()
+{
+	// Sorting happens in view space, so depth is the distance along the camera's forward axis
+	this->drawList.clear();
+
+	// Screen height covered by a sphere of radius r at distance d is roughly r / (d * tan(fov / 2)) of the screen
+	float projectionScale = 1.0f / std::tan(this->fieldOfView * 0.5f);
+	const std::vector<float>& lodThresholds = this->config.lodThresholds;
+
+	// Only meshes whose bounds touch the view frustum are drawn
+	this->visibleInstances.clear();
+	this->sceneBvh.queryFrustum(Frustum::fromMatrix(this->uboViewProjection.projection * this->uboViewProjection.view), &this->visibleInstances);
+	this->frameStats.objectsCulled = static_cast<uint32_t>(this->meshInstances.size() - this->visibleInstances.size());
+
+	// Size on screen of everything visible, which picks its level of detail and how important it is to keep resident
+	this->residency.beginFrame(this->frameStats.frameNumber);
+	this->visibleScreenSizes.resize(this->visibleInstances.size());
+	for (size_t i = 0; i < this->visibleInstances.size(); i++) {
+		uint32_t instanceIndex = this->visibleInstances[i];
+		const MeshInstance& instance = this->meshInstances[instanceIndex];
+		Mesh* thisMesh = this->modelList[instance.modelIndex].getMesh(instance.meshIndex);
+		glm::mat4 modelView = this->uboViewProjection.view * this->sceneGraph.getWorldTransform(this->modelList[instance.modelIndex].getMeshNode(instance.meshIndex));
+
+		// Largest axis scale of the mesh, so a scaled up mesh keeps its detail for longer
+		float modelScale = std::max(glm::length(glm::vec3(modelView[0])),
+			std::max(glm::length(glm::vec3(modelView[1])), glm::length(glm::vec3(modelView[2]))));
+
+		glm::vec4 centre = modelView * glm::vec4(thisMesh->getBoundsCentre(), 1.0f);
+		float distance = std::max(glm::length(glm::vec3(centre)), this->nearPlane);
+		this->visibleScreenSizes[i] = thisMesh->getBoundsRadius() * modelScale * projectionScale / distance;
+
+		this->residency.markUsed(this->meshInstanceResidency[instanceIndex], this->visibleScreenSizes[i]);
+		this->residency.markUsed(this->textureResidency[thisMesh->getTexId()], this->visibleScreenSizes[i]);
+	}
+
+	// Reload what has come into view and evict what hasn't been seen for longest, before any of it is bound
+	this->updateResidency();
+
+	// Then give resident textures the mip levels their size on screen needs
+	this->updateTextureStreaming();
+
+	// And move some of what's left in sparse memory blocks, so the blocks can be freed
+	this->updateDefragmentation();
+
+	for (size_t i = 0; i < this->visibleInstances.size(); i++) {
+		uint32_t instanceIndex = this->visibleInstances[i];
+		const MeshInstance& instance = this->meshInstances[instanceIndex];
+		Mesh* thisMesh = this->modelList[instance.modelIndex].getMesh(instance.meshIndex);
+
+		// Not drawn at all until its buffers are back
+		if (!thisMesh->isResident()) {
+			continue;
+		}
+
+		glm::vec4 viewPosition = this->uboViewProjection.view * this->sceneGraph.getWorldTransform(this->modelList[instance.modelIndex].getMeshNode(instance.meshIndex)) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+		// Pick the level of detail from the mesh's size on screen
+		uint32_t lodIndex = 0;
+		while (lodIndex < lodThresholds.size() && lodIndex + 1 < thisMesh->getLodCount() && this->visibleScreenSizes[i] < lodThresholds[lodIndex]) {
+			lodIndex++;
+		}
+
+		// Drawn with the default texture until its own is back
+		uint32_t textureIndex = thisMesh->getTexId();
+		if (!this->residency.isResident(this->textureResidency[textureIndex])) {
+			textureIndex = 0;
+		}
+
+		// Untextured materials (texture 0) use their own G-buffer permutation. The mesh's residency id identifies its asset
+		// mesh, so models sharing an asset sort together and its buffers are bound once for all of them
+		bool textured = thisMesh->getTexId() != 0;
+		DrawCommand draw = {};
+		draw.sortKey = makeSortKey(textured ? 1 : 0, textureIndex, this->meshInstanceResidency[instanceIndex], -viewPosition.z, this->farPlane);
+		draw.modelIndex = instance.modelIndex;
+		draw.meshIndex = instance.meshIndex;
+		draw.lodIndex = lodIndex;
+		draw.textureIndex = textureIndex;
+		draw.textured = textured;
+		this->drawList.push_back(draw);
+	}
+
+	radixSortDraws(&this->drawList, &this->drawListScratch);
 }
 
 void VulkanRenderer::recordCommands(uint32_t currentImage)
 {
+	uint64_t descriptorSetsBefore = this->frameDescriptorAllocators[this->currentFrame].getStats().setsAllocated;
+
 	// Information about how to begin each command buffer
 	VkCommandBufferBeginInfo bufferBeginInfo = {};
 	bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -1408,46 +3269,156 @@ void VulkanRenderer::recordCommands(uint32_t currentImage)
 	renderPassBeginInfo.renderArea.offset = { 0, 0 }; // Start point of render pass in pixels (in case we want to star in mid of screen)
 	renderPassBeginInfo.renderArea.extent = swapchainExtent; // Size of region to run render pass on (starting at offset)
 	// WHen it's cleared we want to specify what it's being cleared to, and we need to define both colour and depth stencil
-	std::array<VkClearValue, 3> clearValues = {};
+	std::array<VkClearValue, 5> clearValues = {};
 	clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f }; // This clears values for swapchain image - If we are adding a random triangle on first subpass this would be ignored
 	clearValues[1].color = { 0.0f, 0.0f, 0.0f, 1.0f }; // This clear values for colour buffer
 	clearValues[2].depthStencil.depth = 1.0f;
+	clearValues[3].color = { 0.0f, 0.0f, 0.0f, 0.0f }; // Normal
+	clearValues[4].color = { 0.0f, 0.0f, 0.0f, 0.0f }; // Material, unlit where nothing is drawn
 
 	renderPassBeginInfo.pClearValues = clearValues.data(); // List of clear values 
 	renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 	
 	renderPassBeginInfo.framebuffer = this->swapchainFramebuffers[currentImage];
+
+	// Built before anything is recorded, as it reloads and evicts meshes the shadow passes draw too
+	this->buildDrawList();
+
+	// Whether depth is laid down before the G-buffer is, remembered so the frame's GPU time and shaded fragments are
+	// counted against the right mode when they're read back
+	bool depthPrePass = this->chooseDepthPrePass();
+
+	// Pipelines are asked for without waiting, those still being built on the worker threads come back null. The pre-pass's
+	// G-buffer pipelines test depth for equality, so until the textured one (the fallback for the rest) is built the frame
+	// is drawn without the pre-pass
+	bool pipelineFallback = false;
+	if (depthPrePass && this->scenePipelines.request(this->getGBufferPermutation(true, true)) == VK_NULL_HANDLE) {
+		depthPrePass = false;
+		pipelineFallback = true;
+	}
+	this->frameDepthPrePass[this->currentFrame] = depthPrePass;
+	this->frameStats.depthPrePass = depthPrePass;
 			
 	// Start recording commands to comamnd buffer
 	VkResult result = vkBeginCommandBuffer(this->commandBuffers[currentImage], &bufferBeginInfo);
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to start recording a command buffer");
 	}
+	// Timestamps bracket the whole frame so the GPU time can be read back once the frame's fence is signalled
+	if (this->timestampsSupported) {
+		vkCmdResetQueryPool(this->commandBuffers[currentImage], this->timestampQueryPool, this->currentFrame * TIMESTAMPS_PER_FRAME, TIMESTAMPS_PER_FRAME);
+		vkCmdWriteTimestamp(this->commandBuffers[currentImage], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, this->timestampQueryPool, this->currentFrame * TIMESTAMPS_PER_FRAME);
+	}
+
+	// Bin the lights into clusters (one invocation per cluster) before any fragment reads them
+	vkCmdBindPipeline(this->commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_COMPUTE, this->clusterPipeline);
+	vkCmdBindDescriptorSets(this->commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_COMPUTE, this->clusterPipelineLayout,
+		0, 1, &this->descriptorSets[currentImage], 0, nullptr);
+	vkCmdDispatch(this->commandBuffers[currentImage], (CLUSTER_COUNT + 63) / 64, 1, 1);
+
+	VkBufferMemoryBarrier clusterBarrier = {};
+	clusterBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	clusterBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	clusterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	clusterBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	clusterBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	clusterBarrier.buffer = this->clusterBuffers[currentImage];
+	clusterBarrier.offset = 0;
+	clusterBarrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(this->commandBuffers[currentImage], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 0, nullptr, 1, &clusterBarrier, 0, nullptr);
+
+	// Sun shadow cascades, which the lighting subpass samples
+	this->recordShadowPasses(currentImage);
+
+	// Counts the fragment shader invocations of the G-buffer subpass, reset outside the render pass as it has to be
+	if (this->statisticsSupported) {
+		vkCmdResetQueryPool(this->commandBuffers[currentImage], this->statisticsQueryPool, this->currentFrame, 1);
+	}
+
 	// Begin render pass
 		vkCmdBeginRenderPass(this->commandBuffers[currentImage], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-		// Bind pipeline to be used in render pass
-		vkCmdBindPipeline(this->commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, this->graphicsPipeline);
+		// View projection set is the same for every draw, so only bind it once (set 0)
+		vkCmdBindDescriptorSets(
+			this->commandBuffers[currentImage], // Specific command buffer to bind 
+			VK_PIPELINE_BIND_POINT_GRAPHICS, // Can be used in the graphics pipeline
+			this->pipelineLayout, // This is how the data is coming into
+			0, // Because we can have multiple sets for bidning, here we provide which one
+			1, // How many descriptor sets to bind
+			&this->descriptorSets[currentImage], // One to one with command buffers, and not with meshes, so it will be the same for all our meshes
+			0, // Dynamic offsets (only used for dynamic buffers)
+			nullptr);
 
-		// After we bind the pipeline we can bind our vertex buffers
+		// - DEPTH PRE-PASS SUBPASS
+		// Same draws at the same levels of detail as the G-buffer below, from the position-only stream, so the depths match
+		if (depthPrePass) {
+			vkCmdBindPipeline(this->commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS,
+				this->scenePipelines.get(ShaderPermutation(static_cast<uint32_t>(ScenePipeline::DepthPrePass))));
+
+			VkBuffer boundPositionBuffer = VK_NULL_HANDLE;
+			VkBuffer boundPrePassIndexBuffer = VK_NULL_HANDLE;
+			for (const DrawCommand& draw : this->drawList) {
+				MeshModel& thisModel = this->modelList[draw.modelIndex];
+				Mesh* thisMesh = thisModel.getMesh(draw.meshIndex);
+
+				if (boundPositionBuffer != thisMesh->getVertexBuffer()) {
+					VkBuffer vertexBuffers[] = { thisMesh->getVertexBuffer() };
+					VkDeviceSize offsets[] = { thisMesh->getPositionOffset() };
+					vkCmdBindVertexBuffers(this->commandBuffers[currentImage], 0, 1, vertexBuffers, offsets);
+					boundPositionBuffer = thisMesh->getVertexBuffer();
+				}
+				if (boundPrePassIndexBuffer != thisMesh->getIndexBuffer()) {
+					vkCmdBindIndexBuffer(this->commandBuffers[currentImage], thisMesh->getIndexBuffer(), 0, thisMesh->getIndexType());
+					boundPrePassIndexBuffer = thisMesh->getIndexBuffer();
+				}
+
+				const MeshLod& lod = thisMesh->getLod(draw.lodIndex);
+				vkCmdDrawIndexed(this->commandBuffers[currentImage], lod.indexCount, 1, lod.firstIndex, 0, thisModel.getMeshNode(draw.meshIndex));
+			}
+		}
 
-		for (size_t j = 0; j < this->modelList.size(); j++) {
-			
-			MeshModel thisModel = modelList[j];
+		// - START G-BUFFER SUBPASS
+		vkCmdNextSubpass(this->commandBuffers[currentImage], VK_SUBPASS_CONTENTS_INLINE);
 
-			// Push constants to given shader stage directly (no buffer)
-			vkCmdPushConstants(
-				this->commandBuffers[currentImage],
-				this->pipelineLayout,
-				VK_SHADER_STAGE_VERTEX_BIT, // Stage to push constants to
-				0, // Offset of push constants to update
-				sizeof(Model), // size of the model being pushed
-				&thisModel.getModel() // Actual data being pushed (can be array hence &)
-			);
+		if (this->statisticsSupported) {
+			vkCmdBeginQuery(this->commandBuffers[currentImage], this->statisticsQueryPool, this->currentFrame, 0);
+		}
 
-			for (size_t k = 0; k < thisModel.getMeshCount(); k++) {
+		uint32_t bindCount = 1;
+		uint32_t bindsSkipped = 0;
+		uint64_t trianglesDrawn = 0;
+
+		// Draws are sorted by pipeline, texture, mesh then depth, so binds only need issuing when they change from the previous draw
+		int boundPipeline = -1;
+		int boundTexture = -1;
+		VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+		VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+
+		for (const DrawCommand& draw : this->drawList) {
+			// Reference rather than copy, as copying a model every frame copies its whole mesh list
+			MeshModel& thisModel = this->modelList[draw.modelIndex];
+			Mesh* thisMesh = thisModel.getMesh(draw.meshIndex);
+
+			// Only shading the visible surface when the pre-pass has laid down depth
+			if (boundPipeline != static_cast<int>(draw.textured)) {
+				VkPipeline gBufferPipeline = this->scenePipelines.request(this->getGBufferPermutation(depthPrePass, draw.textured));
+				if (gBufferPipeline == VK_NULL_HANDLE) {
+					// The textured variant stands in while it's built, shading with the default texture instead of the vertex
+					// colours. It's always ready, being built up front (or checked for above with the pre-pass)
+					gBufferPipeline = this->scenePipelines.request(this->getGBufferPermutation(depthPrePass, true));
+					pipelineFallback = true;
+				}
+				vkCmdBindPipeline(this->commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, gBufferPipeline);
+				boundPipeline = static_cast<int>(draw.textured);
+				bindCount++;
+			}
+			else {
+				bindsSkipped++;
+			}
 
-				VkBuffer vertexBuffers[] = { thisModel.getMesh(k)->getVertexBuffer() }; // Buffers to bind
+			if (boundVertexBuffer != thisMesh->getVertexBuffer()) {
+				VkBuffer vertexBuffers[] = { thisMesh->getVertexBuffer() }; // Buffers to bind
 				VkDeviceSize offsets[] = { 0 }; // Offsets into buffers being bound (one for each of the buffers)
 				// Command to bind vertex buffer before drawing with them - parameter defs:
 				// Command buffer: Command buffer to bind the vertex buffers to 
@@ -1456,60 +3427,242 @@ void VulkanRenderer::recordCommands(uint32_t currentImage)
 				// pBuffers: This are the vertex buffers that we defined in the create function
 				// pOffsets: This are the offsets for each of the buffers
 				vkCmdBindVertexBuffers(this->commandBuffers[currentImage], 0, 1, vertexBuffers, offsets);
+				boundVertexBuffer = thisMesh->getVertexBuffer();
+				bindCount++;
+			}
+			else {
+				bindsSkipped++;
+			}
 
+			if (boundIndexBuffer != thisMesh->getIndexBuffer()) {
 				// Binding mesh index buffers (note that we can only bind one index buffer - for multiple vertex buffers)
-				vkCmdBindIndexBuffer(this->commandBuffers[currentImage], thisModel.getMesh(k)->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-
-				//// NO LONGER USED BELOW BUT KEEPING FOR REFERENCE, AS THAT'S HOW MODEL WAS DONE VIA DYNAMIC BUFFERS
-				//// Dynamic offset amount
-				//uint32_t dynamicOffset = static_cast<uint32_t>(this->modelUniformAlignment) * j;
+				vkCmdBindIndexBuffer(this->commandBuffers[currentImage], thisMesh->getIndexBuffer(), 0, thisMesh->getIndexType());
+				boundIndexBuffer = thisMesh->getIndexBuffer();
+				bindCount++;
+			}
+			else {
+				bindsSkipped++;
+			}
 
-				std::array<VkDescriptorSet, 2> descriptorSetGroup = {
-					this->descriptorSets[currentImage],
-					this->samplerDescriptorSets[thisModel.getMesh(k)->getTexId()]
-				};
+			//// NO LONGER USED BELOW BUT KEEPING FOR REFERENCE, AS THAT'S HOW MODEL WAS DONE VIA DYNAMIC BUFFERS
+			//// Dynamic offset amount
+			//uint32_t dynamicOffset = static_cast<uint32_t>(this->modelUniformAlignment) * j;
 
-				// Bind Descriptor Sets
+			if (boundTexture != static_cast<int>(draw.textureIndex)) {
+				// Bind texture descriptor set (set 1), leaving set 0 bound
+				VkDescriptorSet textureDescriptorSet = this->getTextureDescriptorSet(draw.textureIndex);
 				vkCmdBindDescriptorSets(
-					this->commandBuffers[currentImage], // Specific command buffer to bind 
-					VK_PIPELINE_BIND_POINT_GRAPHICS, // Can be used in the graphics pipeline
-					this->pipelineLayout, // This is how the data is coming into
-					0, // Because we can have multiple sets for bidning, here we provide which one
-					static_cast<uint32_t>(descriptorSetGroup.size()), // How many descriptor sets for each draw
-					descriptorSetGroup.data(), // Point to the descrptor set that will be used here (one to one with command buffers, and not with meshes, so it will be the same for all our meshse) 
-					0, // // Addresses that it's not possible to address to all our meshes
+					this->commandBuffers[currentImage],
+					VK_PIPELINE_BIND_POINT_GRAPHICS,
+					this->pipelineLayout,
+					1,
+					1,
+					&textureDescriptorSet,
+					0,
 					nullptr);
+				boundTexture = static_cast<int>(draw.textureIndex);
+				bindCount++;
+			}
+			else {
+				bindsSkipped++;
+			}
 
-				// Execute pipeline - Explanation on parameters (in order as per func):
-				// Commandbuffer: Command buffer to attach draw command to
-				// Vertexcount: Number of vertices you want to draw (if using a model, then we would have a bindvertices function) - it will basically go through in this case 3 times as we pass 3
-				// Instance count: Number of instances to draw
-				// First vertex: Location of the first vertex for the first one
-				// FIrst instance: Which instance number to start at
-				// However we're no longer using the vertex directly, we use the index buffers directly now, so see below
-				//vkCmdDraw(this->commandBuffers[i], static_cast<uint32_t>(firstMesh.getVertexCount()), 1, 0, 0);
+			// Execute pipeline - Explanation on parameters (in order as per func):
+			// Commandbuffer: Command buffer to attach draw command to
+			// Vertexcount: Number of vertices you want to draw (if using a model, then we would have a bindvertices function) - it will basically go through in this case 3 times as we pass 3
+			// Instance count: Number of instances to draw
+			// First vertex: Location of the first vertex for the first one
+			// FIrst instance: Which instance number to start at
+			// However we're no longer using the vertex directly, we use the index buffers directly now, so see below
+			//vkCmdDraw(this->commandBuffers[i], static_cast<uint32_t>(firstMesh.getVertexCount()), 1, 0, 0);
+
+			// Every level of detail lives in the same index buffer, so only the range changes
+			const MeshLod& lod = thisMesh->getLod(draw.lodIndex);
+			// First instance picks the mesh's node out of the object buffer
+			vkCmdDrawIndexed(this->commandBuffers[currentImage], lod.indexCount, 1, lod.firstIndex, 0, thisModel.getMeshNode(draw.meshIndex));
+			trianglesDrawn += lod.indexCount / 3;
+		}
+
+		this->frameStats.drawCount = static_cast<uint32_t>(this->drawList.size());
+		this->frameStats.bindCount = bindCount;
+		this->frameStats.bindsSkipped = bindsSkipped;
+		this->frameStats.trianglesDrawn = trianglesDrawn;
+		this->frameStats.descriptorSetsWritten = static_cast<uint32_t>(this->frameDescriptorAllocators[this->currentFrame].getStats().setsAllocated - descriptorSetsBefore);
 
-				vkCmdDrawIndexed(this->commandBuffers[currentImage], thisModel.getMesh(k)->getIndexCount(), 1, 0, 0, 0);
+		if (this->statisticsSupported) {
+			vkCmdEndQuery(this->commandBuffers[currentImage], this->statisticsQueryPool, this->currentFrame);
+			this->statisticsWritten[this->currentFrame] = true;
+		}
 
-				// - START SECOND SUBPASS
-				vkCmdNextSubpass(this->commandBuffers[currentImage], VK_SUBPASS_CONTENTS_INLINE);
+		// - START LIGHTING SUBPASS
+		// Only once all meshes have been drawn, as lighting reads the whole G-buffer
+		vkCmdNextSubpass(this->commandBuffers[currentImage], VK_SUBPASS_CONTENTS_INLINE);
 
-				vkCmdBindPipeline(this->commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, this->secondPipeline);
-				vkCmdBindDescriptorSets(this->commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, this->secondPipelineLayout,
-					0, 1, &this->inputDescriptorSets[currentImage], 0, nullptr);
-				vkCmdDraw(this->commandBuffers[currentImage], 3, 1, 0, 0);
-			}
+		// After a lighting mode or sun change, the last lighting pipeline is used until the new one is built
+		VkPipeline lightingPipeline = this->scenePipelines.request(this->getLightingPermutation());
+		if (lightingPipeline == VK_NULL_HANDLE) {
+			lightingPipeline = this->lastLightingPipeline;
+			pipelineFallback = true;
 		}
+		this->lastLightingPipeline = lightingPipeline;
+		vkCmdBindPipeline(this->commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, lightingPipeline);
+		// Set 0 is still bound from the G-buffer subpass, as both layouts share it
+		vkCmdBindDescriptorSets(this->commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, this->secondPipelineLayout,
+			1, 1, &this->inputDescriptorSets[currentImage], 0, nullptr);
+		vkCmdDraw(this->commandBuffers[currentImage], 3, 1, 0, 0);
 
 		vkCmdEndRenderPass(this->commandBuffers[currentImage]);
+
+		if (pipelineFallback) {
+			this->frameStats.pipelineFallbackFrames++;
+		}
 	// End render pass
 
+	if (this->timestampsSupported) {
+		vkCmdWriteTimestamp(this->commandBuffers[currentImage], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, this->timestampQueryPool, this->currentFrame * TIMESTAMPS_PER_FRAME + 1);
+	}
+
 	result = vkEndCommandBuffer(this->commandBuffers[currentImage]);
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to stop recording a command buffer");
 	}
 }
 
+void VulkanRenderer::recordShadowPasses(uint32_t currentImage)
+{
+	VkCommandBuffer commandBuffer = this->commandBuffers[currentImage];
+	this->shadowCascadesTimed[this->currentFrame] = 0;
+	this->frameStats.shadowCascadesRefreshed = 0;
+	this->frameStats.shadowCasterDraws = 0;
+
+	// The shadow maps are left as they were, the lighting subpass doesn't read them without a sun
+	if (this->sunIntensity <= 0.0f) {
+		return;
+	}
+
+	uint32_t mapSize = this->config.shadowMapSize;
+	uint32_t cascadeCount = this->config.shadowCascades;
+	uint32_t firstQuery = this->currentFrame * TIMESTAMPS_PER_FRAME + 2;
+
+	VkClearValue clearValue = {};
+	clearValue.depthStencil.depth = 1.0f;
+
+	VkRenderPassBeginInfo renderPassBeginInfo = {};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderArea.offset = { 0, 0 };
+	renderPassBeginInfo.renderArea.extent = { mapSize, mapSize };
+	renderPassBeginInfo.clearValueCount = 1;
+	renderPassBeginInfo.pClearValues = &clearValue;
+
+	// Set 0 for the object buffer, rebound with the main pipeline's layout once the render pass starts
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->shadowPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->shadowPipelineLayout,
+		0, 1, &this->descriptorSets[currentImage], 0, nullptr);
+
+	for (uint32_t i = 0; i < cascadeCount; i++) {
+		if (this->timestampsSupported) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, this->timestampQueryPool, firstQuery + i * 2);
+		}
+
+		// -- Static casters, only when the cascade has been refit or something static has changed since its layer was drawn
+		if (this->shadowCascadeVersions[i] != this->staticShadowVersion) {
+			renderPassBeginInfo.renderPass = this->staticShadowRenderPass;
+			renderPassBeginInfo.framebuffer = this->staticShadowFramebuffers[i];
+			vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			this->frameStats.shadowCasterDraws += this->recordShadowCasters(commandBuffer, this->shadowCascades[i], true);
+			vkCmdEndRenderPass(commandBuffer);
+
+			this->shadowCascadeVersions[i] = this->staticShadowVersion;
+			this->frameStats.shadowCascadesRefreshed++;
+		}
+
+		// -- Copy the cached layer into this image's shadow map, whatever was in it was only ever sampled
+		VkImageMemoryBarrier imageMemoryBarrier = {};
+		imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageMemoryBarrier.image = this->shadowMapImages[currentImage];
+		imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+		imageMemoryBarrier.subresourceRange.levelCount = 1;
+		imageMemoryBarrier.subresourceRange.baseArrayLayer = i;
+		imageMemoryBarrier.subresourceRange.layerCount = 1;
+		imageMemoryBarrier.srcAccessMask = 0;
+		imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+
+		VkImageCopy copyRegion = {};
+		copyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		copyRegion.srcSubresource.mipLevel = 0;
+		copyRegion.srcSubresource.baseArrayLayer = i;
+		copyRegion.srcSubresource.layerCount = 1;
+		copyRegion.dstSubresource = copyRegion.srcSubresource;
+		copyRegion.extent = { mapSize, mapSize, 1 };
+		vkCmdCopyImage(commandBuffer, this->staticShadowImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			this->shadowMapImages[currentImage], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+		// -- Dynamic casters over the static shadows, every frame
+		renderPassBeginInfo.renderPass = this->shadowRenderPass;
+		renderPassBeginInfo.framebuffer = this->shadowMapFramebuffers[currentImage * cascadeCount + i];
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		this->frameStats.shadowCasterDraws += this->recordShadowCasters(commandBuffer, this->shadowCascades[i], false);
+		vkCmdEndRenderPass(commandBuffer);
+
+		if (this->timestampsSupported) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, this->timestampQueryPool, firstQuery + i * 2 + 1);
+		}
+	}
+
+	if (this->timestampsSupported) {
+		this->shadowCascadesTimed[this->currentFrame] = cascadeCount;
+	}
+}
+
+uint32_t VulkanRenderer::recordShadowCasters(VkCommandBuffer commandBuffer, const ShadowCascade& cascade, bool staticCasters)
+{
+	vkCmdPushConstants(commandBuffer, this->shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &cascade.viewProjection);
+
+	// Everything in the cascade's box casts, whether or not the camera can see it
+	this->shadowCasters.clear();
+	this->sceneBvh.queryFrustum(Frustum::fromMatrix(cascade.viewProjection), &this->shadowCasters);
+
+	VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+	VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+	uint32_t drawCount = 0;
+
+	for (uint32_t instanceIndex : this->shadowCasters) {
+		const MeshInstance& instance = this->meshInstances[instanceIndex];
+		MeshModel& thisModel = this->modelList[instance.modelIndex];
+		Mesh* thisMesh = thisModel.getMesh(instance.meshIndex);
+
+		// Evicted meshes don't cast until they're reloaded
+		if (thisModel.isStatic() != staticCasters || !thisMesh->isResident()) {
+			continue;
+		}
+
+		if (boundVertexBuffer != thisMesh->getVertexBuffer()) {
+			VkBuffer vertexBuffers[] = { thisMesh->getVertexBuffer() };
+			VkDeviceSize offsets[] = { thisMesh->getPositionOffset() };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+			boundVertexBuffer = thisMesh->getVertexBuffer();
+		}
+		if (boundIndexBuffer != thisMesh->getIndexBuffer()) {
+			vkCmdBindIndexBuffer(commandBuffer, thisMesh->getIndexBuffer(), 0, thisMesh->getIndexType());
+			boundIndexBuffer = thisMesh->getIndexBuffer();
+		}
+
+		// Full detail, the cached layers would otherwise keep whichever level the mesh had when they were drawn
+		const MeshLod& lod = thisMesh->getLod(0);
+		vkCmdDrawIndexed(commandBuffer, lod.indexCount, 1, lod.firstIndex, 0, thisModel.getMeshNode(instance.meshIndex));
+		drawCount++;
+	}
+
+	return drawCount;
+}
+
 void VulkanRenderer::getPhysicalDevice()
 {
 	// Enumerate physical devices the vkInstance can access
@@ -1526,17 +3679,54 @@ void VulkanRenderer::getPhysicalDevice()
 	std::vector<VkPhysicalDevice> deviceList(deviceCount);
 	vkEnumeratePhysicalDevices(this->instance, &deviceCount, deviceList.data());
 
+	// Take the first suitable device, unless one matching the preferred name is also suitable
+	this->mainDevice.physicalDevice = VK_NULL_HANDLE;
 	for (const VkPhysicalDevice& device : deviceList) {
-		if (this->checkDeviceSuitable(device)) {
-			mainDevice.physicalDevice = device;
+		if (!this->checkDeviceSuitable(device)) {
+			continue;
+		}
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(device, &properties);
+		bool preferred = !this->config.preferredDevice.empty() && std::string(properties.deviceName).find(this->config.preferredDevice) != std::string::npos;
+
+		if (this->mainDevice.physicalDevice == VK_NULL_HANDLE || preferred) {
+			this->mainDevice.physicalDevice = device;
+		}
+		if (preferred || this->config.preferredDevice.empty()) {
 			break;
 		}
 	}
 
+	if (this->mainDevice.physicalDevice == VK_NULL_HANDLE) {
+		throw std::runtime_error("Can't find a suitable GPU");
+	}
+
 	// Get properties of our new device
 	VkPhysicalDeviceProperties deviceProperties;
 	vkGetPhysicalDeviceProperties(this->mainDevice.physicalDevice, &deviceProperties);
 
+	this->deviceName = deviceProperties.deviceName;
+	std::cout << "Using device: " << this->deviceName << std::endl;
+
+	// Timestamps need the graphics queue to support them, and the period to convert ticks to nanoseconds
+	QueueFamilyIndices indices = this->getQueueFamilies(this->mainDevice.physicalDevice);
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(this->mainDevice.physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(this->mainDevice.physicalDevice, &queueFamilyCount, queueFamilyList.data());
+
+	// The valid bits are what the queue actually writes, timestampComputeAndGraphics only promises there are some
+	uint32_t timestampValidBits = queueFamilyList[indices.graphicsFamily].timestampValidBits;
+	this->timestampPeriod = deviceProperties.limits.timestampPeriod;
+	this->timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+	this->timestampsSupported = timestampValidBits > 0;
+
+	// Overdraw is measured from the fragment shader invocations counted by a pipeline statistics query
+	VkPhysicalDeviceFeatures deviceFeatures;
+	vkGetPhysicalDeviceFeatures(this->mainDevice.physicalDevice, &deviceFeatures);
+	this->statisticsSupported = deviceFeatures.pipelineStatisticsQuery == VK_TRUE;
+
 	//// NO LONGER USED BELOW BUT KEEPING FOR REFERENCE, AS THAT'S HOW MODEL WAS DONE VIA DYNAMIC BUFFERS
 	//// Get the size of the blocks for buffers
 	//this->minUniformBufferOffset = deviceProperties.limits.minUniformBufferOffsetAlignment;
@@ -1573,9 +3763,14 @@ QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice physicalDev
 			indices.graphicsFamily = i;// If queue family is valid, then get the index
 		}
 
-		// Check if queue family supports presentation
+		// Check if queue family supports presentation (there's nothing to present to when headless, so graphics is enough)
 		VkBool32 presentationSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, this->surface, &presentationSupport);
+		if (this->headless) {
+			presentationSupport = queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT ? VK_TRUE : VK_FALSE;
+		}
+		else {
+			vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, this->surface, &presentationSupport);
+		}
 		// A queue can be both graphics and presentation hence why its not just else if
 		if (queueFamily.queueCount > 0 && presentationSupport) {
 			indices.presentationFamily = i;
@@ -1652,6 +3847,11 @@ bool VulkanRenderer::checkInstanceExtensionSupport(std::vector<const char*>* che
 
 bool VulkanRenderer::checkDeviceExtensionSupport(VkPhysicalDevice physicalDevice)
 {
+	// The only required extension is the swapchain, which isn't used when headless
+	if (this->headless) {
+		return true;
+	}
+
 	// Get device extension count
 	uint32_t extensionCount = 0;
 	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
@@ -1690,20 +3890,33 @@ bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice physicalDevice)
 	VkPhysicalDeviceFeatures deviceFeatures;
 	vkGetPhysicalDeviceFeatures(physicalDevice, &deviceFeatures);
 
+	// Vulkan 1.2 features (timeline semaphores) have to be queried through the chained features struct
+	VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
+	deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	deviceFeatures2.pNext = &vulkan12Features;
+
+	bool timelineSupported = false;
+	if (deviceProperties.apiVersion >= VK_API_VERSION_1_2) {
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures2);
+		timelineSupported = vulkan12Features.timelineSemaphore;
+	}
+
 	std::cout << "Checking device suitable. Vendor ID: " << deviceProperties.vendorID << std::endl;
 
 	QueueFamilyIndices indices = this->getQueueFamilies(physicalDevice);
 
 	bool extensionSupported = checkDeviceExtensionSupport(physicalDevice);
 
-	bool swapchainValid = false;
+	bool swapchainValid = this->headless;
 
-	if (extensionSupported) {
+	if (extensionSupported && !this->headless) {
 		SwapchainDetails swapchainDetails = this->getSwapchainDetails(physicalDevice);
 		swapchainValid = !swapchainDetails.presentationModes.empty() && !swapchainDetails.formats.empty();
 	}
 
-	return indices.isValid() && extensionSupported && swapchainValid && deviceFeatures.samplerAnisotropy;
+	return indices.isValid() && extensionSupported && swapchainValid && deviceFeatures.samplerAnisotropy && timelineSupported;
 }
 
 
@@ -1730,13 +3943,15 @@ VkSurfaceFormatKHR VulkanRenderer::chooseBestSurfaceFormat(const std::vector<VkS
 
 VkPresentModeKHR VulkanRenderer::chooseBestPresentationMode(const std::vector<VkPresentModeKHR>& presentationModes)
 {
+	// Use the configured mode if the surface supports it
 	for (const VkPresentModeKHR& presentationMode : presentationModes) {
-		if (presentationMode == VK_PRESENT_MODE_MAILBOX_KHR) {
+		if (presentationMode == this->config.presentMode) {
 			return presentationMode;
 		}
 	}
 
 	// As part of vulkan spec this should always have to be available
+	std::cout << "Requested present mode not supported, falling back to FIFO" << std::endl;
 	return VK_PRESENT_MODE_FIFO_KHR;
 }
 
@@ -1790,7 +4005,22 @@ VkFormat VulkanRenderer::chooseSupportedFormat(const std::vector<VkFormat>& form
 	throw std::runtime_error("Failed to find matching format");
 }
 
-VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory)
+VkMemoryPropertyFlags VulkanRenderer::chooseTransientAttachmentMemory()
+{
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(this->mainDevice.physicalDevice, &memoryProperties);
+
+	VkMemoryPropertyFlags lazyMemory = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if ((memoryProperties.memoryTypes[i].propertyFlags & lazyMemory) == lazyMemory) {
+			return lazyMemory;
+		}
+	}
+
+	return VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+}
+
+VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory, uint32_t mipLevels, uint32_t arrayLayers)
 {
 	// 1. CREATE IMAGE
 	VkImageCreateInfo imageCreateInfo = {};
@@ -1799,8 +4029,8 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 	imageCreateInfo.extent.width = width;
 	imageCreateInfo.extent.height = height;
 	imageCreateInfo.extent.depth = 1; // Depth of image (just 1, as there is no 3D aspect)
-	imageCreateInfo.mipLevels = 1; // Level of detail, number of mipmap levels
-	imageCreateInfo.arrayLayers = 1; // Can be used for cubemaps if there are multiple levesl of arrays
+	imageCreateInfo.mipLevels = mipLevels; // Level of detail, number of mipmap levels
+	imageCreateInfo.arrayLayers = arrayLayers; // Can be used for cubemaps if there are multiple levesl of arrays
 	imageCreateInfo.format = format; // Format type of image
 	imageCreateInfo.tiling = tiling; // How image data shoudl be "tiled" (arranged in memory for optimal reading)
 	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // Relates back to render pass, colour attachements has initial and final layout (plus what it transitions in renderpass), here we're saying the initial layout but then it will change on renderpass
@@ -1825,7 +4055,7 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 	memoryAllocateInfo.allocationSize = memoryRequirements.size;
 	memoryAllocateInfo.memoryTypeIndex = findMemoryTypeIndex(this->mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, propFlags);
 
-	result = vkAllocateMemory(this->mainDevice.logicalDevice, &memoryAllocateInfo, nullptr, imageMemory);
+	result = allocateDeviceMemory(this->mainDevice.logicalDevice, &memoryAllocateInfo, imageMemory);
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate memory for image");
 	}
@@ -1838,12 +4068,36 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 	return image;
 }
 
-VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags)
+VkImage VulkanRenderer::createTextureImage(uint32_t width, uint32_t height, uint32_t mipLevels, MemoryAllocation* allocation)
+{
+	VkImageCreateInfo imageCreateInfo = {};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.extent.width = width;
+	imageCreateInfo.extent.height = height;
+	imageCreateInfo.extent.depth = 1;
+	imageCreateInfo.mipLevels = mipLevels;
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	// TRANSFER_SRC_BIT so it can be copied elsewhere when its memory block is emptied
+	imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkImage image;
+	*allocation = this->memoryAllocator.createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &image);
+	return image;
+}
+
+VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels,
+	VkImageViewType viewType, uint32_t baseLayer, uint32_t layerCount)
 {
 	VkImageViewCreateInfo viewCreateInfo = {};
 	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 	viewCreateInfo.image = image; // Image to create view for
-	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D; // Type of image (1D, 2D, Cube, etc)
+	viewCreateInfo.viewType = viewType; // Type of image (1D, 2D, Cube, etc)
 	viewCreateInfo.format = format; // Format of image data
 	viewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY; // Allows remappingof rgba components to other rgba values
 	viewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -1853,9 +4107,9 @@ VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkIm
 	// Subresources allow the view to view only a part of an image
 	viewCreateInfo.subresourceRange.aspectMask = aspectFlags; // Which aspect of image to view (eg COLOR_BIT for viewing color)
 	viewCreateInfo.subresourceRange.baseMipLevel = 0; // Start mipmap level to view from
-	viewCreateInfo.subresourceRange.levelCount = 1; // Number of mipmap levels to view
-	viewCreateInfo.subresourceRange.baseArrayLayer = 0; // Start array level to view from
-	viewCreateInfo.subresourceRange.layerCount = 1; // Number of array levels to view
+	viewCreateInfo.subresourceRange.levelCount = mipLevels; // Number of mipmap levels to view
+	viewCreateInfo.subresourceRange.baseArrayLayer = baseLayer; // Start array level to view from
+	viewCreateInfo.subresourceRange.layerCount = layerCount; // Number of array levels to view
 
 	// Create image view and return it
 	VkImageView imageView;
@@ -1884,132 +4138,274 @@ VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
 	return shaderModule;
 }
 
-int VulkanRenderer::createTextureImage(std::string fileName)
+int VulkanRenderer::createTexture(std::string fileName, bool stream)
+{
+	// The same file loaded before (however its path was spelled) is the same texture, without reading it again
+	std::string path = TextureCache::canonicalPath("Textures/" + fileName);
+	int textureId = this->textureCache.findPath(path);
+	if (textureId >= 0) {
+		this->textureCache.acquire(textureId);
+		return textureId;
+	}
+
+	// As is a copy of it under another path
+	std::vector<stbi_uc> fileData = this->loadTextureFile(fileName);
+	uint64_t contentHash = hashContent(fileData.data(), fileData.size());
+	textureId = this->textureCache.findContent(contentHash, fileData.size());
+	if (textureId >= 0) {
+		this->textureCache.addPath(textureId, path);
+		this->textureCache.acquire(textureId);
+		return textureId;
+	}
+
+	TextureSource source = {};
+	source.fileName = fileName;
+	if (!stream) {
+		source.mips = decodeTexture(fileData);
+		if (source.mips.levels.empty()) {
+			throw std::runtime_error("Failed to load a texture file (" + fileName + ")");
+		}
+	}
+
+	textureId = this->addTextureSlot(source);
+	this->textureCache.add(textureId, path, contentHash, fileData.size());
+
+	if (stream) {
+		// Decoded on the streamer's thread, picked up by updateTextureStreaming
+		this->textureStreamer.requestFile(textureId, fileName, std::move(fileData));
+		this->textureSources[textureId].decoding = true;
+	}
+	else {
+		// Every level is on the device, so the pixels aren't needed unless it's evicted, when it's decoded again
+		this->createTextureLevels(textureId, 0);
+		freeMipPixels(&this->textureSources[textureId].mips);
+		this->residency.setResident(this->textureResidency[textureId], true);
+	}
+
+	// Return location of set with texture
+	return textureId;
+}
+
+int VulkanRenderer::createTextureFromPixels(const stbi_uc* pixels, int width, int height)
+{
+	// Same pixels at the same size as a texture already created are the same texture
+	size_t pixelBytes = static_cast<size_t>(width) * height * 4;
+	uint64_t contentHash = hashContent(&width, sizeof(width));
+	contentHash = hashContent(pixels, pixelBytes, contentHash);
+	int textureId = this->textureCache.findContent(contentHash, pixelBytes);
+	if (textureId >= 0) {
+		this->textureCache.acquire(textureId);
+		return textureId;
+	}
+
+	// Same as createTexture but for RGBA pixel data already in memory (eg generated procedurally), which starts at its
+	// smallest levels like a streamed texture
+	TextureSource source = {};
+	source.mips = generateMips(pixels, width, height);
+	textureId = this->addTextureSlot(source);
+	this->textureCache.add(textureId, "", contentHash, pixelBytes);
+
+	this->createTextureLevels(textureId, this->getInitialTextureLevel(textureId));
+	this->residency.setResident(this->textureResidency[textureId], true);
+
+	// Return location of set with texture
+	return textureId;
+}
+
+int VulkanRenderer::addTextureSlot(const TextureSource& source)
 {
-	// Load image file
-	int width, height;
-	VkDeviceSize imageSize;
-	stbi_uc* imageData = this->loadTextureFile(fileName, &width, &height, &imageSize);
+	// A destroyed texture's slot is reused along with its residency id
+	if (!this->freeTextureIds.empty()) {
+		int textureId = this->freeTextureIds.back();
+		this->freeTextureIds.pop_back();
+		this->textureSources[textureId] = source;
+		uint32_t memoryType = findMemoryTypeIndex(this->mainDevice.physicalDevice, 0xFFFFFFFF, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		this->residency.setSize(this->textureResidency[textureId], 0, memoryType);
+		this->residency.setResident(this->textureResidency[textureId], false);
+		return textureId;
+	}
+
+	int textureId = static_cast<int>(this->textureSources.size());
+	this->textureSources.push_back(source);
+	this->textureImages.push_back(VK_NULL_HANDLE);
+	this->textureImageAllocations.push_back(MemoryAllocation());
+	this->textureImageViews.push_back(VK_NULL_HANDLE);
+
+	// Not resident until it has an image. The default texture (0) stands in for those that aren't, so it always stays
+	uint32_t memoryType = findMemoryTypeIndex(this->mainDevice.physicalDevice, 0xFFFFFFFF, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	uint32_t residencyId = this->residency.addResource(ResidentType::Texture, static_cast<uint32_t>(textureId), 0, memoryType, textureId == 0);
+	this->residency.setResident(residencyId, false);
+	this->textureResidency.push_back(residencyId);
+
+	return textureId;
+}
+
+void VulkanRenderer::createTextureLevels(int textureId, uint32_t baseLevel)
+{
+	TextureSource& source = this->textureSources[textureId];
+	const TextureMips& mips = source.mips;
+	uint32_t levelCount = static_cast<uint32_t>(mips.levels.size()) - baseLevel;
+
+	// Callers get the pixels back with requestTexturePixels first if they may have been freed
+	if (!hasMipPixels(mips)) {
+		throw std::runtime_error("Texture's pixels aren't in memory to upload");
+	}
+
+	// Every level goes in one staging buffer, one after the other
+	VkDeviceSize stagingSize = 0;
+	std::vector<VkBufferImageCopy> regions(levelCount);
+	for (uint32_t i = 0; i < levelCount; i++) {
+		regions[i] = {};
+		regions[i].bufferOffset = stagingSize;
+		regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		regions[i].imageSubresource.mipLevel = i;
+		regions[i].imageSubresource.baseArrayLayer = 0;
+		regions[i].imageSubresource.layerCount = 1;
+		regions[i].imageExtent = { mips.widths[baseLevel + i], mips.heights[baseLevel + i], 1 };
+		stagingSize += mips.levels[baseLevel + i].size();
+	}
 
 	// Create staging buffer to hold loaded data, ready to copy to device
 	VkBuffer imageStagingBuffer;
 	VkDeviceMemory imageStagingBufferMemory;
-	createBuffer(this->mainDevice.physicalDevice, this->mainDevice.logicalDevice, imageSize,
+	createBuffer(this->mainDevice.physicalDevice, this->mainDevice.logicalDevice, stagingSize,
 		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 		&imageStagingBuffer, &imageStagingBufferMemory);
 
-	// Copy image to staging buffer
+	// Copy levels to staging buffer
 	void* data;
-	vkMapMemory(this->mainDevice.logicalDevice, imageStagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, imageData, static_cast<size_t>(imageSize));
+	vkMapMemory(this->mainDevice.logicalDevice, imageStagingBufferMemory, 0, stagingSize, 0, &data);
+	for (uint32_t i = 0; i < levelCount; i++) {
+		memcpy(static_cast<char*>(data) + regions[i].bufferOffset, mips.levels[baseLevel + i].data(), mips.levels[baseLevel + i].size());
+	}
 	vkUnmapMemory(this->mainDevice.logicalDevice, imageStagingBufferMemory);
 
-	// Free original image data
-	stbi_image_free(imageData);
-
-	// Create image to hold final texture
-	VkImage texImage;
-	VkDeviceMemory texImageMemory;
-	texImage = createImage(width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texImageMemory);
+	// Create image to hold final texture, its level 0 being the texture's baseLevel
+	MemoryAllocation texImageAllocation;
+	VkImage texImage = this->createTextureImage(mips.widths[baseLevel], mips.heights[baseLevel], levelCount, &texImageAllocation);
 
 	// -- Copy data to image
-	// Transition image to be DST for copay operation
+	// Transition image to be DST for copy operation
 	transitionImageLayout(this->mainDevice.logicalDevice, this->graphicsQueue, this->graphicsCommandPool,
-		texImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+		texImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &this->timeline, levelCount);
 
-	// Copy image data 
-	copyImageBuffer(
-		this->mainDevice.logicalDevice,
-		this->graphicsQueue,
-		this->graphicsCommandPool,
-		imageStagingBuffer,
-		texImage,
-		width,
-		height);
+	// Copy every level
+	copyImageBufferLevels(this->mainDevice.logicalDevice, this->graphicsQueue, this->graphicsCommandPool,
+		imageStagingBuffer, texImage, regions, &this->timeline);
 
 	// Transition image to be shader readable for shader usage
 	transitionImageLayout(this->mainDevice.logicalDevice, this->graphicsQueue, this->graphicsCommandPool,
-		texImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-	// Add texture data to vector for reference
-	this->textureImages.push_back(texImage);
-	this->textureImageMemory.push_back(texImageMemory);
-
-	// Destroy staging buffers
-	vkDestroyBuffer(this->mainDevice.logicalDevice, imageStagingBuffer, nullptr);
-	vkFreeMemory(this->mainDevice.logicalDevice, imageStagingBufferMemory, nullptr);
+		texImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, &this->timeline, levelCount);
+
+	// Destroy staging buffers (once the copy has finished)
+	destroyStagingBuffer(this->mainDevice.logicalDevice, imageStagingBuffer, imageStagingBufferMemory, &this->timeline);
+
+	VkImageView texImageView = createImageView(texImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, levelCount);
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(this->mainDevice.logicalDevice, texImage, &memoryRequirements);
+	this->residency.setSize(this->textureResidency[textureId], memoryRequirements.size,
+		findMemoryTypeIndex(this->mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+
+	if (this->textureImages[textureId] != VK_NULL_HANDLE) {
+		// Frames in flight may still be using the current image through the sets they wrote for it, so it's freed once
+		// everything submitted so far has finished. Later frames write their sets with the new image
+
+		VkDevice device = this->mainDevice.logicalDevice;
+		MemoryBlockAllocator* allocator = &this->memoryAllocator;
+		VkImage oldImage = this->textureImages[textureId];
+		VkImageView oldImageView = this->textureImageViews[textureId];
+		MemoryAllocation oldImageAllocation = this->textureImageAllocations[textureId];
+		this->timeline.retire(this->timeline.lastSubmittedValue(), [device, allocator, oldImage, oldImageView, oldImageAllocation]() {
+			vkDestroyImageView(device, oldImageView, nullptr);
+			vkDestroyImage(device, oldImage, nullptr);
+			allocator->free(oldImageAllocation);
+		});
+	}
 
-	// Return index of new texture image
-	return textureImages.size() - 1;
+	this->textureImages[textureId] = texImage;
+	this->textureImageAllocations[textureId] = texImageAllocation;
+	this->textureImageViews[textureId] = texImageView;
+	source.residentLevel = baseLevel;
+	source.lastDetailFrame = this->frameStats.frameNumber;
 }
 
-int VulkanRenderer::createTexture(std::string fileName)
+void VulkanRenderer::destroyTexture(int textureId)
 {
-	// Create texture image and get its location in array
-	int textureImageLoc = this->createTextureImage(fileName);
+	// The default texture stands in for every other, so it's never freed
+	if (textureId == 0 || !this->textureCache.release(textureId)) {
+		return;
+	}
 
-	// Create image view and add to list
-	VkImageView imageView = createImageView(this->textureImages[textureImageLoc], VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
-	this->textureImageViews.push_back(imageView);
-	
-	// Create texture descriptor
-	int descriptorLoc = this->createTextureDescriptor(imageView);
+	// Nothing draws with it any more, but frames in flight may have, so its image goes once they've finished
+	if (this->textureImages[textureId] != VK_NULL_HANDLE) {
+		VkDevice device = this->mainDevice.logicalDevice;
+		MemoryBlockAllocator* allocator = &this->memoryAllocator;
+		VkImage image = this->textureImages[textureId];
+		VkImageView imageView = this->textureImageViews[textureId];
+		MemoryAllocation imageAllocation = this->textureImageAllocations[textureId];
+		this->timeline.retire(this->timeline.lastSubmittedValue(), [device, allocator, image, imageView, imageAllocation]() {
+			vkDestroyImageView(device, imageView, nullptr);
+			vkDestroyImage(device, image, nullptr);
+			allocator->free(imageAllocation);
+		});
+		this->textureImages[textureId] = VK_NULL_HANDLE;
+		this->textureImageViews[textureId] = VK_NULL_HANDLE;
+		this->textureImageAllocations[textureId] = MemoryAllocation();
+	}
 
-	// Return location of set with texture
-	return descriptorLoc;
+	// Dropping the mips frees their memory too, and stops it being reloaded or streamed
+	this->textureSources[textureId] = TextureSource();
+	this->residency.setResident(this->textureResidency[textureId], false);
+
+	// Frames in flight may still bind it, so the id is only reused once they've finished
+	this->timeline.retire(this->timeline.lastSubmittedValue(), [this, textureId]() {
+		this->freeTextureIds.push_back(textureId);
+	});
 }
 
-int VulkanRenderer::createTextureDescriptor(VkImageView textureImage)
+uint32_t VulkanRenderer::getInitialTextureLevel(int textureId)
 {
-	VkDescriptorSet descriptorSet;
-
-	// Descriptor set allocation info
-	VkDescriptorSetAllocateInfo setAllocInfo = {};
-	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	setAllocInfo.descriptorPool = this->samplerDescriptorPool;
-	setAllocInfo.descriptorSetCount = 1;
-	setAllocInfo.pSetLayouts = &this->samplerDescriptorSetLayout;
-
-	// Allocate Descriptor Sets
-	VkResult result = vkAllocateDescriptorSets(this->mainDevice.logicalDevice, &setAllocInfo, &descriptorSet);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to allocate texture descriptor");
-	}
+	return findMipLevel(this->textureSources[textureId].mips, TEXTURE_STREAM_INITIAL_SIZE);
+}
 
+VkDescriptorSet VulkanRenderer::getTextureDescriptorSet(uint32_t textureId)
+{
 	// Texture image info
 	VkDescriptorImageInfo imageInfo = {};
 	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // Image layout when in use
-	imageInfo.imageView = textureImage; // IMage to bind to set
+	imageInfo.imageView = this->textureImageViews[textureId]; // IMage to bind to set
 	imageInfo.sampler = this->textureSampler; // Sampler to use for set
 
-	// Descriptor write info
+	// Descriptor write info (the set is filled in if a new one is written)
 	VkWriteDescriptorSet descriptorWrite = {};
 	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrite.dstSet = descriptorSet;
 	descriptorWrite.dstBinding = 0;
 	descriptorWrite.dstArrayElement = 0;
 	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	descriptorWrite.descriptorCount = 1;
 	descriptorWrite.pImageInfo = &imageInfo;
 
-	// Update new descriptor set
-	vkUpdateDescriptorSets(this->mainDevice.logicalDevice, 1, &descriptorWrite, 0, nullptr);
-
-	// Add descriptor set to list
-	this->samplerDescriptorSets.push_back(descriptorSet);
-
-	return this->samplerDescriptorSets.size() - 1;
+	// Written the first time this frame binds the image, the same set after that. A texture's image only changes before
+	// a frame's draws are recorded, and the sets go with the frame, so they never need rewriting
+	return this->frameDescriptorAllocators[this->currentFrame].getSet(this->samplerDescriptorSetLayout, this->samplerSetBindings, { descriptorWrite });
 }
 
 int VulkanRenderer::createMeshModel(std::string modelFile)
 {
+	// A file already loaded with the same import flags only needs a new model using its meshes
+	unsigned int importFlags = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices | aiProcess_GenSmoothNormals;
+	std::string key = TextureCache::canonicalPath(modelFile) + "|" + std::to_string(importFlags);
+	int assetId = this->geometryCache.find(key);
+	if (assetId >= 0) {
+		this->geometryCache.acquire(assetId);
+		return this->createModelFromAsset(assetId);
+	}
+
 	// Import model scene
 	Assimp::Importer importer;
-	const aiScene* scene = importer.ReadFile(modelFile, 
-		aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+	const aiScene* scene = importer.ReadFile(modelFile, importFlags);
 
 	if (!scene) {
 		throw std::runtime_error("Failed to load model (" + modelFile + ")");
@@ -2033,38 +4429,193 @@ int VulkanRenderer::createMeshModel(std::string modelFile)
 		}
 	}
 
-	// Load in all our meshes
-	std::vector<Mesh> modelMeshes = MeshModel::LoadNode(
+	// The asset keeps the references to its textures taken by createTexture
+	GeometryAsset asset;
+	asset.key = key;
+	asset.textureIds = matToTex;
+
+	// Load in all our meshes, with the file's node hierarchy beneath the asset's root
+	uint32_t rootNode = asset.nodes.addNode(SCENE_NODE_NONE, glm::mat4(1.0f));
+	asset.meshes = MeshModel::LoadNode(
 		this->mainDevice.physicalDevice,
 		this->mainDevice.logicalDevice,
 		this->graphicsQueue,
 		this->graphicsCommandPool,
 		scene->mRootNode,
 		scene,
-		matToTex
+		matToTex,
+		&asset.nodes,
+		rootNode,
+		&this->memoryAllocator,
+		&this->timeline
 	);
 
-	// Create mesh model and add to list
-	MeshModel meshModel = MeshModel(modelMeshes);
-	modelList.push_back(modelMeshes);
+	return this->createModelFromAsset(this->addGeometryAsset(std::move(asset)));
+}
+
+int VulkanRenderer::createMeshModel(std::vector<Vertex>* vertices, std::vector<uint32_t>* indices, int texId)
+{
+	// Geometry already in memory is cached by its content, so the same vertices, indices and texture share one asset
+	uint64_t contentHash = hashContent(vertices->data(), vertices->size() * sizeof(Vertex));
+	contentHash = hashContent(indices->data(), indices->size() * sizeof(uint32_t), contentHash);
+	contentHash = hashContent(&texId, sizeof(texId), contentHash);
+	std::string key = "memory|" + std::to_string(contentHash) + "|" + std::to_string(vertices->size()) + "|" + std::to_string(indices->size());
+	int assetId = this->geometryCache.find(key);
+	if (assetId >= 0) {
+		this->geometryCache.acquire(assetId);
+		return this->createModelFromAsset(assetId);
+	}
 
-	return this->modelList.size() - 1;
+	// Single mesh model from geometry already in memory rather than loaded through assimp
+	// Levels of detail and optimisation work on copies, leaving the caller's lists as they were
+	std::vector<Vertex> meshVertices = *vertices;
+	std::vector<uint32_t> meshIndices = *indices;
+	std::vector<MeshLod> lods;
+	MeshModel::GenerateNormals(&meshVertices, meshIndices);
+	MeshModel::PrepareMeshData(&meshVertices, &meshIndices, &lods);
+
+	// The asset holds its own reference to the texture, separate from the caller's
+	GeometryAsset asset;
+	asset.key = key;
+	this->textureCache.acquire(texId);
+	asset.textureIds.push_back(texId);
+
+	asset.meshes.push_back(Mesh(
+		this->mainDevice.physicalDevice,
+		this->mainDevice.logicalDevice,
+		this->graphicsQueue,
+		this->graphicsCommandPool,
+		&meshVertices,
+		&meshIndices,
+		texId,
+		&this->memoryAllocator,
+		&this->timeline));
+	asset.meshes[0].setLods(lods);
+	asset.meshes[0].buildTriangleBvh();
+
+	// No hierarchy, so the mesh is drawn with the model's root node
+	asset.meshes[0].setNode(asset.nodes.addNode(SCENE_NODE_NONE, glm::mat4(1.0f)));
+
+	return this->createModelFromAsset(this->addGeometryAsset(std::move(asset)));
 }
 
-stbi_uc* VulkanRenderer::loadTextureFile(std::string fileName, int* width, int* height, VkDeviceSize* imageSize)
+int VulkanRenderer::addGeometryAsset(GeometryAsset asset)
 {
-	// Number of channels the image uses
-	int channels;
+	int assetId = this->geometryCache.add(std::move(asset));
+	GeometryAsset* added = this->geometryCache.getAsset(assetId);
 
-	// Load pixel data for image
-	std::string fileLoc = "Textures/" + fileName;
-	stbi_uc* image = stbi_load(fileLoc.c_str(), width, height, &channels, STBI_rgb_alpha);
+	// Meshes are resident (or not) once for every model using them
+	for (size_t i = 0; i < added->meshes.size(); i++) {
+		added->meshResidency.push_back(this->residency.addResource(ResidentType::Mesh, static_cast<uint32_t>(assetId),
+			added->meshes[i].getDeviceBytes(), added->meshes[i].getMemoryType(), false, static_cast<uint32_t>(i)));
+	}
+
+	return assetId;
+}
+
+int VulkanRenderer::createModelFromAsset(int assetId)
+{
+	GeometryAsset* asset = this->geometryCache.getAsset(assetId);
+
+	// Copy of the asset's hierarchy in the scene graph, in one run of nodes (reusing a destroyed model's where one fits) in
+	// the same order, so parents still come first. Its root's local transform is the model matrix, so updateModel moves
+	// every part of the model together
+	std::vector<uint32_t> nodes(asset->nodes.getNodeCount());
+	uint32_t firstNode = this->sceneGraph.allocateNodes(static_cast<uint32_t>(nodes.size()));
+	for (uint32_t i = 0; i < nodes.size(); i++) {
+		uint32_t parent = asset->nodes.getParent(i);
+		nodes[i] = firstNode + i;
+		this->sceneGraph.setNode(nodes[i], parent == SCENE_NODE_NONE ? SCENE_NODE_NONE : nodes[parent], asset->nodes.getLocalTransform(i));
+	}
+
+	// Create mesh model and add to list, in a destroyed model's slot if there is one
+	int modelId;
+	if (!this->freeModelIds.empty()) {
+		modelId = this->freeModelIds.back();
+		this->freeModelIds.pop_back();
+		this->modelList[modelId] = MeshModel(assetId, asset, nodes);
+	}
+	else {
+		modelId = static_cast<int>(this->modelList.size());
+		this->modelList.push_back(MeshModel(assetId, asset, nodes));
+	}
+	this->addMeshInstances(modelId);
+
+	// Models start out static, so the cached shadows need it added
+	this->staticShadowVersion++;
+
+	return modelId;
+}
+
+void VulkanRenderer::destroyMeshModel(int modelId)
+{
+	if (modelId < 0 || modelId >= static_cast<int>(this->modelList.size()) || this->modelList[modelId].getAssetId() < 0) {
+		throw std::runtime_error("Attempted to destroy invalid model");
+	}
+
+	// Its meshes stop being culled, drawn and picked straight away
+	size_t kept = 0;
+	for (size_t i = 0; i < this->meshInstances.size(); i++) {
+		if (this->meshInstances[i].modelIndex != static_cast<uint32_t>(modelId)) {
+			this->meshInstances[kept] = this->meshInstances[i];
+			this->meshInstanceBounds[kept] = this->meshInstanceBounds[i];
+			this->meshInstanceResidency[kept] = this->meshInstanceResidency[i];
+			kept++;
+		}
+	}
+	this->meshInstances.resize(kept);
+	this->meshInstanceBounds.resize(kept);
+	this->meshInstanceResidency.resize(kept);
+	this->meshInstancesChanged = true;
+
+	// Frames in flight read their own copy of the object buffer, so the nodes can be reused for the next frame
+	MeshModel& model = this->modelList[modelId];
+	if (model.isStatic()) {
+		this->staticShadowVersion++;
+	}
+	this->sceneGraph.freeNodes(model.getNodes()[0], static_cast<uint32_t>(model.getNodes().size()));
 
-	if (!image) {
+	if (this->geometryCache.release(model.getAssetId())) {
+		this->destroyGeometryAsset(model.getAssetId());
+	}
+
+	model = MeshModel();
+	this->freeModelIds.push_back(modelId);
+}
+
+void VulkanRenderer::destroyGeometryAsset(int assetId)
+{
+	GeometryAsset* asset = this->geometryCache.getAsset(assetId);
+
+	// Buffers go once the frames that may draw them have finished
+	for (size_t i = 0; i < asset->meshes.size(); i++) {
+		if (asset->meshes[i].isResident()) {
+			asset->meshes[i].retireBuffers(&this->timeline);
+		}
+		this->residency.removeResource(asset->meshResidency[i]);
+	}
+
+	for (int textureId : asset->textureIds) {
+		this->destroyTexture(textureId);
+	}
+
+	// Frees the CPU copies of its geometry and triangle BVHs, the slot is reused by the next asset loaded
+	*asset = GeometryAsset();
+}
+
+std::vector<stbi_uc> VulkanRenderer::loadTextureFile(std::string fileName)
+{
+	// Read the file's bytes, which are hashed for the texture cache before being decoded
+	std::string fileLoc = "Textures/" + fileName;
+	std::ifstream file(fileLoc, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) {
 		throw std::runtime_error("Failed to load a texture file (" + fileName + ")");
 	}
 
-	*imageSize = *width * *height * 4; // Total height times width times the number of channels
+	std::vector<stbi_uc> fileData(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(fileData.data()), fileData.size());
+	file.close();
 
-	return image;
+	return fileData;
 }
@@ -16,22 +16,109 @@
 #include <set>
 #include <array>
 #include <algorithm>
-
-#include "stb_image.h"
+#include <chrono>
+#include <functional>
+#include <map>
 
 #include "Mesh.h"
 #include "MeshModel.h"
 #include "Utilities.h"
+#include "FrameLimiter.h"
+#include "DrawSort.h"
+#include "TransformKernels.h"
+#include "ResidencyManager.h"
+#include "TextureStreamer.h"
+#include "TextureCache.h"
+#include "MemoryBlockAllocator.h"
+#include "LightClusters.h"
+#include "ShadowCascades.h"
+#include "ShaderCompiler.h"
+#include "ShaderPermutation.h"
+#include "ShaderReflection.h"
+#include "LayoutCache.h"
+#include "DescriptorAllocator.h"
+
+// The scene pipelines kept in the variant cache, the pipeline type of their permutations
+enum class ScenePipeline : uint32_t {
+	DepthPrePass, // Depth only, the first subpass when the pre-pass is drawn
+	GBuffer,
+	GBufferDepthEqual, // GBuffer after the pre-pass: EQUAL depth test without depth writes
+	Lighting
+};
 
 class VulkanRenderer 
 {
 public:
 	VulkanRenderer();
 
-	int init(GLFWwindow* newWindow);
+	int init(GLFWwindow* newWindow, RendererConfig newConfig = RendererConfig());
+	int initHeadless(uint32_t width, uint32_t height, RendererConfig newConfig = RendererConfig());
 
+	// Geometry is cached by file and import flags (or by content for geometry in memory), so creating the same model
+	// again only adds a model with its own transforms that shares the first one's meshes and buffers
 	int createMeshModel(std::string modelFile);
+	int createMeshModel(std::vector<Vertex>* vertices, std::vector<uint32_t>* indices, int texId);
+	// Removes a model from the scene, its meshes and textures are destroyed once no other model uses them. Can be called
+	// between any two frames: GPU resources are kept until the frames in flight that may use them have finished, and
+	// model, texture and scene graph node ids are reused by later loads
+	void destroyMeshModel(int modelId);
+	// Textures are cached by path and content, so creating one already created returns the same id with another reference
+	int createTextureFromPixels(const stbi_uc* pixels, int width, int height);
+	// Drops the caller's reference to a texture, it's destroyed once no model uses it either
+	void destroyTexture(int textureId);
 	void updateModel(int modelId, glm::mat4 newModel);
+	// Batched versions for many models at once, from matrices or translation/rotation/scale components (modelIds has one
+	// entry per transform)
+	void updateModels(const int* modelIds, const glm::mat4* newModels, size_t count);
+	void updateModels(const int* modelIds, const TransformSoA& transforms);
+	void updateView(glm::mat4 newView);
+
+	// Replaces the scene's lights (up to MAX_LIGHTS), each frame bins them into clusters of the view frustum on the GPU so
+	// fragments are only lit by the lights whose range reaches their cluster
+	void setLights(const std::vector<Light>& newLights);
+	// Added to every surface whatever lights there are, white by default so scenes without lights look as they did
+	void setAmbientLight(glm::vec3 colour);
+	// Directional light (the sun) travelling in direction, with cascaded shadow maps. Off until given an intensity above 0
+	void setDirectionalLight(glm::vec3 direction, glm::vec3 colour, float intensity);
+	// Shadows of static models (the default) are cached, and only redrawn when the sun or a static model changes. Models
+	// that move most frames should be made dynamic, so they're drawn over the cached shadows each frame instead
+	void setModelStatic(int modelId, bool isStatic);
+	// Its lighting pipeline is built the first time a mode is drawn with, then kept for switching back
+	void setLightingMode(LightingMode mode);
+
+	// Spatial queries over every mesh's world space bounds, brought up to date with any transform changes first
+	std::vector<MeshInstance> queryFrustum(const glm::mat4& viewProjection);
+	std::vector<MeshInstance> queryBox(const AABB& box);
+	std::vector<MeshInstance> querySphere(const glm::vec3& centre, float radius);
+	bool queryNearest(const glm::vec3& point, float maxDistance, MeshInstance* nearest, float* distance);
+
+	// Closest full detail triangle the ray hits within maxDistance (from either side), false if it hits nothing
+	bool raycast(const glm::vec3& origin, const glm::vec3& direction, RaycastHit* hit,
+		float maxDistance = std::numeric_limits<float>::max());
+
+	// Budget and usage of each device memory heap, textures and meshes are evicted to stay within the budgets
+	std::vector<HeapBudget> getMemoryBudgets();
+
+	// Mesh buffers and texture images share large blocks of device memory. Defragmentation empties the sparsest blocks
+	// (moving what's left in them with GPU copies, a few each frame) so their memory is freed. A pass starts by itself
+	// every DEFRAG_CHECK_FRAMES frames when there are blocks worth emptying, or at the next frame once requested here
+	void defragmentMemory();
+	FragmentationStats getMemoryFragmentation();
+	// The pass in progress, or the last one to finish
+	DefragmentationStats getDefragmentationStats();
+
+	FrameStats getFrameStats();
+	RendererConfig getConfig();
+	std::string getDeviceName();
+	// Shaders compiled and read from the disk cache while the renderer was created
+	ShaderCompilerStats getShaderCompilerStats();
+	// Pipeline permutations built so far and how often they were asked for
+	PipelineVariantStats getPipelineVariantStats();
+	// Descriptor pools and sets, summed over the frame and input attachment sets and every frame's texture sets
+	DescriptorAllocatorStats getDescriptorAllocatorStats();
+	// The light buffer and the cluster buffer the GPU built from it for the last frame drawn, once that frame has finished.
+	// For checking the clusters against assignLightsToClusters, it waits for the copy so isn't for use every frame
+	void readClusterBuffer(LightBufferHeader* header, std::vector<Light>* frameLights, std::vector<uint32_t>* clusterData);
 
 	void cleanup();
 	void draw();
@@ -41,16 +128,47 @@ public:
 private:
 	GLFWwindow* window;
 
+	// Headless renderers draw into offscreen images instead of a window surface
+	bool headless = false;
+	std::string deviceName;
+
+	RendererConfig config;
+	FrameLimiter frameLimiter;
+
 	int currentFrame = 0;
+	FrameStats frameStats;
 
 	// Scene objects
 	std::vector<MeshModel> modelList;
+	GeometryCache geometryCache; // Meshes of every loaded model file, shared by the models created from it
+	std::vector<int> freeModelIds; // Destroyed models, whose slots in modelList are reused
+	SceneGraph sceneGraph; // Transforms of every model and their parts, meshes are drawn with their node's world transform
+	std::vector<uint32_t> batchNodes; // Scratch space for batched transform updates
+
+	// Every mesh of every model with its world space bounds, indexed together by the BVH for culling and queries
+	std::vector<MeshInstance> meshInstances;
+	std::vector<AABB> meshInstanceBounds;
+	Bvh sceneBvh;
+	bool meshInstancesChanged = false; // Set when meshes are added, so the BVH is rebuilt rather than refit
+	std::vector<uint32_t> visibleInstances;
+	std::vector<float> visibleScreenSizes; // Fraction of the screen height each visible instance's bounding sphere covers
+	std::vector<glm::mat4> batchTransforms;
+	std::vector<DrawCommand> drawList; // Rebuilt and sorted every frame
+	std::vector<DrawCommand> drawListScratch;
 
 	// Scene Settings
 	struct UboViewProjection {
 		glm::mat4 projection;
 		glm::mat4 view;
 	} uboViewProjection;
+	float fieldOfView = glm::radians(45.0f);
+	float nearPlane = 0.1f;
+	float farPlane = 100.0f;
+	std::vector<Light> lights;
+	glm::vec3 ambientLight = glm::vec3(1.0f);
+	glm::vec3 sunDirection = glm::vec3(0.0f, -1.0f, 0.0f);
+	glm::vec3 sunColour = glm::vec3(1.0f);
+	float sunIntensity = 0.0f;
 
 	// Vulkan Components
 	// - Main
@@ -65,13 +183,24 @@ private:
 	VkSwapchainKHR swapchain;
 
 	std::vector<SwapchainImage> swapchainImages;
+	std::vector<VkDeviceMemory> offscreenImageMemories; // Only used when headless, swapchain images are owned by the swapchain otherwise
 	std::vector<VkFramebuffer> swapchainFramebuffers;
 	std::vector<VkCommandBuffer> commandBuffers;
 
-	std::vector<VkImage> colourBufferImages;
+	// G-buffer, written by the first subpass and read as input attachments by the lighting subpass. Never stored, so
+	// tile based GPUs can keep it in tile memory for the whole render pass
+	std::vector<VkImage> colourBufferImages; // Albedo
 	std::vector<VkDeviceMemory> colourBufferImageMemories;
 	std::vector<VkImageView> colourBufferImageViews;
 
+	std::vector<VkImage> normalBufferImages; // World space normal, octahedral encoded
+	std::vector<VkDeviceMemory> normalBufferImageMemories;
+	std::vector<VkImageView> normalBufferImageViews;
+
+	std::vector<VkImage> materialBufferImages; // Specular intensity, roughness, unused, lit
+	std::vector<VkDeviceMemory> materialBufferImageMemories;
+	std::vector<VkImageView> materialBufferImageViews;
+
 	std::vector<VkImage> depthBufferImages;
 	std::vector<VkDeviceMemory> depthBufferImageMemories;
 	std::vector<VkImageView> depthBufferImageViews;
@@ -82,19 +211,56 @@ private:
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorSetLayout samplerDescriptorSetLayout;
 	VkDescriptorSetLayout inputDescriptorSetLayout;
-	VkPushConstantRange pushConstantRange;
 
-	VkDescriptorPool descriptorPool;
-	VkDescriptorPool samplerDescriptorPool;
-	VkDescriptorPool inputDescriptorPool;
+	std::vector<VkDescriptorSetLayoutBinding> samplerSetBindings;
+	std::vector<VkDescriptorSetLayoutBinding> inputSetBindings;
+
+	DescriptorAllocator descriptorAllocator; // Frame and input attachment sets, allocated once
+	// Texture sets, one allocator per frame in flight. Each frame writes sets for the textures it binds, reused for the
+	// rest of the frame, and they're all freed together once the frame has finished
+	std::vector<DescriptorAllocator> frameDescriptorAllocators;
 
 	std::vector<VkDescriptorSet> descriptorSets; // One per swapchain image
-	std::vector<VkDescriptorSet> samplerDescriptorSets; // One per texture
 	std::vector<VkDescriptorSet> inputDescriptorSets; // One per swapchain image
 
 	std::vector<VkBuffer> vpUniformBuffer;
 	std::vector<VkDeviceMemory> vpUniformBufferMemory;
 
+	// Model and MVP matrix of every scene graph node, one persistently mapped buffer per image
+	std::vector<VkBuffer> objectBuffers;
+	std::vector<VkDeviceMemory> objectBufferMemories;
+	std::vector<ObjectTransform*> objectBufferMapped;
+	std::vector<uint32_t> objectBufferCapacities;
+
+	// Lights (after a LightBufferHeader) and the clusters they're binned into, one of each per image. The light buffer is
+	// persistently mapped, the cluster buffer is only written by the cluster compute shader
+	std::vector<VkBuffer> lightBuffers;
+	std::vector<VkDeviceMemory> lightBufferMemories;
+	std::vector<void*> lightBufferMapped;
+	std::vector<VkBuffer> clusterBuffers;
+	std::vector<VkDeviceMemory> clusterBufferMemories;
+
+	// Sun shadow cascades. Static casters are drawn into a cached layer per cascade, redrawn only when staticShadowVersion
+	// moves on (the sun, a static model or the set of static models changed) or the cascade has to be refit. Each frame
+	// the cached layers are copied into the image's shadow map and the dynamic casters drawn over them
+	VkFormat shadowFormat;
+	VkImage staticShadowImage;
+	VkDeviceMemory staticShadowImageMemory;
+	std::vector<VkImageView> staticShadowLayerViews; // One per cascade
+	std::vector<VkFramebuffer> staticShadowFramebuffers;
+	std::vector<VkImage> shadowMapImages; // One per image, sampled by the lighting subpass
+	std::vector<VkDeviceMemory> shadowMapImageMemories;
+	std::vector<VkImageView> shadowMapImageViews; // Every cascade's layer, for sampling
+	std::vector<VkImageView> shadowMapLayerViews; // Image i's cascade c at i * shadowCascades + c, for drawing into
+	std::vector<VkFramebuffer> shadowMapFramebuffers; // Same order as the layer views
+	VkSampler shadowSampler;
+
+	std::vector<ShadowCascade> shadowCascades; // Where each cascade's cached layer was drawn
+	std::vector<float> shadowCascadeSplits; // View depth each cascade ends at this frame
+	std::vector<uint64_t> shadowCascadeVersions; // staticShadowVersion each cascade's cached layer was drawn at
+	uint64_t staticShadowVersion = 1;
+	std::vector<uint32_t> shadowCasters; // Scratch space for each cascade's caster query
+
 	// NO LONGER USED BELOW BUT KEEPING FOR REFERENCE, AS THAT'S HOW MODEL WAS DONE VIA DYNAMIC BUFFERS
 	//std::vector<VkBuffer> modelDynamicUniformBuffer;
 	//std::vector<VkDeviceMemory> modelDynamicUniformBufferMemory;
@@ -104,17 +270,62 @@ private:
 
 	// - Assets
 	std::vector<VkImage> textureImages;
-	std::vector<VkDeviceMemory> textureImageMemory;
+	std::vector<MemoryAllocation> textureImageAllocations;
 	std::vector<VkImageView> textureImageViews;
 
+	// - Streaming
+	// Every mip level of a texture, which its image is (re)created from as levels are needed or it's reloaded after eviction
+	struct TextureSource {
+		std::string fileName; // Empty if created from pixels
+		// Empty until the streamer has decoded the file. A file's pixels are freed once its image has the levels it needs,
+		// keeping only their sizes, and decoded again when a reload or more detail needs them. Textures created from pixels
+		// keep theirs, as there's nothing to decode them from
+		TextureMips mips;
+		bool decoding = false; // The streamer has the file to decode
+		uint64_t decodedFrame = 0; // Pixels decoded for a reload that doesn't happen are freed some time after
+		uint32_t residentLevel = TEXTURE_LEVEL_NONE; // Most detailed level in the texture's image
+		uint32_t wantedLevel = TEXTURE_LEVEL_NONE; // Most detailed level this frame's draws need
+		uint64_t lastDetailFrame = 0; // Last frame the resident level was all needed, the top levels are trimmed some time after
+	};
+	TextureStreamer textureStreamer;
+	TextureCache textureCache;
+	std::vector<int> freeTextureIds; // Destroyed textures no frame in flight uses any more, whose slots are reused
+
+	// - Residency
+	ResidencyManager residency;
+	bool memoryBudgetSupported = false; // VK_EXT_memory_budget enabled
+	std::vector<TextureSource> textureSources;
+	std::vector<uint32_t> textureResidency; // Residency id of each texture
+	std::vector<uint32_t> meshInstanceResidency; // Residency id of each mesh instance's asset mesh, shared by models using the same asset
+
+	// - Device memory
+	MemoryBlockAllocator memoryAllocator; // Places mesh buffers and texture images
+	DefragmentationStats defragStats;
+	bool defragRequested = false;
+
+	// - Shaders
+	ShaderCompiler shaderCompiler;
+	std::vector<ShaderDefine> shaderDefines; // Given to every shader, the constants shared with the C++ side
+	std::map<std::string, ShaderReflection> shaderReflections; // By file name, what each shader's layouts have to provide
+	LayoutCache layoutCache; // Owns every descriptor set and pipeline layout, one of each distinct layout
+	std::vector<VkDescriptorSetLayoutBinding> frameSetBindings; // Of set 0, as reflected from every shader together
+
 	// - Pipeline
-	VkPipeline graphicsPipeline;
-	VkPipelineLayout pipelineLayout;
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE; // Shared by every pipeline build on every thread, and saved between runs
+	PipelineVariantCache scenePipelines; // Every pipeline of the main render pass, by permutation
+	VkPipeline lastLightingPipeline = VK_NULL_HANDLE; // Stands in while the lighting permutation a frame needs is being built
+	VkPipelineLayout pipelineLayout; // Depth pre-pass and G-buffer pipelines
+	VkPipelineLayout secondPipelineLayout; // Lighting pipelines
 
-	VkPipeline secondPipeline;
-	VkPipelineLayout secondPipelineLayout;
+	VkPipeline clusterPipeline; // Compute, bins the lights into clusters before the render pass
+	VkPipelineLayout clusterPipelineLayout;
+
+	VkPipeline shadowPipeline; // Depth only, for both shadow render passes
+	VkPipelineLayout shadowPipelineLayout;
 
 	VkRenderPass renderPass;
+	VkRenderPass staticShadowRenderPass; // Clears a cached shadow layer, left ready to copy from
+	VkRenderPass shadowRenderPass; // Loads the static shadows copied into a shadow map layer, left ready to sample
 
 	// - Pools
 	VkCommandPool graphicsCommandPool;
@@ -124,37 +335,115 @@ private:
 	VkExtent2D swapchainExtent;
 
 	// - Synchronisation
-	std::vector<VkSemaphore> imageAvailable;
+	GpuTimeline timeline; // Signalled by every submission to the graphics queue (frames and uploads)
+	std::vector<VkSemaphore> imageAvailable; // Binary, as the swapchain can't use timeline semaphores
 	std::vector<VkSemaphore> renderFinished;
-	std::vector<VkFence> drawFences;
+	std::vector<uint64_t> frameValues; // Timeline value signalled by the last submission of each frame in flight
+	std::vector<uint64_t> imageValues; // Timeline value of the frame last using each swapchain image, as there may be more frames in flight than images
+	uint32_t lastImageIndex = 0; // Swapchain image the last frame submitted was drawn to
+	uint64_t lastFrameValue = 0; // Anything submitted after this (and before the next frame) is an upload the next frame has to wait for
+	std::vector<std::chrono::high_resolution_clock::time_point> frameStartTimes; // When each frame in flight started on the CPU, for latency
+	std::vector<bool> latencyPending; // Whether each frame in flight has been submitted but not yet seen complete
+
+	// - Profiling
+	VkQueryPool timestampQueryPool = VK_NULL_HANDLE; // TIMESTAMPS_PER_FRAME per frame in flight: the frame's start and end, then each cascade's
+	std::vector<bool> timestampsWritten; // Whether the frame's queries hold results yet
+	std::vector<uint32_t> shadowCascadesTimed; // Cascades each frame in flight wrote timestamps for
+	float timestampPeriod = 0.0f; // Nanoseconds per timestamp tick
+	uint64_t timestampMask = 0; // The queue's timestampValidBits, the bits above them are undefined
+	bool timestampsSupported = false;
+	VkQueryPool statisticsQueryPool = VK_NULL_HANDLE; // G-buffer fragment shader invocations, one per frame in flight
+	std::vector<bool> statisticsWritten;
+	bool statisticsSupported = false;
+
+	// - Depth pre-pass
+	std::vector<bool> frameDepthPrePass; // Whether each frame in flight drew the pre-pass, so its results are averaged with the right ones
+	bool depthPrePassChosen = false; // Automatic choice, before the occasional frame drawn the other way
+	double shadedWithPrePass = -1.0; // Averaged G-buffer fragments shaded per frame with the pre-pass, about the covered pixels
+	double shadedWithoutPrePass = -1.0;
 
 	// Vulkan Functions
+	int initRenderer();
+
 	// - Creation functions
 	void createInstance();
 	void createLogicalDevice();
 	void createSurface();
 	void createSwapchain();
+	void createOffscreenImages();
 	void createRenderPass();
 	void createDescriptorSetLayout();
-	void createPushConstantRange();
+	void createShaderCompiler();
+	void createPipelineCache();
 	void createGraphicsPipeline();
-	void createColourBufferImage();
+	VkPipeline createScenePipeline(const ShaderPermutation& permutation);
+	// Reflections of already reflected shaders, throws for any that aren't
+	std::vector<const ShaderReflection*> getShaderReflections(const std::vector<std::string>& shaderFiles);
+	// Layout of a pipeline made of the shaders: the frame set, the sets they declare after it and their push constants
+	VkPipelineLayout getShaderPipelineLayout(const std::vector<std::string>& shaderFiles);
+	// Attributes for the vertex shader's inputs, from the interleaved vertices or the position-only stream
+	std::vector<VkVertexInputAttributeDescription> getVertexAttributes(const std::string& vertexShaderFile, bool positionStream);
+	void createClusterPipeline();
+	void createShadowRenderPasses();
+	void createShadowPipeline();
+	void createShadowMaps();
+	void createGBufferImages();
 	void createDepthBufferImage();
 	void createFramebuffers();
 	void createCommandPool();
 	void createCommandBuffers();
 	void createSynchronization();
 	void createTextureSampler();
+	void createTimestampQueryPool();
+	void createStatisticsQueryPool();
 
 	void createUniformBuffers();
-	void createDescriptorPool();
+	void createDescriptorAllocators();
 	void createDescriptorSets();
 	void createInputDescriptorSets();
 
 	void updateUniformBuffers(uint32_t imageIndex);
+	void updateObjectTransforms(uint32_t imageIndex);
+	void updateLightBuffer(uint32_t imageIndex);
+	void updateShadowCascades();
+	size_t updateScene();
+	void addMeshInstances(size_t modelIndex);
+	int addGeometryAsset(GeometryAsset asset);
+	int createModelFromAsset(int assetId);
+	void destroyGeometryAsset(int assetId);
+	std::vector<MeshInstance> toMeshInstances(const std::vector<uint32_t>& items);
+	void createObjectBuffer(size_t imageIndex, uint32_t capacity);
+	void destroyObjectBuffer(size_t imageIndex);
+	void writeObjectBufferDescriptor(size_t imageIndex);
+	void readTimestamps();
+	// Latency of submitted frames whose timeline value has now been reached, timed to this check
+	void observeFrameCompletion();
+	// Milliseconds between two timestamps, masked to their valid bits so a counter that wrapped in between still works
+	double timestampDuration(uint64_t start, uint64_t end);
+	void readPipelineStatistics();
+	// Whether this frame draws the depth pre-pass, from the config and (automatically) the measured overdraw
+	bool chooseDepthPrePass();
+	// Permutations of the G-buffer pipeline for a draw, and of the lighting pipeline for the current settings
+	ShaderPermutation getGBufferPermutation(bool depthEqual, bool textured);
+	ShaderPermutation getLightingPermutation();
+	void updateResidency();
+	void evictTexture(int textureId);
+	bool reloadTexture(int textureId);
+	// Whether the texture's pixels are in memory, if not its file is sent to the streamer to be decoded again
+	bool requestTexturePixels(int textureId);
+	void updateTextureStreaming();
+	void updateDefragmentation();
+	// Records copying the texture's levels from baseLevel (its resident level, or a less detailed one to drop the rest) into
+	// a new image, which later frames write their descriptor sets with. Returns what frees the old image, to be retired once
+	// the copy has been submitted
+	std::function<void()> copyTextureLevels(int textureId, uint32_t baseLevel, VkCommandBuffer commandBuffer);
 
 	// - Record Functions
+	void buildDrawList();
 	void recordCommands(uint32_t currentImage);
+	void recordShadowPasses(uint32_t currentImage);
+	// Draws the resident casters of one kind (static or dynamic) that touch the cascade, returns the number of draws
+	uint32_t recordShadowCasters(VkCommandBuffer commandBuffer, const ShadowCascade& cascade, bool staticCasters);
 
 	// - Get Functions
 	void getPhysicalDevice();
@@ -177,19 +466,30 @@ private:
 	VkPresentModeKHR chooseBestPresentationMode(const std::vector<VkPresentModeKHR>& presentationModes);
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities);
 	VkFormat chooseSupportedFormat(const std::vector<VkFormat>& formats, VkImageTiling tiling, VkFormatFeatureFlags featureFlags);
+	// Lazily allocated device memory where there is any (tile based GPUs), as transient attachments may then never need backing
+	VkMemoryPropertyFlags chooseTransientAttachmentMemory();
 
 	// - Create functions
 	VkImage createImage(uint32_t width, uint32_t height, VkFormat format, 
 		VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags,
-		VkDeviceMemory* imageMemory);
-	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
+		VkDeviceMemory* imageMemory, uint32_t mipLevels = 1, uint32_t arrayLayers = 1);
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels = 1,
+		VkImageViewType viewType = VK_IMAGE_VIEW_TYPE_2D, uint32_t baseLayer = 0, uint32_t layerCount = 1);
+	// Sampled texture image placed by memoryAllocator
+	VkImage createTextureImage(uint32_t width, uint32_t height, uint32_t mipLevels, MemoryAllocation* allocation);
 	VkShaderModule createShaderModule(const std::vector<char>& code);
 
-	int createTextureImage(std::string fileName);
-	int createTexture(std::string fileName);
-	int createTextureDescriptor(VkImageView textureImage);
+	// Streamed textures start with no image, their smallest levels are uploaded once the file is decoded (so they're drawn
+	// with the default texture until then). Without streaming the file is loaded and all of its levels uploaded now
+	int createTexture(std::string fileName, bool stream = true);
+	int addTextureSlot(const TextureSource& source);
+	// Replaces the texture's image with one holding its levels from baseLevel down. The old image is retired once the
+	// frames in flight drawing with it have finished, later frames write their texture sets with the new one
+	void createTextureLevels(int textureId, uint32_t baseLevel);
+	uint32_t getInitialTextureLevel(int textureId);
+	VkDescriptorSet getTextureDescriptorSet(uint32_t textureId);
 
 	// - Loader functions
-	stbi_uc* loadTextureFile(std::string fileName, int* width, int* height, VkDeviceSize* imageSize);
+	std::vector<stbi_uc> loadTextureFile(std::string fileName);
 };
 
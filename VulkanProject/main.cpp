@@ -9,6 +9,7 @@
 #include <iostream>
 
 #include "VulkanRenderer.h"
+#include "Benchmark.h"
 
 GLFWwindow* window;
 VulkanRenderer vulkanRenderer;
@@ -24,16 +25,116 @@ void initWindow(std::string wName = "Test Window", const int width = 800, const
 	window = glfwCreateWindow(width, height, wName.c_str(), nullptr, nullptr);
 }
 
-int main() 
+int runBenchmark(int argc, char* argv[])
 {
+	BenchmarkConfig config;
+	if (!Benchmark::parseArgs(argc, argv, &config)) {
+		return EXIT_FAILURE;
+	}
+
+	Benchmark benchmark(config);
+	return benchmark.run();
+}
+
+int runMeshReport(std::string modelFile)
+{
+	// Same import and preparation as createMeshModel, but only on the CPU so it runs without a GPU
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(modelFile,
+		aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices | aiProcess_GenSmoothNormals);
+
+	if (!scene) {
+		std::cout << "Failed to load model (" << modelFile << ")" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < scene->mNumMeshes; i++) {
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+		std::vector<MeshLod> lods;
+		MeshModel::LoadMeshData(scene->mMeshes[i], &vertices, &indices);
+		MeshOptimizationReport report = MeshModel::PrepareMeshData(&vertices, &indices, &lods);
+
+		std::cout << "Mesh " << i << ": " << lods[0].indexCount / 3 << " triangles, " << lods.size() << " LODs, "
+			<< (vertices.size() <= 0xFFFF ? "16" : "32") << " bit indices" << std::endl;
+		std::cout << "  ACMR " << report.before.acmr << " -> " << report.after.acmr
+			<< ", ATVR " << report.before.atvr << " -> " << report.after.atvr
+			<< ", vertices " << report.verticesBefore << " -> " << report.verticesAfter << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) 
+{
+	// Headless benchmark instead of the interactive window
+	if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+		return runBenchmark(argc, argv);
+	}
+
+	// CPU only benchmark of the spatial index
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-bvh") {
+		BenchmarkConfig config;
+		config.instanceCount = 10000;
+		config.trianglesPerMesh = 1000000;
+		config.frameCount = 100;
+		config.outputFile = "benchmark_bvh.json";
+		if (!Benchmark::parseArgs(argc, argv, &config)) {
+			return EXIT_FAILURE;
+		}
+		return Benchmark::runSpatial(config);
+	}
+
+	// GPU light clusters read back and compared with the CPU reference, over a few frames of the benchmark scene with lights
+	if (argc > 1 && std::string(argv[1]) == "--check-clusters") {
+		BenchmarkConfig config;
+		config.lightCount = 256;
+		config.frameCount = 20;
+		if (!Benchmark::parseArgs(argc, argv, &config)) {
+			return EXIT_FAILURE;
+		}
+		Benchmark benchmark(config);
+		return benchmark.checkClusters();
+	}
+
+	// Vertex cache statistics for a model before and after import time optimisation
+	if (argc > 2 && std::string(argv[1]) == "--mesh-report") {
+		return runMeshReport(argv[2]);
+	}
+
+	// Renderer options come in pairs, eg --present-mode fifo --frames-in-flight 3 --target-fps 60
+	RendererConfig rendererConfig;
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc) {
+			std::cout << "Missing value for option: " << argv[i] << std::endl;
+			return EXIT_FAILURE;
+		}
+		if (!parseRendererConfigArg(argv[i], argv[i + 1], &rendererConfig)) {
+			std::cout << "Unknown option: " << argv[i] << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
 	std::cout << "Init window" << std::endl;
 	initWindow("Test Window", 1920, 1080);
 
 	std::cout << "Init renderer" << std::endl;
-	if (vulkanRenderer.init(window) == EXIT_FAILURE) {
+	if (vulkanRenderer.init(window, rendererConfig) == EXIT_FAILURE) {
 		return EXIT_FAILURE;
 	}
 
+	rendererConfig = vulkanRenderer.getConfig();
+	std::cout << "Present mode: " << presentModeName(rendererConfig.presentMode)
+		<< ", frames in flight: " << rendererConfig.framesInFlight
+		<< ", target fps: " << rendererConfig.targetFps << std::endl;
+
+	// Frame timings are averaged and reported once a second
+	float lastReportTime = 0.0f;
+	int reportFrames = 0;
+	double cpuFrameTotal = 0.0;
+	double gpuTotal = 0.0;
+	double latencyTotal = 0.0;
+
 	float angle = 0.0f;
 	float deltaTime = 0.0f;
 	float lastTime = 0.0f;
@@ -61,6 +162,25 @@ int main()
 		vulkanRenderer.updateModel(helicopterId, testMat);
 
 		vulkanRenderer.draw();
+
+		FrameStats frameStats = vulkanRenderer.getFrameStats();
+		cpuFrameTotal += frameStats.cpuFrameTime;
+		gpuTotal += std::max(frameStats.gpuTime, 0.0);
+		latencyTotal += std::max(frameStats.latency, 0.0);
+		reportFrames++;
+
+		if (now - lastReportTime >= 1.0f) {
+			std::cout << "fps: " << reportFrames / (now - lastReportTime)
+				<< ", cpu: " << cpuFrameTotal / reportFrames << "ms"
+				<< ", gpu: " << gpuTotal / reportFrames << "ms"
+				<< ", latency: " << latencyTotal / reportFrames << "ms" << std::endl;
+
+			lastReportTime = now;
+			reportFrames = 0;
+			cpuFrameTotal = 0.0;
+			gpuTotal = 0.0;
+			latencyTotal = 0.0;
+		}
 	}
 
 	std::cout << "Cleaning up" << std::endl;